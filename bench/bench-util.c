@@ -0,0 +1,104 @@
+/*
+ * Timing and allocation counting shared by chime-bench and
+ * chime-audio-bench.
+ */
+#include "bench-util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef __GLIBC__
+/* Count every allocation made by us, GLib, libsoup and json-glib alike */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static guint64 n_allocs;
+
+void *malloc(size_t size)
+{
+	__atomic_fetch_add(&n_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	__atomic_fetch_add(&n_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	__atomic_fetch_add(&n_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+
+guint64 bench_alloc_count(void)
+{
+	return __atomic_load_n(&n_allocs, __ATOMIC_RELAXED);
+}
+#else
+guint64 bench_alloc_count(void)
+{
+	return 0;
+}
+#endif
+
+gint64 bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (gint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void bench_result_init(struct bench_result *r, const gchar *kind,
+		       const gchar *name, guint expected)
+{
+	r->kind = kind;
+	r->name = name;
+	r->ns = g_array_sized_new(FALSE, FALSE, sizeof(gint64), expected);
+	r->allocs = 0;
+	r->total_ns = 0;
+}
+
+void bench_result_add(struct bench_result *r, gint64 start, guint64 allocs)
+{
+	gint64 ns = bench_now_ns() - start;
+
+	r->allocs += bench_alloc_count() - allocs;
+	r->total_ns += ns;
+	g_array_append_val(r->ns, ns);
+}
+
+static gint cmp_ns(gconstpointer a, gconstpointer b)
+{
+	gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+
+	return (x > y) - (x < y);
+}
+
+static double pct_us(GArray *ns, guint pct)
+{
+	guint idx = (ns->len * pct + 99) / 100;
+
+	if (!ns->len)
+		return 0;
+	if (idx)
+		idx--;
+	return g_array_index(ns, gint64, idx) / 1000.0;
+}
+
+void bench_report(struct bench_result *r)
+{
+	g_array_sort(r->ns, cmp_ns);
+
+	printf("%-5s %-24s %8u events %10.0f/s  p50 %8.1fµs  p99 %8.1fµs  %7.1f allocs/event\n",
+	       r->kind, r->name, r->ns->len,
+	       r->total_ns ? r->ns->len * 1e9 / r->total_ns : 0.0,
+	       pct_us(r->ns, 50), pct_us(r->ns, 99),
+	       r->ns->len ? (double)r->allocs / r->ns->len : 0.0);
+	g_array_free(r->ns, TRUE);
+	r->ns = NULL;
+}
@@ -0,0 +1,28 @@
+/*
+ * Timing and allocation counting shared by chime-bench and
+ * chime-audio-bench.
+ */
+#ifndef __BENCH_UTIL_H__
+#define __BENCH_UTIL_H__
+
+#include <glib.h>
+
+struct bench_result {
+	const gchar *kind, *name;
+	GArray *ns;	/* gint64 per event */
+	guint64 allocs;
+	gint64 total_ns;
+};
+
+/* Calls to malloc(), calloc() and realloc() so far; always 0 without glibc */
+guint64 bench_alloc_count(void);
+gint64 bench_now_ns(void);
+
+void bench_result_init(struct bench_result *r, const gchar *kind,
+		       const gchar *name, guint expected);
+/* One event, which started at 'start' with bench_alloc_count() at 'allocs' */
+void bench_result_add(struct bench_result *r, gint64 start, guint64 allocs);
+/* Print throughput, p50/p99 and allocations per event, and free 'r' */
+void bench_report(struct bench_result *r);
+
+#endif /* __BENCH_UTIL_H__ */
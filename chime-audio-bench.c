@@ -0,0 +1,1024 @@
+/*
+ * Soak a call's audio over a real transport, against a peer on the
+ * loopback which stands in for the media server, in real time.
+ *
+ * The peer is DTLS over UDP on 127.0.0.1 with a certificate of its own,
+ * or with --websocket a websocket on 127.0.0.1, to which the client
+ * falls back as it would if UDP were blocked. Once the client is
+ * authorised, the peer sends an RT message every 20ms, and every so
+ * often a StreamMessage split into DataMessage fragments. Loss,
+ * reordering, duplication and fragmentation are of our choosing, and
+ * the lost fragments are sent again a little later, as the server
+ * would. Meanwhile a "mic" feeds a frame every 20ms to the appsink the
+ * client sends from, with some frames missed or late.
+ *
+ * Reported are the client's CPU time per packet received, allocations,
+ * the latency and interval jitter of the frames as the peer gets them,
+ * the client's own estimates, reassembly memory, and the loss and
+ * reordering counted by the audio quality stats beside what was
+ * actually injected.
+ *
+ * Screen sharing is not covered.
+ */
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "chime/chime-connection-private.h"
+#include "chime/chime-call-audio.h"
+#include "bench/bench-util.h"
+
+#include "protobuf/auth_message.pb-c.h"
+#include "protobuf/rt_message.pb-c.h"
+#include "protobuf/data_message.pb-c.h"
+
+#include <gst/gst.h>
+#include <gst/rtp/gstrtpbuffer.h>
+
+#include <gnutls/gnutls.h>
+#include <gnutls/x509.h>
+#include <gnutls/dtls.h>
+
+/* The peer has libsoup's own websocket server, whichever websocket
+ * code the client was built with */
+#undef SoupWebsocketConnection
+#undef soup_websocket_connection_send_binary
+
+#define FRAME_NS (20 * GST_MSECOND)
+#define FRAME_US (20 * 1000)
+#define FRAME_SAMPLES 320
+#define OPUS_FRAME_LEN 60
+#define N_STREAMS 16
+/* Fragments lost are sent again after this many frames */
+#define RETX_DELAY 5
+/* How long the client has to get as far as sending audio */
+#define CONNECT_TIMEOUT 10
+
+static gint frames = 1500;
+static gdouble loss_pct = 2, reorder_pct = 1, dup_pct = 0.5;
+static gint frag_size = 128;
+static gint stream_every = 250;
+static gint seed = 1;
+static gboolean use_ws;
+
+static GOptionEntry options[] = {
+	{ "frames", 'n', 0, G_OPTION_ARG_INT, &frames,
+	  "Audio frames each way, 20ms apart (default 1500; 180000 is an hour)", "N" },
+	{ "websocket", 'w', 0, G_OPTION_ARG_NONE, &use_ws,
+	  "Use the websocket transport instead of DTLS", NULL },
+	{ "loss", 'l', 0, G_OPTION_ARG_DOUBLE, &loss_pct,
+	  "Percentage of packets lost (default 2)", "PCT" },
+	{ "reorder", 'r', 0, G_OPTION_ARG_DOUBLE, &reorder_pct,
+	  "Percentage of packets swapped with the next (default 1)", "PCT" },
+	{ "duplicate", 'd', 0, G_OPTION_ARG_DOUBLE, &dup_pct,
+	  "Percentage of packets received twice (default 0.5)", "PCT" },
+	{ "frag-size", 'f', 0, G_OPTION_ARG_INT, &frag_size,
+	  "Largest DataMessage fragment (default 128)", "BYTES" },
+	{ "stream-every", 's', 0, G_OPTION_ARG_INT, &stream_every,
+	  "Frames between StreamMessages (default 250)", "N" },
+	{ "seed", 0, 0, G_OPTION_ARG_INT, &seed,
+	  "Random seed (default 1)", "N" },
+	{ NULL }
+};
+
+enum inject {
+	INJECT_NONE,
+	INJECT_LOSS,
+	INJECT_REORDER,
+	INJECT_DUP,
+};
+
+struct injected {
+	guint rx_lost, rx_reordered, rx_dups;
+	guint tx_missed, tx_late;
+	guint streams_sent, frags_sent, frags_lost;
+};
+
+static enum inject pick(GRand *rand)
+{
+	gdouble r = g_rand_double_range(rand, 0, 100);
+
+	if (r < loss_pct)
+		return INJECT_LOSS;
+	r -= loss_pct;
+	if (r < reorder_pct)
+		return INJECT_REORDER;
+	r -= reorder_pct;
+	if (r < dup_pct)
+		return INJECT_DUP;
+	return INJECT_NONE;
+}
+
+/* For sources driven only by g_source_set_ready_time() */
+static gboolean ready_time_dispatch(GSource *source, GSourceFunc callback, gpointer user_data)
+{
+	return callback(user_data);
+}
+
+static GSourceFuncs ready_time_funcs = {
+	.dispatch = ready_time_dispatch,
+};
+
+static GSource *paced_source(GMainContext *ctx, GSourceFunc cb, gpointer data, gint64 due)
+{
+	GSource *source = g_source_new(&ready_time_funcs, sizeof(GSource));
+
+	g_source_set_priority(source, G_PRIORITY_HIGH);
+	g_source_set_callback(source, cb, data, NULL);
+	g_source_set_ready_time(source, due);
+	g_source_attach(source, ctx);
+	g_source_unref(source);
+	return source;
+}
+
+static GBytes *pack_xrp(guint16 type, const ProtobufCMessage *message)
+{
+	gsize len = protobuf_c_message_get_packed_size(message) + sizeof(struct xrp_header);
+	struct xrp_header *hdr = g_malloc(len);
+
+	hdr->type = htons(type);
+	hdr->len = htons(len);
+	protobuf_c_message_pack(message, (void *)(hdr + 1));
+	return g_bytes_new_take(hdr, len);
+}
+
+static GBytes *rt_frame(GRand *rand, guint32 seq, guint32 sample_time, guint64 server_time)
+{
+	RTMessage rt;
+	AudioMessage am;
+	guint8 opus[OPUS_FRAME_LEN];
+	guint i;
+
+	for (i = 0; i < sizeof(opus); i++)
+		opus[i] = g_rand_int(rand);
+
+	rtmessage__init(&rt);
+	audio_message__init(&am);
+	rt.audio = &am;
+	am.has_seq = TRUE;
+	am.seq = seq & 0xffff;
+	am.has_sample_time = TRUE;
+	am.sample_time = sample_time;
+	am.has_server_time = TRUE;
+	am.server_time = server_time;
+	am.has_audio = TRUE;
+	am.audio.data = opus;
+	am.audio.len = sizeof(opus);
+
+	return pack_xrp(XRP_RT_MESSAGE, &rt.base);
+}
+
+/* The logical message, XRP header and all, which DataMessages carry */
+static GBytes *stream_msg(void)
+{
+	StreamMessage sm;
+	StreamIdInfo infos[N_STREAMS], *ptrs[N_STREAMS];
+	gchar *ids[N_STREAMS];
+	GBytes *ret;
+	int i;
+
+	stream_message__init(&sm);
+	for (i = 0; i < N_STREAMS; i++) {
+		stream_id_info__init(&infos[i]);
+		ids[i] = g_strdup_printf("00000000-0000-4000-8000-%012x", i + 1);
+		infos[i].has_stream_id = TRUE;
+		infos[i].stream_id = i + 1;
+		infos[i].profile_id = ids[i];
+		ptrs[i] = &infos[i];
+	}
+	sm.n_streams = N_STREAMS;
+	sm.streams = ptrs;
+
+	ret = pack_xrp(XRP_STREAM_MESSAGE, &sm.base);
+	for (i = 0; i < N_STREAMS; i++)
+		g_free(ids[i]);
+	return ret;
+}
+
+static GBytes *data_frag(GBytes *logical, guint32 seq, guint32 msg_id, gsize offset)
+{
+	DataMessage dm;
+	gsize len;
+	const guint8 *data = g_bytes_get_data(logical, &len);
+
+	data_message__init(&dm);
+	dm.has_seq = TRUE;
+	dm.seq = seq;
+	dm.has_msg_id = TRUE;
+	dm.msg_id = msg_id;
+	dm.has_msg_len = TRUE;
+	dm.msg_len = len;
+	dm.has_offset = TRUE;
+	dm.offset = offset;
+	dm.has_data = TRUE;
+	dm.data.data = (guint8 *)data + offset;
+	dm.data.len = MIN(frag_size, len - offset);
+
+	return pack_xrp(XRP_DATA_MESSAGE, &dm.base);
+}
+
+/* Everything the peer sends, and the frame with which each goes */
+struct rx_stream {
+	GPtrArray *pkts;
+	GArray *frames;
+	guint data_pkts;
+};
+
+static void add_pkt(struct rx_stream *rx, GBytes *pkt, gint frame)
+{
+	g_ptr_array_add(rx->pkts, pkt);
+	g_array_append_val(rx->frames, frame);
+}
+
+struct retx {
+	gint due;	/* Frame after which it goes again */
+	guint32 msg_id;
+	gsize offset;
+};
+
+static void send_retx(struct rx_stream *rx, GQueue *retx, GBytes *logical,
+		      guint32 *data_seq, gint frame, struct injected *inj)
+{
+	while (!g_queue_is_empty(retx) &&
+	       ((struct retx *)g_queue_peek_head(retx))->due <= frame) {
+		struct retx *r = g_queue_pop_head(retx);
+
+		add_pkt(rx, data_frag(logical, (*data_seq)++, r->msg_id, r->offset),
+			MIN(frame, frames));
+		rx->data_pkts++;
+		inj->frags_sent++;
+		g_free(r);
+	}
+}
+
+/* The whole incoming stream is built up front, so that packing it
+ * doesn't hold the peer up. */
+static void build_rx(struct rx_stream *rx, GRand *rand, struct injected *inj)
+{
+	GBytes *logical = stream_msg();
+	GQueue retx = G_QUEUE_INIT;
+	GBytes *held = NULL;
+	guint32 data_seq = 1, msg_id = 0;
+	guint32 seq0 = g_rand_int(rand), ts0 = g_rand_int(rand);
+	gint f;
+
+	rx->pkts = g_ptr_array_new_with_free_func((GDestroyNotify)g_bytes_unref);
+	rx->frames = g_array_new(FALSE, FALSE, sizeof(gint));
+
+	for (f = 0; f < frames; f++) {
+		GBytes *pkt = rt_frame(rand, seq0 + f, ts0 + f * FRAME_SAMPLES,
+				       (guint64)f * FRAME_NS / 1000);
+
+		switch (held ? INJECT_NONE : pick(rand)) {
+		case INJECT_LOSS:
+			inj->rx_lost++;
+			g_bytes_unref(pkt);
+			break;
+		case INJECT_REORDER:
+			/* Goes out after the next one */
+			held = pkt;
+			inj->rx_reordered++;
+			break;
+		case INJECT_DUP:
+			inj->rx_dups++;
+			add_pkt(rx, g_bytes_ref(pkt), f);
+			/* fall through */
+		case INJECT_NONE:
+			add_pkt(rx, pkt, f);
+			if (held) {
+				add_pkt(rx, held, f);
+				held = NULL;
+			}
+			break;
+		}
+
+		send_retx(rx, &retx, logical, &data_seq, f, inj);
+
+		if (f % stream_every)
+			continue;
+
+		/* Split it up, and shuffle some of the pieces */
+		gsize len = g_bytes_get_size(logical), n = (len + frag_size - 1) / frag_size, i;
+		gsize *offsets = g_new(gsize, n);
+
+		for (i = 0; i < n; i++)
+			offsets[i] = i * frag_size;
+		for (i = n - 1; i > 0; i--) {
+			gsize j = g_rand_int_range(rand, 0, i + 1), t = offsets[i];
+
+			if (pick(rand) != INJECT_REORDER)
+				continue;
+			offsets[i] = offsets[j];
+			offsets[j] = t;
+		}
+		for (i = 0; i < n; i++) {
+			if (pick(rand) == INJECT_LOSS) {
+				struct retx *r = g_new0(struct retx, 1);
+
+				r->due = f + RETX_DELAY;
+				r->msg_id = msg_id;
+				r->offset = offsets[i];
+				g_queue_push_tail(&retx, r);
+				inj->frags_lost++;
+				continue;
+			}
+			add_pkt(rx, data_frag(logical, data_seq++, msg_id, offsets[i]), f);
+			rx->data_pkts++;
+			inj->frags_sent++;
+		}
+		g_free(offsets);
+		inj->streams_sent++;
+		msg_id++;
+	}
+	if (held)
+		add_pkt(rx, held, frames);
+	send_retx(rx, &retx, logical, &data_seq, G_MAXINT, inj);
+	g_bytes_unref(logical);
+}
+
+/*
+ * The media server. It has a thread and main context of its own, so
+ * that it keeps time however busy the client is, and so that the
+ * client's CPU time can be told apart from its own.
+ */
+struct peer {
+	GMainContext *ctx;
+	GMainLoop *loop;
+	GThread *thread;
+
+	SoupServer *server;
+	SoupWebsocketConnection *ws;
+
+	GSocket *udp;
+	gnutls_certificate_credentials_t cred;
+	gnutls_session_t sess;
+
+	struct rx_stream *rx;
+	guint next_pkt;
+	gboolean sending;
+	gint64 start, next_due;
+
+	/* What arrived from the client */
+	guint64 rx_packets, rx_bytes, rx_frames, acks;
+	gint64 last_arrival;
+	guint16 last_seq;
+	GArray *latency_us, *interval_us;
+};
+
+static void peer_send(struct peer *p, gconstpointer data, gsize len)
+{
+	if (p->ws)
+		soup_websocket_connection_send_binary(p->ws, data, len);
+	else if (p->sess)
+		gnutls_record_send(p->sess, data, len);
+}
+
+/* From when each was due rather than when it went, as the server would */
+static gboolean peer_send_due(gpointer _p)
+{
+	struct peer *p = _p;
+	gint frame = (p->next_due - p->start) / FRAME_US;
+
+	while (p->next_pkt < p->rx->pkts->len &&
+	       g_array_index(p->rx->frames, gint, p->next_pkt) <= frame) {
+		gsize len;
+		gconstpointer data = g_bytes_get_data(p->rx->pkts->pdata[p->next_pkt++], &len);
+
+		peer_send(p, data, len);
+	}
+	if (p->next_pkt == p->rx->pkts->len)
+		return G_SOURCE_REMOVE;
+
+	p->next_due += FRAME_US;
+	g_source_set_ready_time(g_main_current_source(), p->next_due);
+	return G_SOURCE_CONTINUE;
+}
+
+static void peer_authorise(struct peer *p)
+{
+	AuthMessage msg = AUTH_MESSAGE__INIT;
+	GBytes *pkt;
+	gsize len;
+
+	msg.message_type = AUTH_MESSAGE_TYPE__RESPONSE;
+	msg.has_message_type = TRUE;
+	msg.authorized = TRUE;
+	msg.has_authorized = TRUE;
+
+	pkt = pack_xrp(XRP_AUTH_MESSAGE, &msg.base);
+	peer_send(p, g_bytes_get_data(pkt, &len), len);
+	g_bytes_unref(pkt);
+
+	if (p->sending)
+		return;
+	p->sending = TRUE;
+	/* A frame after, so the client has seen the response first */
+	p->start = g_get_monotonic_time() + FRAME_US;
+	p->next_due = p->start;
+	paced_source(p->ctx, peer_send_due, p, p->next_due);
+}
+
+static void peer_got_frame(struct peer *p, AudioMessage *am)
+{
+	gint64 now = g_get_monotonic_time();
+
+	/* The client stamps it with the real time as it goes */
+	if (am->has_ntp_time) {
+		gint64 latency = g_get_real_time() - (gint64)am->ntp_time;
+
+		g_array_append_val(p->latency_us, latency);
+	}
+	if (p->rx_frames && am->seq == ((p->last_seq + 1) & 0xffff)) {
+		gint64 d = now - p->last_arrival - FRAME_US;
+
+		d = d < 0 ? -d : d;
+		g_array_append_val(p->interval_us, d);
+	}
+	p->last_seq = am->seq;
+	p->last_arrival = now;
+	p->rx_frames++;
+}
+
+static void peer_receive(struct peer *p, gconstpointer data, gsize len)
+{
+	const struct xrp_header *hdr = data;
+	const guint8 *payload = (const guint8 *)(hdr + 1);
+
+	p->rx_packets++;
+	p->rx_bytes += len;
+	if (len < sizeof(*hdr) || ntohs(hdr->len) != len)
+		return;
+	len -= sizeof(*hdr);
+
+	switch (ntohs(hdr->type)) {
+	case XRP_AUTH_MESSAGE: {
+		AuthMessage *msg = auth_message__unpack(NULL, len, payload);
+
+		if (msg && msg->has_message_type &&
+		    msg->message_type == AUTH_MESSAGE_TYPE__REQUEST)
+			peer_authorise(p);
+		if (msg)
+			auth_message__free_unpacked(msg, NULL);
+		break;
+	}
+	case XRP_RT_MESSAGE: {
+		RTMessage *msg = rtmessage__unpack(NULL, len, payload);
+
+		if (msg && msg->audio && msg->audio->has_audio && msg->audio->audio.len)
+			peer_got_frame(p, msg->audio);
+		if (msg)
+			rtmessage__free_unpacked(msg, NULL);
+		break;
+	}
+	case XRP_DATA_MESSAGE:
+		p->acks++;
+		break;
+	}
+}
+
+static void peer_ws_message(SoupWebsocketConnection *ws, gint type,
+			    GBytes *message, gpointer _p)
+{
+	gsize len;
+	gconstpointer data = g_bytes_get_data(message, &len);
+
+	peer_receive(_p, data, len);
+}
+
+static void peer_ws_cb(SoupServer *server, SoupWebsocketConnection *ws,
+		       const char *path, SoupClientContext *client, gpointer _p)
+{
+	struct peer *p = _p;
+
+	/* There's only the one call */
+	if (p->ws)
+		return;
+
+	p->ws = g_object_ref(ws);
+	g_signal_connect(ws, "message", G_CALLBACK(peer_ws_message), p);
+}
+
+static gboolean peer_dtls_readable(GSocket *sock, GIOCondition cond, gpointer _p)
+{
+	struct peer *p = _p;
+	guint8 buf[2048];
+	ssize_t len;
+
+	while ((len = gnutls_record_recv(p->sess, buf, sizeof(buf))) > 0)
+		peer_receive(p, buf, len);
+
+	if (!len || (len != GNUTLS_E_AGAIN && gnutls_error_is_fatal(len)))
+		return G_SOURCE_REMOVE;
+	return G_SOURCE_CONTINUE;
+}
+
+/* In the peer's thread, while the client handshakes from the main loop */
+static gboolean peer_dtls_accept(struct peer *p)
+{
+	GSocketAddress *from = NULL;
+	GInputVector v = { NULL, 0 };
+	gint flags = G_SOCKET_MSG_PEEK;
+	GError *error = NULL;
+	int ret;
+
+	/* Look at the ClientHello, to find out who to talk to */
+	if (g_socket_receive_message(p->udp, &from, &v, 1, NULL, NULL, &flags, NULL, &error) < 0 ||
+	    !g_socket_connect(p->udp, from, NULL, &error)) {
+		fprintf(stderr, "DTLS peer: %s\n", error->message);
+		g_clear_error(&error);
+		g_clear_object(&from);
+		return FALSE;
+	}
+	g_object_unref(from);
+
+	gnutls_init(&p->sess, GNUTLS_SERVER | GNUTLS_DATAGRAM);
+	gnutls_set_default_priority(p->sess);
+	gnutls_credentials_set(p->sess, GNUTLS_CRD_CERTIFICATE, p->cred);
+	gnutls_transport_set_int(p->sess, g_socket_get_fd(p->udp));
+	gnutls_handshake_set_timeout(p->sess, CONNECT_TIMEOUT * 1000);
+	do
+		ret = gnutls_handshake(p->sess);
+	while (ret < 0 && !gnutls_error_is_fatal(ret));
+	if (ret < 0) {
+		fprintf(stderr, "DTLS peer: %s\n", gnutls_strerror(ret));
+		return FALSE;
+	}
+
+	GSource *source = g_socket_create_source(p->udp, G_IO_IN, NULL);
+	g_source_set_callback(source, (GSourceFunc)peer_dtls_readable, p, NULL);
+	g_source_attach(source, p->ctx);
+	g_source_unref(source);
+	return TRUE;
+}
+
+/* Self-signed; the client is given credentials which don't check it */
+static gboolean peer_make_cert(struct peer *p)
+{
+	gnutls_x509_privkey_t key;
+	gnutls_x509_crt_t crt;
+	time_t now = time(NULL);
+	guint8 serial = 1;
+	int ret;
+
+	gnutls_x509_privkey_init(&key);
+	gnutls_x509_crt_init(&crt);
+	ret = gnutls_x509_privkey_generate(key, GNUTLS_PK_EC, 256, 0);
+	if (!ret) {
+		gnutls_x509_crt_set_version(crt, 3);
+		gnutls_x509_crt_set_serial(crt, &serial, sizeof(serial));
+		gnutls_x509_crt_set_activation_time(crt, now - 60);
+		gnutls_x509_crt_set_expiration_time(crt, now + 24 * 60 * 60);
+		gnutls_x509_crt_set_dn_by_oid(crt, GNUTLS_OID_X520_COMMON_NAME, 0,
+					      "127.0.0.1", strlen("127.0.0.1"));
+		gnutls_x509_crt_set_key(crt, key);
+		ret = gnutls_x509_crt_sign2(crt, crt, key, GNUTLS_DIG_SHA256, 0);
+	}
+	if (!ret) {
+		gnutls_certificate_allocate_credentials(&p->cred);
+		ret = gnutls_certificate_set_x509_key(p->cred, &crt, 1, key);
+	}
+	gnutls_x509_crt_deinit(crt);
+	gnutls_x509_privkey_deinit(key);
+
+	if (ret < 0)
+		fprintf(stderr, "DTLS peer certificate: %s\n", gnutls_strerror(ret));
+	return ret >= 0;
+}
+
+static guint16 local_port(GSocket *sock)
+{
+	GSocketAddress *addr = g_socket_get_local_address(sock, NULL);
+	guint16 port = 0;
+
+	if (addr) {
+		port = g_inet_socket_address_get_port(G_INET_SOCKET_ADDRESS(addr));
+		g_object_unref(addr);
+	}
+	return port;
+}
+
+/* A bound UDP socket on 127.0.0.1, on a port of the kernel's choosing */
+static GSocket *loopback_udp(void)
+{
+	GSocketAddress *addr = g_inet_socket_address_new_from_string("127.0.0.1", 0);
+	GError *error = NULL;
+	GSocket *sock;
+
+	sock = g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_DATAGRAM,
+			    G_SOCKET_PROTOCOL_UDP, &error);
+	if (sock && !g_socket_bind(sock, addr, FALSE, &error))
+		g_clear_object(&sock);
+	if (!sock) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+	}
+	g_object_unref(addr);
+	return sock;
+}
+
+static gpointer peer_thread(gpointer _p)
+{
+	struct peer *p = _p;
+
+	g_main_context_push_thread_default(p->ctx);
+	if (p->server || peer_dtls_accept(p))
+		g_main_loop_run(p->loop);
+	g_main_context_pop_thread_default(p->ctx);
+	return NULL;
+}
+
+/* Sets the host:port for DTLS and the websocket URL for the call */
+static struct peer *peer_new(struct rx_stream *rx, gchar **media_host, gchar **ws_url)
+{
+	struct peer *p = g_new0(struct peer, 1);
+	GError *error = NULL;
+	GSocket *closed;
+
+	p->ctx = g_main_context_new();
+	p->loop = g_main_loop_new(p->ctx, FALSE);
+	p->rx = rx;
+	p->latency_us = g_array_sized_new(FALSE, FALSE, sizeof(gint64), frames);
+	p->interval_us = g_array_sized_new(FALSE, FALSE, sizeof(gint64), frames);
+
+	if (!use_ws) {
+		if (!peer_make_cert(p) || !(p->udp = loopback_udp()))
+			goto err;
+		g_socket_set_timeout(p->udp, CONNECT_TIMEOUT);
+		*media_host = g_strdup_printf("127.0.0.1:%u", local_port(p->udp));
+		*ws_url = g_strdup("ws://127.0.0.1:9");
+	} else {
+		char *protocols[] = { (char *)"opus-med", NULL };
+		GSList *uris;
+
+		/* The server's sources go to the context it's set up in */
+		g_main_context_push_thread_default(p->ctx);
+		p->server = soup_server_new(SOUP_SERVER_SERVER_HEADER, "chime-audio-bench ", NULL);
+		soup_server_add_websocket_handler(p->server, "/audio", NULL, protocols,
+						  peer_ws_cb, p, NULL);
+		if (!soup_server_listen_local(p->server, 0, SOUP_SERVER_LISTEN_IPV4_ONLY, &error)) {
+			g_main_context_pop_thread_default(p->ctx);
+			fprintf(stderr, "%s\n", error->message);
+			g_error_free(error);
+			goto err;
+		}
+		g_main_context_pop_thread_default(p->ctx);
+
+		uris = soup_server_get_uris(p->server);
+		*ws_url = g_strdup_printf("ws://127.0.0.1:%u", soup_uri_get_port(uris->data));
+		g_slist_free_full(uris, (GDestroyNotify)soup_uri_free);
+
+		/* Nothing listens there, so DTLS fails at once */
+		if (!(closed = loopback_udp()))
+			goto err;
+		*media_host = g_strdup_printf("127.0.0.1:%u", local_port(closed));
+		g_object_unref(closed);
+	}
+
+	p->thread = g_thread_new("bench-peer", peer_thread, p);
+	return p;
+
+ err:
+	g_clear_object(&p->server);
+	g_clear_object(&p->udp);
+	if (p->cred)
+		gnutls_certificate_free_credentials(p->cred);
+	g_main_loop_unref(p->loop);
+	g_main_context_unref(p->ctx);
+	g_array_free(p->latency_us, TRUE);
+	g_array_free(p->interval_us, TRUE);
+	g_free(p);
+	return NULL;
+}
+
+static gboolean peer_quit(gpointer _p)
+{
+	struct peer *p = _p;
+
+	g_main_loop_quit(p->loop);
+	return G_SOURCE_REMOVE;
+}
+
+/* After which its figures can be looked at */
+static void peer_stop(struct peer *p)
+{
+	if (!p->thread)
+		return;
+
+	/* Quits the loop even if it hasn't quite started yet */
+	g_main_context_invoke(p->ctx, peer_quit, p);
+	g_thread_join(p->thread);
+	p->thread = NULL;
+}
+
+static void peer_free(struct peer *p)
+{
+	peer_stop(p);
+	g_clear_object(&p->ws);
+	g_clear_object(&p->server);
+	if (p->sess)
+		gnutls_deinit(p->sess);
+	if (p->cred)
+		gnutls_certificate_free_credentials(p->cred);
+	g_clear_object(&p->udp);
+	g_main_loop_unref(p->loop);
+	g_main_context_unref(p->ctx);
+	g_array_free(p->latency_us, TRUE);
+	g_array_free(p->interval_us, TRUE);
+	g_free(p);
+}
+
+/* What the mic would hand us for frame 'f' */
+static GstBuffer *tx_frame(GRand *rand, gint f)
+{
+	GstBuffer *buffer = gst_rtp_buffer_new_allocate(OPUS_FRAME_LEN, 0, 0);
+	GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+
+	if (gst_rtp_buffer_map(buffer, GST_MAP_WRITE, &rtp)) {
+		guint8 *p = gst_rtp_buffer_get_payload(&rtp);
+		int i;
+
+		for (i = 0; i < OPUS_FRAME_LEN; i++)
+			p[i] = g_rand_int(rand);
+		gst_rtp_buffer_unmap(&rtp);
+	}
+	GST_BUFFER_DTS(buffer) = GST_BUFFER_PTS(buffer) = f * FRAME_NS;
+	GST_BUFFER_DURATION(buffer) = FRAME_NS;
+	return buffer;
+}
+
+struct mic {
+	GstAppSrc *src;
+	GRand *rand;
+	GMainLoop *loop;
+	struct injected *inj;
+	gint f, sent;
+	gint64 next_due;
+};
+
+static gboolean quit_loop(gpointer loop)
+{
+	g_main_loop_quit(loop);
+	return G_SOURCE_REMOVE;
+}
+
+/* Through the appsink, so the frames go out from its streaming thread
+ * exactly as they would in a call */
+static gboolean mic_tick(gpointer _m)
+{
+	struct mic *m = _m;
+
+	if (m->sent == frames) {
+		gst_app_src_end_of_stream(m->src);
+		/* For the last of the peer's packets, and ours to arrive */
+		g_timeout_add(200, quit_loop, m->loop);
+		return G_SOURCE_REMOVE;
+	}
+
+	switch (pick(m->rand)) {
+	case INJECT_LOSS:
+		/* The sample never made it out of the appsink */
+		m->inj->tx_missed++;
+		m->f++;
+		break;
+	case INJECT_REORDER:
+		/* An old one turns up and has to be dropped */
+		if (m->f) {
+			gst_app_src_push_buffer(m->src, tx_frame(m->rand, m->f - 1));
+			m->inj->tx_late++;
+		}
+		break;
+	default:
+		break;
+	}
+	gst_app_src_push_buffer(m->src, tx_frame(m->rand, m->f++));
+	m->sent++;
+
+	m->next_due += FRAME_US;
+	g_source_set_ready_time(g_main_current_source(), m->next_due);
+	return G_SOURCE_CONTINUE;
+}
+
+static ChimeCall *bench_call(ChimeConnection *cxn, const gchar *media_host, const gchar *ws_url)
+{
+	gchar *call_json = g_strdup_printf(
+		"{\"uuid\":\"00000000-0000-4000-8000-000000000000\","
+		"\"alert_body\":\"Benchmark\",\"ongoing?\":true,\"is_recording\":false,"
+		"\"channel\":\"call_bench\",\"roster_channel\":\"call_roster_bench\","
+		"\"host\":\"127.0.0.1\",\"media_host\":\"%s\","
+		"\"mobile_bithub_url\":\"https://bench.invalid/\","
+		"\"desktop_bithub_url\":\"https://bench.invalid/\","
+		"\"control_url\":\"https://bench.invalid/\","
+		"\"stun_server_url\":\"stun:bench.invalid:3478\","
+		"\"audio_ws_url\":\"%s\"}", media_host, ws_url);
+	JsonNode *node = json_from_string(call_json, NULL);
+	GError *error = NULL;
+	ChimeCall *call;
+
+	chime_init_calls(cxn);
+	call = chime_connection_parse_call(cxn, node, &error);
+	if (!call) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+	}
+	json_node_unref(node);
+	g_free(call_json);
+	return call;
+}
+
+static gboolean keep_waiting(gpointer unused)
+{
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean wait_for_audio(ChimeCallAudio *audio)
+{
+	gint64 deadline = g_get_monotonic_time() + CONNECT_TIMEOUT * G_USEC_PER_SEC;
+	guint beat = g_timeout_add(100, keep_waiting, NULL);
+
+	while (audio->state != CHIME_AUDIO_STATE_AUDIO && g_get_monotonic_time() < deadline)
+		g_main_context_iteration(NULL, TRUE);
+	g_source_remove(beat);
+
+	return audio->state == CHIME_AUDIO_STATE_AUDIO;
+}
+
+static gint64 thread_cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (gint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static gint cmp_us(gconstpointer a, gconstpointer b)
+{
+	gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void report_us(const gchar *what, GArray *us)
+{
+	if (!us->len) {
+		printf("%-24s none arrived\n", what);
+		return;
+	}
+	g_array_sort(us, cmp_us);
+	printf("%-24s p50 %8" G_GINT64_FORMAT "µs  p99 %8" G_GINT64_FORMAT "µs  max %8" G_GINT64_FORMAT "µs\n",
+	       what, g_array_index(us, gint64, us->len / 2),
+	       g_array_index(us, gint64, (us->len * 99) / 100),
+	       g_array_index(us, gint64, us->len - 1));
+}
+
+int main(int argc, char *argv[])
+{
+	GOptionContext *context;
+	ChimeConnection *cxn;
+	ChimeCall *call;
+	ChimeCallAudio *audio;
+	ChimeCallAudioStats *q;
+	GError *error = NULL;
+	struct injected inj = { 0 };
+	struct rx_stream rx = { 0 };
+	struct mic mic = { 0 };
+	struct peer *peer;
+	gchar *media_host = NULL, *ws_url = NULL;
+	GstElement *mic_pipe, *spk_pipe = NULL;
+	GstElement *mic_src, *mic_sink, *spk_src;
+	GRand *rand;
+	gsize reassembly = 0;
+	int i, status = EXIT_FAILURE;
+
+	context = g_option_context_new("- soak the call audio path over a loopback transport");
+	g_option_context_add_main_entries(context, options, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error) || frames < 1 ||
+	    frag_size < 1 || stream_every < 1) {
+		fprintf(stderr, "%s\n", error ? error->message : "Invalid options");
+		g_clear_error(&error);
+		g_option_context_free(context);
+		return EXIT_FAILURE;
+	}
+	g_option_context_free(context);
+	gst_init(NULL, NULL);
+
+	mic_pipe = gst_parse_launch("appsrc name=src is-live=true format=time caps=application/x-rtp "
+				    "! appsink name=sink sync=false", &error);
+	if (!error)
+		spk_pipe = gst_parse_launch("appsrc name=src format=time caps=application/x-rtp "
+					    "! fakesink sync=false", &error);
+	if (error) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		return EXIT_FAILURE;
+	}
+	mic_src = gst_bin_get_by_name(GST_BIN(mic_pipe), "src");
+	mic_sink = gst_bin_get_by_name(GST_BIN(mic_pipe), "sink");
+	spk_src = gst_bin_get_by_name(GST_BIN(spk_pipe), "src");
+
+	rand = g_rand_new_with_seed(seed);
+	build_rx(&rx, rand, &inj);
+
+	peer = peer_new(&rx, &media_host, &ws_url);
+	if (!peer)
+		return EXIT_FAILURE;
+
+	cxn = chime_connection_new("bench@example.com", NULL, "bench", "bench");
+	call = bench_call(cxn, media_host, ws_url);
+	if (!call)
+		return EXIT_FAILURE;
+
+	audio = chime_call_audio_open(cxn, call, FALSE);
+	/* Before connect_dtls() makes its own, which would want the peer
+	 * to have a certificate that we can't give it */
+	if (!use_ws)
+		gnutls_certificate_allocate_credentials(&audio->dtls_cred);
+	chime_call_audio_install_gst_app_callbacks(audio, GST_APP_SRC(spk_src),
+						   GST_APP_SINK(mic_sink));
+	gst_element_set_state(spk_pipe, GST_STATE_PLAYING);
+	gst_element_set_state(mic_pipe, GST_STATE_PLAYING);
+
+	if (!wait_for_audio(audio)) {
+		fprintf(stderr, "Audio didn't start within %ds\n", CONNECT_TIMEOUT);
+		goto out;
+	}
+	if (use_ws ? !audio->ws : !audio->dtls_sess) {
+		fprintf(stderr, "Connected over %s instead\n", use_ws ? "DTLS" : "the websocket");
+		goto out;
+	}
+
+	mic.src = GST_APP_SRC(mic_src);
+	mic.rand = g_rand_new_with_seed(seed + 1);
+	mic.loop = g_main_loop_new(NULL, FALSE);
+	mic.inj = &inj;
+	mic.next_due = g_get_monotonic_time();
+	paced_source(NULL, mic_tick, &mic, mic.next_due);
+
+	guint64 rx_pkts = audio->stats.rx_packets, allocs = bench_alloc_count();
+	gint64 cpu = thread_cpu_ns(), start = g_get_monotonic_time();
+
+	g_main_loop_run(mic.loop);
+
+	cpu = thread_cpu_ns() - cpu;
+	allocs = bench_alloc_count() - allocs;
+	rx_pkts = audio->stats.rx_packets - rx_pkts;
+	peer_stop(peer);
+
+	printf("%s, %d frames each way in %.1fs\n", use_ws ? "Websocket" : "DTLS", frames,
+	       (g_get_monotonic_time() - start) / 1e6);
+	printf("%-24s %.1fµs CPU per packet received (%" G_GUINT64_FORMAT " of %u sent)\n",
+	       "client main loop", rx_pkts ? cpu / 1000.0 / rx_pkts : 0.0, rx_pkts, peer->next_pkt);
+	printf("%-24s %.1f per packet either way, the peer's included\n", "allocations",
+	       rx_pkts + peer->rx_packets ? (gdouble)allocs / (rx_pkts + peer->rx_packets) : 0.0);
+
+	q = &audio->quality;
+	printf("\nFrames from the mic, as the peer got them:\n");
+	report_us("latency", peer->latency_us);
+	report_us("interval jitter", peer->interval_us);
+	printf("%-24s jitter %" G_GINT64_FORMAT "µs, send cost %" G_GINT64_FORMAT "µs\n",
+	       "client's own estimates", (gint64)q->tx_jitter_us, (gint64)q->tx_cost_us);
+
+	for (i = 0; i < DATA_MSG_WINDOW; i++)
+		reassembly += audio->data_slots[i].alloc;
+	printf("%-24s %" G_GSIZE_FORMAT " bytes\n", "reassembly buffers", reassembly);
+
+	printf("\n%-24s %10s %10s\n", "", "injected", "counted");
+	printf("%-24s %10u %10" G_GUINT64_FORMAT "\n", "rx frames lost", inj.rx_lost, (guint64)q->rx_lost);
+	printf("%-24s %10u %10" G_GUINT64_FORMAT "\n", "rx frames reordered", inj.rx_reordered, (guint64)q->rx_reordered);
+	printf("%-24s %10u %10" G_GUINT64_FORMAT "\n", "rx frames duplicated", inj.rx_dups, (guint64)q->rx_duplicates);
+	printf("%-24s %10u %10" G_GUINT64_FORMAT "\n", "tx frames missed", inj.tx_missed, (guint64)q->tx_frames_missed);
+	printf("%-24s %10u %10u\n", "stream messages", inj.streams_sent, (guint)audio->data_next_logical_msg);
+	printf("\n%u of %u fragments lost and resent, %" G_GUINT64_FORMAT " acknowledgements\n",
+	       inj.frags_lost, rx.data_pkts, peer->acks);
+	printf("%" G_GUINT64_FORMAT " packets (%" G_GUINT64_FORMAT " bytes) reached the peer, "
+	       "%" G_GUINT64_FORMAT " frames, %u late frames dropped\n",
+	       peer->rx_packets, peer->rx_bytes, (guint64)q->tx_frames, inj.tx_late);
+
+	status = EXIT_SUCCESS;
+ out:
+	peer_stop(peer);
+	chime_call_audio_close(audio, TRUE);
+	gst_element_set_state(mic_pipe, GST_STATE_NULL);
+	gst_element_set_state(spk_pipe, GST_STATE_NULL);
+	gst_object_unref(mic_src);
+	gst_object_unref(mic_sink);
+	gst_object_unref(spk_src);
+	gst_object_unref(mic_pipe);
+	gst_object_unref(spk_pipe);
+
+	peer_free(peer);
+	if (mic.loop)
+		g_main_loop_unref(mic.loop);
+	if (mic.rand)
+		g_rand_free(mic.rand);
+	g_rand_free(rand);
+	g_ptr_array_unref(rx.pkts);
+	g_array_free(rx.frames, TRUE);
+	g_free(media_host);
+	g_free(ws_url);
+	g_object_unref(call);
+	g_object_unref(cxn);
+	return status;
+}
@@ -8,17 +8,22 @@ if len(sys.argv) != 2:
 
 chimeurl = sys.argv[1]
 
+bus = dbus.SessionBus()
+
+pidgin = bus.get_object("im.pidgin.purple.PurpleService",
+                        "/im/pidgin/purple/PurpleObject")
+
+# Links in messages, such as to the full size of an image, go to the plugin
+if chimeurl.startswith('chime://attachment?'):
+    pidgin.PurpleGotProtocolHandlerUri(chimeurl)
+    exit(0)
+
 if not chimeurl.startswith('chime://sso_sessions?Token='):
     print("Need Chime URL starting chime://sso_sessions?Token=")
     exit(1)
 
 token = chimeurl[27:]
 
-bus = dbus.SessionBus()
-
-pidgin = bus.get_object("im.pidgin.purple.PurpleService",
-                        "/im/pidgin/purple/PurpleObject")
-
 accounts = pidgin.PurpleAccountsGetAllActive()
 
 for account in accounts:
@@ -0,0 +1,377 @@
+/*
+ * Replay recorded HTTP responses and juggernaut messages through the
+ * connection's real handlers, and report how fast they go and how much
+ * they allocate. Nothing touches the network.
+ *
+ * Each round signs in a new connection whose SoupSession answers from
+ * the fixtures instead. Files ending in .json are response bodies, and
+ * answer the requests whose path ends with their name: sessions.json is
+ * the device registration, then contacts.json, rooms.json and
+ * conversations.json are the initial sync and messages.json is the
+ * history fetched for a conversation. Anything else that is asked for,
+ * such as the websocket or presence, is left unanswered.
+ *
+ * After the last round, the contacts are subscribed, rooms opened and
+ * conversations hydrated as the buddy list and chat windows would. Then
+ * files ending in .jugg, which hold one juggernaut message per line as
+ * found after the "3:::" of the frame, are dispatched to them.
+ */
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chime/chime-connection-private.h"
+#include "bench/bench-util.h"
+
+#define DEFAULT_ROUNDS 200
+
+static gint rounds = DEFAULT_ROUNDS;
+
+static GOptionEntry options[] = {
+	{ "rounds", 'n', 0, G_OPTION_ARG_INT, &rounds,
+	  "Times to replay each fixture (default 200)", "N" },
+	{ NULL }
+};
+
+struct fixture {
+	gchar *path, *name;
+	gchar *data;
+	gsize len;
+	struct bench_result r;
+};
+
+static GPtrArray *http_fixtures;
+
+/*
+ * A SoupSession which answers each message from its fixture, from idle
+ * as libsoup would, and keeps those it has no fixture for until it is
+ * aborted. The time taken by the connection's callback is what's
+ * measured, so it covers the JSON parse and the real handler.
+ */
+typedef struct {
+	SoupSession parent;
+	GQueue ready, held;
+	guint idle_id;
+} BenchSession;
+
+typedef struct {
+	SoupSessionClass parent_class;
+} BenchSessionClass;
+
+G_DEFINE_TYPE(BenchSession, bench_session, SOUP_TYPE_SESSION)
+
+struct bench_req {
+	SoupMessage *msg;
+	SoupSessionCallback cb;
+	gpointer cb_data;
+	struct fixture *fx;
+};
+
+static struct fixture *find_fixture(SoupMessage *msg)
+{
+	const gchar *path = soup_uri_get_path(soup_message_get_uri(msg));
+	const gchar *last = strrchr(path, '/');
+	guint i;
+
+	last = last ? last + 1 : path;
+	for (i = 0; i < http_fixtures->len; i++) {
+		struct fixture *fx = http_fixtures->pdata[i];
+
+		if (!strcmp(fx->name, last))
+			return fx;
+	}
+	return NULL;
+}
+
+static void complete_req(SoupSession *sess, struct bench_req *req)
+{
+	req->cb(sess, req->msg, req->cb_data);
+	g_object_unref(req->msg);
+	g_free(req);
+}
+
+static gboolean answer_ready(gpointer _sess)
+{
+	BenchSession *sess = _sess;
+	struct bench_req *req;
+
+	sess->idle_id = 0;
+	while ((req = g_queue_pop_head(&sess->ready))) {
+		struct fixture *fx = req->fx;
+
+		soup_message_set_status(req->msg, SOUP_STATUS_OK);
+		soup_message_headers_set_content_type(req->msg->response_headers,
+						      "application/json", NULL);
+		soup_message_body_append(req->msg->response_body, SOUP_MEMORY_STATIC,
+					 fx->data, fx->len);
+		soup_message_body_flatten(req->msg->response_body);
+
+		guint64 allocs = bench_alloc_count();
+		gint64 start = bench_now_ns();
+
+		complete_req(SOUP_SESSION(sess), req);
+		bench_result_add(&fx->r, start, allocs);
+	}
+	return G_SOURCE_REMOVE;
+}
+
+static void bench_session_queue_message(SoupSession *session, SoupMessage *msg,
+					SoupSessionCallback cb, gpointer cb_data)
+{
+	BenchSession *sess = (BenchSession *)session;
+	struct bench_req *req = g_new0(struct bench_req, 1);
+
+	/* soup_session_queue_message() drops the caller's reference */
+	req->msg = g_object_ref(msg);
+	req->cb = cb;
+	req->cb_data = cb_data;
+	req->fx = find_fixture(msg);
+
+	if (!req->fx) {
+		g_queue_push_tail(&sess->held, req);
+		return;
+	}
+	g_queue_push_tail(&sess->ready, req);
+	if (!sess->idle_id)
+		sess->idle_id = g_idle_add(answer_ready, sess);
+}
+
+/* soup_session_abort() cancels what libsoup has queued; ours are here */
+static void bench_session_flush_queue(SoupSession *session)
+{
+	BenchSession *sess = (BenchSession *)session;
+	struct bench_req *req;
+
+	if (sess->idle_id) {
+		g_source_remove(sess->idle_id);
+		sess->idle_id = 0;
+	}
+	while ((req = g_queue_pop_head(&sess->ready)) ||
+	       (req = g_queue_pop_head(&sess->held))) {
+		soup_message_set_status(req->msg, SOUP_STATUS_CANCELLED);
+		complete_req(session, req);
+	}
+	SOUP_SESSION_CLASS(bench_session_parent_class)->flush_queue(session);
+}
+
+static void bench_session_init(BenchSession *sess)
+{
+	g_queue_init(&sess->ready);
+	g_queue_init(&sess->held);
+}
+
+static void bench_session_class_init(BenchSessionClass *klass)
+{
+	SoupSessionClass *session_class = SOUP_SESSION_CLASS(klass);
+
+	session_class->queue_message = bench_session_queue_message;
+	session_class->flush_queue = bench_session_flush_queue;
+}
+
+static void drain(void)
+{
+	while (g_main_context_iteration(NULL, FALSE))
+		;
+}
+
+static void first_conversation(ChimeConnection *cxn, ChimeConversation *conv, gpointer _first)
+{
+	ChimeConversation **first = _first;
+
+	if (!*first)
+		*first = conv;
+}
+
+/* Sign in and sync, as far as the fixtures go */
+static ChimeConnection *sync_round(void)
+{
+	ChimeConnection *cxn = chime_connection_new("bench@example.com", "https://bench.invalid",
+						    "bench", "bench");
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	ChimeConversation *conv = NULL;
+
+	g_object_unref(priv->soup_sess);
+	priv->soup_sess = g_object_new(bench_session_get_type(), NULL);
+
+	chime_connection_connect(cxn);
+	drain();
+
+	/* The history is fetched when a conversation is opened */
+	chime_connection_foreach_conversation(cxn, first_conversation, &conv);
+	if (conv)
+		chime_connection_fetch_messages_async(cxn, CHIME_OBJECT(conv), NULL, NULL,
+						      NULL, NULL, NULL);
+	drain();
+
+	return cxn;
+}
+
+static void subscribe_contact(ChimeConnection *cxn, ChimeContact *contact, gpointer _unused)
+{
+	chime_contact_get_availability(contact);
+}
+
+static void open_room(ChimeConnection *cxn, ChimeRoom *room, gpointer _unused)
+{
+	chime_connection_open_room(cxn, room);
+}
+
+static void hydrate_conversation(ChimeConnection *cxn, ChimeConversation *conv, gpointer _unused)
+{
+	chime_conversation_hydrate(cxn, conv);
+}
+
+/* Who would be listening with the buddy list up and every chat open */
+static void open_everything(ChimeConnection *cxn)
+{
+	chime_connection_foreach_contact(cxn, subscribe_contact, NULL);
+	chime_connection_foreach_room(cxn, open_room, NULL);
+	chime_connection_foreach_conversation(cxn, hydrate_conversation, NULL);
+	drain();
+}
+
+static gboolean has_subscriber(ChimeConnection *cxn, JsonParser *parser, const gchar *line)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	const gchar *channel;
+
+	return json_parser_load_from_data(parser, line, -1, NULL) &&
+		parse_string(json_parser_get_root(parser), "channel", &channel) &&
+		priv->subscriptions && g_hash_table_lookup(priv->subscriptions, channel);
+}
+
+static void bench_jugg(ChimeConnection *cxn, const gchar *path, gchar *data)
+{
+	struct bench_result r;
+	gchar **lines = g_strsplit(data, "\n", -1);
+	JsonParser *parser = json_parser_new();
+	guint unsubscribed = 0, n = 0;
+	gchar **l;
+	gint i;
+
+	for (l = lines; *l; l++) {
+		if (!**l)
+			continue;
+		n++;
+		if (!has_subscriber(cxn, parser, *l))
+			unsubscribed++;
+	}
+	g_object_unref(parser);
+	if (unsubscribed)
+		g_warning("%s: nobody is subscribed to the channel of %u of %u messages",
+			  path, unsubscribed, n);
+
+	bench_result_init(&r, "jugg", path, rounds * n);
+	for (i = 0; i < rounds; i++) {
+		for (l = lines; *l; l++) {
+			gsize len = strlen(*l);
+
+			if (!len)
+				continue;
+
+			guint64 allocs = bench_alloc_count();
+			gint64 start = bench_now_ns();
+
+			chime_jugg_replay(cxn, *l, len);
+			bench_result_add(&r, start, allocs);
+		}
+		/* Whatever the handlers deferred, such as index updates */
+		drain();
+	}
+	bench_report(&r);
+	g_strfreev(lines);
+}
+
+int main(int argc, char *argv[])
+{
+	GOptionContext *context;
+	ChimeConnection *cxn = NULL;
+	GPtrArray *jugg_fixtures;
+	GError *error = NULL;
+	int i, status = EXIT_SUCCESS;
+
+	context = g_option_context_new("FIXTURE... - replay recorded Chime traffic");
+	g_option_context_add_main_entries(context, options, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error) || argc < 2 || rounds < 1) {
+		fprintf(stderr, "%s\n", error ? error->message :
+			"Usage: chime-bench [-n ROUNDS] FIXTURE...");
+		g_clear_error(&error);
+		g_option_context_free(context);
+		return EXIT_FAILURE;
+	}
+	g_option_context_free(context);
+
+	/* Parse in the callback, so that its time is counted too */
+	g_setenv("CHIME_JSON_THREADS", "0", FALSE);
+
+	http_fixtures = g_ptr_array_new();
+	jugg_fixtures = g_ptr_array_new();
+	for (i = 1; i < argc; i++) {
+		struct fixture *fx = g_new0(struct fixture, 1);
+
+		fx->path = argv[i];
+		if (!g_file_get_contents(fx->path, &fx->data, &fx->len, &error)) {
+			fprintf(stderr, "%s\n", error->message);
+			g_clear_error(&error);
+			g_free(fx);
+			status = EXIT_FAILURE;
+			continue;
+		}
+
+		if (g_str_has_suffix(fx->path, ".jugg")) {
+			g_ptr_array_add(jugg_fixtures, fx);
+		} else if (g_str_has_suffix(fx->path, ".json")) {
+			gchar *base = g_path_get_basename(fx->path);
+
+			fx->name = g_strndup(base, strlen(base) - strlen(".json"));
+			g_free(base);
+			bench_result_init(&fx->r, "http", fx->path, rounds);
+			g_ptr_array_add(http_fixtures, fx);
+		} else {
+			fprintf(stderr, "%s: not a .json or .jugg fixture\n", fx->path);
+			g_free(fx->data);
+			g_free(fx);
+			status = EXIT_FAILURE;
+		}
+	}
+
+	for (i = 0; i < rounds; i++) {
+		if (cxn) {
+			chime_connection_disconnect(cxn);
+			g_object_unref(cxn);
+		}
+		cxn = sync_round();
+	}
+	for (i = 0; i < http_fixtures->len; i++) {
+		struct fixture *fx = http_fixtures->pdata[i];
+
+		if (!fx->r.ns->len)
+			g_warning("%s was never asked for", fx->path);
+		bench_report(&fx->r);
+		g_free(fx->name);
+		g_free(fx->data);
+		g_free(fx);
+	}
+
+	open_everything(cxn);
+	for (i = 0; i < jugg_fixtures->len; i++) {
+		struct fixture *fx = jugg_fixtures->pdata[i];
+
+		bench_jugg(cxn, fx->path, fx->data);
+		g_free(fx->data);
+		g_free(fx);
+	}
+
+	JsonNode *metrics = chime_connection_get_metrics(cxn);
+	gchar *str = json_to_string(metrics, TRUE);
+	printf("\nConnection metrics afterwards:\n%s\n", str);
+	g_free(str);
+	json_node_unref(metrics);
+
+	chime_connection_disconnect(cxn);
+	g_object_unref(cxn);
+	g_ptr_array_free(http_fixtures, TRUE);
+	g_ptr_array_free(jugg_fixtures, TRUE);
+	return status;
+}
@@ -36,13 +36,14 @@
 
 
 
-static gboolean audio_receive_rt_msg(ChimeCallAudio *audio, gconstpointer pkt, gsize len)
+/* The parts of an RTMessage which have to be handled in the main loop */
+static gboolean rt_msg_has_control(RTMessage *msg)
 {
-	RTMessage *msg = rtmessage__unpack(NULL, len, pkt);
-	if (!msg)
-		return FALSE;
-	gint64 now = g_get_monotonic_time();
+	return msg->client_status || msg->n_profiles;
+}
 
+static void rt_msg_control(ChimeCallAudio *audio, RTMessage *msg)
+{
 	if (msg->client_status) {
 		/* This never seems to happen in practice. We just get a Juggernaut message
 		 * about the call roster, with a 'muter' node in our own participant information. */
@@ -56,36 +57,6 @@ static gboolean audio_receive_rt_msg(ChimeCallAudio *audio, gconstpointer pkt, g
 			audio->rt_msg.client_status = NULL;
 		}
 
-	}
-	if (msg->audio) {
-		if (msg->audio->has_server_time) {
-			audio->last_server_time_offset = msg->audio->server_time - now;
-			audio->echo_server_time = TRUE;
-		}
-		if (msg->audio->has_audio && audio->audio_src && audio->appsrc_need_data) {
-			GstBuffer *buffer = gst_rtp_buffer_new_allocate(msg->audio->audio.len, 0, 0);
-			GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
-			if (gst_rtp_buffer_map(buffer, GST_MAP_WRITE, &rtp)) {
-
-				chime_debug("Audio RX seq %d ts %u\n", msg->audio->seq, msg->audio->sample_time);
-
-				gst_rtp_buffer_set_ssrc(&rtp, audio->recv_ssrc);
-				gst_rtp_buffer_set_payload_type(&rtp, 97);
-				gst_rtp_buffer_set_seq(&rtp, msg->audio->seq);
-				gst_rtp_buffer_set_timestamp(&rtp, msg->audio->sample_time);
-				gst_rtp_buffer_unmap(&rtp);
-
-				gst_buffer_fill(buffer, gst_rtp_buffer_calc_header_len(0),
-						msg->audio->audio.data, msg->audio->audio.len);
-
-				gst_app_src_push_buffer(GST_APP_SRC(audio->audio_src), buffer);
-			}
-		} else if (msg->audio->has_audio && msg->audio->audio.len) {
-			chime_debug("Audio drop (%p %d) seq %d ts %u\n",
-				    audio->audio_src, audio->appsrc_need_data,
-				    msg->audio->seq, msg->audio->sample_time);
-		}
-
 	}
 	gboolean send_sig = FALSE;
 	int i;
@@ -118,8 +89,129 @@ static gboolean audio_receive_rt_msg(ChimeCallAudio *audio, gconstpointer pkt, g
 	}
 	if (send_sig)
 		chime_call_emit_participants(audio->call);
+}
+
+/* Loss, reordering and jitter of what the server sends, from its sequence
+ * numbers and sample times. Called under rt_lock. */
+static void track_rx_frame(ChimeCallAudio *audio, AudioMessage *am, gint64 now)
+{
+	ChimeCallAudioStats *q = &audio->quality;
+
+	if (!am->has_seq)
+		return;
+
+	q->rx_frames++;
+	if (audio->rx_seq_valid) {
+		gint16 delta = (guint16)am->seq - audio->rx_seq_max;
+
+		if (!delta) {
+			q->rx_duplicates++;
+			return;
+		}
+		if (delta < 0) {
+			/* It was counted as lost when the later one arrived */
+			q->rx_reordered++;
+			if (audio->rx_session_lost) {
+				audio->rx_session_lost--;
+				q->rx_lost--;
+			}
+			return;
+		}
+		audio->rx_session_lost += delta - 1;
+		q->rx_lost += delta - 1;
+	}
+	audio->rx_seq_valid = TRUE;
+	audio->rx_seq_max = am->seq;
+
+	if (!am->has_sample_time)
+		return;
+
+	if (audio->rx_last_arrival) {
+		gint64 d = (now - audio->rx_last_arrival) * 16000 / G_USEC_PER_SEC -
+			(gint32)(am->sample_time - audio->rx_last_ts);
+
+		if (d < 0)
+			d = -d;
+		audio->rx_jitter16 += d - ((audio->rx_jitter16 + 8) >> 4);
+		q->jitter_us = (audio->rx_jitter16 >> 4) * G_USEC_PER_SEC / 16000;
+	}
+	audio->rx_last_arrival = now;
+	audio->rx_last_ts = am->sample_time;
+}
+
+/* The server echoes the last server_time we sent it, which was our estimate
+ * of its clock at the time. Comparing that with our estimate now gives the
+ * round trip, for as long as the offset between the clocks holds still. */
+static void track_rtt(ChimeCallAudio *audio, AudioMessage *am, gint64 now)
+{
+	ChimeCallAudioStats *q = &audio->quality;
+
+	if (!am->has_echo_time || !audio->last_server_time_offset)
+		return;
+
+	gint64 rtt = audio->last_server_time_offset + now - (gint64)am->echo_time;
+	if (rtt < 0 || rtt > 10 * G_USEC_PER_SEC)
+		return;
+
+	q->rtt_us = rtt;
+	if (q->srtt_us < 0)
+		q->srtt_us = rtt;
+	else
+		q->srtt_us += (rtt - q->srtt_us) / 8;
+}
+
+/* The audio itself, which may be handled in the media thread */
+static void rt_msg_audio(ChimeCallAudio *audio, RTMessage *msg)
+{
+	gint64 now = g_get_monotonic_time();
+
+	if (msg->audio) {
+		g_mutex_lock(&audio->rt_lock);
+		track_rx_frame(audio, msg->audio, now);
+		track_rtt(audio, msg->audio, now);
+		if (msg->audio->has_server_time) {
+			audio->last_server_time_offset = msg->audio->server_time - now;
+			audio->echo_server_time = TRUE;
+		}
+		g_mutex_unlock(&audio->rt_lock);
+		if (msg->audio->has_audio && audio->audio_src &&
+		    g_atomic_int_get(&audio->appsrc_need_data)) {
+			GstBuffer *buffer = gst_rtp_buffer_new_allocate(msg->audio->audio.len, 0, 0);
+			GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+			if (gst_rtp_buffer_map(buffer, GST_MAP_WRITE, &rtp)) {
+
+				chime_debug("Audio RX seq %d ts %u\n", msg->audio->seq, msg->audio->sample_time);
+
+				gst_rtp_buffer_set_ssrc(&rtp, audio->recv_ssrc);
+				gst_rtp_buffer_set_payload_type(&rtp, 97);
+				gst_rtp_buffer_set_seq(&rtp, msg->audio->seq);
+				gst_rtp_buffer_set_timestamp(&rtp, msg->audio->sample_time);
+				gst_rtp_buffer_unmap(&rtp);
+
+				gst_buffer_fill(buffer, gst_rtp_buffer_calc_header_len(0),
+						msg->audio->audio.data, msg->audio->audio.len);
+
+				gst_app_src_push_buffer(GST_APP_SRC(audio->audio_src), buffer);
+			}
+		} else if (msg->audio->has_audio && msg->audio->audio.len) {
+			chime_debug("Audio drop (%p %d) seq %d ts %u\n",
+				    audio->audio_src, audio->appsrc_need_data,
+				    msg->audio->seq, msg->audio->sample_time);
+		}
+
+	}
+}
+
+static gboolean audio_receive_rt_msg(ChimeCallAudio *audio, gconstpointer pkt, gsize len)
+{
+	RTMessage *msg = rtmessage__unpack(&audio->rx_arena.alloc, len, pkt);
+	if (!msg)
+		return FALSE;
 
-	rtmessage__free_unpacked(msg, NULL);
+	rt_msg_control(audio, msg);
+	rt_msg_audio(audio, msg);
+
+	rtmessage__free_unpacked(msg, &audio->rx_arena.alloc);
 	return TRUE;
 }
 
@@ -129,12 +221,32 @@ static gboolean audio_reconnect(gpointer _audio)
 
 	audio->timeout_source = 0;
 
-	chime_call_transport_disconnect(audio, TRUE);
-	chime_call_transport_connect(audio, audio->silent);
+	g_mutex_lock(&audio->rt_lock);
+	audio->quality.reconnects++;
+	g_mutex_unlock(&audio->rt_lock);
+
+	chime_call_transport_reconnect(audio);
 
 	return G_SOURCE_REMOVE;
 }
 
+/* A running average over the last 16 or so. Called under rt_lock */
+static void smooth_us(gint64 *avg, gint64 us)
+{
+	if (*avg < 0)
+		*avg = us;
+	else
+		*avg += (us - *avg) / 16;
+}
+
+/* Frames from the mic should go out one frame duration apart */
+static void track_tx_jitter(ChimeCallAudio *audio, gint64 interval_us, gint64 dur_us)
+{
+	gint64 d = interval_us - dur_us;
+
+	smooth_us(&audio->quality.tx_jitter_us, d < 0 ? -d : d);
+}
+
 static gboolean timed_send_rt_packet(ChimeCallAudio *audio);
 static void do_send_rt_packet(ChimeCallAudio *audio, GstBuffer *buffer)
 {
@@ -143,7 +255,10 @@ static void do_send_rt_packet(ChimeCallAudio *audio, GstBuffer *buffer)
 
 	g_mutex_lock(&audio->rt_lock);
 	gint64 now = g_get_monotonic_time();
-	if (!audio->timeout_source && audio->last_rx + 10000000 < now) {
+	g_mutex_lock(&audio->transport_lock);
+	gint64 last_rx = audio->last_rx;
+	g_mutex_unlock(&audio->transport_lock);
+	if (!audio->timeout_source && last_rx + 10000000 < now) {
 		chime_debug("RX timeout, reconnect audio\n");
 		audio->timeout_source = g_timeout_add(0, audio_reconnect, audio);
 	}
@@ -167,8 +282,12 @@ static void do_send_rt_packet(ChimeCallAudio *audio, GstBuffer *buffer)
 			frames_missed = (dts - audio->next_dts) / dur;
 			if (frames_missed) {
 				chime_debug("Missed %d frames\n", frames_missed);
+				audio->quality.tx_frames_missed += frames_missed;
 				audio->audio_msg.sample_time += frames_missed * nr_samples;
 				audio->next_dts += frames_missed * dur;
+			} else {
+				track_tx_jitter(audio, now - audio->last_send_local_time,
+						dur / 1000);
 			}
 			audio->next_dts += dur;
 		} else {
@@ -206,12 +325,14 @@ static void do_send_rt_packet(ChimeCallAudio *audio, GstBuffer *buffer)
 		audio->audio_msg.has_echo_time = 0;
 
 	audio->audio_msg.has_total_frames_lost = TRUE;
-	audio->audio_msg.total_frames_lost = 0;
+	audio->audio_msg.total_frames_lost = audio->rx_session_lost;
 
 	audio->audio_msg.has_ntp_time = TRUE;
 	audio->audio_msg.ntp_time = g_get_real_time();
 
 	audio->audio_msg.has_audio = TRUE;
+	if (audio->audio_msg.audio.len)
+		audio->quality.tx_frames++;
 
 	audio->last_send_local_time = now;
 	chime_call_transport_send_packet(audio, XRP_RT_MESSAGE, &audio->rt_msg.base);
@@ -220,20 +341,66 @@ static void do_send_rt_packet(ChimeCallAudio *audio, GstBuffer *buffer)
 		gst_rtp_buffer_unmap(&rtp);
 	}
 	audio->audio_msg.sample_time += nr_samples;
+	smooth_us(&audio->quality.tx_cost_us, g_get_monotonic_time() - now);
  drop:
 	g_mutex_unlock(&audio->rt_lock);
 }
 
-static gboolean timed_send_rt_packet(ChimeCallAudio *audio)
+/* While there's no audio from the mic to drive them, RT packets are sent
+ * every RT_PACKET_INTERVAL. Each is scheduled from when the last one was
+ * due rather than when it went out, so that lateness doesn't accumulate. */
+#define RT_PACKET_INTERVAL (100 * 1000)
+
+static gboolean timed_send_rt_packet(gpointer _audio)
 {
+	ChimeCallAudio *audio = _audio;
+	gint64 now = g_get_monotonic_time();
+
 	if (audio->state >= CHIME_AUDIO_STATE_AUDIOLESS)
 		do_send_rt_packet(audio, NULL);
-	return TRUE;
+
+	audio->send_rt_next += RT_PACKET_INTERVAL;
+	if (audio->send_rt_next < now)
+		audio->send_rt_next = now + RT_PACKET_INTERVAL;
+	g_source_set_ready_time(g_main_current_source(), audio->send_rt_next);
+	return G_SOURCE_CONTINUE;
+}
+
+/* For sources driven only by g_source_set_ready_time() */
+static gboolean ready_time_dispatch(GSource *source, GSourceFunc callback, gpointer user_data)
+{
+	return callback(user_data);
+}
+
+static GSourceFuncs ready_time_funcs = {
+	.dispatch = ready_time_dispatch,
+};
+
+static void start_rt_timer(ChimeCallAudio *audio)
+{
+	if (audio->send_rt_timer)
+		return;
+
+	audio->send_rt_next = g_get_monotonic_time() + RT_PACKET_INTERVAL;
+	audio->send_rt_timer = g_source_new(&ready_time_funcs, sizeof(GSource));
+	g_source_set_priority(audio->send_rt_timer, G_PRIORITY_HIGH);
+	g_source_set_callback(audio->send_rt_timer, timed_send_rt_packet, audio, NULL);
+	g_source_set_ready_time(audio->send_rt_timer, audio->send_rt_next);
+	g_source_attach(audio->send_rt_timer, audio->media_ctx);
+}
+
+void chime_call_audio_stop_rt_timer(ChimeCallAudio *audio)
+{
+	if (audio->send_rt_timer) {
+		g_source_destroy(audio->send_rt_timer);
+		g_source_unref(audio->send_rt_timer);
+		audio->send_rt_timer = NULL;
+	}
 }
 
 static gboolean audio_receive_auth_msg(ChimeCallAudio *audio, gconstpointer pkt, gsize len)
 {
-	AuthMessage *msg = auth_message__unpack(NULL, len, pkt);
+	AuthMessage *msg = auth_message__unpack(&audio->rx_arena.alloc, len, pkt);
 	if (!msg)
 		return FALSE;
 
@@ -243,71 +410,91 @@ static gboolean audio_receive_auth_msg(ChimeCallAudio *audio, gconstpointer pkt,
 		chime_call_audio_set_state(audio, audio->silent ? CHIME_AUDIO_STATE_AUDIOLESS :
 					   (audio->local_mute ? CHIME_AUDIO_STATE_AUDIO_MUTED : CHIME_AUDIO_STATE_AUDIO),
 					   NULL);
-		if ((audio->silent || audio->local_mute) &&
-		    !audio->send_rt_source)
-			audio->send_rt_source = g_timeout_add(100, (GSourceFunc)timed_send_rt_packet, audio);
+		if (audio->silent || audio->local_mute)
+			start_rt_timer(audio);
 	}
 
-	auth_message__free_unpacked(msg, NULL);
+	auth_message__free_unpacked(msg, &audio->rx_arena.alloc);
 	return TRUE;
 }
-struct message_frag {
-	struct message_frag *next;
-	gint32 start;
-	gint32 end;
-};
+static struct data_msg_slot *find_msg_slot(ChimeCallAudio *audio, gint32 msg_id, gint32 msg_len)
+{
+	struct data_msg_slot *m = &audio->data_slots[msg_id % DATA_MSG_WINDOW];
 
-struct message_buf {
-	gint32 msg_id;
-	gint32 len;
-	uint8_t *buf;
-	struct message_frag *frags;
-};
+	if (m->used && m->msg_id == msg_id)
+		return m;
 
-static struct message_buf *find_msgbuf(ChimeCallAudio *audio, gint32 msg_id, gint32 msg_len)
-{
-	GSList **l = &audio->data_messages;
-	struct message_buf *m;
+	/* Make room in the window, giving up on anything older */
+	if (msg_id - audio->data_next_logical_msg >= DATA_MSG_WINDOW) {
+		gint32 base = msg_id - DATA_MSG_WINDOW + 1;
+		int i;
 
-	while (*l) {
-		m = (*l)->data;
-		if (m->msg_id == msg_id)
-			return m;
-		else if (m->msg_id > msg_id)
-			break;
-		else
-			l = &((*l)->next);
+		for (i = 0; i < DATA_MSG_WINDOW; i++) {
+			if (audio->data_slots[i].used && audio->data_slots[i].msg_id < base)
+				audio->data_slots[i].used = FALSE;
+		}
+		audio->data_next_logical_msg = base;
 	}
-	m = g_new0(struct message_buf, 1);
 
+	if (msg_len > m->alloc) {
+		m->alloc = msg_len;
+		g_free(m->buf);
+		g_free(m->frags);
+		m->buf = g_malloc(m->alloc);
+		m->frags = g_malloc((m->alloc + 63) / 64 * sizeof(guint64));
+	}
+	memset(m->frags, 0, (msg_len + 63) / 64 * sizeof(guint64));
+	m->used = TRUE;
 	m->msg_id = msg_id;
 	m->len = msg_len;
-	m->buf = g_malloc0(msg_len);
-	/* Insert into the correct place in the sorted list */
-	*l = g_slist_prepend(*l, m);
+	m->received = 0;
 	return m;
 }
 
-static void free_msgbuf(struct message_buf *m)
+/* Mark [start, end) as arrived, and return how many of those bytes hadn't */
+static gint32 mark_frag(guint64 *bits, gint32 start, gint32 end)
+{
+	gint32 added = 0;
+
+	while (start < end) {
+		gint32 word = start / 64, bit = start % 64;
+		gint32 n = MIN(64 - bit, end - start);
+		guint64 mask = (n == 64) ? ~0ULL : ((1ULL << n) - 1) << bit;
+
+		added += n - __builtin_popcountll(bits[word] & mask);
+		bits[word] |= mask;
+		start += n;
+	}
+	return added;
+}
+
+static void free_msg_slots(ChimeCallAudio *audio)
 {
-	while (m->frags) {
-		struct message_frag *f = m->frags;
-		m->frags = f->next;
-		g_free(f);
+	int i;
+
+	for (i = 0; i < DATA_MSG_WINDOW; i++) {
+		g_free(audio->data_slots[i].buf);
+		g_free(audio->data_slots[i].frags);
 	}
-	g_free(m->buf);
-	g_free(m);
+	memset(audio->data_slots, 0, sizeof(audio->data_slots));
 }
 
+static void discard_media_rx(ChimeCallAudio *audio);
+
 void chime_call_audio_cleanup_datamsgs(ChimeCallAudio *audio)
 {
+	int i;
+
+	discard_media_rx(audio);
+
 	if (audio->data_ack_source) {
 		g_source_remove(audio->data_ack_source);
 		audio->data_ack_source = 0;
 	}
 
-	g_slist_free_full(audio->data_messages, (GDestroyNotify) free_msgbuf);
-	audio->data_messages = NULL;
+	/* The buffers are kept for when we reconnect */
+	for (i = 0; i < DATA_MSG_WINDOW; i++)
+		audio->data_slots[i].used = FALSE;
 
 	audio->data_next_seq = 0;
 	audio->data_ack_mask = 0;
@@ -338,47 +525,9 @@ static gboolean idle_send_ack(gpointer _audio)
 	return FALSE;
 }
 
-static gboolean insert_frag(struct message_buf *m, gint32 start, gint32 end)
-{
-	struct message_frag **f = &m->frags, *nf;
-	while (*f) {
-		if (end < (*f)->start) {
-			/* Insert before *f */
-			break;
-		} else if (start <= (*f)->end) {
-			/* Overlap / touching *f so merge */
-			if (start < (*f)->start)
-				(*f)->start = start;
-			/* ... and merge subsequent frags that we now touch */
-			if (end > (*f)->end) {
-				(*f)->end = end;
-				nf = (*f)->next;
-				while ((*f)->next && nf->start <= (*f)->end) {
-					(*f)->end = nf->end;
-					(*f)->next = nf->next;
-					g_free(nf);
-				}
-			}
-			goto done;
-		} else {
-			/* New frag lives after *f */
-			f = &(*f)->next;
-		}
-	}
-	nf = g_new0(struct message_frag, 1);
-	nf->start = start;
-	nf->end = end;
-	nf->next = *f;
-	*f = nf;
- done:
-	return (m->frags->start == 0 &&
-		m->frags->end == m->len);
-}
-
-
 static gboolean audio_receive_stream_msg(ChimeCallAudio *audio, gconstpointer pkt, gsize len)
 {
-	StreamMessage *msg = stream_message__unpack(NULL, len, pkt);
+	StreamMessage *msg = stream_message__unpack(&audio->rx_arena.alloc, len, pkt);
 	if (!msg)
 		return FALSE;
 
@@ -398,13 +547,13 @@ static gboolean audio_receive_stream_msg(ChimeCallAudio *audio, gconstpointer pk
 	/* XX: Find the ChimeContacts, put them into a hash table and use them for
 	   emitting signals on receipt of ProfileMessages */
 
-	stream_message__free_unpacked(msg, NULL);
+	stream_message__free_unpacked(msg, &audio->rx_arena.alloc);
 	return TRUE;
 }
 static gboolean audio_receive_data_msg(ChimeCallAudio *audio, gconstpointer pkt, gsize len)
 {
 	gboolean ret = FALSE;
-	DataMessage *msg = data_message__unpack(NULL, len, pkt);
+	DataMessage *msg = data_message__unpack(&audio->rx_arena.alloc, len, pkt);
 	if (!msg)
 		return FALSE;
 
@@ -446,53 +595,207 @@ static gboolean audio_receive_data_msg(ChimeCallAudio *audio, gconstpointer pkt,
 	if (msg->msg_id < audio->data_next_logical_msg)
 		goto drop;
 
-	struct message_buf *m = find_msgbuf(audio, msg->msg_id, msg->msg_len);
+	if (msg->msg_len <= 0 || msg->msg_len > DATA_MSG_MAX_LEN || msg->offset < 0)
+		goto fail;
+
+	struct data_msg_slot *m = find_msg_slot(audio, msg->msg_id, msg->msg_len);
 	if (msg->msg_len != m->len ||
 	    msg->offset + msg->data.len > m->len)
 		goto fail;
 
 	memcpy(m->buf + msg->offset, msg->data.data, msg->data.len);
-	if (insert_frag(m, msg->offset, msg->offset + msg->data.len)) {
+	m->received += mark_frag(m->frags, msg->offset, msg->offset + msg->data.len);
+	if (m->received == m->len) {
 		struct xrp_header *hdr = (void *)m->buf;
 		if (m->len > sizeof(*hdr) && ntohs(hdr->len) == m->len &&
 		    ntohs(hdr->type) == XRP_STREAM_MESSAGE) {
 			audio_receive_stream_msg(audio, m->buf + sizeof(*hdr), m->len - sizeof(*hdr));
 			audio->data_next_logical_msg = m->msg_id + 1;
 		}
-		/* Now kill *all* pending messagse up to and including this one */
-		while (audio->data_messages) {
-			struct message_buf *m = audio->data_messages->data;
-
-			if (m->msg_id >= audio->data_next_logical_msg)
-				break;
-
-			audio->data_messages = g_slist_remove(audio->data_messages, m);
-			free_msgbuf(m);
+		m->used = FALSE;
+
+		/* Now kill *all* pending messages up to and including this one */
+		int i;
+		for (i = 0; i < DATA_MSG_WINDOW; i++) {
+			if (audio->data_slots[i].used &&
+			    audio->data_slots[i].msg_id < audio->data_next_logical_msg)
+				audio->data_slots[i].used = FALSE;
 		}
 	}
  drop:
 	ret = TRUE;
  fail:
-	data_message__free_unpacked(msg, NULL);
+	data_message__free_unpacked(msg, &audio->rx_arena.alloc);
 	return ret;
 }
 
-gboolean audio_receive_packet(ChimeCallAudio *audio, gconstpointer pkt, gsize len)
+/* Protobuf allocations for incoming messages come from the arena, and are
+ * all released at once when the next packet arrives. Only messages too big
+ * for it need the heap. */
+static void *arena_alloc(void *_arena, size_t size)
 {
-	if (len < sizeof(struct xrp_header))
-		return FALSE;
+	struct chime_pb_arena *arena = _arena;
+
+	size = (size + 7) & ~(size_t)7;
+	if (size <= sizeof(arena->buf) - arena->used) {
+		void *p = (guint8 *)arena->buf + arena->used;
+		arena->used += size;
+		return p;
+	}
+	return g_malloc(size);
+}
+
+static void arena_free(void *_arena, void *p)
+{
+	struct chime_pb_arena *arena = _arena;
+
+	if ((guint8 *)p < (guint8 *)arena->buf ||
+	    (guint8 *)p >= (guint8 *)arena->buf + sizeof(arena->buf))
+		g_free(p);
+}
+
+static void init_arena(struct chime_pb_arena *arena)
+{
+	arena->alloc.alloc = arena_alloc;
+	arena->alloc.free = arena_free;
+	arena->alloc.allocator_data = arena;
+	arena->used = 0;
+}
+
+/* What the media thread passes back to the main loop */
+struct media_pkt {
+	gboolean control_only; /* RTMessage whose audio was already handled */
+	gsize len;
+	guint8 data[];
+};
+
+static gboolean audio_receive_payload(ChimeCallAudio *audio, guint16 type,
+				      gconstpointer pkt, gsize len);
+
+/* In the main loop: handle what the media thread received */
+static gboolean media_rx_cb(gpointer _audio)
+{
+	ChimeCallAudio *audio = _audio;
+	GQueue q;
+
+	g_mutex_lock(&audio->media_rx_lock);
+	q = audio->media_rx;
+	g_queue_init(&audio->media_rx);
+	audio->media_rx_source = 0;
+	g_mutex_unlock(&audio->media_rx_lock);
+
+	struct media_pkt *mp;
+	while ((mp = g_queue_pop_head(&q))) {
+		const struct xrp_header *hdr = (void *)mp->data;
+
+		audio->rx_arena.used = 0;
+		if (!mp->control_only) {
+			audio_receive_payload(audio, ntohs(hdr->type), hdr + 1, mp->len - sizeof(*hdr));
+		} else {
+			RTMessage *msg = rtmessage__unpack(&audio->rx_arena.alloc,
+							   mp->len - sizeof(*hdr), hdr + 1);
+			if (msg) {
+				rt_msg_control(audio, msg);
+				rtmessage__free_unpacked(msg, &audio->rx_arena.alloc);
+			}
+		}
+		g_free(mp);
+	}
+	return G_SOURCE_REMOVE;
+}
+
+static void queue_media_pkt(ChimeCallAudio *audio, gboolean control_only,
+			    gconstpointer pkt, gsize len)
+{
+	struct media_pkt *mp = g_malloc(sizeof(*mp) + len);
+
+	mp->control_only = control_only;
+	mp->len = len;
+	memcpy(mp->data, pkt, len);
+
+	g_mutex_lock(&audio->media_rx_lock);
+	g_queue_push_tail(&audio->media_rx, mp);
+	if (!audio->media_rx_source)
+		audio->media_rx_source = g_idle_add_full(G_PRIORITY_HIGH, media_rx_cb, audio, NULL);
+	g_mutex_unlock(&audio->media_rx_lock);
+}
+
+/* Anything the media thread received which is still waiting for us */
+static void discard_media_rx(ChimeCallAudio *audio)
+{
+	struct media_pkt *mp;
+
+	g_mutex_lock(&audio->media_rx_lock);
+	if (audio->media_rx_source) {
+		g_source_remove(audio->media_rx_source);
+		audio->media_rx_source = 0;
+	}
+	while ((mp = g_queue_pop_head(&audio->media_rx)))
+		g_free(mp);
+	g_mutex_unlock(&audio->media_rx_lock);
+}
+
+/* The stats are read from the main loop and last_rx from whichever thread
+ * sends, while the packet may come in on the media thread. Returns
+ * whether it has a plausible header. */
+static gboolean count_rx_packet(ChimeCallAudio *audio, gconstpointer pkt, gsize len)
+{
+	const struct xrp_header *hdr = pkt;
+	gboolean valid = len >= sizeof(*hdr) && len == ntohs(hdr->len);
+
+	g_mutex_lock(&audio->transport_lock);
+	audio->stats.rx_packets++;
+	audio->stats.rx_bytes += len;
+	if (valid)
+		audio->last_rx = g_get_monotonic_time();
+	g_mutex_unlock(&audio->transport_lock);
+
+	return valid;
+}
+
+/* In the media thread. The audio goes straight to GStreamer from here;
+ * anything else goes back to the main loop. */
+void audio_receive_media_packet(ChimeCallAudio *audio, gconstpointer pkt, gsize len)
+{
+	if (!count_rx_packet(audio, pkt, len))
+		return;
 
 	const struct xrp_header *hdr = pkt;
-	if (len != ntohs(hdr->len))
+	if (ntohs(hdr->type) != XRP_RT_MESSAGE) {
+		queue_media_pkt(audio, FALSE, pkt, len);
+		return;
+	}
+
+	audio->media_arena.used = 0;
+	RTMessage *msg = rtmessage__unpack(&audio->media_arena.alloc,
+					   len - sizeof(*hdr), hdr + 1);
+	if (!msg)
+		return;
+
+	rt_msg_audio(audio, msg);
+	if (rt_msg_has_control(msg))
+		queue_media_pkt(audio, TRUE, pkt, len);
+
+	rtmessage__free_unpacked(msg, &audio->media_arena.alloc);
+}
+
+gboolean audio_receive_packet(ChimeCallAudio *audio, gconstpointer pkt, gsize len)
+{
+	audio->rx_arena.used = 0;
+
+	if (!count_rx_packet(audio, pkt, len))
 		return FALSE;
 
-	audio->last_rx = g_get_monotonic_time();
+	const struct xrp_header *hdr = pkt;
 
 	/* Point to the payload, without (void *) arithmetic */
-	pkt = hdr + 1;
-	len -= 4;
+	return audio_receive_payload(audio, ntohs(hdr->type), hdr + 1, len - sizeof(*hdr));
+}
 
-	switch (ntohs(hdr->type)) {
+static gboolean audio_receive_payload(ChimeCallAudio *audio, guint16 type,
+				      gconstpointer pkt, gsize len)
+{
+	switch (type) {
 	case XRP_RT_MESSAGE:
 		return audio_receive_rt_msg(audio, pkt, len);
 	case XRP_AUTH_MESSAGE:
@@ -506,6 +809,14 @@ gboolean audio_receive_packet(ChimeCallAudio *audio, gconstpointer pkt, gsize le
 static GstAppSinkCallbacks no_appsink_callbacks;
 static GstAppSrcCallbacks no_appsrc_callbacks;
 
+static void discard_tx_ring(ChimeCallAudio *audio)
+{
+	while (audio->tx_tail != audio->tx_head) {
+		gst_sample_unref(audio->tx_ring[audio->tx_tail]);
+		audio->tx_tail = (audio->tx_tail + 1) & (CHIME_AUDIO_TX_RING - 1);
+	}
+}
+
 void chime_call_audio_close(ChimeCallAudio *audio, gboolean hangup)
 {
 	g_signal_handlers_disconnect_matched(G_OBJECT(audio->call), G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, audio);
@@ -518,12 +829,32 @@ void chime_call_audio_close(ChimeCallAudio *audio, gboolean hangup)
 		gst_app_sink_set_callbacks(audio->audio_sink, &no_appsink_callbacks, NULL, NULL);
 
 	chime_call_transport_disconnect(audio, hangup);
+	chime_call_transport_release(audio);
 	chime_call_audio_set_state(audio, CHIME_AUDIO_STATE_HANGUP, NULL);
 
+	if (audio->media_thread) {
+		g_main_loop_quit(audio->media_loop);
+		g_thread_join(audio->media_thread);
+		g_main_loop_unref(audio->media_loop);
+		g_main_context_unref(audio->media_ctx);
+	}
+	if (audio->tx_source) {
+		g_source_destroy(audio->tx_source);
+		g_source_unref(audio->tx_source);
+		discard_tx_ring(audio);
+	}
+	discard_media_rx(audio);
+	g_mutex_clear(&audio->media_rx_lock);
+
+	free_msg_slots(audio);
 	g_hash_table_destroy(audio->profiles);
 	g_free(audio);
 }
 
+/* In the streaming thread. Without a media thread the sample is sent
+ * from here, since the main loop may be busy. Otherwise it's passed to
+ * tx_source, and if that has fallen this far behind, the sample is
+ * dropped and do_send_rt_packet() will see the gap. */
 static GstFlowReturn chime_appsink_new_sample(GstAppSink* self, gpointer data)
 {
 	ChimeCallAudio *audio = (ChimeCallAudio*)data;
@@ -532,16 +863,48 @@ static GstFlowReturn chime_appsink_new_sample(GstAppSink* self, gpointer data)
 	if (!sample)
 		return GST_FLOW_OK;
 
-	if (audio->state == CHIME_AUDIO_STATE_AUDIO) {
-		GstBuffer *buffer = gst_sample_get_buffer(sample);
+	if (!audio->tx_source) {
+		if (audio->state == CHIME_AUDIO_STATE_AUDIO)
+			do_send_rt_packet(audio, gst_sample_get_buffer(sample));
+		gst_sample_unref(sample);
+		return GST_FLOW_OK;
+	}
 
-		do_send_rt_packet(audio, buffer);
+	gint head = audio->tx_head;
+	gint next = (head + 1) & (CHIME_AUDIO_TX_RING - 1);
+	if (next == g_atomic_int_get(&audio->tx_tail)) {
+		gst_sample_unref(sample);
+		return GST_FLOW_OK;
 	}
-	gst_sample_unref(sample);
+	audio->tx_ring[head] = sample;
+	g_atomic_int_set(&audio->tx_head, next);
+	g_source_set_ready_time(audio->tx_source, 0);
 
 	return GST_FLOW_OK;
 }
 
+/* On the media thread, with the RT timer, so they don't contend either */
+static gboolean audio_tx_cb(gpointer _audio)
+{
+	ChimeCallAudio *audio = _audio;
+	gint tail = audio->tx_tail;
+
+	/* Before looking, so that anything added after is another wakeup */
+	g_source_set_ready_time(g_main_current_source(), -1);
+
+	while (tail != g_atomic_int_get(&audio->tx_head)) {
+		GstSample *sample = audio->tx_ring[tail];
+
+		if (audio->state == CHIME_AUDIO_STATE_AUDIO)
+			do_send_rt_packet(audio, gst_sample_get_buffer(sample));
+		gst_sample_unref(sample);
+
+		tail = (tail + 1) & (CHIME_AUDIO_TX_RING - 1);
+		g_atomic_int_set(&audio->tx_tail, tail);
+	}
+	return G_SOURCE_CONTINUE;
+}
+
 static GstAppSinkCallbacks chime_appsink_callbacks = {
 	.new_sample = chime_appsink_new_sample,
 };
@@ -549,13 +912,13 @@ static GstAppSinkCallbacks chime_appsink_callbacks = {
 static void chime_appsrc_need_data(GstAppSrc *src, guint length, gpointer _audio)
 {
 	ChimeCallAudio *audio = _audio;
-	audio->appsrc_need_data = TRUE;
+	g_atomic_int_set(&audio->appsrc_need_data, TRUE);
 }
 
 static void chime_appsrc_enough_data(GstAppSrc *src, gpointer _audio)
 {
 	ChimeCallAudio *audio = _audio;
-	audio->appsrc_need_data = FALSE;
+	g_atomic_int_set(&audio->appsrc_need_data, FALSE);
 }
 
 static void chime_appsrc_destroy(gpointer _audio)
@@ -582,20 +945,48 @@ void chime_call_audio_install_gst_app_callbacks(ChimeCallAudio *audio, GstAppSrc
 	audio->audio_sink = appsink;
 	audio->audio_src = appsrc;
 
-	audio->appsrc_need_data = TRUE;
+	g_atomic_int_set(&audio->appsrc_need_data, TRUE);
 
 	gst_app_src_set_callbacks(appsrc, &chime_appsrc_callbacks, audio, chime_appsrc_destroy);
 	gst_app_sink_set_callbacks(appsink, &chime_appsink_callbacks, audio, chime_appsink_destroy);
 }
 
-ChimeCallAudio *chime_call_audio_open(ChimeConnection *cxn, ChimeCall *call, gboolean silent)
+static gpointer media_thread_fn(gpointer _audio)
+{
+	ChimeCallAudio *audio = _audio;
+
+	g_main_context_push_thread_default(audio->media_ctx);
+	g_main_loop_run(audio->media_loop);
+	g_main_context_pop_thread_default(audio->media_ctx);
+	return NULL;
+}
+
+static ChimeCallAudio *audio_new(ChimeCall *call)
 {
 	ChimeCallAudio *audio = g_new0(ChimeCallAudio, 1);
 
 	audio->call = call;
+	audio->debug = !!getenv("CHIME_AUDIO_DEBUG");
+	audio->warm_ws = !!getenv("CHIME_AUDIO_WS_STANDBY");
+	init_arena(&audio->rx_arena);
+	init_arena(&audio->media_arena);
+	g_mutex_init(&audio->media_rx_lock);
+	g_queue_init(&audio->media_rx);
+	if (getenv("CHIME_AUDIO_THREAD")) {
+		audio->media_ctx = g_main_context_new();
+		audio->media_loop = g_main_loop_new(audio->media_ctx, FALSE);
+		audio->media_thread = g_thread_new("chime-audio", media_thread_fn, audio);
+
+		audio->tx_source = g_source_new(&ready_time_funcs, sizeof(GSource));
+		g_source_set_priority(audio->tx_source, G_PRIORITY_HIGH);
+		g_source_set_callback(audio->tx_source, audio_tx_cb, audio, NULL);
+		g_source_attach(audio->tx_source, audio->media_ctx);
+	}
 	audio->profiles = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
 	g_mutex_init(&audio->transport_lock);
 	g_mutex_init(&audio->rt_lock);
+	audio->quality.rtt_us = audio->quality.srtt_us = audio->quality.jitter_us = -1;
+	audio->quality.tx_jitter_us = audio->quality.tx_cost_us = -1;
 
 	audio->session_id = ((guint64)g_random_int() << 32) | g_random_int();
 
@@ -608,6 +999,13 @@ ChimeCallAudio *chime_call_audio_open(ChimeConnection *cxn, ChimeCall *call, gbo
 	audio->audio_msg.has_sample_time = 1;
 	audio->audio_msg.sample_time = g_random_int();
 
+	return audio;
+}
+
+ChimeCallAudio *chime_call_audio_open(ChimeConnection *cxn, ChimeCall *call, gboolean silent)
+{
+	ChimeCallAudio *audio = audio_new(call);
+
 	chime_call_transport_connect(audio, silent);
 
 	return audio;
@@ -636,14 +1034,10 @@ void chime_call_audio_local_mute(ChimeCallAudio *audio, gboolean muted)
 	if (muted) {
 		if (audio->state == CHIME_AUDIO_STATE_AUDIO)
 			chime_call_audio_set_state(audio, CHIME_AUDIO_STATE_AUDIO_MUTED, NULL);
-		if (!audio->send_rt_source)
-			audio->send_rt_source = g_timeout_add(100, (GSourceFunc)timed_send_rt_packet, audio);
+		start_rt_timer(audio);
 	} else {
 		if (audio->state == CHIME_AUDIO_STATE_AUDIO_MUTED)
 			chime_call_audio_set_state(audio, CHIME_AUDIO_STATE_AUDIO, NULL);
-		if (audio->send_rt_source) {
-			g_source_remove(audio->send_rt_source);
-			audio->send_rt_source = 0;
-		}
+		chime_call_audio_stop_rt_timer(audio);
 	}
 }
@@ -33,6 +33,38 @@
 
 #define NS_PER_SAMPLE (1000000000 / 16000)
 
+/* Outgoing packets are built in a buffer of this size, when they fit */
+#define CHIME_AUDIO_SEND_BUF 1500
+/* Incoming messages are unpacked into an arena of this size, when they fit */
+#define CHIME_AUDIO_ARENA_SIZE 16384
+/* Incoming DTLS datagrams are read this many at a time */
+#define CHIME_DTLS_RX_BATCH 16
+#define CHIME_DTLS_RX_SLOT 2048
+/* Mic samples waiting to be sent; must be a power of two */
+#define CHIME_AUDIO_TX_RING 16
+
+/* Protobuf allocations come from here, and are all released at once */
+struct chime_pb_arena {
+	ProtobufCAllocator alloc;
+	gsize used;
+	guint64 buf[CHIME_AUDIO_ARENA_SIZE / sizeof(guint64)];
+};
+
+/* DataMessages being reassembled, in slots indexed by msg_id. Anything
+ * older than the window is given up on when a newer message arrives. */
+#define DATA_MSG_WINDOW 16
+#define DATA_MSG_MAX_LEN 65536
+
+struct data_msg_slot {
+	gboolean used;
+	gint32 msg_id;
+	gint32 len;
+	gint32 received;	/* Bytes of len which have arrived */
+	gsize alloc;		/* Kept for the next message in the slot */
+	guint8 *buf;
+	guint64 *frags;		/* Bitmap of which bytes have arrived */
+};
+
 struct _ChimeCallAudio {
 	ChimeCall *call;
 	ChimeAudioState state;
@@ -52,28 +84,77 @@ struct _ChimeCallAudio {
 	gnutls_session_t dtls_sess;
 	gchar *dtls_hostname;
 	gnutls_certificate_credentials_t dtls_cred;
+	gnutls_datum_t dtls_resume;	/* Kept over reconnects, to resume the session */
+	/* With CHIME_AUDIO_WS_STANDBY, a websocket is kept connected but not
+	 * authenticated while we use DTLS, so we needn't wait to fall back */
+	gboolean warm_ws;
+	SoupWebsocketConnection *standby_ws;
+	GCancellable *standby_cancel;
+	gboolean standby_promote;	/* Use it as soon as it connects */
+	/* Datagrams received by the last batch which gnutls has yet to pull */
+	guint8 *dtls_rx;
+	gsize dtls_rx_len[CHIME_DTLS_RX_BATCH];
+	guint dtls_rx_next, dtls_rx_count;
 	GCancellable *cancel;
+	gboolean debug;		/* CHIME_AUDIO_DEBUG, read when opened */
+
+	/* Used under transport_lock */
+	guint64 send_buf[CHIME_AUDIO_SEND_BUF / sizeof(guint64)];
+
+	/* Reset for each incoming packet, so nothing is freed individually */
+	struct chime_pb_arena rx_arena;
+
+	/* With CHIME_AUDIO_THREAD set, DTLS packets are received and the
+	 * paced RT packets sent from a thread of our own, so that a busy
+	 * main loop doesn't delay them. Anything else it receives is passed
+	 * back to the main loop through media_rx. */
+	GMainContext *media_ctx;
+	GMainLoop *media_loop;
+	GThread *media_thread;
+	struct chime_pb_arena media_arena;
+	GMutex media_rx_lock;
+	GQueue media_rx;
+	guint media_rx_source;
 
 	guint data_ack_source;
 	guint32 data_next_seq;
 	guint64 data_ack_mask;
 	gint32 data_next_logical_msg;
-	GSList *data_messages;
+	struct data_msg_slot data_slots[DATA_MSG_WINDOW];
 	GHashTable *profiles;
 
 	GstClockTime next_dts;
 	gint64 last_send_local_time;
 	GstAppSrc *audio_src;
 	GstAppSink *audio_sink;
-	gboolean appsrc_need_data;
+	gint appsrc_need_data;	/* Atomic, set from the streaming thread */
+
+	/* With a media thread, samples from the appsink are passed to its
+	 * tx_source without a lock, so the streaming thread never waits for
+	 * it. Only the appsink adds at tx_head, and only tx_source takes from
+	 * tx_tail. Without one, the appsink sends them itself. */
+	GstSample *tx_ring[CHIME_AUDIO_TX_RING];
+	gint tx_head, tx_tail;
+	GSource *tx_source;
 
 	GMutex rt_lock;
-	guint send_rt_source;
+	GSource *send_rt_timer;
+	gint64 send_rt_next;	/* Monotonic time the next is due */
 	gint64 last_server_time_offset;
 	gboolean echo_server_time;
+	/* Not reset when reconnecting, unlike the rx_seq etc. below */
+	ChimeCallAudioStats quality;
+	gboolean rx_seq_valid;
+	guint16 rx_seq_max;
+	guint32 rx_session_lost;	/* Sent back as total_frames_lost */
+	gint64 rx_last_arrival;
+	guint32 rx_last_ts;
+	gint64 rx_jitter16;	/* In samples, scaled by 16 as in RFC3550 */
 	RTMessage rt_msg;
 	AudioMessage audio_msg;
 	ClientStatusMessage client_status_msg;
+
+	ChimeMediaStats stats;
 };
 
 struct xrp_header {
@@ -99,10 +180,14 @@ void chime_call_audio_local_mute(ChimeCallAudio *audio, gboolean muted);
 /* Called from audio code */
 void chime_call_transport_connect(ChimeCallAudio *audio, gboolean silent);
 void chime_call_transport_disconnect(ChimeCallAudio *audio, gboolean hangup);
+void chime_call_transport_reconnect(ChimeCallAudio *audio);
+void chime_call_transport_release(ChimeCallAudio *audio);
 void chime_call_transport_send_packet(ChimeCallAudio *audio, enum xrp_pkt_type type, const ProtobufCMessage *message);
 
 /* Callbacks into audio code from transport */
 gboolean audio_receive_packet(ChimeCallAudio *audio, gconstpointer pkt, gsize len);
+void audio_receive_media_packet(ChimeCallAudio *audio, gconstpointer pkt, gsize len);
+void chime_call_audio_stop_rt_timer(ChimeCallAudio *audio);
 
 void chime_call_audio_install_gst_app_callbacks(ChimeCallAudio *audio, GstAppSrc *appsrc, GstAppSink *appsink);
 void chime_call_audio_cleanup_datamsgs(ChimeCallAudio *audio);
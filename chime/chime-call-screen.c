@@ -22,7 +22,6 @@
 #include <string.h>
 #include <ctype.h>
 
-#include <gst/rtp/gstrtpbuffer.h>
 #include <gst/video/video.h>
 
 static GstAppSrcCallbacks no_appsrc_callbacks;
@@ -86,33 +85,114 @@ static void hexdump(const void *buf, int len)
 	printf("\n");
 }
 
+/* When this much is waiting to go out, delta frames are dropped until the
+ * next key frame; beyond the maximum, key frames too. So viewers are never
+ * much more than SCREEN_TX_MAX_BUFFERED behind. */
+#define SCREEN_TX_HIGH_WATER	(256 * 1024)
+#define SCREEN_TX_MAX_BUFFERED	(1024 * 1024)
+/* Each time that happens, the encoder's bitrate is halved, and it is
+ * raised again gradually once the queue has stayed short for a while */
+#define SCREEN_TX_MIN_BITRATE	64000
+#define SCREEN_TX_RECOVER_US	(5 * G_USEC_PER_SEC)
+
+static void request_key_frame(ChimeCallScreen *screen)
+{
+	GstEvent *ev = gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, FALSE, 0);
+	GstPad *pad = gst_element_get_static_pad(GST_ELEMENT(screen->screen_sink), "sink");
+	GstPad *peer = gst_pad_get_peer(pad);
+
+	if (peer) {
+		gst_pad_send_event(peer, ev);
+		gst_object_unref(peer);
+	} else
+		gst_event_unref(ev);
+	gst_object_unref(pad);
+}
+
+/* The encoder is whatever feeds the appsink, if it has a bitrate */
+static void scale_tx_bitrate(ChimeCallScreen *screen, gint num, gint den)
+{
+	GstPad *pad = gst_element_get_static_pad(GST_ELEMENT(screen->screen_sink), "sink");
+	GstPad *peer = gst_pad_get_peer(pad);
+	GstElement *enc = peer ? gst_pad_get_parent_element(peer) : NULL;
+
+	if (enc && g_object_class_find_property(G_OBJECT_GET_CLASS(enc), "target-bitrate")) {
+		if (!screen->tx_max_bitrate) {
+			g_object_get(enc, "target-bitrate", &screen->tx_max_bitrate, NULL);
+			screen->tx_bitrate = screen->tx_max_bitrate;
+		}
+		gint rate = (gint64)screen->tx_bitrate * num / den;
+		rate = CLAMP(rate, SCREEN_TX_MIN_BITRATE, MAX(screen->tx_max_bitrate, SCREEN_TX_MIN_BITRATE));
+		if (rate != screen->tx_bitrate) {
+			chime_debug("Screen bitrate %d -> %d\n", screen->tx_bitrate, rate);
+			g_object_set(enc, "target-bitrate", rate, NULL);
+			screen->tx_bitrate = rate;
+		}
+	}
+	if (enc)
+		gst_object_unref(enc);
+	if (peer)
+		gst_object_unref(peer);
+	gst_object_unref(pad);
+}
+
+/* Returns TRUE if the frame should be sent */
+static gboolean screen_tx_backpressure(ChimeCallScreen *screen, GstBuffer *buffer, gsize queued)
+{
+	gboolean key = !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+	gint64 now = g_get_monotonic_time();
+
+	if (queued >= SCREEN_TX_MAX_BUFFERED || (!key && queued >= SCREEN_TX_HIGH_WATER)) {
+		if (!screen->tx_dropping) {
+			chime_debug("Screen send congested, %zu bytes queued\n", queued);
+			screen->tx_dropping = TRUE;
+			screen->tx_key_requested = FALSE;
+			screen->tx_last_congested = now;
+			scale_tx_bitrate(screen, 1, 2);
+		}
+	} else if (key && screen->tx_dropping) {
+		chime_debug("Screen send resumed after dropping %" G_GUINT64_FORMAT " frames\n",
+			    screen->tx_frames_dropped);
+		screen->tx_dropping = FALSE;
+		screen->tx_frames_dropped = 0;
+	}
+
+	if (screen->tx_dropping) {
+		/* Once there's room, ask for a key frame to resume from */
+		if (!screen->tx_key_requested && queued < SCREEN_TX_HIGH_WATER) {
+			request_key_frame(screen);
+			screen->tx_key_requested = TRUE;
+		}
+		screen->tx_frames_dropped++;
+		return FALSE;
+	}
+
+	if (screen->tx_bitrate < screen->tx_max_bitrate && queued < SCREEN_TX_HIGH_WATER / 4 &&
+	    now - screen->tx_last_congested > SCREEN_TX_RECOVER_US) {
+		screen->tx_last_congested = now;
+		scale_tx_bitrate(screen, 5, 4);
+	}
+	return TRUE;
+}
+
 static void screen_send_packet(ChimeCallScreen *screen, enum screen_pkt_type type, void *data, size_t dlen)
 {
 	unsigned char source = 0;
 	unsigned char dest = 0;
 	enum screen_pkt_flag flag = SCREEN_PKT_FLAG_LOCAL;
 
-	g_mutex_lock(&screen->transport_lock);
-	if (dlen) {
-		/* Ick, we need to fix websockets to take iovecs */
-		struct screen_pkt *buf = g_malloc0(sizeof(*buf) + dlen);
-		buf->type = type;
-		buf->source = source;
-		buf->dest = dest;
-		buf->flag = flag;
-		memcpy(&buf[1], data, dlen);
-
-		soup_websocket_connection_send_binary(screen->ws, buf, sizeof(*buf) + dlen);
-		g_free(buf);
-	} else {
-		struct screen_pkt pkt;
-		pkt.type = type;
-		pkt.source = source;
-		pkt.dest = dest;
-		pkt.flag = flag;
+	struct screen_pkt pkt;
+	pkt.type = type;
+	pkt.source = source;
+	pkt.dest = dest;
+	pkt.flag = flag;
 
-		soup_websocket_connection_send_binary(screen->ws, &pkt, sizeof(pkt));
-	}
+	GOutputVector vectors[2] = { { &pkt, sizeof(pkt) }, { data, dlen } };
+
+	g_mutex_lock(&screen->transport_lock);
+	chime_websocket_send_binaryv(screen->ws, vectors, dlen ? 2 : 1);
+	screen->stats.tx_bytes += sizeof(pkt) + dlen;
+	screen->stats.tx_packets++;
 	g_mutex_unlock(&screen->transport_lock);
 }
 
@@ -145,6 +225,9 @@ static void on_screenws_message(SoupWebsocketConnection *ws, gint type,
 	gsize s;
 	gconstpointer d = g_bytes_get_data(message, &s);
 
+	screen->stats.rx_packets++;
+	screen->stats.rx_bytes += s;
+
 	if (getenv("CHIME_SCREEN_DEBUG")) {
 		printf("incoming:\n");
 		hexdump(d, s);
@@ -167,10 +250,7 @@ static void on_screenws_message(SoupWebsocketConnection *ws, gint type,
 	case SCREEN_PKT_TYPE_KEY_REQUEST:
 		if (screen->screen_sink) {
 			screen->viewer_present = 1;
-			GstEvent *ev = gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, FALSE, 0);
-			GstPad *pad = gst_element_get_static_pad(GST_ELEMENT(screen->screen_sink), "sink");
-			GstPad *peer = gst_pad_get_peer(pad);
-			gst_pad_send_event(peer, ev);
+			request_key_frame(screen);
 		}
 		break;
 
@@ -186,8 +266,12 @@ static void on_screenws_message(SoupWebsocketConnection *ws, gint type,
 
 	case SCREEN_PKT_TYPE_CAPTURE:
 		if (screen->screen_src) {
-			GstBuffer *buffer = gst_rtp_buffer_new_allocate(s - 4, 0, 0);
-			gst_buffer_fill(buffer, 0, &pkt[1], s - sizeof(*pkt));
+			/* The buffer keeps the message, rather than a copy of it */
+			GstBuffer *buffer = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY,
+									(gpointer)d, s, sizeof(*pkt),
+									s - sizeof(*pkt),
+									g_bytes_ref(message),
+									(GDestroyNotify)g_bytes_unref);
 			gst_app_src_push_buffer(GST_APP_SRC(screen->screen_src), buffer);
 		}
 		break;
@@ -389,21 +473,35 @@ static GstFlowReturn screen_appsink_new_sample(GstAppSink* self, gpointer data)
 	if (screen->state == CHIME_SCREEN_STATE_SENDING && screen->viewer_present) {
 		GstBuffer *buffer = gst_sample_get_buffer(sample);
 		gsize len = gst_buffer_get_size(buffer);
+		guint i, n_mem = gst_buffer_n_memory(buffer);
+		struct screen_pkt pkt;
+		pkt.type = SCREEN_PKT_TYPE_CAPTURE;
+		pkt.source = 0;
+		pkt.dest = 0;
+		pkt.flag = SCREEN_PKT_FLAG_BROADCAST;
+
+		/* The frame is built straight from the buffer's memories */
+		GstMapInfo *maps = g_newa(GstMapInfo, n_mem);
+		GOutputVector *vectors = g_newa(GOutputVector, n_mem + 1);
+		vectors[0].buffer = &pkt;
+		vectors[0].size = sizeof(pkt);
+		for (i = 0; i < n_mem; i++) {
+			if (!gst_memory_map(gst_buffer_peek_memory(buffer, i), &maps[i], GST_MAP_READ))
+				break;
+			vectors[i + 1].buffer = maps[i].data;
+			vectors[i + 1].size = maps[i].size;
+		}
 
-		/* Ick, we need to fix websockets to take iovecs */
-		struct screen_pkt *buf = g_malloc0(sizeof(*buf) + len);
-		buf->type = SCREEN_PKT_TYPE_CAPTURE;
-		buf->source = 0;
-		buf->dest = 0;
-		buf->flag = SCREEN_PKT_FLAG_BROADCAST;
-		gst_buffer_extract(buffer, 0, &buf[1], len);
 		g_mutex_lock(&screen->transport_lock);
-		if (screen->ws && screen->state == CHIME_SCREEN_STATE_SENDING) {
+		if (i == n_mem && screen->ws && screen->state == CHIME_SCREEN_STATE_SENDING &&
+		    screen_tx_backpressure(screen, buffer, chime_websocket_get_buffered_amount(screen->ws))) {
 			chime_debug("Screen send %zu bytes dts %ld\n", len, GST_BUFFER_DTS(buffer));
-			soup_websocket_connection_send_binary(screen->ws, buf, sizeof(*buf) + len);
+			chime_websocket_send_binaryv(screen->ws, vectors, n_mem + 1);
 		}
 		g_mutex_unlock(&screen->transport_lock);
-		g_free(buf);
+
+		while (i--)
+			gst_memory_unmap(gst_buffer_peek_memory(buffer, i), &maps[i]);
 	}
 	gst_sample_unref(sample);
 
@@ -440,6 +538,10 @@ void chime_call_screen_install_appsink(ChimeCallScreen *screen, GstAppSink *apps
 		screen->screen_src = NULL;
 	}
 
+	screen->tx_dropping = FALSE;
+	screen->tx_frames_dropped = 0;
+	screen->tx_bitrate = screen->tx_max_bitrate = 0;
+
 	if (screen->ws) {
 		screen->viewer_present = 0;
 		screen_send_packet(screen, SCREEN_PKT_TYPE_PRESENTER_BEGIN, NULL, 0);
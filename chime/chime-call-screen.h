@@ -36,6 +36,15 @@ struct _ChimeCallScreen {
 	GstAppSink *screen_sink;
 
 	SoupWebsocketConnection *ws;
+
+	/* Backpressure on what we send, all in the streaming thread */
+	gboolean tx_dropping;		/* Until the next key frame */
+	gboolean tx_key_requested;
+	gint tx_bitrate, tx_max_bitrate;
+	gint64 tx_last_congested;
+	guint64 tx_frames_dropped;
+
+	ChimeMediaStats stats;
 };
 
 /* Called from ChimeMeeting */
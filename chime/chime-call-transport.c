@@ -61,15 +61,16 @@ static void on_audiows_closed(SoupWebsocketConnection *ws, gpointer _audio)
 static void on_audiows_message(SoupWebsocketConnection *ws, gint type,
 			       GBytes *message, gpointer _audio)
 {
+	ChimeCallAudio *audio = _audio;
 	gsize s;
 	gconstpointer d = g_bytes_get_data(message, &s);
 
-	if (getenv("CHIME_AUDIO_DEBUG")) {
+	if (audio->debug) {
 		printf("incoming:\n");
 		hexdump(d, s);
 	}
 
-	audio_receive_packet(_audio, d, s);
+	audio_receive_packet(audio, d, s);
 }
 
 static void audio_send_auth_packet(ChimeCallAudio *audio)
@@ -151,6 +152,15 @@ static void audio_send_hangup_packet(ChimeCallAudio *audio)
 	chime_call_transport_send_packet(audio, XRP_AUTH_MESSAGE, &msg.base);
 }
 
+static void use_audio_ws(ChimeCallAudio *audio, SoupWebsocketConnection *ws)
+{
+	g_signal_connect(G_OBJECT(ws), "closed", G_CALLBACK(on_audiows_closed), audio);
+	g_signal_connect(G_OBJECT(ws), "message", G_CALLBACK(on_audiows_message), audio);
+	audio->ws = ws;
+
+	audio_send_auth_packet(audio);
+}
+
 static void audio_ws_connect_cb(GObject *obj, GAsyncResult *res, gpointer _audio)
 {
 	ChimeCallAudio *audio = _audio;
@@ -168,16 +178,11 @@ static void audio_ws_connect_cb(GObject *obj, GAsyncResult *res, gpointer _audio
 		return;
 	}
 	chime_debug("audio ws connected!\n");
-	g_signal_connect(G_OBJECT(ws), "closed", G_CALLBACK(on_audiows_closed), audio);
-	g_signal_connect(G_OBJECT(ws), "message", G_CALLBACK(on_audiows_message), audio);
-	audio->ws = ws;
-
-	audio_send_auth_packet(audio);
+	use_audio_ws(audio, ws);
 	g_object_unref(cxn);
 }
 
-
-static void chime_call_transport_connect_ws(ChimeCallAudio *audio)
+static void start_audio_ws(ChimeCallAudio *audio, GCancellable *cancel, GAsyncReadyCallback cb)
 {
 	SoupURI *uri = soup_uri_new_printf(chime_call_get_audio_ws_url(audio->call), "/audio");
 	SoupMessage *msg = soup_message_new_from_uri("GET", uri);
@@ -188,10 +193,82 @@ static void chime_call_transport_connect_ws(ChimeCallAudio *audio)
 
 	ChimeConnection *cxn = chime_call_get_connection(audio->call);
 	chime_connection_websocket_connect_async(g_object_ref(cxn), msg, origin, protocols,
-						 audio->cancel, audio_ws_connect_cb, audio);
+						 cancel, cb, audio);
 	g_free(origin);
 }
 
+static void promote_standby_ws(ChimeCallAudio *audio)
+{
+	SoupWebsocketConnection *ws = audio->standby_ws;
+
+	chime_debug("Switching to standby audio ws\n");
+	audio->standby_ws = NULL;
+	audio->standby_promote = FALSE;
+	g_signal_handlers_disconnect_matched(G_OBJECT(ws), G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, audio);
+	use_audio_ws(audio, ws);
+}
+
+static void on_standby_ws_closed(SoupWebsocketConnection *ws, gpointer _audio)
+{
+	ChimeCallAudio *audio = _audio;
+
+	chime_debug("audio standby ws closed\n");
+	g_signal_handlers_disconnect_matched(G_OBJECT(ws), G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, audio);
+	audio->standby_ws = NULL;
+	g_object_unref(ws);
+}
+
+static void chime_call_transport_connect_ws(ChimeCallAudio *audio);
+
+static void standby_ws_connect_cb(GObject *obj, GAsyncResult *res, gpointer _audio)
+{
+	ChimeCallAudio *audio = _audio;
+	ChimeConnection *cxn = CHIME_CONNECTION(obj);
+	GError *error = NULL;
+	SoupWebsocketConnection *ws = chime_connection_websocket_connect_finish(cxn, res, &error);
+	if (!ws) {
+		/* If it was cancelled, 'audio' may have been freed. */
+		if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			chime_debug("audio standby ws error %s\n", error->message);
+			g_clear_object(&audio->standby_cancel);
+			/* Someone was waiting for it, so try again for them */
+			if (audio->standby_promote) {
+				audio->standby_promote = FALSE;
+				chime_call_transport_connect_ws(audio);
+			}
+		}
+		g_clear_error(&error);
+		g_object_unref(cxn);
+		return;
+	}
+	chime_debug("audio standby ws connected\n");
+	g_clear_object(&audio->standby_cancel);
+	g_signal_connect(G_OBJECT(ws), "closed", G_CALLBACK(on_standby_ws_closed), audio);
+	audio->standby_ws = ws;
+	if (audio->standby_promote)
+		promote_standby_ws(audio);
+	g_object_unref(cxn);
+}
+
+static void start_standby_ws(ChimeCallAudio *audio)
+{
+	if (!audio->warm_ws || audio->standby_ws || audio->standby_cancel)
+		return;
+
+	audio->standby_cancel = g_cancellable_new();
+	start_audio_ws(audio, audio->standby_cancel, standby_ws_connect_cb);
+}
+
+static void chime_call_transport_connect_ws(ChimeCallAudio *audio)
+{
+	if (audio->standby_ws)
+		promote_standby_ws(audio);
+	else if (audio->standby_cancel)
+		audio->standby_promote = TRUE;
+	else
+		start_audio_ws(audio, audio->cancel, audio_ws_connect_cb);
+}
+
 static void set_gnutls_error (ChimeCallAudio *audio, GError *error)
 {
 	if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
@@ -208,6 +285,8 @@ static void set_gnutls_error (ChimeCallAudio *audio, GError *error)
 	g_error_free(error);
 }
 
+/* Read as many datagrams as are waiting (with recvmmsg() where there is
+ * one), and hand them to gnutls one per pull until they're used up. */
 static ssize_t
 g_tls_connection_gnutls_pull_func (gnutls_transport_ptr_t  transport_data,
                                    void                   *buf,
@@ -215,19 +294,39 @@ g_tls_connection_gnutls_pull_func (gnutls_transport_ptr_t  transport_data,
 {
 	ChimeCallAudio *audio = transport_data;
 	GError *error = NULL;
-	ssize_t ret;
-
-	GInputVector vector = { buf, buflen };
-	GInputMessage message = { NULL, &vector, 1, 0, 0, NULL, NULL };
+	gint ret, i;
+
+	if (audio->dtls_rx_next == audio->dtls_rx_count) {
+		GInputVector vectors[CHIME_DTLS_RX_BATCH];
+		GInputMessage messages[CHIME_DTLS_RX_BATCH];
+
+		memset(messages, 0, sizeof(messages));
+		for (i = 0; i < CHIME_DTLS_RX_BATCH; i++) {
+			vectors[i].buffer = audio->dtls_rx + i * CHIME_DTLS_RX_SLOT;
+			vectors[i].size = CHIME_DTLS_RX_SLOT;
+			messages[i].vectors = &vectors[i];
+			messages[i].num_vectors = 1;
+		}
 
-	ret = g_datagram_based_receive_messages(G_DATAGRAM_BASED(audio->dtls_sock),
-						&message, 1, 0, 0, NULL, &error);
-	if (ret > 0)
-		ret = message.bytes_received;
-	else if (ret < 0)
-		set_gnutls_error (audio, error);
+		audio->dtls_rx_next = audio->dtls_rx_count = 0;
+		ret = g_datagram_based_receive_messages(G_DATAGRAM_BASED(audio->dtls_sock),
+							messages, CHIME_DTLS_RX_BATCH,
+							0, 0, NULL, &error);
+		if (ret < 0) {
+			set_gnutls_error (audio, error);
+			return -1;
+		}
+		for (i = 0; i < ret; i++)
+			audio->dtls_rx_len[i] = messages[i].bytes_received;
+		audio->dtls_rx_count = ret;
+		if (!ret)
+			return 0;
+	}
 
-	return ret;
+	i = audio->dtls_rx_next++;
+	buflen = MIN(buflen, audio->dtls_rx_len[i]);
+	memcpy(buf, audio->dtls_rx + i * CHIME_DTLS_RX_SLOT, buflen);
+	return buflen;
 }
 
 static ssize_t
@@ -327,7 +426,8 @@ g_tls_connection_gnutls_pull_timeout_func (gnutls_transport_ptr_t transport_data
 	ChimeCallAudio *audio = transport_data;
 
 	/* Fast path. */
-	if (g_datagram_based_condition_check(G_DATAGRAM_BASED(audio->dtls_sock), G_IO_IN) ||
+	if (audio->dtls_rx_next < audio->dtls_rx_count ||
+	    g_datagram_based_condition_check(G_DATAGRAM_BASED(audio->dtls_sock), G_IO_IN) ||
 	    g_cancellable_is_cancelled (audio->cancel))
 		return 1;
 
@@ -378,6 +478,63 @@ g_tls_connection_gnutls_pull_timeout_func (gnutls_transport_ptr_t transport_data
 
 static gboolean dtls_timeout(ChimeCallAudio *audio);
 
+/* Decrypt everything the socket has for us, so that a wakeup handles a
+ * whole batch of datagrams rather than one. Anything left in dtls_rx
+ * must be used up before returning, since the socket won't wake us for
+ * it again. Runs in the media thread, if there is one, where
+ * disconnecting may free the session under transport_lock. */
+static void dtls_drain(ChimeCallAudio *audio)
+{
+	guint64 pkt[CHIME_DTLS_RX_SLOT / sizeof(guint64)];
+	gboolean threaded = !!audio->media_ctx;
+	guint count = 0;
+	ssize_t len;
+
+	for (;;) {
+		if (threaded)
+			g_mutex_lock(&audio->transport_lock);
+		if (!audio->dtls_sess ||
+		    (count >= CHIME_DTLS_RX_BATCH * 4 &&
+		     audio->dtls_rx_next == audio->dtls_rx_count)) {
+			if (threaded)
+				g_mutex_unlock(&audio->transport_lock);
+			break;
+		}
+		len = gnutls_record_recv(audio->dtls_sess, pkt, sizeof(pkt));
+		if (threaded)
+			g_mutex_unlock(&audio->transport_lock);
+
+		if (len <= 0) {
+			/* Stray or corrupt records are just dropped */
+			if (!len || len == GNUTLS_E_AGAIN || gnutls_error_is_fatal(len))
+				break;
+			continue;
+		}
+		count++;
+		if (audio->debug) {
+			printf("incoming:\n");
+			hexdump(pkt, len);
+		}
+		if (threaded)
+			audio_receive_media_packet(audio, pkt, len);
+		else
+			audio_receive_packet(audio, pkt, len);
+	}
+}
+
+/* Once the handshake is done, this takes over if there's a media thread */
+static gboolean media_dtls_cb(GDatagramBased *dgram, GIOCondition condition, ChimeCallAudio *audio)
+{
+	g_mutex_lock(&audio->transport_lock);
+	gboolean gone = g_source_is_destroyed(g_main_current_source()) || !audio->dtls_sess;
+	g_mutex_unlock(&audio->transport_lock);
+	if (gone)
+		return G_SOURCE_REMOVE;
+
+	dtls_drain(audio);
+	return G_SOURCE_CONTINUE;
+}
+
 static gboolean dtls_src_cb(GDatagramBased *dgram, GIOCondition condition, ChimeCallAudio *audio)
 {
 	if (!audio->dtls_handshaked) {
@@ -395,6 +552,10 @@ static gboolean dtls_src_cb(GDatagramBased *dgram, GIOCondition condition, Chime
 
 		if (ret) {
 			chime_debug("DTLS failed: %s\n", gnutls_strerror(ret));
+			/* Don't offer the same session again */
+			gnutls_free(audio->dtls_resume.data);
+			audio->dtls_resume.data = NULL;
+			audio->dtls_resume.size = 0;
 			gnutls_deinit(audio->dtls_sess);
 			audio->dtls_sess = NULL;
 			g_source_destroy(audio->dtls_source);
@@ -409,24 +570,29 @@ static gboolean dtls_src_cb(GDatagramBased *dgram, GIOCondition condition, Chime
 			return G_SOURCE_REMOVE;
 		}
 
-		chime_debug("DTLS established\n");
+		chime_debug("DTLS established%s\n",
+			    gnutls_session_is_resumed(audio->dtls_sess) ? " (resumed)" : "");
 		g_source_remove(audio->timeout_source);
 		audio->timeout_source = 0;
 		audio->dtls_handshaked = TRUE;
 		audio_send_auth_packet(audio);
-		/* Fall through and receive data, not that it should be there */
-	}
 
-	unsigned char pkt[CHIME_DTLS_MTU];
-	ssize_t len = gnutls_record_recv(audio->dtls_sess, pkt, sizeof(pkt));
-	if (len > 0) {
-		if (getenv("CHIME_AUDIO_DEBUG")) {
-			printf("incoming:\n");
-			hexdump(pkt, len);
+		if (audio->media_ctx) {
+			g_mutex_lock(&audio->transport_lock);
+			g_source_destroy(audio->dtls_source);
+			audio->dtls_source = g_datagram_based_create_source(G_DATAGRAM_BASED(audio->dtls_sock),
+									    G_IO_IN, audio->cancel);
+			g_source_set_priority(audio->dtls_source, G_PRIORITY_HIGH);
+			g_source_set_callback(audio->dtls_source, (GSourceFunc)media_dtls_cb, audio, NULL);
+			g_source_attach(audio->dtls_source, audio->media_ctx);
+			g_mutex_unlock(&audio->transport_lock);
+			return G_SOURCE_REMOVE;
 		}
-		audio_receive_packet(audio, pkt, len);
+		/* Fall through and receive data, not that it should be there */
 	}
 
+	dtls_drain(audio);
+
 	return G_SOURCE_CONTINUE;
 }
 
@@ -467,6 +633,9 @@ static void connect_dtls(ChimeCallAudio *audio, GSocket *s)
 
 	audio->dtls_source = g_datagram_based_create_source(G_DATAGRAM_BASED(s), G_IO_IN, audio->cancel);
 	audio->dtls_sock = s;
+	if (!audio->dtls_rx)
+		audio->dtls_rx = g_malloc(CHIME_DTLS_RX_BATCH * CHIME_DTLS_RX_SLOT);
+	audio->dtls_rx_next = audio->dtls_rx_count = 0;
 	g_source_set_callback(audio->dtls_source, (GSourceFunc)dtls_src_cb, audio, NULL);
 	g_source_attach(audio->dtls_source, NULL);
 
@@ -497,6 +666,11 @@ static void connect_dtls(ChimeCallAudio *audio, GSocket *s)
 	/* We can't rely on the length argument to gnutls_server_name_set().
 	   https://bugs.launchpad.net/ubuntu/+bug/1762710 */
 	gnutls_server_name_set(audio->dtls_sess, GNUTLS_NAME_DNS, audio->dtls_hostname, strlen(audio->dtls_hostname));
+	/* After a reconnect, this saves the certificate exchange. The server
+	 * does a full handshake anyway if it doesn't want to resume. */
+	if (audio->dtls_resume.data)
+		gnutls_session_set_data(audio->dtls_sess, audio->dtls_resume.data,
+					audio->dtls_resume.size);
 
 	gnutls_transport_set_ptr(audio->dtls_sess, audio);
 	gnutls_transport_set_push_function (audio->dtls_sess,
@@ -583,14 +757,27 @@ static void audio_dtls_one(GObject *obj, GAsyncResult *res, gpointer user_data)
 					       (GAsyncReadyCallback)audio_dtls_one, audio);
 }
 
-void chime_call_transport_connect(ChimeCallAudio *audio, gboolean silent)
+static void prepare_connect(ChimeCallAudio *audio, gboolean silent)
 {
 	audio->silent = silent;
 	audio->cancel = g_cancellable_new();
 	audio->dtls_handshaked = FALSE;
 	audio->recv_ssrc = g_random_int();
 
+	/* The server starts its sequence afresh */
+	g_mutex_lock(&audio->rt_lock);
+	audio->rx_seq_valid = FALSE;
+	audio->rx_session_lost = 0;
+	audio->rx_last_arrival = 0;
+	audio->rx_jitter16 = 0;
+	g_mutex_unlock(&audio->rt_lock);
+
 	chime_call_audio_set_state(audio, CHIME_AUDIO_STATE_CONNECTING, NULL);
+}
+
+void chime_call_transport_connect(ChimeCallAudio *audio, gboolean silent)
+{
+	prepare_connect(audio, silent);
 
 	GSocketConnectable *addr = g_network_address_parse(chime_call_get_media_host(audio->call),
 							   0, NULL);
@@ -601,10 +788,26 @@ void chime_call_transport_connect(ChimeCallAudio *audio, gboolean silent)
 	GSocketAddressEnumerator *enumerator = g_socket_connectable_enumerate(addr);
 	g_object_unref(addr);
 
+	start_standby_ws(audio);
 	g_socket_address_enumerator_next_async(enumerator, audio->cancel,
 					       (GAsyncReadyCallback)audio_dtls_one, audio);
 }
 
+/* When DTLS has stopped getting through, and there's a websocket ready (or
+ * nearly), switch to that rather than starting all over again. */
+void chime_call_transport_reconnect(ChimeCallAudio *audio)
+{
+	gboolean was_dtls = audio->dtls_sess != NULL;
+
+	chime_call_transport_disconnect(audio, TRUE);
+
+	if (was_dtls && (audio->standby_ws || audio->standby_cancel)) {
+		prepare_connect(audio, audio->silent);
+		chime_call_transport_connect_ws(audio);
+	} else
+		chime_call_transport_connect(audio, audio->silent);
+}
+
 
 static void on_final_audiows_close(SoupWebsocketConnection *ws, gpointer _unused)
 {
@@ -615,10 +818,7 @@ static void on_final_audiows_close(SoupWebsocketConnection *ws, gpointer _unused
 
 void chime_call_transport_disconnect(ChimeCallAudio *audio, gboolean hangup)
 {
-	if (audio->send_rt_source) {
-		g_source_remove(audio->send_rt_source);
-		audio->send_rt_source = 0;
-	}
+	chime_call_audio_stop_rt_timer(audio);
 
 	g_hash_table_remove_all(audio->profiles);
 
@@ -629,6 +829,7 @@ void chime_call_transport_disconnect(ChimeCallAudio *audio, gboolean hangup)
 
 	g_mutex_lock(&audio->transport_lock);
 
+	audio->standby_promote = FALSE;
 	if (audio->cancel) {
 		g_cancellable_cancel(audio->cancel);
 		g_object_unref(audio->cancel);
@@ -640,6 +841,13 @@ void chime_call_transport_disconnect(ChimeCallAudio *audio, gboolean hangup)
 		soup_websocket_connection_close(audio->ws, 0, NULL);
 		audio->ws = NULL;
 	} else if (audio->dtls_sess) {
+		if (audio->dtls_handshaked) {
+			gnutls_free(audio->dtls_resume.data);
+			if (gnutls_session_get_data2(audio->dtls_sess, &audio->dtls_resume)) {
+				audio->dtls_resume.data = NULL;
+				audio->dtls_resume.size = 0;
+			}
+		}
 		gnutls_deinit(audio->dtls_sess);
 		audio->dtls_sess = NULL;
 
@@ -649,6 +857,8 @@ void chime_call_transport_disconnect(ChimeCallAudio *audio, gboolean hangup)
 		}
 		g_clear_object(&audio->dtls_sock);
 	}
+	g_clear_pointer(&audio->dtls_rx, g_free);
+	audio->dtls_rx_next = audio->dtls_rx_count = 0;
 
 	if (audio->dtls_hostname) {
 		g_free(audio->dtls_hostname);
@@ -668,6 +878,24 @@ void chime_call_transport_disconnect(ChimeCallAudio *audio, gboolean hangup)
 	g_mutex_unlock(&audio->transport_lock);
 }
 
+/* Once the call is finished with, rather than between connections */
+void chime_call_transport_release(ChimeCallAudio *audio)
+{
+	if (audio->standby_cancel) {
+		g_cancellable_cancel(audio->standby_cancel);
+		g_clear_object(&audio->standby_cancel);
+	}
+	if (audio->standby_ws) {
+		g_signal_handlers_disconnect_matched(G_OBJECT(audio->standby_ws), G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, audio);
+		g_signal_connect(G_OBJECT(audio->standby_ws), "closed", G_CALLBACK(on_final_audiows_close), NULL);
+		soup_websocket_connection_close(audio->standby_ws, 0, NULL);
+		audio->standby_ws = NULL;
+	}
+	gnutls_free(audio->dtls_resume.data);
+	audio->dtls_resume.data = NULL;
+	audio->dtls_resume.size = 0;
+}
+
 void chime_call_transport_send_packet(ChimeCallAudio *audio, enum xrp_pkt_type type, const ProtobufCMessage *message)
 {
 	if (!audio->ws && !audio->dtls_sess)
@@ -676,19 +904,28 @@ void chime_call_transport_send_packet(ChimeCallAudio *audio, enum xrp_pkt_type t
 	size_t len = protobuf_c_message_get_packed_size(message);
 
 	len += sizeof(struct xrp_header);
-	struct xrp_header *hdr = g_malloc0(len);
+
+	/* Audio frames always fit in the preallocated buffer */
+	g_mutex_lock(&audio->transport_lock);
+	struct xrp_header *hdr, *big = NULL;
+	if (len <= sizeof(audio->send_buf))
+		hdr = (void *)audio->send_buf;
+	else
+		hdr = big = g_malloc(len);
+
 	hdr->type = htons(type);
 	hdr->len = htons(len);
 	protobuf_c_message_pack(message, (void *)(hdr + 1));
-	if (getenv("CHIME_AUDIO_DEBUG")) {
+	if (audio->debug) {
 		printf("sending protobuf of len %"G_GSIZE_FORMAT"\n", len);
 		hexdump(hdr, len);
 	}
-	g_mutex_lock(&audio->transport_lock);
 	if (audio->dtls_sess)
 		gnutls_record_send(audio->dtls_sess, hdr, len);
 	else if (audio->ws)
 		soup_websocket_connection_send_binary(audio->ws, hdr, len);
+	audio->stats.tx_packets++;
+	audio->stats.tx_bytes += len;
 	g_mutex_unlock(&audio->transport_lock);
-	g_free(hdr);
+	g_free(big);
 }
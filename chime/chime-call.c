@@ -22,6 +22,7 @@
 #include "chime-call-screen.h"
 
 #include <glib/gi18n.h>
+#include <string.h>
 
 #define BOOL_PROPS(x)							\
 	x(ongoing, ONGOING, "ongoing?", "ongoing", "ongoing", TRUE)	\
@@ -58,6 +59,7 @@ enum {
 	AUDIO_STATE,
 	SCREEN_STATE,
 	PARTICIPANTS_CHANGED,
+	PARTICIPANT_CHANGED,
 	NEW_PRESENTER,
 	LAST_SIGNAL,
 };
@@ -193,6 +195,11 @@ static void chime_call_class_init(ChimeCallClass *klass)
 			      G_OBJECT_CLASS_TYPE (object_class), G_SIGNAL_RUN_FIRST,
 			      0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_HASH_TABLE);
 
+	signals[PARTICIPANT_CHANGED] =
+		g_signal_new ("participant-changed",
+			      G_OBJECT_CLASS_TYPE (object_class), G_SIGNAL_RUN_FIRST,
+			      0, NULL, NULL, NULL, G_TYPE_NONE, 2, G_TYPE_POINTER, G_TYPE_INT);
+
 	signals[NEW_PRESENTER] =
 		g_signal_new ("new_presenter",
 			      G_OBJECT_CLASS_TYPE (object_class), G_SIGNAL_RUN_FIRST,
@@ -344,14 +351,19 @@ static void free_participant(void *_p)
 }
 
 static gboolean parse_participant(ChimeConnection *cxn, ChimeCall *call, JsonNode *p,
-				  ChimeCallParticipant **presenter)
+				  ChimeCallParticipant **presenter, GHashTable *seen)
 {
 	const gchar *participant_id, *full_name, *participant_type, *video_present;
 	gboolean pots, speaker;
 	ChimeCallParticipationStatus status;
 
-	if (!parse_string(p, "participant_id", &participant_id) ||
-	    !parse_string(p, "full_name", &full_name) ||
+	if (!parse_string(p, "participant_id", &participant_id))
+		return FALSE;
+
+	/* Still in the call, even if we can't make sense of the rest */
+	g_hash_table_add(seen, (gpointer)participant_id);
+
+	if (!parse_string(p, "full_name", &full_name) ||
 	    !parse_string(p, "participant_type", &participant_type) ||
 	    !parse_call_participation_status(p, "status", &status) ||
 	    !parse_boolean(p, "pots?", &pots) ||
@@ -365,6 +377,9 @@ static gboolean parse_participant(ChimeConnection *cxn, ChimeCall *call, JsonNod
 	ChimeCallSharedScreenStatus screen = CHIME_SHARED_SCREEN_NONE;
 	parse_call_shared_screen_status(p, "shared_screen_indicator", &screen);
 
+	gboolean video = !!strcmp(video_present, "none");
+	gboolean changed = TRUE;
+	ChimeCallParticipantChange change = CHIME_PARTICIPANT_CHANGED;
 	ChimeCallParticipant *cp = g_hash_table_lookup(call->participants, (void *)participant_id);
 	if (!cp) {
 		cp = g_new0(ChimeCallParticipant, 1);
@@ -375,16 +390,19 @@ static gboolean parse_participant(ChimeConnection *cxn, ChimeCall *call, JsonNod
 		if (email)
 			cp->email = g_strdup(email);
 		g_hash_table_insert(call->participants, (void *)cp->participant_id, cp);
-	}
+		change = CHIME_PARTICIPANT_JOINED;
+	} else if (cp->pots == pots && cp->speaker == speaker && cp->status == status &&
+		   cp->shared_screen == screen && cp->video_present == video)
+		changed = FALSE;
+
 	cp->pots = pots;
 	cp->speaker = speaker;
 	cp->status = status;
 	cp->shared_screen = screen;
+	cp->video_present = video;
 
-	if(!strcmp(video_present, "none"))
-		cp->video_present = FALSE;
-	else
-		cp->video_present = TRUE;
+	if (changed)
+		g_signal_emit(call, signals[PARTICIPANT_CHANGED], 0, cp, change);
 
 	if (screen == CHIME_SHARED_SCREEN_PRESENTING)
 		*presenter = cp;
@@ -416,14 +434,33 @@ static gboolean call_roster_cb(ChimeConnection *cxn, gpointer _call, JsonNode *d
 	JsonArray *participants_arr = json_node_get_array(participants_node);
 	int i, len = json_array_get_length(participants_arr);
 
-	gboolean ret = TRUE;
+	gboolean ret = TRUE, anonymous = FALSE;
 
 	ChimeCallParticipant *presenter = NULL;
+	GHashTable *seen = g_hash_table_new(g_str_hash, g_str_equal);
 	for (i = 0; i < len; i++) {
 		JsonNode *p = json_array_get_element(participants_arr, i);
-		if (!parse_participant(cxn, call, p, &presenter))
+		const gchar *id;
+
+		if (!parse_participant(cxn, call, p, &presenter, seen)) {
 			ret = FALSE;
+			if (!parse_string(p, "participant_id", &id))
+				anonymous = TRUE;
+		}
 	}
+
+	/* Each roster is complete, so anyone not in it has gone. Unless
+	 * there was an entry we couldn't tell who it was for. */
+	GHashTableIter iter;
+	gpointer id, cp;
+	g_hash_table_iter_init(&iter, call->participants);
+	while (!anonymous && g_hash_table_iter_next(&iter, &id, &cp)) {
+		if (!g_hash_table_contains(seen, id)) {
+			g_signal_emit(call, signals[PARTICIPANT_CHANGED], 0, cp, CHIME_PARTICIPANT_LEFT);
+			g_hash_table_iter_remove(&iter);
+		}
+	}
+	g_hash_table_destroy(seen);
 	if (call->presenter != presenter) {
 		call->presenter = presenter;
 		g_signal_emit(call, signals[NEW_PRESENTER], 0, presenter);
@@ -447,12 +484,59 @@ gboolean chime_call_participant_audio_stats(ChimeCall *call, const gchar *partic
 	if (vol != p->volume || signal_strength != p->signal_strength) {
 		p->volume = vol;
 		p->signal_strength = signal_strength;
+		g_signal_emit(call, signals[PARTICIPANT_CHANGED], 0, p, CHIME_PARTICIPANT_CHANGED);
 		return TRUE;
 	}
 
 	return FALSE;
 }
 
+/* Only for calls which we have open */
+gboolean chime_call_get_media_stats(ChimeCall *call, ChimeMediaStats *audio,
+				    ChimeMediaStats *screen)
+{
+	g_return_val_if_fail(CHIME_IS_CALL(call), FALSE);
+
+	memset(audio, 0, sizeof(*audio));
+	memset(screen, 0, sizeof(*screen));
+
+	if (!call->audio && !call->screen)
+		return FALSE;
+
+	if (call->audio) {
+		g_mutex_lock(&call->audio->transport_lock);
+		*audio = call->audio->stats;
+		g_mutex_unlock(&call->audio->transport_lock);
+	}
+	if (call->screen) {
+		g_mutex_lock(&call->screen->transport_lock);
+		*screen = call->screen->stats;
+		g_mutex_unlock(&call->screen->transport_lock);
+	}
+	return TRUE;
+}
+
+gboolean chime_call_get_audio_stats(ChimeCall *call, ChimeCallAudioStats *stats)
+{
+	g_return_val_if_fail(CHIME_IS_CALL(call), FALSE);
+
+	memset(stats, 0, sizeof(*stats));
+	if (!call->audio)
+		return FALSE;
+
+	g_mutex_lock(&call->audio->rt_lock);
+	*stats = call->audio->quality;
+	g_mutex_unlock(&call->audio->rt_lock);
+
+	g_mutex_lock(&call->audio->transport_lock);
+	if (call->audio->dtls_sess)
+		stats->transport = CHIME_AUDIO_TRANSPORT_DTLS;
+	else if (call->audio->ws)
+		stats->transport = CHIME_AUDIO_TRANSPORT_WEBSOCKET;
+	g_mutex_unlock(&call->audio->transport_lock);
+	return TRUE;
+}
+
 void chime_call_emit_participants(ChimeCall *call)
 {
 	g_signal_emit(call, signals[PARTICIPANTS_CHANGED], 0, call->participants);
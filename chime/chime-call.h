@@ -95,6 +95,15 @@ typedef struct {
 
 GList *chime_call_get_participants(ChimeCall *self);
 
+/* The "participant-changed" signal reports each of these as they happen,
+ * before "participants-changed" is emitted for the whole batch. A
+ * participant who has left is freed when the handlers return. */
+typedef enum {
+	CHIME_PARTICIPANT_JOINED,
+	CHIME_PARTICIPANT_LEFT,
+	CHIME_PARTICIPANT_CHANGED,
+} ChimeCallParticipantChange;
+
 struct _ChimeCallAudio;
 typedef struct _ChimeCallAudio ChimeCallAudio;
 
@@ -123,6 +132,29 @@ typedef enum {
 	CHIME_SCREEN_STATE_SENDING,
 } ChimeScreenState;
 
+typedef enum {
+	CHIME_AUDIO_TRANSPORT_NONE = 0,
+	CHIME_AUDIO_TRANSPORT_DTLS,
+	CHIME_AUDIO_TRANSPORT_WEBSOCKET,
+} ChimeAudioTransport;
+
+/* Quality of an open audio connection. The rx_* counts are of frames from
+ * the server, by sequence number, and carry over reconnects. The times
+ * are -1 until they have been measured. tx_jitter_us is how far the gaps
+ * between outgoing frames stray from their duration, and tx_cost_us the
+ * time taken to build and send each packet, both smoothed. */
+typedef struct {
+	ChimeAudioTransport transport;
+	guint reconnects;
+	guint64 rx_frames, rx_lost, rx_reordered, rx_duplicates;
+	guint64 tx_frames, tx_frames_missed;
+	gint64 rtt_us, srtt_us;
+	gint64 jitter_us;
+	gint64 tx_jitter_us, tx_cost_us;
+} ChimeCallAudioStats;
+
+gboolean chime_call_get_audio_stats(ChimeCall *call, ChimeCallAudioStats *stats);
+
 void chime_call_install_gst_app_callbacks(ChimeCall *call, GstAppSrc *appsrc, GstAppSink *appsink);
 void chime_call_view_screen(ChimeConnection *cxn, ChimeCall *call, GstAppSrc *appsrc);
 void chime_call_send_screen(ChimeConnection *cxn, ChimeCall *call, GstAppSink *appsink);
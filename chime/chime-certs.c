@@ -32,28 +32,33 @@ static const char *cert_filenames[NR_CERTS] = {
 	"SFS_Root_CA_G2.pem",
 };
 
+/* Loaded once and kept for the life of the process, so that further
+ * connections (and reconnections) don't parse them all again. */
 static GTlsCertificate *certs[NR_CERTS];
+static gboolean certs_loaded;
 
 GSList *chime_cert_list(void)
 {
 	int i;
 	GSList *ret = NULL;
 
-	for (i=0; i < NR_CERTS; i++) {
-		if (certs[i]) {
-			g_object_ref(certs[i]);
-		} else {
+	if (!certs_loaded) {
+		for (i=0; i < NR_CERTS; i++) {
 			GError *error = NULL;
 			gchar *filename = g_build_filename(CHIME_CERTS_DIR, cert_filenames[i], NULL);
 			certs[i] = g_tls_certificate_new_from_file(filename, &error);
 			if (!certs[i]) {
-				chime_debug("Failed to load %s: %s\n", cert_filenames[1], error->message);
+				chime_debug("Failed to load %s: %s\n", cert_filenames[i], error->message);
 				g_clear_error(&error);
-				continue;
 			}
-			g_object_add_weak_pointer(G_OBJECT(certs[i]), (gpointer *)&certs[i]);
+			g_free(filename);
 		}
-		ret = g_slist_prepend(ret, certs[i]);
+		certs_loaded = TRUE;
+	}
+
+	for (i=0; i < NR_CERTS; i++) {
+		if (certs[i])
+			ret = g_slist_prepend(ret, g_object_ref(certs[i]));
 	}
 	return ret;
 }
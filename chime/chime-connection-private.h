@@ -89,6 +89,22 @@ typedef enum {
 #define CHIME_DEVICE_CAP_WEBINAR			(1<<3)
 #define CHIME_DEVICE_CAP_PRESENCE_SUBSCRIPTION		(1<<4)
 
+/* Further callers for the same GET, sharing the response */
+struct chime_msg_dup {
+	struct chime_msg *cmsg;
+	ChimeSoupMessageCallback cb;
+	gpointer cb_data;
+	GCancellable *cancel;
+	gulong cancel_id;
+};
+
+/* Requests to one host: those waiting for a slot, by priority, and the
+ * number handed to libsoup. */
+struct chime_host_reqs {
+	guint in_flight;
+	GQueue waiting[CHIME_REQ_N_PRIORITIES];
+};
+
 /* SoupMessage handling for Chime communication, with retry on re-auth
  * and JSON parsing. XX: MAke this a proper superclass of SoupMessage */
 struct chime_msg {
@@ -97,8 +113,34 @@ struct chime_msg {
 	gpointer cb_data;
 	SoupMessage *msg;
 	gboolean auto_renew;
+	ChimeRequestPriority prio;
+	gint64 started;	/* When handed to libsoup, for the metrics */
+	GCancellable *cancel;	/* The first caller's, as each dup has its own */
+	gulong cancel_id;
+	gchar *dedup_key;
+	GSList *dups;
 };
 
+/* Packet counts for the audio and screen transports of a call */
+typedef struct {
+	guint64 tx_packets, tx_bytes;
+	guint64 rx_packets, rx_bytes;
+} ChimeMediaStats;
+
+#define CHIME_METRICS_BUCKETS 11
+
+typedef struct {
+	gint64 created;
+	GHashTable *http;	/* Endpoint name → struct chime_endpoint_stats */
+	guint64 jugg_messages;
+	guint64 jugg_dispatch[CHIME_METRICS_BUCKETS];	/* By handling time */
+	gint64 jugg_dispatch_total_us, jugg_dispatch_max_us;
+	guint jugg_connects;
+	gint64 jugg_window_start;
+	guint64 jugg_window_base;
+	double jugg_rate;
+} ChimeMetrics;
+
 typedef struct {
 	ChimeConnectionState state;
 	GSList *amazon_cas;
@@ -106,9 +148,29 @@ typedef struct {
 	gchar *server;
 	gchar *device_token;
 	gchar *session_token;
+	gchar *cache_dir;
+	gboolean message_store;
+
+	ChimeLogLevel log_level;
+	gboolean log_ratelimit;
+	ChimeLogFilterFunc log_filter;
+	gpointer log_filter_data;
+
+	/* Object IDs and channel names, shared by everything that refers to them */
+	GStringChunk *intern_pool;
+
+	/* Proactive token renewal */
+	guint token_renew_timer;
+	gint64 token_renewed_at;	/* Monotonic time of our last renewal */
+	guint token_lifetime;		/* Seconds, learned from 401s */
+	gint64 token_expires;		/* Monotonic time the current one should last till */
+	guint token_retry_delay;	/* Seconds before retrying a failed early renewal */
+	gboolean token_renewing;
 
 	gboolean jugg_online, contacts_online, rooms_online, convs_online, meetings_online;
 
+	ChimeMetrics metrics;
+
 	/* Service config */
 	JsonNode *reg_node;
 	const gchar *account_email;
@@ -138,6 +200,11 @@ typedef struct {
 	/* Messages queued for resubmission */
 	GQueue *msgs_queued;
 	GQueue *msgs_pending_auth;
+	guint msgs_waiting[CHIME_REQ_N_PRIORITIES];	/* Over all hosts */
+	GHashTable *host_reqs;		/* host → struct chime_host_reqs */
+	GHashTable *msgs_by_uri;	/* Outstanding GETs, for coalescing */
+	GQueue *msgs_parsing;		/* Responses being parsed in a thread */
+	GCancellable *json_cancel;
 
 	/* Juggernaut */
 	SoupWebsocketConnection *ws_conn;
@@ -145,10 +212,17 @@ typedef struct {
 	guint keepalive_timer;
 	gchar *ws_key;
 	GHashTable *subscriptions;
+	JsonParser *jugg_parser;	/* Reused for each incoming message */
+	GHashTable *jugg_msg_times;	/* ChimeObject → struct jugg_msg_time */
+	guint64 jugg_ack_id;		/* Highest id not yet acked, if jugg_acks_pending */
+	guint jugg_acks_pending;
+	guint jugg_ack_timer;
 
 	/* Contacts */
 	ChimeObjectCollection contacts;
 	ChimeSyncState contacts_sync;
+	GPtrArray *contact_index;	/* of struct contact_index_entry, by key */
+	gboolean contact_index_dirty;
 	GSList *contacts_needed;
 	guint contacts_src_id;
 
@@ -158,10 +232,14 @@ typedef struct {
 
 	/* Conversations */
 	ChimeObjectCollection conversations;
+	GSequence *recent_conversations;	/* Most recently updated first */
+	GHashTable *conversations_by_members;	/* Sorted member IDs → conversation */
 	ChimeSyncState conversations_sync;
 
 	/* Meetings */
 	ChimeObjectCollection meetings;
+	GHashTable *meetings_by_pin;	/* Passcode or display ID → meeting */
+	GQueue pin_lookups;		/* Recent server PIN lookups, newest first */
 	ChimeObjectCollection calls;
 } ChimeConnectionPrivate;
 
@@ -171,6 +249,21 @@ typedef struct {
 
 #define chime_debug(...) do { if (getenv("CHIME_DEBUG")) printf(__VA_ARGS__); } while (0)
 
+/* chime-metrics.c */
+void chime_metrics_init(ChimeConnection *cxn);
+void chime_metrics_destroy(ChimeConnection *cxn);
+void chime_metrics_http(ChimeConnection *cxn, SoupMessage *msg, gint64 started);
+void chime_metrics_jugg_message(ChimeConnection *cxn);
+void chime_metrics_jugg_connected(ChimeConnection *cxn);
+void chime_metrics_jugg_dispatch(ChimeConnection *cxn, gint64 started);
+
+/* chime-msgstore.c */
+gboolean chime_msgstore_replay(ChimeConnection *cxn, ChimeObject *obj,
+			       gint64 before, gint64 after, gint64 *resume);
+void chime_msgstore_append(ChimeConnection *cxn, ChimeObject *obj,
+			   gint64 from, gint64 before, GPtrArray *msgs);
+void chime_msgstore_update(ChimeConnection *cxn, ChimeObject *obj, JsonNode *node);
+
 /* chime-websocket.c */
 /* Like the soup_session_ variants, but with the auth retry */
 void
@@ -187,21 +280,79 @@ chime_connection_websocket_connect_finish (ChimeConnection  *cxn,
 					   GAsyncResult     *result,
 					   GError          **error);
 
+/* Ask for RFC 7692 compression of a connection about to be made with the
+ * above. Only text is compressed on the way out. Not offered with libsoup's
+ * own websockets, which would fail on compressed frames. */
+void
+chime_websocket_offer_deflate (SoupMessage *msg);
+
+/* A binary message in pieces, which are only copied where the websocket
+ * would have copied anyway */
+void
+chime_websocket_send_binaryv (SoupWebsocketConnection *ws,
+			      const GOutputVector     *vectors,
+			      gsize                    n_vectors);
+
+/* Bytes queued but not yet sent. Always 0 with libsoup's own websockets,
+ * which don't say. */
+gsize
+chime_websocket_get_buffered_amount (SoupWebsocketConnection *ws);
+
 /* chime-connection.c */
 void chime_connection_fail(ChimeConnection *cxn, gint code,
 			   const gchar *format, ...);
 void chime_connection_fail_error(ChimeConnection *cxn, GError *error);
+gboolean chime_connection_mentions_us(ChimeConnection *cxn, const gchar *content);
 void chime_connection_calculate_online(ChimeConnection *cxn);
 void chime_connection_new_contact(ChimeConnection *cxn, ChimeContact *contact);
 void chime_connection_new_room(ChimeConnection *cxn, ChimeRoom *room);
 void chime_connection_new_conversation(ChimeConnection *cxn, ChimeConversation *conversation);
 void chime_connection_new_meeting(ChimeConnection *cxn, ChimeMeeting *meeting);
-void chime_connection_log(ChimeConnection *cxn, ChimeLogLevel level, const gchar *format, ...);
+
+/* Check the level before evaluating the arguments, so that disabled
+ * messages cost nothing (beyond the check) to not print. */
+gboolean chime_connection_log_enabled(ChimeConnection *cxn, ChimeLogLevel level);
+void chime_connection_log_real(ChimeConnection *cxn, ChimeLogLevel level, const gchar *format, ...)
+	G_GNUC_PRINTF(3, 4);
+#define chime_connection_log(cxn, level, ...) do {			\
+		if (chime_connection_log_enabled(cxn, level))		\
+			chime_connection_log_real(cxn, level, __VA_ARGS__); \
+	} while (0)
+
+/* For very verbose paths: if ratelimiting is enabled on the connection,
+ * at most CHIME_LOG_BURST messages from each call site per
+ * CHIME_LOG_INTERVAL seconds, with a count of those suppressed. */
+typedef struct {
+	gint64 window_start;
+	guint count;
+	guint suppressed;
+} ChimeLogRatelimit;
+gboolean chime_connection_log_ratelimit(ChimeConnection *cxn, ChimeLogLevel level,
+					ChimeLogRatelimit *rl);
+#define chime_connection_log_ratelimited(cxn, level, ...) do {		\
+		static ChimeLogRatelimit _rl;				\
+		if (chime_connection_log_enabled(cxn, level) &&		\
+		    chime_connection_log_ratelimit(cxn, level, &_rl))	\
+			chime_connection_log_real(cxn, level, __VA_ARGS__); \
+	} while (0)
 void chime_connection_progress(ChimeConnection *cxn, int percent, const gchar *message);
 SoupMessage *chime_connection_queue_http_request(ChimeConnection *self, JsonNode *node,
 						 SoupURI *uri, const gchar *method,
 						 ChimeSoupMessageCallback callback,
 						 gpointer cb_data);
+SoupMessage *chime_connection_queue_http_request_prio(ChimeConnection *self, JsonNode *node,
+						      SoupURI *uri, const gchar *method,
+						      ChimeRequestPriority prio,
+						      ChimeSoupMessageCallback callback,
+						      gpointer cb_data);
+SoupMessage *chime_connection_queue_http_request_full(ChimeConnection *self, JsonNode *node,
+						      SoupURI *uri, const gchar *method,
+						      ChimeRequestPriority prio,
+						      GCancellable *cancellable,
+						      ChimeSoupMessageCallback callback,
+						      gpointer cb_data);
+const gchar *chime_connection_intern(ChimeConnection *cxn, const gchar *str);
+gboolean chime_id_equal(gconstpointer a, gconstpointer b);
 SoupURI *soup_uri_new_printf(const gchar *base, const gchar *format, ...);
 gboolean parse_notify_pref(JsonNode *node, const gchar *member, ChimeNotifyPref *type);
 gboolean parse_visibility(JsonNode *node, const gchar *member, gboolean *val);
@@ -210,6 +361,7 @@ gboolean parse_visibility(JsonNode *node, const gchar *member, gboolean *val);
 /* chime-contact.c */
 void chime_init_contacts(ChimeConnection *cxn);
 void chime_destroy_contacts(ChimeConnection *cxn);
+void chime_refresh_presences(ChimeConnection *cxn);
 ChimeContact *chime_connection_parse_conversation_contact(ChimeConnection *cxn,
 							  JsonNode *node,
 							  GError **error);
@@ -224,6 +376,7 @@ gboolean chime_connection_jugg_send(ChimeConnection *self, JsonNode *node);
 /* chime-conversation.c */
 void chime_init_conversations(ChimeConnection *cxn);
 void chime_destroy_conversations(ChimeConnection *cxn);
+void chime_conversation_messages_read(ChimeConversation *conv, const gchar *msg_id);
 
 /* chime-juggernaut.c */
 void chime_init_juggernaut(ChimeConnection *cxn);
@@ -237,12 +390,17 @@ void chime_jugg_subscribe(ChimeConnection *cxn, const gchar *channel,
 void chime_jugg_unsubscribe(ChimeConnection *cxn, const gchar *channel,
 			    const gchar *klass, JuggernautCallback cb,
 			    gpointer cb_data);
+void chime_jugg_note_message(ChimeConnection *cxn, ChimeObject *obj, JsonNode *record);
+void chime_jugg_forget_messages(ChimeConnection *cxn, ChimeObject *obj);
+/* Dispatch a message as if it had arrived on the websocket, for chime-bench */
+void chime_jugg_replay(ChimeConnection *cxn, const gchar *msg, gsize len);
 
 /* chime-rooms.c */
 void chime_init_rooms(ChimeConnection *cxn);
 void chime_destroy_rooms(ChimeConnection *cxn);
 gboolean chime_connection_fetch_room(ChimeConnection *cxn, const gchar *id,
 				     JuggernautCallback cb, gpointer cb_data);
+void chime_room_messages_read(ChimeRoom *room, const gchar *msg_id);
 
 /* chime-meeting.c */
 void chime_init_meetings(ChimeConnection *cxn);
@@ -259,6 +417,7 @@ void chime_connection_close_call(ChimeConnection *cxn, ChimeCall *call);
 void chime_connection_open_call(ChimeConnection *cxn, ChimeCall *call, gboolean muted);
 
 gboolean chime_call_participant_audio_stats(ChimeCall *call, const gchar *profile_id, int vol, int signal_strength);
+gboolean chime_call_get_media_stats(ChimeCall *call, ChimeMediaStats *audio, ChimeMediaStats *screen);
 
 
 /* chime-login.c */
@@ -23,6 +23,22 @@
 
 #define SIGNIN_DEFAULT "https://signin.id.ue1.app.chime.aws/"
 
+/* Concurrent requests per host, for the highest priority class */
+#define CHIME_HTTP_HOST_SLOTS 4
+
+/* The server doesn't tell us how long a session token lasts. Assume this
+ * until a 401 shows otherwise, and renew when 3/4 of it has elapsed. */
+#define CHIME_TOKEN_LIFETIME_DEFAULT (60 * 60)
+#define CHIME_TOKEN_LIFETIME_MIN 120
+
+/* A failed early renewal is tried again after this, doubling each time,
+ * until the token actually runs out */
+#define CHIME_TOKEN_RETRY_MIN 15
+#define CHIME_TOKEN_RETRY_MAX 300
+
+/* Responses at least this big are parsed off the main thread */
+#define CHIME_JSON_THREAD_MIN (64 * 1024)
+
 enum
 {
     PROP_0,
@@ -55,6 +71,10 @@ G_DEFINE_QUARK(chime-error-quark, chime_error)
 G_DEFINE_TYPE(ChimeConnection, chime_connection, G_TYPE_OBJECT)
 
 static void soup_msg_cb(SoupSession *soup_sess, SoupMessage *msg, gpointer _cmsg);
+static void chime_connection_dispatch_requests(ChimeConnection *self);
+static void chime_renew_token(ChimeConnection *self);
+static void arm_token_renewal(ChimeConnection *self);
+static gboolean retry_token_renewal(ChimeConnection *self, SoupMessage *msg);
 
 static void
 chime_connection_finalize(GObject *object)
@@ -66,19 +86,112 @@ chime_connection_finalize(GObject *object)
 	g_free(priv->device_token);
 	g_free(priv->server);
 	g_free(priv->express_url);
+	g_free(priv->cache_dir);
+	g_string_chunk_free(priv->intern_pool);
+	/* Put back by a juggernaut message whose handler disconnected us */
+	g_clear_object(&priv->jugg_parser);
+	chime_metrics_destroy(self);
 
 	chime_connection_log(self, CHIME_LOGLVL_MISC, "Connection finalized: %p\n", self);
 
 	G_OBJECT_CLASS(chime_connection_parent_class)->finalize(object);
 }
 
+/* A caller is about to be told, or has been cancelled */
+static void
+cmsg_forget_cancel(GCancellable **cancel, gulong *cancel_id)
+{
+	if (*cancel) {
+		g_signal_handler_disconnect(*cancel, *cancel_id);
+		g_clear_object(cancel);
+	}
+}
+
+static void
+dup_free(struct chime_msg_dup *dup)
+{
+	cmsg_forget_cancel(&dup->cancel, &dup->cancel_id);
+	g_free(dup);
+}
+
 static void
 cmsg_free(struct chime_msg *cmsg)
 {
+	cmsg_forget_cancel(&cmsg->cancel, &cmsg->cancel_id);
 	g_object_unref(cmsg->msg);
+	g_slist_free_full(cmsg->dups, (GDestroyNotify)dup_free);
+	g_free(cmsg->dedup_key);
 	g_free(cmsg);
 }
 
+/* Hand the response to the callback(s), leaving the cmsg to be freed. */
+static void
+cmsg_run_callbacks(struct chime_msg *cmsg, SoupMessage *msg, JsonNode *node)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cmsg->cxn);
+
+	/* Unhash before the callbacks, so that they can issue the same
+	 * request again and actually get a new one. */
+	if (cmsg->dedup_key && priv->msgs_by_uri)
+		g_hash_table_remove(priv->msgs_by_uri, cmsg->dedup_key);
+
+	cmsg_forget_cancel(&cmsg->cancel, &cmsg->cancel_id);
+	if (cmsg->cb)
+		cmsg->cb(cmsg->cxn, msg, node, cmsg->cb_data);
+	while (cmsg->dups) {
+		struct chime_msg_dup *dup = cmsg->dups->data;
+		cmsg->dups = g_slist_delete_link(cmsg->dups, cmsg->dups);
+		cmsg_forget_cancel(&dup->cancel, &dup->cancel_id);
+		if (dup->cb)
+			dup->cb(cmsg->cxn, msg, node, dup->cb_data);
+		g_free(dup);
+	}
+}
+
+/* Fail a request that we are dropping, the same way that
+ * soup_session_abort() fails those which are in flight. */
+static void
+cmsg_cancel(struct chime_msg *cmsg)
+{
+	soup_message_set_status(cmsg->msg, SOUP_STATUS_CANCELLED);
+	cmsg_run_callbacks(cmsg, cmsg->msg, NULL);
+}
+
+/* The callbacks may queue new requests, which are cancelled in turn. */
+static void
+cancel_unsent_msgs(ChimeConnection *self)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
+	struct chime_msg *cmsg;
+	gboolean more;
+
+	do {
+		/* Hosts are never removed, so the list stays valid even if
+		 * the callbacks add more */
+		GList *hosts = g_hash_table_get_values(priv->host_reqs), *l;
+
+		more = FALSE;
+		for (l = hosts; l; l = l->next) {
+			struct chime_host_reqs *h = l->data;
+
+			for (int prio = 0; prio < CHIME_REQ_N_PRIORITIES; prio++) {
+				while ( (cmsg = g_queue_pop_head(&h->waiting[prio])) ) {
+					priv->msgs_waiting[prio]--;
+					cmsg_cancel(cmsg);
+					cmsg_free(cmsg);
+					more = TRUE;
+				}
+			}
+		}
+		g_list_free(hosts);
+		while ( (cmsg = g_queue_pop_head(priv->msgs_pending_auth)) ) {
+			cmsg_cancel(cmsg);
+			cmsg_free(cmsg);
+			more = TRUE;
+		}
+	} while (more);
+}
+
 void
 chime_connection_disconnect(ChimeConnection    *self)
 {
@@ -86,10 +199,40 @@ chime_connection_disconnect(ChimeConnection    *self)
 
 	chime_connection_log(self, CHIME_LOGLVL_MISC, "Disconnecting connection: %p\n", self);
 
+	/* Nothing more gets coalesced, and with soup_sess cleared first
+	 * nothing more gets dispatched, while the session is aborted. */
+	g_clear_pointer(&priv->msgs_by_uri, g_hash_table_destroy);
 	if (priv->soup_sess) {
-		soup_session_abort(priv->soup_sess);
-		g_clear_object(&priv->soup_sess);
+		SoupSession *sess = priv->soup_sess;
+
+		priv->soup_sess = NULL;
+		soup_session_abort(sess);
+		g_object_unref(sess);
+	}
+
+	/* Every request gets its callbacks, with the objects that they
+	 * may refer to still alive, before those are destroyed below.
+	 *
+	 * A parse that is already running in a thread can't be stopped.
+	 * Its callbacks are called now, and json_parsed_cb() will only
+	 * free what's left once the thread returns. */
+	if (priv->msgs_parsing) {
+		struct chime_msg *cmsg;
+
+		while ( (cmsg = g_queue_pop_head(priv->msgs_parsing)) )
+			cmsg_cancel(cmsg);
+		g_clear_pointer(&priv->msgs_parsing, g_queue_free);
 	}
+	if (priv->json_cancel) {
+		g_cancellable_cancel(priv->json_cancel);
+		g_clear_object(&priv->json_cancel);
+	}
+	if (priv->host_reqs) {
+		cancel_unsent_msgs(self);
+		/* Nothing else can be queued after this */
+		g_clear_pointer(&priv->host_reqs, g_hash_table_destroy);
+	}
+	g_clear_pointer(&priv->msgs_pending_auth, g_queue_free);
 
 	chime_destroy_meetings(self);
 	chime_destroy_calls(self);
@@ -100,10 +243,13 @@ chime_connection_disconnect(ChimeConnection    *self)
 
 	g_clear_pointer(&priv->reg_node, json_node_unref);
 
-	if (priv->msgs_pending_auth) {
-		g_queue_free_full(priv->msgs_pending_auth, (GDestroyNotify)cmsg_free);
-		priv->msgs_pending_auth = NULL;
+	if (priv->token_renew_timer) {
+		g_source_remove(priv->token_renew_timer);
+		priv->token_renew_timer = 0;
 	}
+	priv->token_renewing = FALSE;
+	priv->token_retry_delay = 0;
+
 	if (priv->msgs_queued) {
 		g_queue_free(priv->msgs_queued);
 		priv->msgs_queued = NULL;
@@ -125,6 +271,10 @@ chime_connection_dispose(GObject *object)
 
 	g_slist_free_full(priv->amazon_cas, g_object_unref);
 	priv->amazon_cas = NULL;
+
+	/* Everything holding an interned string held a reference on us too,
+	 * and has gone by now. */
+	g_string_chunk_clear(priv->intern_pool);
 	chime_connection_log(self, CHIME_LOGLVL_MISC, "Connection disposed: %p\n", self);
 
 	G_OBJECT_CLASS(chime_connection_parent_class)->dispose(object);
@@ -298,6 +448,29 @@ void chime_connection_fail_error(ChimeConnection *cxn, GError *error)
 	chime_connection_disconnect(cxn);
 }
 
+/* Whether message content mentions us, or @all/@present */
+gboolean chime_connection_mentions_us(ChimeConnection *cxn, const gchar *content)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	const gchar *p = content;
+
+	/* Mentions look like <@id|Name>, before escaping */
+	while ((p = strstr(p, "<@"))) {
+		const gchar *id = p + 2;
+		const gchar *bar = strchr(id, '|');
+
+		if (!bar)
+			break;
+		if ((priv->profile_id && !strncmp(id, priv->profile_id, bar - id) &&
+		     !priv->profile_id[bar - id]) ||
+		    (bar - id == 3 && !strncmp(id, "all", 3)) ||
+		    (bar - id == 7 && !strncmp(id, "present", 7)))
+			return TRUE;
+		p = bar;
+	}
+	return FALSE;
+}
+
 void chime_connection_fail(ChimeConnection *cxn, gint code, const gchar *format, ...)
 {
 	GError *error;
@@ -325,6 +498,10 @@ req_started_cb(SoupSession *sess, SoupMessage *msg, SoupSocket *sock, gpointer _
 	if (!cert_errors)
 		return;
 
+	/* Already checked for an earlier request on this connection */
+	if (g_object_get_data(G_OBJECT(sock), "chime-amazon-ca"))
+		return;
+
 	/* If the problem was *only* an unknown CA (i.e. the hostname did
 	 * match OK, it wasn't expired, etc.) then check if it's trusted
 	 * by the Amazon internal CA. */
@@ -344,9 +521,11 @@ req_started_cb(SoupSession *sess, SoupMessage *msg, SoupSocket *sock, gpointer _
 			l = l->next;
 		}
 		g_object_unref(ident);
+		g_object_unref(cert);
 
 		if (!cert_errors) {
 			chime_debug("Allow Amazon CA for %s\n", soup_uri_get_host(uri));
+			g_object_set_data(G_OBJECT(sock), "chime-amazon-ca", GINT_TO_POINTER(1));
 			return;
 		}
 	}
@@ -374,11 +553,18 @@ chime_connection_init(ChimeConnection *self)
 	/* Unset ssl-strict and manually check, so that we can allow
 	 * the Amazon internal CAs. The media endpoints may use those. */
 	g_object_set(priv->soup_sess, "ssl-strict", FALSE, NULL);
+	g_object_set(priv->soup_sess, "max-conns-per-host", CHIME_HTTP_HOST_SLOTS, NULL);
 	g_signal_connect(G_OBJECT(priv->soup_sess), "request-started", G_CALLBACK(req_started_cb), self);
 
 	priv->msgs_pending_auth = g_queue_new();
 	priv->msgs_queued = g_queue_new();
+	priv->msgs_parsing = g_queue_new();
+	priv->token_lifetime = CHIME_TOKEN_LIFETIME_DEFAULT;
+	priv->intern_pool = g_string_chunk_new(4096);
+	priv->host_reqs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	priv->msgs_by_uri = g_hash_table_new(g_str_hash, g_str_equal);
 	priv->state = CHIME_STATE_DISCONNECTED;
+	chime_metrics_init(self);
 }
 
 ChimeConnection *
@@ -513,6 +699,17 @@ static void register_cb(ChimeConnection *self, SoupMessage *msg,
 {
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
 
+	/* A cached token which has expired doesn't need the user to do
+	 * anything but sign in again, so don't fail for it. */
+	if (msg && msg->status_code == 401) {
+		chime_connection_log(self, CHIME_LOGLVL_INFO,
+				     "Cached session token rejected; signing in again\n");
+		chime_connection_set_session_token(self, NULL);
+		priv->state = CHIME_STATE_DISCONNECTED;
+		chime_connection_signin(self);
+		return;
+	}
+
 	if (!node) {
 		chime_connection_fail(self, CHIME_ERROR_NETWORK,
 				      _("Device registration failed"));
@@ -527,6 +724,7 @@ static void register_cb(ChimeConnection *self, SoupMessage *msg,
 	}
 
 	chime_init_juggernaut(self);
+	arm_token_renewal(self);
 
 	chime_jugg_subscribe(self, priv->profile_channel, NULL, NULL, NULL);
 	chime_jugg_subscribe(self, priv->presence_channel, NULL, NULL, NULL);
@@ -696,6 +894,193 @@ chime_connection_set_session_token(ChimeConnection *self,
 	}
 }
 
+/* Directory for on-disk snapshots of the contacts/rooms/conversations so
+ * that they can be shown immediately on the next login. Must be set before
+ * chime_connection_connect(), and a NULL dir disables the snapshots. */
+void
+chime_connection_set_cache_dir(ChimeConnection *self, const gchar *dir)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
+	g_return_if_fail(CHIME_IS_CONNECTION(self));
+
+	g_free(priv->cache_dir);
+	priv->cache_dir = g_strdup(dir);
+}
+
+/* Keep message history in the cache dir, and only fetch what's newer */
+void
+chime_connection_set_message_store(ChimeConnection *self, gboolean enabled)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
+	g_return_if_fail(CHIME_IS_CONNECTION(self));
+
+	priv->message_store = enabled;
+}
+
+/* Requests are held in a queue for their host and priority, and only
+ * handed to libsoup while that host has a free slot. Lower priorities
+ * get fewer slots, so a bulk sync can never occupy every connection to
+ * a host and an interactive request (like sending a message) only ever
+ * waits for other interactive requests. */
+static guint host_slots(ChimeRequestPriority prio)
+{
+	return CHIME_HTTP_HOST_SLOTS - prio;
+}
+
+/* There are only a handful of hosts, and they stay for the connection. */
+static struct chime_host_reqs *host_reqs_get(ChimeConnectionPrivate *priv, struct chime_msg *cmsg)
+{
+	const gchar *host = soup_message_get_uri(cmsg->msg)->host;
+	struct chime_host_reqs *h = g_hash_table_lookup(priv->host_reqs, host);
+
+	if (!h) {
+		h = g_new0(struct chime_host_reqs, 1);
+		for (int prio = 0; prio < CHIME_REQ_N_PRIORITIES; prio++)
+			g_queue_init(&h->waiting[prio]);
+		g_hash_table_insert(priv->host_reqs, g_strdup(host), h);
+	}
+	return h;
+}
+
+/* Leave a request to wait for a slot, or fail it if we've disconnected. */
+static void cmsg_enqueue(ChimeConnectionPrivate *priv, struct chime_msg *cmsg)
+{
+	if (!priv->host_reqs) {
+		cmsg_cancel(cmsg);
+		cmsg_free(cmsg);
+		return;
+	}
+
+	g_queue_push_tail(&host_reqs_get(priv, cmsg)->waiting[cmsg->prio], cmsg);
+	priv->msgs_waiting[cmsg->prio]++;
+}
+
+/* Take a request back out, if it's still waiting */
+static gboolean cmsg_unqueue(ChimeConnectionPrivate *priv, struct chime_msg *cmsg)
+{
+	struct chime_host_reqs *h;
+
+	if (!priv->host_reqs)
+		return FALSE;
+
+	h = g_hash_table_lookup(priv->host_reqs, soup_message_get_uri(cmsg->msg)->host);
+	if (!h || !g_queue_remove(&h->waiting[cmsg->prio], cmsg))
+		return FALSE;
+
+	priv->msgs_waiting[cmsg->prio]--;
+	return TRUE;
+}
+
+/* Nobody wants the response any more, so stop the request if we still
+ * can. One in flight completes through soup_msg_cb() as usual, and one
+ * being parsed just finishes, in both cases with nobody left to tell. */
+static void cmsg_abandon(ChimeConnectionPrivate *priv, struct chime_msg *cmsg)
+{
+	/* Later requests for the URI mustn't join this one */
+	if (cmsg->dedup_key && priv->msgs_by_uri)
+		g_hash_table_remove(priv->msgs_by_uri, cmsg->dedup_key);
+	g_clear_pointer(&cmsg->dedup_key, g_free);
+
+	if (cmsg_unqueue(priv, cmsg) ||
+	    (priv->msgs_pending_auth && g_queue_remove(priv->msgs_pending_auth, cmsg))) {
+		cmsg_cancel(cmsg);
+		cmsg_free(cmsg);
+	} else if (priv->soup_sess && priv->msgs_queued &&
+		   g_queue_find(priv->msgs_queued, cmsg)) {
+		soup_session_cancel_message(priv->soup_sess, cmsg->msg, SOUP_STATUS_CANCELLED);
+	}
+}
+
+/* One caller's cancellable fired. It's told now, with a message of its
+ * own, and the shared request stops only if it was the last one waiting. */
+static void cmsg_caller_cancelled(struct chime_msg *cmsg, ChimeSoupMessageCallback cb,
+				  gpointer cb_data)
+{
+	ChimeConnection *cxn = g_object_ref(cmsg->cxn);
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	SoupMessage *msg = soup_message_new_from_uri(cmsg->msg->method,
+						     soup_message_get_uri(cmsg->msg));
+
+	soup_message_set_status(msg, SOUP_STATUS_CANCELLED);
+	if (!cmsg->cb && !cmsg->dups)
+		cmsg_abandon(priv, cmsg);
+	if (cb)
+		cb(cxn, msg, NULL, cb_data);
+	g_object_unref(msg);
+	chime_connection_dispatch_requests(cxn);
+	g_object_unref(cxn);
+}
+
+static void cmsg_cancelled(GCancellable *cancel, gpointer _cmsg)
+{
+	struct chime_msg *cmsg = _cmsg;
+	ChimeSoupMessageCallback cb = cmsg->cb;
+
+	cmsg_forget_cancel(&cmsg->cancel, &cmsg->cancel_id);
+	cmsg->cb = NULL;
+	cmsg_caller_cancelled(cmsg, cb, cmsg->cb_data);
+}
+
+static void dup_cancelled(GCancellable *cancel, gpointer _dup)
+{
+	struct chime_msg_dup *dup = _dup;
+	struct chime_msg *cmsg = dup->cmsg;
+	ChimeSoupMessageCallback cb = dup->cb;
+	gpointer cb_data = dup->cb_data;
+
+	cmsg->dups = g_slist_remove(cmsg->dups, dup);
+	dup_free(dup);
+	cmsg_caller_cancelled(cmsg, cb, cb_data);
+}
+
+/* Only the heads of each host's queues are looked at, so this costs
+ * nothing for requests which have to keep waiting. */
+static void chime_connection_dispatch_requests(ChimeConnection *self)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
+	GHashTableIter iter;
+	gpointer h_p;
+
+	if (!priv->soup_sess || !priv->host_reqs)
+		return;
+
+	g_hash_table_iter_init(&iter, priv->host_reqs);
+	while (g_hash_table_iter_next(&iter, NULL, &h_p)) {
+		struct chime_host_reqs *h = h_p;
+
+		for (int prio = 0; prio < CHIME_REQ_N_PRIORITIES; prio++) {
+			struct chime_msg *cmsg;
+
+			while (h->in_flight < host_slots(prio) &&
+			       (cmsg = g_queue_pop_head(&h->waiting[prio]))) {
+				priv->msgs_waiting[prio]--;
+				h->in_flight++;
+				g_queue_push_tail(priv->msgs_queued, cmsg);
+				cmsg->started = g_get_monotonic_time();
+				g_object_ref(self);
+				soup_session_queue_message(priv->soup_sess, cmsg->msg, soup_msg_cb, cmsg);
+			}
+		}
+	}
+}
+
+guint chime_connection_get_queue_depth(ChimeConnection *self, ChimeRequestPriority prio)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
+	g_return_val_if_fail(CHIME_IS_CONNECTION(self), 0);
+	g_return_val_if_fail(prio < CHIME_REQ_N_PRIORITIES, 0);
+
+	return priv->msgs_waiting[prio];
+}
+
+guint chime_connection_get_requests_in_flight(ChimeConnection *self)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
+	g_return_val_if_fail(CHIME_IS_CONNECTION(self), 0);
+
+	return priv->msgs_queued ? g_queue_get_length(priv->msgs_queued) : 0;
+}
+
 /* If we get an auth failure on a standard request, we automatically attempt
  * to renew the authentication token and resubmit the request. */
 static void renew_cb(ChimeConnection *self, SoupMessage *msg,
@@ -706,7 +1091,14 @@ static void renew_cb(ChimeConnection *self, SoupMessage *msg,
 	const gchar *sess_tok;
 	gchar *cookie_hdr;
 
+	priv->token_renewing = FALSE;
+
 	if (!node || !parse_string(node, "SessionToken", &sess_tok)) {
+		/* Nothing has been refused yet, so the old token still works */
+		if (priv->msgs_pending_auth && g_queue_is_empty(priv->msgs_pending_auth) &&
+		    retry_token_renewal(self, msg))
+			return;
+
 		chime_connection_fail(self, CHIME_ERROR_NETWORK,
 				      _("Failed to renew session token"));
 		chime_connection_set_session_token(self, NULL);
@@ -718,21 +1110,99 @@ static void renew_cb(ChimeConnection *self, SoupMessage *msg,
 	if (priv->state == CHIME_STATE_DISCONNECTED)
 		return;
 
+	priv->token_renewed_at = g_get_monotonic_time();
+	priv->token_retry_delay = 0;
+	arm_token_renewal(self);
+
 	cookie_hdr = g_strdup_printf("_aws_wt_session=%s", priv->session_token);
 
-	while ( (cmsg = g_queue_pop_head(priv->msgs_pending_auth)) ) {
+	while (priv->msgs_pending_auth &&
+	       (cmsg = g_queue_pop_head(priv->msgs_pending_auth))) {
 		soup_message_headers_replace(cmsg->msg->request_headers,
 					     "Cookie", cookie_hdr);
 		soup_message_headers_replace(cmsg->msg->request_headers,
 					     "X-Chime-Auth-Token", cookie_hdr);
 		chime_connection_log(self, CHIME_LOGLVL_MISC, "Requeued %p to %s\n", cmsg->msg,
 				     soup_uri_get_path(soup_message_get_uri(cmsg->msg)));
-		g_object_ref(self);
-		soup_session_queue_message(priv->soup_sess, cmsg->msg,
-					   soup_msg_cb, cmsg);
+		cmsg_enqueue(priv, cmsg);
 	}
 
 	g_free(cookie_hdr);
+	chime_connection_dispatch_requests(self);
+}
+
+static gboolean token_renew_timeout(gpointer _self)
+{
+	ChimeConnection *self = _self;
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
+
+	priv->token_renew_timer = 0;
+	chime_connection_log(self, CHIME_LOGLVL_MISC, "Renewing session token before expiry\n");
+	chime_renew_token(self);
+	return FALSE;
+}
+
+/* Renew the token in the background before it expires, while the old
+ * one is still valid. Nothing is held back while that happens; only a
+ * 401 (see soup_msg_cb()) parks requests in msgs_pending_auth. */
+static void arm_token_renewal(ChimeConnection *self)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
+
+	if (priv->token_renew_timer)
+		g_source_remove(priv->token_renew_timer);
+
+	priv->token_expires = g_get_monotonic_time() +
+		(gint64)priv->token_lifetime * G_USEC_PER_SEC;
+	priv->token_renew_timer = g_timeout_add_seconds(priv->token_lifetime * 3 / 4,
+							token_renew_timeout, self);
+}
+
+/* An early renewal failed. There's no need to drop the connection while
+ * the old token lasts, so try again later if it'll still be valid then.
+ * If it runs out first, the 401 will renew it as usual. */
+static gboolean retry_token_renewal(ChimeConnection *self, SoupMessage *msg)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
+
+	if (priv->state == CHIME_STATE_DISCONNECTED ||
+	    msg->status_code == SOUP_STATUS_CANCELLED)
+		return FALSE;
+
+	priv->token_retry_delay = priv->token_retry_delay ?
+		MIN(priv->token_retry_delay * 2, CHIME_TOKEN_RETRY_MAX) :
+		CHIME_TOKEN_RETRY_MIN;
+
+	gint64 left = (priv->token_expires - g_get_monotonic_time()) / G_USEC_PER_SEC;
+	if (left <= priv->token_retry_delay)
+		return FALSE;
+
+	chime_connection_log(self, CHIME_LOGLVL_WARNING,
+			     "Failed to renew session token (%d %s); retrying in %us\n",
+			     msg->status_code, msg->reason_phrase,
+			     priv->token_retry_delay);
+	priv->token_renew_timer = g_timeout_add_seconds(priv->token_retry_delay,
+							token_renew_timeout, self);
+	return TRUE;
+}
+
+/* A 401 on a token that we obtained ourselves tells us how long tokens
+ * actually last. A token that we were started with may have been old
+ * already, so that tells us nothing. */
+static void learn_token_lifetime(ChimeConnection *self)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
+
+	if (!priv->token_renewed_at)
+		return;
+
+	gint64 age = (g_get_monotonic_time() - priv->token_renewed_at) / G_USEC_PER_SEC;
+	if (age >= CHIME_TOKEN_LIFETIME_MIN && age < priv->token_lifetime) {
+		chime_connection_log(self, CHIME_LOGLVL_INFO,
+				     "Session token expired after %" G_GINT64_FORMAT "s\n", age);
+		priv->token_lifetime = age;
+	}
+	priv->token_renewed_at = 0;
 }
 
 static void chime_renew_token(ChimeConnection *self)
@@ -742,6 +1212,15 @@ static void chime_renew_token(ChimeConnection *self)
 	JsonBuilder *builder;
 	JsonNode *node;
 
+	if (priv->token_renewing)
+		return;
+	priv->token_renewing = TRUE;
+
+	if (priv->token_renew_timer) {
+		g_source_remove(priv->token_renew_timer);
+		priv->token_renew_timer = 0;
+	}
+
 	builder = json_builder_new();
 	builder = json_builder_begin_object(builder);
 	builder = json_builder_set_member_name(builder, "Token");
@@ -757,6 +1236,88 @@ static void chime_renew_token(ChimeConnection *self)
 	g_object_unref(builder);
 }
 
+/* Hand the response to the callback(s) and retire the request. */
+static void cmsg_complete(struct chime_msg *cmsg, SoupMessage *msg, JsonNode *node)
+{
+	ChimeConnection *cxn = cmsg->cxn;
+
+	cmsg_run_callbacks(cmsg, msg, node);
+	g_free(cmsg->dedup_key);
+	g_free(cmsg);
+	chime_connection_dispatch_requests(cxn);
+	g_object_unref(cxn);
+}
+
+/* Large responses (room members, message history) are parsed in a worker
+ * thread so that they don't stall the UI. The JsonParser is handed back
+ * to the main context with its tree, and nothing else is touched from
+ * the thread. Set CHIME_JSON_THREADS=0 in the environment to disable.
+ *
+ * This means that responses are no longer completed in the order they
+ * arrive: a large one can complete after a smaller one which arrived
+ * later. Callers which need an order must not issue the second request
+ * until the first has completed, as the paged history and member
+ * fetches already do. And the prpl holds back all messages until both
+ * the history and the member list are complete, whichever is first. */
+static gboolean json_threads_enabled(void)
+{
+	static gint enabled = -1;
+
+	if (enabled < 0) {
+		const gchar *env = getenv("CHIME_JSON_THREADS");
+		enabled = !env || atoi(env) != 0;
+	}
+	return enabled;
+}
+
+static void json_parse_thread(GTask *task, gpointer source, gpointer task_data,
+			      GCancellable *cancellable)
+{
+	GBytes *bytes = task_data;
+	JsonParser *parser = json_parser_new();
+	GError *error = NULL;
+	gsize len;
+	const gchar *data = g_bytes_get_data(bytes, &len);
+
+	if (json_parser_load_from_data(parser, data, len, &error))
+		g_task_return_pointer(task, parser, g_object_unref);
+	else {
+		g_object_unref(parser);
+		g_task_return_error(task, error);
+	}
+}
+
+static void json_parsed_cb(GObject *source, GAsyncResult *result, gpointer _cmsg)
+{
+	struct chime_msg *cmsg = _cmsg;
+	ChimeConnection *cxn = cmsg->cxn;
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	SoupMessage *msg = cmsg->msg;
+	GError *error = NULL;
+	JsonParser *parser = g_task_propagate_pointer(G_TASK(result), &error);
+
+	/* If we were disconnected meanwhile, chime_connection_disconnect()
+	 * has already failed it and called the callbacks. */
+	if (!priv->msgs_parsing || !g_queue_remove(priv->msgs_parsing, cmsg)) {
+		g_clear_object(&parser);
+		g_clear_error(&error);
+		g_free(cmsg->dedup_key);
+		g_free(cmsg);
+		g_object_unref(msg);
+		g_object_unref(cxn);
+		return;
+	}
+
+	if (!parser) {
+		g_warning("Error loading data: %s", error->message);
+		g_error_free(error);
+	}
+
+	cmsg_complete(cmsg, msg, parser ? json_parser_get_root(parser) : NULL);
+	g_clear_object(&parser);
+	g_object_unref(msg);
+}
+
 /* First callback for SoupMessage completion — do the common
  * parsing of the JSON response (if any) and hand it on to the
  * real callback function. Also handles auth token renewal. */
@@ -768,8 +1329,9 @@ static void soup_msg_cb(SoupSession *soup_sess, SoupMessage *msg, gpointer _cmsg
 	JsonParser *parser = NULL;
 	JsonNode *node = NULL;
 
-	if (priv->msgs_queued)
-		g_queue_remove(priv->msgs_queued, cmsg);
+	if (priv->msgs_queued && g_queue_remove(priv->msgs_queued, cmsg) && priv->host_reqs)
+		host_reqs_get(priv, cmsg)->in_flight--;
+	chime_metrics_http(cxn, msg, cmsg->started);
 
 	/* Special case for renew_cb itself, which mustn't recurse! */
 	if (priv->state != CHIME_STATE_DISCONNECTED &&
@@ -780,6 +1342,7 @@ static void soup_msg_cb(SoupSession *soup_sess, SoupMessage *msg, gpointer _cmsg
 		gboolean already_renewing = !g_queue_is_empty(priv->msgs_pending_auth);
 		g_queue_push_tail(priv->msgs_pending_auth, cmsg);
 		if (!already_renewing) {
+			learn_token_lifetime(cxn);
 #if 0 /* Not working; we can catch statue_code==7 above but it's also breaking
 	 the websocket connection too. */
 			while (!g_queue_is_empty(priv->msgs_queued)) {
@@ -790,6 +1353,7 @@ static void soup_msg_cb(SoupSession *soup_sess, SoupMessage *msg, gpointer _cmsg
 #endif
 			chime_renew_token(cxn);
 		}
+		chime_connection_dispatch_requests(cxn);
 		g_object_unref(cxn);
 		return;
 	}
@@ -798,6 +1362,25 @@ static void soup_msg_cb(SoupSession *soup_sess, SoupMessage *msg, gpointer _cmsg
 	if (!g_strcmp0(content_type, "application/json") && msg->response_body->data) {
 		GError *error = NULL;
 
+		if (json_threads_enabled() && priv->msgs_parsing &&
+		    msg->response_body->length >= CHIME_JSON_THREAD_MIN) {
+			GBytes *bytes = g_bytes_new(msg->response_body->data,
+						    msg->response_body->length);
+			GTask *task;
+
+			if (!priv->json_cancel)
+				priv->json_cancel = g_cancellable_new();
+			task = g_task_new(NULL, priv->json_cancel, json_parsed_cb, cmsg);
+			g_queue_push_tail(priv->msgs_parsing, cmsg);
+
+			/* libsoup drops its reference when we return */
+			g_object_ref(msg);
+			g_task_set_task_data(task, bytes, (GDestroyNotify)g_bytes_unref);
+			g_task_run_in_thread(task, json_parse_thread);
+			g_object_unref(task);
+			return;
+		}
+
 		parser = json_parser_new();
 		if (!json_parser_load_from_data(parser, msg->response_body->data, msg->response_body->length, &error)) {
 			g_warning("Error loading data: %s", error->message);
@@ -807,11 +1390,8 @@ static void soup_msg_cb(SoupSession *soup_sess, SoupMessage *msg, gpointer _cmsg
 		}
 	}
 
-	if (cmsg->cb)
-		cmsg->cb(cmsg->cxn, msg, node, cmsg->cb_data);
+	cmsg_complete(cmsg, msg, node);
 	g_clear_object(&parser);
-	g_free(cmsg);
-	g_object_unref(cxn);
 }
 
 SoupMessage *
@@ -819,17 +1399,105 @@ chime_connection_queue_http_request(ChimeConnection *self, JsonNode *node,
 				    SoupURI *uri, const gchar *method,
 				    ChimeSoupMessageCallback callback,
 				    gpointer cb_data)
+{
+	return chime_connection_queue_http_request_prio(self, node, uri, method,
+							CHIME_REQ_INTERACTIVE,
+							callback, cb_data);
+}
+
+SoupMessage *
+chime_connection_queue_http_request_prio(ChimeConnection *self, JsonNode *node,
+					 SoupURI *uri, const gchar *method,
+					 ChimeRequestPriority prio,
+					 ChimeSoupMessageCallback callback,
+					 gpointer cb_data)
+{
+	return chime_connection_queue_http_request_full(self, node, uri, method, prio,
+							NULL, callback, cb_data);
+}
+
+/* If the cancellable fires (or already has), the callback is called
+ * straight away with a SOUP_STATUS_CANCELLED message of its own. A request shared by several
+ * identical GETs is only cancelled once none of them want it. */
+SoupMessage *
+chime_connection_queue_http_request_full(ChimeConnection *self, JsonNode *node,
+					 SoupURI *uri, const gchar *method,
+					 ChimeRequestPriority prio,
+					 GCancellable *cancellable,
+					 ChimeSoupMessageCallback callback,
+					 gpointer cb_data)
 {
 	g_return_val_if_fail(CHIME_IS_CONNECTION(self), NULL);
 	g_return_val_if_fail(SOUP_URI_IS_VALID(uri), NULL);
+	g_return_val_if_fail(prio < CHIME_REQ_N_PRIORITIES, NULL);
 
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
-	struct chime_msg *cmsg = g_new0(struct chime_msg, 1);
+	struct chime_msg *cmsg;
+	SoupMessage *msg;
+	gchar *dedup_key = NULL;
+
+	/* Nothing is sent once we've disconnected, but the callback is still
+	 * called as if it had been cancelled, so that its caller can finish. */
+	if (!priv->host_reqs || g_cancellable_is_cancelled(cancellable)) {
+		msg = soup_message_new_from_uri(method, uri);
+		soup_uri_free(uri);
+		soup_message_set_status(msg, SOUP_STATUS_CANCELLED);
+		if (callback)
+			callback(self, msg, NULL, cb_data);
+		g_object_unref(msg);
+		return NULL;
+	}
+
+	/* A GET without a body is idempotent, so if the same one is already
+	 * outstanding then just wait for its response instead. */
+	if (!node && !strcmp(method, SOUP_METHOD_GET) && priv->msgs_by_uri) {
+		dedup_key = soup_uri_to_string(uri, FALSE);
+		cmsg = g_hash_table_lookup(priv->msgs_by_uri, dedup_key);
+		if (cmsg) {
+			struct chime_msg_dup *dup = g_new0(struct chime_msg_dup, 1);
+			dup->cmsg = cmsg;
+			dup->cb = callback;
+			dup->cb_data = cb_data;
+			if (cancellable) {
+				dup->cancel = g_object_ref(cancellable);
+				dup->cancel_id = g_signal_connect(cancellable, "cancelled",
+								  G_CALLBACK(dup_cancelled), dup);
+			}
+			cmsg->dups = g_slist_append(cmsg->dups, dup);
+
+			/* Promote it if it's still waiting and we're more urgent */
+			if (prio < cmsg->prio) {
+				gboolean waiting = cmsg_unqueue(priv, cmsg);
+
+				cmsg->prio = prio;
+				if (waiting) {
+					cmsg_enqueue(priv, cmsg);
+					chime_connection_dispatch_requests(self);
+				}
+			}
 
+			chime_connection_log(self, CHIME_LOGLVL_MISC, "Coalesced request for %s\n",
+					     dedup_key);
+			g_free(dedup_key);
+			soup_uri_free(uri);
+			return cmsg->msg;
+		}
+	}
+
+	cmsg = g_new0(struct chime_msg, 1);
 	cmsg->cxn = self;
 	cmsg->cb = callback;
 	cmsg->cb_data = cb_data;
-	cmsg->msg = soup_message_new_from_uri(method, uri);
+	cmsg->prio = prio;
+	if (cancellable) {
+		cmsg->cancel = g_object_ref(cancellable);
+		cmsg->cancel_id = g_signal_connect(cancellable, "cancelled",
+						   G_CALLBACK(cmsg_cancelled), cmsg);
+	}
+	cmsg->dedup_key = dedup_key;
+	if (dedup_key)
+		g_hash_table_insert(priv->msgs_by_uri, dedup_key, cmsg);
+	cmsg->msg = msg = soup_message_new_from_uri(method, uri);
 	soup_uri_free(uri);
 
 	if (priv->session_token) {
@@ -859,12 +1527,18 @@ chime_connection_queue_http_request(ChimeConnection *self, JsonNode *node,
 	if (cmsg->cb != renew_cb && !g_queue_is_empty(priv->msgs_pending_auth))
 		g_queue_push_tail(priv->msgs_pending_auth, cmsg);
 	else {
-		g_queue_push_tail(priv->msgs_queued, cmsg);
-		g_object_ref(self);
-		soup_session_queue_message(priv->soup_sess, cmsg->msg, soup_msg_cb, cmsg);
+		struct chime_host_reqs *h = host_reqs_get(priv, cmsg);
+
+		cmsg_enqueue(priv, cmsg);
+		chime_connection_dispatch_requests(self);
+		if (g_queue_find(&h->waiting[prio], cmsg))
+			chime_connection_log(self, CHIME_LOGLVL_MISC,
+					     "Deferred %p to %s (priority %d, %u waiting)\n",
+					     msg, soup_uri_get_path(soup_message_get_uri(msg)),
+					     prio, priv->msgs_waiting[prio]);
 	}
 
-	return cmsg->msg;
+	return msg;
 }
 
 void chime_connection_new_contact(ChimeConnection *cxn, ChimeContact *contact)
@@ -887,7 +1561,71 @@ void chime_connection_new_meeting(ChimeConnection *cxn, ChimeMeeting *meeting)
 	g_signal_emit(cxn, signals[NEW_MEETING], 0, meeting);
 }
 
-void chime_connection_log(ChimeConnection *cxn, ChimeLogLevel level, const gchar *format, ...)
+/* Messages below 'level' are not emitted at all, and with 'ratelimit'
+ * the noisiest ones (each websocket frame, etc.) are throttled. */
+void chime_connection_set_log_level(ChimeConnection *self, ChimeLogLevel level,
+				    gboolean ratelimit)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
+	g_return_if_fail(CHIME_IS_CONNECTION(self));
+
+	priv->log_level = level;
+	priv->log_ratelimit = ratelimit;
+}
+
+/* For when whether a message is wanted can change at any time, like
+ * when the user opens a debug window. */
+void chime_connection_set_log_filter(ChimeConnection *self, ChimeLogFilterFunc filter,
+				     gpointer user_data)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
+	g_return_if_fail(CHIME_IS_CONNECTION(self));
+
+	priv->log_filter = filter;
+	priv->log_filter_data = user_data;
+}
+
+gboolean chime_connection_log_enabled(ChimeConnection *cxn, ChimeLogLevel level)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+
+	return level >= priv->log_level &&
+		(!priv->log_filter || priv->log_filter(level, priv->log_filter_data)) &&
+		g_signal_has_handler_pending(cxn, signals[LOG_MESSAGE], 0, FALSE);
+}
+
+#define CHIME_LOG_BURST 10
+#define CHIME_LOG_INTERVAL 5
+
+gboolean chime_connection_log_ratelimit(ChimeConnection *cxn, ChimeLogLevel level,
+					ChimeLogRatelimit *rl)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	gint64 now;
+
+	if (!priv->log_ratelimit)
+		return TRUE;
+
+	now = g_get_monotonic_time();
+	if (now - rl->window_start >= CHIME_LOG_INTERVAL * G_USEC_PER_SEC) {
+		if (rl->suppressed)
+			chime_connection_log_real(cxn, level, "(%u similar messages suppressed)\n",
+						  rl->suppressed);
+		rl->window_start = now;
+		rl->count = 0;
+		rl->suppressed = 0;
+	}
+
+	if (rl->count < CHIME_LOG_BURST) {
+		rl->count++;
+		return TRUE;
+	}
+
+	rl->suppressed++;
+	return FALSE;
+}
+
+void chime_connection_log_real(ChimeConnection *cxn, ChimeLogLevel level, const gchar *format, ...)
 {
 	va_list args;
 	gchar *str;
@@ -904,6 +1642,26 @@ void chime_connection_progress(ChimeConnection *cxn, int percent, const gchar *m
 	g_signal_emit(cxn, signals[PROGRESS], 0, percent, message);
 }
 
+/* The same profile/room/conversation UUIDs turn up all over the place.
+ * Keep one copy of each for the lifetime of the connection; anything
+ * holding one must hold a reference to the connection too. */
+const gchar *chime_connection_intern(ChimeConnection *cxn, const gchar *str)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+
+	if (!str)
+		return NULL;
+
+	return g_string_chunk_insert_const(priv->intern_pool, str);
+}
+
+/* For hash tables keyed by interned strings, which are usually
+ * looked up with the same pointer */
+gboolean chime_id_equal(gconstpointer a, gconstpointer b)
+{
+	return a == b || !strcmp(a, b);
+}
+
 SoupURI *soup_uri_new_printf(const gchar *base, const gchar *format, ...)
 {
 	SoupURI *uri;
@@ -1006,14 +1764,87 @@ gboolean parse_string(JsonNode *parent, const gchar *name, const gchar **res)
 	return TRUE;
 }
 
+static gboolean parse_digits(const gchar *p, int n, int *val)
+{
+	*val = 0;
+	while (n--) {
+		if (!g_ascii_isdigit(*p))
+			return FALSE;
+		*val = *val * 10 + (*p++ - '0');
+	}
+	return TRUE;
+}
+
+/* Days since 1970-01-01 of a proleptic Gregorian date */
+static gint64 days_from_civil(int y, int m, int d)
+{
+	if (m <= 2)
+		y--;
+
+	int era = (y >= 0 ? y : y - 399) / 400;
+	int yoe = y - era * 400;
+	int doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+	int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return (gint64)era * 146097 + doe - 719468;
+}
+
+/* The server always gives us UTC times like '2017-05-12T09:23:51.813Z',
+ * so handle those directly and only fall back to the general parser for
+ * anything else. Returns microseconds since the epoch. */
+gboolean chime_parse_time_us(const gchar *str, gint64 *us)
+{
+	int Y, M, D, h, m, s;
+
+	if (!str)
+		return FALSE;
+
+	if (parse_digits(str, 4, &Y) && str[4] == '-' &&
+	    parse_digits(str + 5, 2, &M) && str[7] == '-' &&
+	    parse_digits(str + 8, 2, &D) && str[10] == 'T' &&
+	    parse_digits(str + 11, 2, &h) && str[13] == ':' &&
+	    parse_digits(str + 14, 2, &m) && str[16] == ':' &&
+	    parse_digits(str + 17, 2, &s) &&
+	    M >= 1 && M <= 12 && D >= 1 && D <= 31 && h < 24 && m < 60 && s < 61) {
+		const gchar *p = str + 19;
+		gint64 frac = 0;
+		int scale = G_USEC_PER_SEC;
+
+		if (*p == '.') {
+			for (p++; g_ascii_isdigit(*p); p++) {
+				if (scale > 1) {
+					scale /= 10;
+					frac += (*p - '0') * scale;
+				}
+			}
+		}
+		if (p[0] == 'Z' && !p[1]) {
+			*us = ((days_from_civil(Y, M, D) * 86400 + h * 3600 + m * 60 + s) *
+			       G_USEC_PER_SEC) + frac;
+			return TRUE;
+		}
+	}
+
+	GTimeVal tv;
+	if (!g_time_val_from_iso8601(str, &tv))
+		return FALSE;
+
+	*us = (gint64)tv.tv_sec * G_USEC_PER_SEC + tv.tv_usec;
+	return TRUE;
+}
+
 gboolean parse_time(JsonNode *parent, const gchar *name, const gchar **time_str, GTimeVal *tv)
 {
 	const gchar *msg_time;
+	gint64 us;
 
 	if (!parse_string(parent, name, &msg_time) ||
-	    !g_time_val_from_iso8601(msg_time, tv))
+	    !chime_parse_time_us(msg_time, &us))
 		return FALSE;
 
+	tv->tv_sec = us / G_USEC_PER_SEC;
+	tv->tv_usec = us % G_USEC_PER_SEC;
+
 	if (time_str)
 		*time_str = msg_time;
 
@@ -1146,10 +1977,18 @@ const gchar *chime_connection_get_email(ChimeConnection *self)
 struct fetch_msg_data {
 	ChimeObject *obj;
 	GHashTable *query;
+	ChimeRequestPriority prio;
+	/* For the local message store. If we're fetching the delta after
+	 * what it holds, resume is later than 'after' and the overlap must
+	 * not be emitted again. Fetched messages are kept in 'stored'. */
+	gint64 before, after, resume;
+	GPtrArray *stored;
 };
 static void free_fetch_msg_data(gpointer _fmd)
 {
 	struct fetch_msg_data *fmd = _fmd;
+	if (fmd->stored)
+		g_ptr_array_unref(fmd->stored);
 	g_hash_table_destroy(fmd->query);
 	g_object_unref(fmd->obj);
 	g_free(fmd);
@@ -1181,9 +2020,24 @@ static void fetch_messages_cb(ChimeConnection *self, SoupMessage *msg,
 
 		for (i = 0; i < len; i++) {
 			JsonNode *msg_node = json_array_get_element(msgs_array, i);
-			const gchar *id;
-			if (parse_string(msg_node, "MessageId", &id))
-				g_signal_emit_by_name(fmd->obj, "message", msg_node);
+			const gchar *id, *created;
+			gint64 created_us;
+
+			if (!parse_string(msg_node, "MessageId", &id))
+				continue;
+
+			if (fmd->stored)
+				g_ptr_array_add(fmd->stored, json_node_ref(msg_node));
+
+			/* The store already played up to 'resume'. If we can't
+			 * tell when a message was sent, better twice than never. */
+			if (fmd->resume > fmd->after &&
+			    parse_string(msg_node, "CreatedOn", &created) &&
+			    chime_parse_time_us(created, &created_us) &&
+			    created_us <= fmd->resume)
+				continue;
+
+			g_signal_emit_by_name(fmd->obj, "message", msg_node);
 		}
 
 		const gchar *next_token;
@@ -1193,6 +2047,10 @@ static void fetch_messages_cb(ChimeConnection *self, SoupMessage *msg,
 			return;
 		}
 
+		if (fmd->stored)
+			chime_msgstore_append(self, fmd->obj, fmd->resume,
+					      fmd->before, fmd->stored);
+
 		g_task_return_boolean(task, TRUE);
 	}
 	g_object_unref(task);
@@ -1207,10 +2065,38 @@ static void fetch_messages_req(ChimeConnection *self, GTask *task)
 					   CHIME_IS_ROOM(fmd->obj) ? "room" : "conversation",
 					   chime_object_get_id(fmd->obj));
 	soup_uri_set_query_from_form(uri, fmd->query);
-	chime_connection_queue_http_request(self, NULL, uri, "GET", fetch_messages_cb, task);
+	chime_connection_queue_http_request_prio(self, NULL, uri, "GET", fmd->prio,
+						 fetch_messages_cb, task);
 
 }
 
+/* Play what we have locally, then fetch only what the store lacks. This
+ * happens from idle because callers expect the messages to arrive after
+ * chime_connection_fetch_messages_async() has returned. */
+static gboolean fetch_messages_stored(gpointer _task)
+{
+	GTask *task = G_TASK(_task);
+	ChimeConnection *self = CHIME_CONNECTION(g_task_get_source_object(task));
+	struct fetch_msg_data *fmd = g_task_get_task_data(task);
+
+	if (chime_msgstore_replay(self, fmd->obj, fmd->before, fmd->after, &fmd->resume)) {
+		g_task_return_boolean(task, TRUE);
+		g_object_unref(task);
+		return G_SOURCE_REMOVE;
+	}
+
+	if (fmd->resume >= 0)
+		fmd->stored = g_ptr_array_new_with_free_func((GDestroyNotify)json_node_unref);
+
+	if (fmd->resume > fmd->after) {
+		GTimeVal tv = { fmd->resume / G_USEC_PER_SEC, fmd->resume % G_USEC_PER_SEC };
+		g_hash_table_insert(fmd->query, (void *)"after", g_time_val_to_iso8601(&tv));
+	}
+
+	fetch_messages_req(self, task);
+	return G_SOURCE_REMOVE;
+}
+
 void chime_connection_fetch_messages_async(ChimeConnection *self,
 					   ChimeObject *obj,
 					   const gchar *before,
@@ -1231,7 +2117,28 @@ void chime_connection_fetch_messages_async(ChimeConnection *self,
 	if (after)
 		g_hash_table_insert(fmd->query, (void *)"after", g_strdup(after));
 
+	/* Active conversations get their history ahead of the long tail,
+	 * and a room with its chat open is being waited for */
+	fmd->prio = CHIME_REQ_BACKGROUND;
+	if (CHIME_IS_CONVERSATION(obj)) {
+		chime_conversation_hydrate(self, CHIME_CONVERSATION(obj));
+		if (chime_conversation_is_active(CHIME_CONVERSATION(obj)))
+			fmd->prio = CHIME_REQ_PRESENCE;
+	} else if (CHIME_IS_ROOM(obj) && chime_room_is_open(CHIME_ROOM(obj))) {
+		fmd->prio = CHIME_REQ_INTERACTIVE;
+	}
+
 	g_task_set_task_data(task, fmd, free_fetch_msg_data);
+
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
+	if (priv->message_store && priv->cache_dir &&
+	    (!before || chime_parse_time_us(before, &fmd->before)) &&
+	    (!after || chime_parse_time_us(after, &fmd->after))) {
+		g_idle_add(fetch_messages_stored, task);
+		return;
+	}
+
+	fmd->resume = -1;
 	fetch_messages_req(self, task);
 }
 
@@ -1245,7 +2152,99 @@ chime_connection_fetch_messages_finish(ChimeConnection *self, GAsyncResult *resu
 	return g_task_propagate_boolean(G_TASK(result), error);
 }
 
+/* A single message, fresh from the server and not from the local store,
+ * for when its presigned attachment URLs may have expired. It is found
+ * by asking for the messages either side of its CreatedOn. */
+static void fetch_message_cb(ChimeConnection *self, SoupMessage *msg,
+			     JsonNode *node, gpointer user_data)
+{
+	GTask *task = G_TASK(user_data);
+	const gchar *msg_id = g_task_get_task_data(task);
 
+	if (!SOUP_STATUS_IS_SUCCESSFUL(msg->status_code) || !node) {
+		const gchar *reason = msg->reason_phrase;
+
+		if (node)
+			parse_string(node, "error", &reason);
+
+		g_task_return_new_error(task, CHIME_ERROR,
+					CHIME_ERROR_NETWORK,
+					_("Failed to fetch message: %d %s"),
+					msg->status_code, reason);
+		g_object_unref(task);
+		return;
+	}
+
+	JsonObject *obj = json_node_get_object(node);
+	JsonNode *msgs_node = json_object_get_member(obj, "Messages");
+	if (msgs_node && JSON_NODE_HOLDS_ARRAY(msgs_node)) {
+		JsonArray *msgs_array = json_node_get_array(msgs_node);
+		guint i, len = json_array_get_length(msgs_array);
+
+		for (i = 0; i < len; i++) {
+			JsonNode *msg_node = json_array_get_element(msgs_array, i);
+			const gchar *id;
+
+			if (parse_string(msg_node, "MessageId", &id) && !strcmp(id, msg_id)) {
+				g_task_return_pointer(task, json_node_ref(msg_node),
+						      (GDestroyNotify)json_node_unref);
+				g_object_unref(task);
+				return;
+			}
+		}
+	}
+	g_task_return_new_error(task, CHIME_ERROR, CHIME_ERROR_BAD_RESPONSE,
+				_("Message %s not found"), msg_id);
+	g_object_unref(task);
+}
+
+void chime_connection_fetch_message_async(ChimeConnection *self,
+					  ChimeObject *obj,
+					  const gchar *msg_id,
+					  const gchar *created_on,
+					  GCancellable *cancellable,
+					  GAsyncReadyCallback callback,
+					  gpointer user_data)
+{
+	g_return_if_fail(CHIME_IS_CONNECTION(self));
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
+
+	GTask *task = g_task_new(self, cancellable, callback, user_data);
+	g_task_set_task_data(task, g_strdup(msg_id), g_free);
+
+	gint64 created_us;
+	if (!chime_parse_time_us(created_on, &created_us)) {
+		g_task_return_new_error(task, CHIME_ERROR, CHIME_ERROR_REQUEST_FAILED,
+					_("Invalid message time %s"), created_on);
+		g_object_unref(task);
+		return;
+	}
+
+	GTimeVal before_tv = { created_us / G_USEC_PER_SEC + 1, created_us % G_USEC_PER_SEC };
+	GTimeVal after_tv = { created_us / G_USEC_PER_SEC - 1, created_us % G_USEC_PER_SEC };
+	gchar *before = g_time_val_to_iso8601(&before_tv);
+	gchar *after = g_time_val_to_iso8601(&after_tv);
+
+	SoupURI *uri = soup_uri_new_printf(priv->messaging_url, "/%ss/%s/messages",
+					   CHIME_IS_ROOM(obj) ? "room" : "conversation",
+					   chime_object_get_id(obj));
+	soup_uri_set_query_from_fields(uri, "before", before, "after", after,
+				       "max-results", "50", NULL);
+	chime_connection_queue_http_request_full(self, NULL, uri, "GET", CHIME_REQ_INTERACTIVE,
+						 cancellable, fetch_message_cb, task);
+	g_free(before);
+	g_free(after);
+}
+
+JsonNode *
+chime_connection_fetch_message_finish(ChimeConnection *self, GAsyncResult *result,
+				      GError **error)
+{
+	g_return_val_if_fail(CHIME_IS_CONNECTION(self), NULL);
+	g_return_val_if_fail(g_task_is_valid(result, self), NULL);
+
+	return g_task_propagate_pointer(G_TASK(result), error);
+}
 
 static void update_last_read_cb(ChimeConnection *self, SoupMessage *msg,
 				JsonNode *node, gpointer user_data)
@@ -1275,6 +2274,11 @@ void chime_connection_update_last_read_async (ChimeConnection    *self,
 	g_return_if_fail(CHIME_IS_CONNECTION(self));
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
 
+	if (CHIME_IS_ROOM(obj))
+		chime_room_messages_read(CHIME_ROOM(obj), msg_id);
+	else
+		chime_conversation_messages_read(CHIME_CONVERSATION(obj), msg_id);
+
 	GTask *task = g_task_new(self, cancellable, callback, user_data);
 
 	JsonBuilder *jb = json_builder_new();
@@ -50,6 +50,19 @@ typedef enum {
 	CHIME_LOGLVL_FATAL
 } ChimeLogLevel;
 
+/* Asked before each message at or above the connection's log level is
+ * formatted, for whether anyone will see it. */
+typedef gboolean (*ChimeLogFilterFunc)(ChimeLogLevel level, gpointer user_data);
+
+/* Priority classes for HTTP requests. Lower values are more urgent, and
+ * get a larger share of the per-host connection slots. */
+typedef enum {
+	CHIME_REQ_INTERACTIVE,
+	CHIME_REQ_PRESENCE,
+	CHIME_REQ_BACKGROUND,
+	CHIME_REQ_N_PRIORITIES
+} ChimeRequestPriority;
+
 typedef void (*ChimeSoupMessageCallback)(ChimeConnection *cxn,
 					 SoupMessage *msg,
 					 JsonNode *node,
@@ -83,9 +96,30 @@ gboolean         chime_connection_set_device_status_finish   (ChimeConnection  *
 
 const gchar     *chime_connection_get_session_token          (ChimeConnection  *self);
 
+void             chime_connection_set_log_level              (ChimeConnection  *self,
+                                                              ChimeLogLevel     level,
+                                                              gboolean          ratelimit);
+
+void             chime_connection_set_log_filter             (ChimeConnection  *self,
+                                                              ChimeLogFilterFunc filter,
+                                                              gpointer          user_data);
+
+guint            chime_connection_get_queue_depth            (ChimeConnection  *self,
+                                                              ChimeRequestPriority prio);
+
+guint            chime_connection_get_requests_in_flight     (ChimeConnection  *self);
+
+JsonNode        *chime_connection_get_metrics                (ChimeConnection  *self);
+
 void             chime_connection_set_session_token          (ChimeConnection  *self,
                                                               const gchar      *sess_tok);
 
+void             chime_connection_set_cache_dir              (ChimeConnection  *self,
+                                                              const gchar      *dir);
+
+void             chime_connection_set_message_store          (ChimeConnection  *self,
+                                                              gboolean          enabled);
+
 
 void chime_connection_signin (ChimeConnection *self);
 void chime_connection_authenticate (ChimeConnection *self,
@@ -109,6 +143,7 @@ void chime_connection_disconnect(ChimeConnection *cxn);
 gboolean parse_int(JsonNode *node, const gchar *member, gint64 *val);
 gboolean parse_string(JsonNode *parent, const gchar *name, const gchar **res);
 gboolean parse_time(JsonNode *parent, const gchar *name, const gchar **time_str, GTimeVal *tv);
+gboolean chime_parse_time_us(const gchar *str, gint64 *us);
 gboolean parse_boolean(JsonNode *node, const gchar *member, gboolean *val);
 G_END_DECLS
 
@@ -48,8 +48,18 @@ struct _ChimeContact {
 
 	ChimeAvailability availability;
 	gint64 avail_revision;
+	gint64 avail_updated;	/* Monotonic time we last heard its presence */
+	gboolean presence_queued;	/* On priv->contacts_needed */
+	GSList *index_entries;
 };
 
+/* Profile IDs per GET /presence request, to keep the URL sane */
+#define CHIME_PRESENCE_BATCH 100
+
+/* If we have heard a contact's presence within this long (in seconds),
+ * there is no need to ask for it again when it is next queued. */
+#define CHIME_PRESENCE_REFRESH (15 * 60)
+
 G_DEFINE_TYPE(ChimeContact, chime_contact, CHIME_TYPE_OBJECT)
 
 #define CHIME_AVAILABILITY_VALUES \
@@ -273,22 +283,188 @@ gboolean chime_contact_get_contacts_list(ChimeContact *contact)
 	return !chime_object_is_dead(CHIME_OBJECT(contact));
 }
 
+static void queue_presence_fetch(ChimeConnection *cxn, ChimeContact *contact)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE(cxn);
+
+	if (contact->presence_queued)
+		return;
+
+	contact->presence_queued = TRUE;
+	priv->contacts_needed = g_slist_prepend(priv->contacts_needed, contact);
+	if (!priv->contacts_src_id)
+		priv->contacts_src_id = g_idle_add(fetch_presences, g_object_ref(cxn));
+}
+
 static void
 subscribe_contact(ChimeConnection *cxn, ChimeContact *contact)
 {
-	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE(cxn);
+	if (!cxn)
+		return;
 
 	contact->cxn = cxn;
 
-	if (contact->presence_channel)
+	/* Without a channel there is nothing to unsubscribe from later;
+	 * we'll be back when chime_contact_get_availability() next asks. */
+	if (contact->presence_channel) {
 		chime_jugg_subscribe(cxn, contact->presence_channel, "Presence",
 				     contact_presence_jugg_cb, contact);
+		contact->subscribed = TRUE;
+	}
 
 	/* As well as subscribing to the channel, we'll need to fetch the
 	 * initial presence information for this contact */
-	priv->contacts_needed = g_slist_prepend(priv->contacts_needed, contact);
-	if (!priv->contacts_src_id)
-		priv->contacts_src_id = g_idle_add(fetch_presences, g_object_ref(cxn));
+	queue_presence_fetch(cxn, contact);
+}
+
+/*
+ * Local prefix index for autocompletion, over the casefolded email address
+ * and each word of the full and display names of every contact we know.
+ * New entries are appended and the array is only re-sorted when it is
+ * next searched; entries for contacts which go away are left with a NULL
+ * contact and dropped at the next sort.
+ */
+struct contact_index_entry {
+	gchar *key;
+	ChimeContact *contact;
+};
+
+/* Enough for any sensible completion list */
+#define CHIME_AUTOCOMPLETE_MAX 20
+
+static void free_index_entry(gpointer _e)
+{
+	struct contact_index_entry *e = _e;
+
+	g_free(e->key);
+	g_free(e);
+}
+
+static void add_index_entry(ChimeConnectionPrivate *priv, ChimeContact *contact,
+			    const gchar *str)
+{
+	struct contact_index_entry *e = g_new0(struct contact_index_entry, 1);
+
+	e->key = g_utf8_casefold(str, -1);
+	e->contact = contact;
+	g_ptr_array_add(priv->contact_index, e);
+	contact->index_entries = g_slist_prepend(contact->index_entries, e);
+	priv->contact_index_dirty = TRUE;
+}
+
+static void add_index_words(ChimeConnectionPrivate *priv, ChimeContact *contact,
+			    const gchar *str)
+{
+	gchar **words;
+	int i;
+
+	if (!str)
+		return;
+
+	words = g_strsplit_set(str, " \t,()", -1);
+	for (i = 0; words[i]; i++) {
+		if (*words[i])
+			add_index_entry(priv, contact, words[i]);
+	}
+	g_strfreev(words);
+}
+
+static void unindex_contact(ChimeContact *contact)
+{
+	while (contact->index_entries) {
+		struct contact_index_entry *e = contact->index_entries->data;
+
+		e->contact = NULL;
+		contact->index_entries = g_slist_delete_link(contact->index_entries,
+							     contact->index_entries);
+	}
+}
+
+static void index_contact(ChimeConnection *cxn, ChimeContact *contact)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE(cxn);
+	const gchar *email = chime_object_get_name(CHIME_OBJECT(contact));
+
+	if (!priv->contact_index)
+		return;
+
+	unindex_contact(contact);
+	if (email)
+		add_index_entry(priv, contact, email);
+	add_index_words(priv, contact, contact->full_name);
+	add_index_words(priv, contact, contact->display_name);
+}
+
+static gint index_entry_cmp(gconstpointer _a, gconstpointer _b)
+{
+	const struct contact_index_entry *a = *(struct contact_index_entry **)_a;
+	const struct contact_index_entry *b = *(struct contact_index_entry **)_b;
+
+	return strcmp(a->key, b->key);
+}
+
+static void sort_contact_index(ChimeConnectionPrivate *priv)
+{
+	guint i, j;
+
+	if (!priv->contact_index_dirty)
+		return;
+
+	for (i = j = 0; i < priv->contact_index->len; i++) {
+		struct contact_index_entry *e = g_ptr_array_index(priv->contact_index, i);
+		if (e->contact)
+			priv->contact_index->pdata[j++] = e;
+		else
+			free_index_entry(e);
+	}
+	g_ptr_array_set_size(priv->contact_index, j);
+
+	g_ptr_array_sort(priv->contact_index, index_entry_cmp);
+	priv->contact_index_dirty = FALSE;
+}
+
+/* Returns a list of referenced contacts, as the server lookup does */
+static GSList *autocomplete_local(ChimeConnection *cxn, const gchar *query)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE(cxn);
+	GSList *results = NULL;
+	guint lo, hi, nr = 0;
+	gsize len;
+
+	if (!priv->contact_index || !query || !*query)
+		return NULL;
+
+	sort_contact_index(priv);
+
+	gchar *key = g_utf8_casefold(query, -1);
+	len = strlen(key);
+
+	/* Find the first entry >= key */
+	lo = 0;
+	hi = priv->contact_index->len;
+	while (lo < hi) {
+		guint mid = (lo + hi) / 2;
+		struct contact_index_entry *e = g_ptr_array_index(priv->contact_index, mid);
+		if (strcmp(e->key, key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (; lo < priv->contact_index->len && nr < CHIME_AUTOCOMPLETE_MAX; lo++) {
+		struct contact_index_entry *e = g_ptr_array_index(priv->contact_index, lo);
+
+		if (strncmp(e->key, key, len))
+			break;
+		if (!e->contact || g_slist_find(results, e->contact))
+			continue;
+
+		results = g_slist_append(results, g_object_ref(e->contact));
+		nr++;
+	}
+
+	g_free(key);
+	return results;
 }
 
 static ChimeContact *find_or_create_contact(ChimeConnection *cxn, const gchar *id,
@@ -319,26 +495,34 @@ static ChimeContact *find_or_create_contact(ChimeConnection *cxn, const gchar *i
 		if (!is_contact)
 			g_object_ref(contact);
 		chime_object_collection_hash_object(&priv->contacts, CHIME_OBJECT(contact), is_contact);
+		index_contact(cxn, contact);
 
 		chime_connection_new_contact(cxn, contact);
 
 		return contact;
 	}
 
+	gboolean reindex = FALSE;
+
 	/* This should never happen? */
 	if (email && g_strcmp0(email, chime_object_get_name(CHIME_OBJECT(contact)))) {
 		chime_object_rename(CHIME_OBJECT(contact), email);
+		reindex = TRUE;
 	}
 	if (full_name && g_strcmp0(full_name, contact->full_name)) {
 		g_free(contact->full_name);
 		contact->full_name = g_strdup(full_name);
 		g_object_notify(G_OBJECT(contact), "full-name");
+		reindex = TRUE;
 	}
 	if (display_name && g_strcmp0(display_name, contact->display_name)) {
 		g_free(contact->display_name);
 		contact->display_name = g_strdup(display_name);
 		g_object_notify(G_OBJECT(contact), "display-name");
+		reindex = TRUE;
 	}
+	if (reindex)
+		index_contact(cxn, contact);
 
 	if (presence_channel && !contact->presence_channel) {
 		contact->presence_channel = g_strdup(presence_channel);
@@ -381,9 +565,19 @@ ChimeContact *chime_connection_parse_contact(ChimeConnection *cxn, gboolean is_c
 	parse_string(node, "presence_channel", &presence_channel);
 	parse_string(node, "profile_channel", &profile_channel);
 
-	return find_or_create_contact(cxn, profile_id, presence_channel,
-				      profile_channel, email, full_name,
-				      display_name, is_contact, error);
+	ChimeContact *contact = find_or_create_contact(cxn, profile_id, presence_channel,
+						       profile_channel, email, full_name,
+						       display_name, is_contact, error);
+	if (contact && is_contact)
+		chime_object_set_snapshot_node(CHIME_OBJECT(contact), node);
+
+	return contact;
+}
+
+static ChimeObject *parse_snapshot_contact(ChimeConnection *cxn, JsonNode *node,
+					   GError **error)
+{
+	return (ChimeObject *)chime_connection_parse_contact(cxn, TRUE, node, error);
 }
 
 /* Returns a ChimeContact which is not necessarily in the contacts list,
@@ -446,6 +640,8 @@ static gboolean set_contact_presence(ChimeConnection *cxn, JsonNode *node,
 		return FALSE;
 	}
 
+	contact->avail_updated = g_get_monotonic_time();
+
 	/* We already have newer data */
 	if (revision < contact->avail_revision)
 		return TRUE;
@@ -488,39 +684,83 @@ static void presence_cb(ChimeConnection *cxn, SoupMessage *msg,
 		set_contact_presence(cxn, json_array_get_element(arr, i), NULL);
 }
 
+static void send_presence_query(ChimeConnection *cxn, const gchar *ids)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+
+	SoupURI *uri = soup_uri_new_printf(priv->presence_url, "/presence");
+	soup_uri_set_query_from_fields(uri, "profile-ids", ids, NULL);
+
+	chime_connection_queue_http_request_prio(cxn, NULL, uri, "GET",
+						 CHIME_REQ_PRESENCE,
+						 presence_cb, NULL);
+}
+
+static gboolean presence_is_fresh(ChimeContact *contact, gint64 now)
+{
+	return contact->avail_revision && contact->avail_updated &&
+		now - contact->avail_updated < CHIME_PRESENCE_REFRESH * G_USEC_PER_SEC;
+}
+
+/* Ask for the presence of the contacts we don't know (or haven't heard
+ * about for a while), in batches. The request scheduler runs several of
+ * those concurrently. */
 static gboolean fetch_presences(gpointer _cxn)
 {
 	ChimeConnection *cxn = _cxn;
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
-	GPtrArray *ids = g_ptr_array_new();
+	GString *ids = g_string_new(NULL);
+	gint64 now = g_get_monotonic_time();
+	int n = 0;
 
 	while (priv->contacts_needed) {
 		ChimeContact *contact = priv->contacts_needed->data;
-		priv->contacts_needed = g_slist_remove(priv->contacts_needed,
-						       contact);
-		if (!contact || contact->avail_revision)
+		priv->contacts_needed = g_slist_delete_link(priv->contacts_needed,
+							    priv->contacts_needed);
+		contact->presence_queued = FALSE;
+		if (presence_is_fresh(contact, now))
 			continue;
 
-		g_ptr_array_add(ids, (gpointer)chime_object_get_id(CHIME_OBJECT(contact)));
+		if (n)
+			g_string_append_c(ids, ',');
+		g_string_append(ids, chime_object_get_id(CHIME_OBJECT(contact)));
+		if (++n == CHIME_PRESENCE_BATCH) {
+			send_presence_query(cxn, ids->str);
+			g_string_truncate(ids, 0);
+			n = 0;
+		}
 	}
-	if (ids->len > 0) {
-		g_ptr_array_add(ids, NULL);
+	if (n)
+		send_presence_query(cxn, ids->str);
 
-		gchar *query = g_strjoinv(",", (gchar **)ids->pdata);
-
-		SoupURI *uri = soup_uri_new_printf(priv->presence_url, "/presence");
-		soup_uri_set_query_from_fields(uri, "profile-ids", query, NULL);
-		g_free(query);
-
-		chime_connection_queue_http_request(cxn, NULL, uri, "GET",
-						    presence_cb, NULL);
-	}
-	g_ptr_array_unref(ids);
+	g_string_free(ids, TRUE);
 	priv->contacts_src_id = 0;
 	g_object_unref(cxn);
 	return FALSE;
 }
 
+static void refresh_contact_presence(gpointer _id, gpointer _contact, gpointer _unused)
+{
+	ChimeContact *contact = _contact;
+
+	if (contact->subscribed && contact->cxn) {
+		contact->avail_updated = 0;
+		queue_presence_fetch(contact->cxn, contact);
+	}
+}
+
+/* Presence updates sent while the websocket was down are lost, so when it
+ * comes back ask again for everyone we are watching. While it stays up,
+ * the juggernaut channels are all we need. */
+void chime_refresh_presences(ChimeConnection *cxn)
+{
+	g_return_if_fail(CHIME_IS_CONNECTION(cxn));
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+
+	if (priv->contacts.by_id)
+		g_hash_table_foreach(priv->contacts.by_id, refresh_contact_presence, NULL);
+}
+
 static void fetch_contacts(ChimeConnection *cxn, const gchar *next_token);
 
 static void contacts_cb(ChimeConnection *cxn, SoupMessage *msg, JsonNode *node,
@@ -552,6 +792,7 @@ static void contacts_cb(ChimeConnection *cxn, SoupMessage *msg, JsonNode *node,
 			priv->contacts_sync = CHIME_SYNC_IDLE;
 
 			chime_object_collection_expire_outdated(&priv->contacts);
+			chime_object_collection_save_snapshot(&priv->contacts);
 
 			if (!priv->contacts_online) {
 				priv->contacts_online = TRUE;
@@ -593,8 +834,9 @@ static void fetch_contacts(ChimeConnection *cxn, const gchar *next_token)
 	if (next_token)
 		soup_uri_set_query_from_fields(uri, "next_token", next_token, NULL);
 
-	chime_connection_queue_http_request(cxn, NULL, uri, "GET", contacts_cb,
-					    NULL);
+	chime_connection_queue_http_request_prio(cxn, NULL, uri, "GET",
+						 CHIME_REQ_BACKGROUND, contacts_cb,
+						 NULL);
 }
 
 void chime_init_contacts(ChimeConnection *cxn)
@@ -603,6 +845,13 @@ void chime_init_contacts(ChimeConnection *cxn)
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
 
 	chime_object_collection_init(cxn, &priv->contacts);
+	priv->contact_index = g_ptr_array_new();
+
+	/* If we have a snapshot, consider ourselves online immediately and
+	 * let the fetch reconcile it in the background. */
+	if (chime_object_collection_load_snapshot(&priv->contacts, "contacts",
+						  parse_snapshot_contact))
+		priv->contacts_online = TRUE;
 
 	fetch_contacts(cxn, NULL);
 }
@@ -615,6 +864,8 @@ static void unsubscribe_contact(gpointer key, gpointer val, gpointer data)
 
 		priv->contacts_needed = g_slist_remove(priv->contacts_needed,
 						       contact);
+		contact->presence_queued = FALSE;
+		unindex_contact(contact);
 
 		if (contact->subscribed)
 			chime_jugg_unsubscribe(contact->cxn, contact->presence_channel, "Presence",
@@ -640,6 +891,11 @@ void chime_destroy_contacts(ChimeConnection *cxn)
 	if (priv->contacts.by_id)
 		g_hash_table_foreach(priv->contacts.by_id, unsubscribe_contact, NULL);
 
+	if (priv->contact_index) {
+		g_ptr_array_foreach(priv->contact_index, (GFunc)free_index_entry, NULL);
+		g_ptr_array_unref(priv->contact_index);
+		priv->contact_index = NULL;
+	}
 	chime_object_collection_destroy(&priv->contacts);
 }
 
@@ -808,13 +1064,33 @@ gboolean chime_connection_remove_contact_finish(ChimeConnection *self,
 	return g_task_propagate_boolean(G_TASK(result), error);
 }
 
+static void free_contact_list(gpointer list)
+{
+	g_slist_free_full(list, g_object_unref);
+}
+
+/* An address which doesn't belong to anyone we know may be someone else */
+static gboolean wants_server_lookup(const gchar *query, GSList *local)
+{
+	if (!strchr(query, '@'))
+		return FALSE;
+
+	for (; local; local = local->next) {
+		if (!g_ascii_strcasecmp(query, chime_contact_get_email(local->data)))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/* The local matches come first, followed by anyone else the server found */
 static void autocomplete_cb(ChimeConnection *cxn, SoupMessage *msg,
 			    JsonNode *node, gpointer user_data)
 {
 	GTask *task = G_TASK(user_data);
+	GSList *local = g_task_get_task_data(task);
+	GSList *results = g_slist_copy_deep(local, (GCopyFunc)g_object_ref, NULL);
 
 	if (SOUP_STATUS_IS_SUCCESSFUL(msg->status_code) && node) {
-		GSList *results = NULL;
 		ChimeContact *contact;
 
 		JsonArray *arr = json_node_get_array(node);
@@ -824,10 +1100,17 @@ static void autocomplete_cb(ChimeConnection *cxn, SoupMessage *msg,
 			contact = chime_connection_parse_contact(cxn, FALSE,
 								 json_array_get_element(arr, i),
 								 NULL);
-			if (contact)
+			if (!contact)
+				continue;
+			if (g_slist_find(local, contact))
+				g_object_unref(contact);
+			else
 				results = g_slist_append(results, contact);
 		}
 		g_task_return_pointer(task, results, NULL);
+	} else if (results) {
+		/* What we already know is better than nothing */
+		g_task_return_pointer(task, results, NULL);
 	} else {
 		const gchar *reason = msg->reason_phrase;
 
@@ -853,6 +1136,18 @@ void chime_connection_autocomplete_contact_async(ChimeConnection *cxn,
 
 	GTask *task = g_task_new(cxn, cancellable, callback, user_data);
 
+	/* Known people are answered from the index without a round trip.
+	 * The server is only asked when nobody matches, or when the query
+	 * is an address which none of the matches has, and its matches
+	 * are then merged in after ours. */
+	GSList *local = autocomplete_local(cxn, query);
+	if (local && !wants_server_lookup(query, local)) {
+		g_task_return_pointer(task, local, NULL);
+		g_object_unref(task);
+		return;
+	}
+	g_task_set_task_data(task, local, free_contact_list);
+
 	SoupURI *uri = soup_uri_new_printf(priv->express_url, "/bazl/contact-auto-completes");
 	JsonBuilder *jb = json_builder_new();
 	jb = json_builder_begin_object(jb);
@@ -23,6 +23,10 @@
 
 #include <glib/gi18n.h>
 
+/* Conversations updated more recently than this are subscribed to at
+ * once; the rest are left until they are first used. */
+#define CHIME_CONV_ACTIVE_AGE (7 * 86400)
+
 #define BOOL_PROPS(x)							\
 	x(favourite, FAVOURITE, "Favorite", "favourite", "favourite", TRUE)
 
@@ -33,6 +37,7 @@
 	x(last_sent, LAST_SENT, "LastSent", "last-sent", "last sent", FALSE)
 
 #define CHIME_PROP_OBJ_VAR conversation
+#define CHIME_PROP_STR_CHANGED(obj) conversation_times_changed(obj)
 #include "chime-props.h"
 
 enum
@@ -44,6 +49,8 @@ enum
 
 	PROP_MOBILE_NOTIFICATION_PREFS,
 	PROP_DESKTOP_NOTIFICATION_PREFS,
+	PROP_UNREAD_COUNT,
+	PROP_MENTION_COUNT,
 	LAST_PROP,
 };
 
@@ -69,6 +76,24 @@ struct _ChimeConversation {
 
 	CHIME_PROPS_VARS;
 
+	/* Parsed from the strings above when next needed; 0 if absent */
+	gboolean times_valid;
+	gint64 last_sent_us, updated_on_us;
+
+	/* Our key in priv->conversations_by_members */
+	gchar *members_key;
+
+	/* In priv->recent_conversations, sorted by recent_us */
+	GSequenceIter *recent_iter;
+	gint64 recent_us;
+
+	/* Messages from others since the newest we've read, counted as they
+	 * arrive. There's no LastRead for conversations, so only our own
+	 * reads and sends clear them. */
+	guint unread_count, mention_count;
+	gint64 newest_us;
+	gchar *newest_id;
+
 	ChimeNotifyPref mobile_notification;
 	ChimeNotifyPref desktop_notification;
 };
@@ -83,6 +108,19 @@ chime_conversation_dispose(GObject *object)
 	ChimeConversation *self = CHIME_CONVERSATION(object);
 
 	unsubscribe_conversation(NULL, self, NULL);
+	if (self->recent_iter) {
+		g_sequence_remove(self->recent_iter);
+		self->recent_iter = NULL;
+	}
+	if (self->members_key) {
+		ChimeConnection *cxn = chime_object_get_connection(CHIME_OBJECT(self));
+		ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE(cxn);
+
+		if (priv->conversations_by_members &&
+		    g_hash_table_lookup(priv->conversations_by_members, self->members_key) == self)
+			g_hash_table_remove(priv->conversations_by_members, self->members_key);
+		g_clear_pointer(&self->members_key, g_free);
+	}
 	if (self->members) {
 		g_hash_table_destroy(self->members);
 		self->members = NULL;
@@ -99,6 +137,8 @@ chime_conversation_finalize(GObject *object)
 
 	CHIME_PROPS_FREE
 
+	g_free(self->newest_id);
+
 	G_OBJECT_CLASS(chime_conversation_parent_class)->finalize(object);
 }
 
@@ -120,6 +160,12 @@ static void chime_conversation_get_property(GObject *object, guint prop_id,
 	case PROP_DESKTOP_NOTIFICATION_PREFS:
 		g_value_set_enum(value, self->desktop_notification);
 		break;
+	case PROP_UNREAD_COUNT:
+		g_value_set_uint(value, self->unread_count);
+		break;
+	case PROP_MENTION_COUNT:
+		g_value_set_uint(value, self->mention_count);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
 		break;
@@ -131,6 +177,8 @@ static void chime_conversation_set_property(GObject *object, guint prop_id,
 {
 	ChimeConversation *self = CHIME_CONVERSATION(object);
 
+	self->times_valid = FALSE;
+
 	switch (prop_id) {
 	case PROP_VISIBILITY:
 		self->visibility = g_value_get_boolean(value);
@@ -190,6 +238,22 @@ static void chime_conversation_class_init(ChimeConversationClass *klass)
 				  G_PARAM_CONSTRUCT |
 				  G_PARAM_STATIC_STRINGS);
 
+	props[PROP_UNREAD_COUNT] =
+		g_param_spec_uint("unread-count",
+				  "unread count",
+				  "unread count",
+				  0, G_MAXUINT, 0,
+				  G_PARAM_READABLE |
+				  G_PARAM_STATIC_STRINGS);
+
+	props[PROP_MENTION_COUNT] =
+		g_param_spec_uint("mention-count",
+				  "mention count",
+				  "mention count",
+				  0, G_MAXUINT, 0,
+				  G_PARAM_READABLE |
+				  G_PARAM_STATIC_STRINGS);
+
 	g_object_class_install_properties(object_class, LAST_PROP, props);
 
 	signals[TYPING] =
@@ -282,6 +346,143 @@ const gchar *chime_conversation_get_created_on(ChimeConversation *self)
 	return self->created_on;
 }
 
+static gint64 time_us(const gchar *str)
+{
+	gint64 us;
+
+	return chime_parse_time_us(str, &us) ? us : 0;
+}
+
+static void update_times(ChimeConversation *self)
+{
+	if (self->times_valid)
+		return;
+
+	self->last_sent_us = time_us(self->last_sent);
+	self->updated_on_us = time_us(self->updated_on);
+	self->times_valid = TRUE;
+}
+
+static gint compare_recent(gconstpointer _a, gconstpointer _b, gpointer unused)
+{
+	const ChimeConversation *a = _a, *b = _b;
+
+	if (a->recent_us != b->recent_us)
+		return (a->recent_us < b->recent_us) - (a->recent_us > b->recent_us);
+
+	return g_strcmp0(chime_object_get_id(CHIME_OBJECT(a)),
+			 chime_object_get_id(CHIME_OBJECT(b)));
+}
+
+/* Move it to its new place in the index, if UpdatedOn changed */
+static void conversation_times_changed(ChimeConversation *self)
+{
+	self->times_valid = FALSE;
+
+	if (!self->recent_iter)
+		return;
+
+	update_times(self);
+	if (self->recent_us != self->updated_on_us) {
+		self->recent_us = self->updated_on_us;
+		g_sequence_sort_changed(self->recent_iter, compare_recent, NULL);
+	}
+}
+
+static void index_conversation(ChimeConnection *cxn, ChimeConversation *self)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE(cxn);
+
+	update_times(self);
+	self->recent_us = self->updated_on_us;
+	self->recent_iter = g_sequence_insert_sorted(priv->recent_conversations, self,
+						     compare_recent, NULL);
+}
+
+gint64 chime_conversation_get_last_sent_time(ChimeConversation *self)
+{
+	g_return_val_if_fail(CHIME_IS_CONVERSATION(self), 0);
+
+	update_times(self);
+	return self->last_sent_us;
+}
+
+guint chime_conversation_get_unread_count(ChimeConversation *self)
+{
+	g_return_val_if_fail(CHIME_IS_CONVERSATION(self), 0);
+
+	return self->unread_count;
+}
+
+guint chime_conversation_get_mention_count(ChimeConversation *self)
+{
+	g_return_val_if_fail(CHIME_IS_CONVERSATION(self), 0);
+
+	return self->mention_count;
+}
+
+static void set_counts(ChimeConversation *self, guint unread, guint mentions)
+{
+	if (self->unread_count != unread) {
+		self->unread_count = unread;
+		g_object_notify(G_OBJECT(self), "unread-count");
+	}
+	if (self->mention_count != mentions) {
+		self->mention_count = mentions;
+		g_object_notify(G_OBJECT(self), "mention-count");
+	}
+}
+
+/* Only a read up to the newest counted message clears the counts */
+void chime_conversation_messages_read(ChimeConversation *self, const gchar *msg_id)
+{
+	if (self->unread_count && !g_strcmp0(msg_id, self->newest_id))
+		set_counts(self, 0, 0);
+}
+
+static void count_message(ChimeConnection *cxn, ChimeConversation *conv, JsonNode *record)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	const gchar *id, *created, *sender, *content;
+	gint64 created_us;
+
+	if (!parse_string(record, "MessageId", &id) ||
+	    !parse_string(record, "CreatedOn", &created) ||
+	    !chime_parse_time_us(created, &created_us))
+		return;
+
+	/* Having sent one, we've evidently read everything before it */
+	if (parse_string(record, "Sender", &sender) &&
+	    !g_strcmp0(sender, priv->profile_id)) {
+		set_counts(conv, 0, 0);
+		return;
+	}
+
+	if (created_us <= conv->newest_us)
+		return;
+
+	conv->newest_us = created_us;
+	g_free(conv->newest_id);
+	conv->newest_id = g_strdup(id);
+
+	gboolean mention = parse_string(record, "Content", &content) &&
+		chime_connection_mentions_us(cxn, content);
+	set_counts(conv, conv->unread_count + 1, conv->mention_count + mention);
+}
+
+gboolean chime_conversation_is_active(ChimeConversation *self)
+{
+	g_return_val_if_fail(CHIME_IS_CONVERSATION(self), FALSE);
+
+	if (self->favourite)
+		return TRUE;
+
+	gint64 cutoff = g_get_real_time() - (gint64)CHIME_CONV_ACTIVE_AGE * G_USEC_PER_SEC;
+
+	update_times(self);
+	return self->last_sent_us >= cutoff || self->updated_on_us >= cutoff;
+}
+
 static gboolean conv_typing_jugg_cb(ChimeConnection *cxn, gpointer _conv, JsonNode *data_node)
 {
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
@@ -314,6 +515,96 @@ static gboolean conv_typing_jugg_cb(ChimeConnection *cxn, gpointer _conv, JsonNo
 	return TRUE;
 }
 
+static gint compare_ids(gconstpointer a, gconstpointer b)
+{
+	return strcmp(*(const gchar **)a, *(const gchar **)b);
+}
+
+/* The canonical form of a set of members: their sorted profile IDs,
+ * always including our own. */
+static gchar *members_key(ChimeConnection *cxn, GPtrArray *ids)
+{
+	GString *key = g_string_new(NULL);
+	const gchar *last = NULL;
+	guint i;
+
+	const gchar *me = chime_connection_get_profile_id(cxn);
+	if (me)
+		g_ptr_array_add(ids, (gpointer)me);
+	g_ptr_array_sort(ids, compare_ids);
+
+	for (i = 0; i < ids->len; i++) {
+		const gchar *id = ids->pdata[i];
+
+		if (last && !strcmp(id, last))
+			continue;
+		if (last)
+			g_string_append_c(key, ',');
+		g_string_append(key, id);
+		last = id;
+	}
+	return g_string_free(key, FALSE);
+}
+
+static void index_members(ChimeConnection *cxn, ChimeConversation *conv)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE(cxn);
+	GPtrArray *ids = g_ptr_array_new();
+	GHashTableIter iter;
+	gpointer id;
+
+	g_hash_table_iter_init(&iter, conv->members);
+	while (g_hash_table_iter_next(&iter, &id, NULL))
+		g_ptr_array_add(ids, id);
+
+	gchar *key = members_key(cxn, ids);
+	g_ptr_array_unref(ids);
+
+	if (!g_strcmp0(key, conv->members_key)) {
+		g_free(key);
+		return;
+	}
+
+	if (conv->members_key &&
+	    g_hash_table_lookup(priv->conversations_by_members, conv->members_key) == conv)
+		g_hash_table_remove(priv->conversations_by_members, conv->members_key);
+	g_free(conv->members_key);
+	conv->members_key = key;
+	g_hash_table_insert(priv->conversations_by_members, g_strdup(key), conv);
+}
+
+/* Purely local; NULL doesn't mean the server hasn't got one. */
+ChimeConversation *chime_connection_conversation_by_members(ChimeConnection *cxn,
+							    GSList *contacts)
+{
+	g_return_val_if_fail(CHIME_IS_CONNECTION(cxn), NULL);
+
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE(cxn);
+	ChimeConversation *conv = NULL;
+
+	if (!priv->conversations_by_members)
+		return NULL;
+
+	GPtrArray *ids = g_ptr_array_new();
+	for (; contacts; contacts = contacts->next)
+		g_ptr_array_add(ids, (gpointer)chime_contact_get_profile_id(contacts->data));
+
+	gchar *key = members_key(cxn, ids);
+	g_ptr_array_unref(ids);
+
+	conv = g_hash_table_lookup(priv->conversations_by_members, key);
+	g_free(key);
+
+	if (conv && chime_object_is_dead(CHIME_OBJECT(conv)))
+		conv = NULL;
+
+	/* A deferred conversation isn't told when its membership changes,
+	 * so the key it was indexed under may no longer be true. */
+	if (conv && !conv->cxn)
+		conv = NULL;
+	return conv;
+}
+
 static gboolean conv_membership_jugg_cb(ChimeConnection *cxn, gpointer _conv, JsonNode *node)
 {
 	ChimeConversation *conv = CHIME_CONVERSATION(_conv);
@@ -334,6 +625,7 @@ static gboolean conv_membership_jugg_cb(ChimeConnection *cxn, gpointer _conv, Js
 	if (member) {
 		const gchar *id = chime_contact_get_profile_id(member);
 		g_hash_table_insert(conv->members, (gpointer)id, member);
+		index_members(cxn, conv);
 		return TRUE;
 	}
 	return FALSE;
@@ -363,6 +655,7 @@ static void parse_members(ChimeConnection *cxn, ChimeConversation *conv, JsonNod
 			g_hash_table_insert(conv->members, (gpointer)id, member);
 		}
 	}
+	index_members(cxn, conv);
 }
 
 static void generate_conv_name(ChimeConnection *cxn, ChimeConversation *conv)
@@ -390,6 +683,7 @@ static ChimeConversation *chime_connection_parse_conversation(ChimeConnection *c
 						       GError **error)
 {
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE(cxn);
+	JsonNode *conv_node = node;
 	const gchar *id, *name;
 	gboolean visibility;
 	ChimeNotifyPref desktop, mobile;
@@ -430,9 +724,13 @@ static ChimeConversation *chime_connection_parse_conversation(ChimeConnection *c
 				    "mobile-notification-prefs", mobile,
 				    NULL);
 
-		subscribe_conversation(cxn, conversation);
+		/* The long tail gets hydrated on first use */
+		if (chime_conversation_is_active(conversation))
+			subscribe_conversation(cxn, conversation);
 
 		chime_object_collection_hash_object(&priv->conversations, CHIME_OBJECT(conversation), TRUE);
+		chime_object_set_snapshot_node(CHIME_OBJECT(conversation), conv_node);
+		index_conversation(cxn, conversation);
 		parse_members(cxn, conversation, members_node);
 
 		if (!name || !name[0])
@@ -464,12 +762,22 @@ static ChimeConversation *chime_connection_parse_conversation(ChimeConnection *c
 		g_object_notify(G_OBJECT(conversation), "mobile-notification-prefs");
 	}
 
+	if (!conversation->cxn && chime_conversation_is_active(conversation))
+		subscribe_conversation(cxn, conversation);
+
 	chime_object_collection_hash_object(&priv->conversations, CHIME_OBJECT(conversation), TRUE);
+	chime_object_set_snapshot_node(CHIME_OBJECT(conversation), conv_node);
 	parse_members(cxn, conversation, members_node);
 
 	return conversation;
 }
 
+static ChimeObject *parse_snapshot_conversation(ChimeConnection *cxn, JsonNode *node,
+						GError **error)
+{
+	return (ChimeObject *)chime_connection_parse_conversation(cxn, node, error);
+}
+
 static void fetch_conversations(ChimeConnection *cxn, const gchar *next_token);
 
 static void conversations_cb(ChimeConnection *cxn, SoupMessage *msg, JsonNode *node,
@@ -508,6 +816,7 @@ static void conversations_cb(ChimeConnection *cxn, SoupMessage *msg, JsonNode *n
 			priv->conversations_sync = CHIME_SYNC_IDLE;
 
 			chime_object_collection_expire_outdated(&priv->conversations);
+			chime_object_collection_save_snapshot(&priv->conversations);
 
 			if (!priv->convs_online) {
 				priv->convs_online = TRUE;
@@ -549,8 +858,9 @@ static void fetch_conversations(ChimeConnection *cxn, const gchar *next_token)
 	soup_uri_set_query_from_fields(uri, "max-results", "50",
 				       next_token ? "next-token" : NULL, next_token,
 				       NULL);
-	chime_connection_queue_http_request(cxn, NULL, uri, "GET", conversations_cb,
-					    NULL);
+	chime_connection_queue_http_request_prio(cxn, NULL, uri, "GET",
+						 CHIME_REQ_BACKGROUND, conversations_cb,
+						 NULL);
 }
 
 
@@ -617,18 +927,18 @@ static gboolean conv_msg_jugg_cb(ChimeConnection *cxn, gpointer _unused, JsonNod
 		defer->cb = conv_msg_jugg_cb;
 
 		SoupURI *uri = soup_uri_new_printf(priv->messaging_url, "/conversations/%s", conv_id);
-		if (chime_connection_queue_http_request(cxn, NULL, uri, "GET", fetch_new_conv_cb, defer))
-			return TRUE;
-
-		json_node_unref(defer->node);
-		g_free(defer);
-		return FALSE;
+		chime_connection_queue_http_request(cxn, NULL, uri, "GET", fetch_new_conv_cb, defer);
+		return TRUE;
 	}
 
 	const gchar *id;
 	if (!parse_string(record, "MessageId", &id))
 		return FALSE;
 
+	chime_conversation_hydrate(cxn, conv);
+	chime_jugg_note_message(cxn, CHIME_OBJECT(conv), record);
+	chime_msgstore_update(cxn, CHIME_OBJECT(conv), record);
+	count_message(cxn, conv, record);
 	g_signal_emit(conv, signals[MESSAGE], 0, record);
 	return TRUE;
 }
@@ -648,6 +958,12 @@ void chime_init_conversations(ChimeConnection *cxn)
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
 
 	chime_object_collection_init(cxn, &priv->conversations);
+	priv->recent_conversations = g_sequence_new(NULL);
+	priv->conversations_by_members = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+	if (chime_object_collection_load_snapshot(&priv->conversations, "conversations",
+						  parse_snapshot_conversation))
+		priv->convs_online = TRUE;
 
 	chime_jugg_subscribe(cxn, priv->device_channel, "Conversation",
 			     conv_jugg_cb, NULL);
@@ -682,6 +998,20 @@ void chime_destroy_conversations(ChimeConnection *cxn)
 	if (priv->conversations.by_id)
 		g_hash_table_foreach(priv->conversations.by_id, unsubscribe_conversation, NULL);
 
+	/* Conversations which outlive the connection mustn't touch the index */
+	if (priv->recent_conversations) {
+		GSequenceIter *iter = g_sequence_get_begin_iter(priv->recent_conversations);
+
+		while (!g_sequence_iter_is_end(iter)) {
+			ChimeConversation *conv = g_sequence_get(iter);
+
+			conv->recent_iter = NULL;
+			iter = g_sequence_iter_next(iter);
+		}
+		g_clear_pointer(&priv->recent_conversations, g_sequence_free);
+	}
+
+	g_clear_pointer(&priv->conversations_by_members, g_hash_table_destroy);
 	chime_object_collection_destroy(&priv->conversations);
 }
 
@@ -717,12 +1047,46 @@ void chime_connection_foreach_conversation(ChimeConnection *cxn, ChimeConversati
 	chime_object_collection_foreach_object(cxn, &priv->conversations, (ChimeObjectCB)cb, cbdata);
 }
 
+/* In order of UpdatedOn, most recent first */
+void chime_connection_foreach_recent_conversation(ChimeConnection *cxn, ChimeConversationCB cb,
+						  gpointer cbdata)
+{
+	g_return_if_fail(CHIME_IS_CONNECTION(cxn));
+
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE(cxn);
+	GSequenceIter *iter;
+
+	if (!priv->recent_conversations)
+		return;
+
+	for (iter = g_sequence_get_begin_iter(priv->recent_conversations);
+	     !g_sequence_iter_is_end(iter); iter = g_sequence_iter_next(iter)) {
+		ChimeConversation *conv = g_sequence_get(iter);
+
+		if (!chime_object_is_dead(CHIME_OBJECT(conv)))
+			cb(cxn, conv, cbdata);
+	}
+}
+
+/* Subscribe to the conversation's own channel, if we deferred that
+ * when it was first parsed. */
+void chime_conversation_hydrate(ChimeConnection *cxn, ChimeConversation *conv)
+{
+	g_return_if_fail(CHIME_IS_CONNECTION(cxn));
+	g_return_if_fail(CHIME_IS_CONVERSATION(conv));
+
+	if (!conv->cxn && !chime_object_is_dead(CHIME_OBJECT(conv)))
+		subscribe_conversation(cxn, conv);
+}
+
 void chime_conversation_send_typing(ChimeConnection *cxn, ChimeConversation *conv,
 				    gboolean typing)
 {
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
 	JsonBuilder *jb = json_builder_new();
 
+	chime_conversation_hydrate(cxn, conv);
+
 	jb = json_builder_begin_object(jb);
 	jb = json_builder_set_member_name(jb, "channel");
 	jb = json_builder_add_string_value(jb, conv->channel);
@@ -848,9 +1212,12 @@ static void conv_found_cb(ChimeConnection *cxn, SoupMessage *msg,
 				conv = chime_connection_parse_conversation(cxn, json_array_get_element(arr, 0), NULL);
 		}
 
-		if (conv)
+		if (conv) {
+			/* It's about to be used, and this keeps its members
+			 * current so the next lookup can be answered locally. */
+			chime_conversation_hydrate(cxn, conv);
 			g_task_return_pointer(task, g_object_ref(conv), g_object_unref);
-		else
+		} else
 			g_task_return_new_error(task, CHIME_ERROR, CHIME_ERROR_NETWORK,
 						_("Failed to create conversation"));
 	} else {
@@ -876,6 +1243,7 @@ void chime_connection_find_conversation_async(ChimeConnection *cxn,
 {
 	g_return_if_fail(CHIME_IS_CONNECTION(cxn));
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	GSList *contacts_head = contacts;
 	int i, len = g_slist_length(contacts);
 	const gchar **contact_ids = g_new0(const gchar *, len + 1);
 
@@ -888,11 +1256,21 @@ void chime_connection_find_conversation_async(ChimeConnection *cxn,
 
 	GTask *task = g_task_new(cxn, cancellable, callback, user_data);
 
+	/* Only ask the server if we don't already know of one */
+	ChimeConversation *conv = chime_connection_conversation_by_members(cxn, contacts_head);
+	if (conv) {
+		g_free(query_str);
+		g_task_return_pointer(task, g_object_ref(conv), g_object_unref);
+		g_object_unref(task);
+		return;
+	}
+
 	SoupURI *uri = soup_uri_new_printf(priv->messaging_url, "/conversations");
 	soup_uri_set_query_from_fields(uri, "profile-ids", query_str, NULL);
 	g_free(query_str);
 
-	chime_connection_queue_http_request(cxn, NULL, uri, "GET", conv_found_cb, task);
+	chime_connection_queue_http_request_full(cxn, NULL, uri, "GET", CHIME_REQ_INTERACTIVE,
+						 cancellable, conv_found_cb, task);
 }
 
 ChimeConversation *chime_connection_find_conversation_finish(ChimeConnection *self,
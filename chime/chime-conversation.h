@@ -47,15 +47,33 @@ const gchar *chime_conversation_get_last_sent(ChimeConversation *self);
 const gchar *chime_conversation_get_updated_on(ChimeConversation *self);
 const gchar *chime_conversation_get_created_on(ChimeConversation *self);
 
+/* LastSent in microseconds since the epoch, or 0 if unset */
+gint64 chime_conversation_get_last_sent_time(ChimeConversation *self);
+
+/* As chime_room_get_unread_count() */
+guint chime_conversation_get_unread_count(ChimeConversation *self);
+guint chime_conversation_get_mention_count(ChimeConversation *self);
+
+/* Favourite, or recently updated */
+gboolean chime_conversation_is_active(ChimeConversation *self);
+void chime_conversation_hydrate(ChimeConnection *cxn, ChimeConversation *conv);
+
 ChimeConversation *chime_connection_conversation_by_name(ChimeConnection *cxn,
 					 const gchar *name);
 ChimeConversation *chime_connection_conversation_by_id(ChimeConnection *cxn,
 				       const gchar *id);
+/* With exactly these members, plus ourselves. Only conversations whose
+ * channel we are subscribed to are known to still match. */
+ChimeConversation *chime_connection_conversation_by_members(ChimeConnection *cxn,
+							    GSList *contacts);
 
 /* Designed to match the NEW_CONVERSATION signal handler */
 typedef void (*ChimeConversationCB) (ChimeConnection *, ChimeConversation *, gpointer);
 void chime_connection_foreach_conversation(ChimeConnection *cxn, ChimeConversationCB cb,
 				   gpointer cbdata);
+/* Most recently updated first. The callback mustn't change UpdatedOn. */
+void chime_connection_foreach_recent_conversation(ChimeConnection *cxn, ChimeConversationCB cb,
+						  gpointer cbdata);
 
 void chime_conversation_send_typing(ChimeConnection *cxn, ChimeConversation *conv,
 				    gboolean typing);
@@ -28,23 +28,112 @@
 #include "chime-websocket-connection.h"
 
 static void connect_jugg(ChimeConnection *cxn);
+static void send_resubscribe_message(ChimeConnection *cxn);
 
+/* Subscriptions are refcounted so that a callback can unsubscribe
+ * itself or others while handle_callback() is still working through
+ * them. An unsubscribed one has its cb cleared, so it isn't called. */
 struct jugg_subscription {
+	gint refcount;
 	JuggernautCallback cb;
 	gpointer cb_data;
-	gchar *klass;
+	const gchar *klass;	/* Interned */
 };
 
-static void free_jugg_subscription(gpointer user_data)
+static void jugg_sub_unref(struct jugg_subscription *sub)
 {
-	struct jugg_subscription *sub = user_data;
+	if (!--sub->refcount)
+		g_free(sub);
+}
+
+static void jugg_sub_cancel(struct jugg_subscription *sub)
+{
+	sub->cb = NULL;
+	jugg_sub_unref(sub);
+}
+
+static void free_sub_list(GList *l)
+{
+	g_list_free_full(l, (GDestroyNotify)jugg_sub_cancel);
+}
+
+/* The subscribers to a channel, indexed by klass. Those which want every
+ * message on the channel (klass == NULL) are kept separately. */
+struct jugg_channel {
+	GHashTable *by_klass;	/* interned klass → GList of jugg_subscription */
+	GList *any;
+};
+
+static struct jugg_channel *jugg_channel_new(void)
+{
+	struct jugg_channel *chan = g_new0(struct jugg_channel, 1);
 
-	g_free(sub->klass);
-	g_free(sub);
+	chan->by_klass = g_hash_table_new(g_str_hash, g_str_equal);
+	return chan;
+}
+
+static void free_klass_subs(gpointer _klass, gpointer l, gpointer _unused)
+{
+	free_sub_list(l);
+}
+
+static void jugg_channel_free(struct jugg_channel *chan)
+{
+	g_hash_table_foreach(chan->by_klass, free_klass_subs, NULL);
+	g_hash_table_destroy(chan->by_klass);
+	free_sub_list(chan->any);
+	g_free(chan);
+}
+
+static gboolean jugg_channel_empty(struct jugg_channel *chan)
+{
+	return !chan->any && !g_hash_table_size(chan->by_klass);
+}
+
+#define JUGG_SUBS_STACK 8
+
+/* Take a reference to every subscriber first, since any callback may
+ * unsubscribe, which can free the lists and even the channel itself. */
+static gboolean call_subs(ChimeConnection *cxn, struct jugg_channel *chan,
+			  const gchar *klass, JsonNode *data_node)
+{
+	struct jugg_subscription *stack[JUGG_SUBS_STACK], **subs = stack;
+	GList *by_klass = g_hash_table_lookup(chan->by_klass, klass);
+	guint i, n = g_list_length(by_klass) + g_list_length(chan->any);
+	gboolean handled = FALSE;
+	GList *l;
+
+	if (n > JUGG_SUBS_STACK)
+		subs = g_new(struct jugg_subscription *, n);
+
+	i = 0;
+	for (l = by_klass; l; l = l->next)
+		subs[i++] = l->data;
+	for (l = chan->any; l; l = l->next)
+		subs[i++] = l->data;
+	for (i = 0; i < n; i++)
+		subs[i]->refcount++;
+
+	for (i = 0; i < n; i++) {
+		if (subs[i]->cb)
+			handled |= subs[i]->cb(cxn, subs[i]->cb_data, data_node);
+		jugg_sub_unref(subs[i]);
+	}
+
+	if (subs != stack)
+		g_free(subs);
+	return handled;
 }
 
 #define KEEPALIVE_INTERVAL 30
 
+/* Plain numeric message ids are acked lazily: only the highest one, once
+ * the stream has been idle for JUGG_ACK_DELAY ms or JUGG_ACK_MAX_PENDING
+ * messages have arrived. Anything else (like 'N+' ids which want a data
+ * ack) is acked immediately, after flushing any pending ack. */
+#define JUGG_ACK_DELAY 100
+#define JUGG_ACK_MAX_PENDING 16
+
 static void on_websocket_closed(SoupWebsocketConnection *ws,
 				gpointer _cxn)
 {
@@ -64,18 +153,43 @@ static void on_websocket_closed(SoupWebsocketConnection *ws,
 				      _("Failed to establish WebSocket connection"));
 }
 
-static void handle_callback(ChimeConnection *cxn, const gchar *msg)
+/* The parser is taken out of priv while in use, in case a callback
+ * somehow ends up back here. */
+static JsonParser *get_jugg_parser(ChimeConnectionPrivate *priv)
+{
+	JsonParser *parser = priv->jugg_parser;
+
+	if (parser)
+		priv->jugg_parser = NULL;
+	else
+		parser = json_parser_new();
+
+	return parser;
+}
+
+static void put_jugg_parser(ChimeConnectionPrivate *priv, JsonParser *parser)
+{
+	if (!priv->jugg_parser)
+		priv->jugg_parser = parser;
+	else
+		g_object_unref(parser);
+}
+
+static void handle_callback(ChimeConnection *cxn, const gchar *msg, gsize len)
 {
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
-	JsonParser *parser = json_parser_new();
+	JsonParser *parser = get_jugg_parser(priv);
 	gboolean handled = FALSE;
 	GError *error = NULL;
+	gint64 started = g_get_monotonic_time();
 
-	if (!json_parser_load_from_data(parser, msg, strlen(msg), &error)) {
+	chime_metrics_jugg_message(cxn);
+
+	if (!json_parser_load_from_data(parser, msg, len, &error)) {
 		chime_connection_log(cxn, CHIME_LOGLVL_WARNING, "Error parsing juggernaut message: '%s'\n",
 				     error->message);
 		g_error_free(error);
-		g_object_unref(parser);
+		put_jugg_parser(priv, parser);
 		return;
 	}
 
@@ -86,17 +200,11 @@ static void handle_callback(ChimeConnection *cxn, const gchar *msg)
 		JsonNode *data_node = json_object_get_member(obj, "data");
 
 		const gchar *klass;
-		if (parse_string(data_node, "klass", &klass)) {
-			    GList *l = g_hash_table_lookup(priv->subscriptions, channel);
-			    while (l) {
-				    struct jugg_subscription *sub = l->data;
-				    if (sub->cb && (!sub->klass || !strcmp(sub->klass, klass)))
-					    handled |= sub->cb(cxn, sub->cb_data, data_node);
-				    l = l->next;
-			    }
-		}
+		struct jugg_channel *chan = g_hash_table_lookup(priv->subscriptions, channel);
+		if (chan && parse_string(data_node, "klass", &klass))
+			handled = call_subs(cxn, chan, klass, data_node);
 	}
-	if (!handled) {
+	if (!handled && chime_connection_log_enabled(cxn, CHIME_LOGLVL_INFO)) {
 		JsonGenerator *gen = json_generator_new();
 		json_generator_set_root(gen, r);
 		json_generator_set_pretty(gen, TRUE);
@@ -107,7 +215,16 @@ static void handle_callback(ChimeConnection *cxn, const gchar *msg)
 		g_free(data);
 		g_object_unref(gen);
 	}
-	g_object_unref(parser);
+	put_jugg_parser(priv, parser);
+	chime_metrics_jugg_dispatch(cxn, started);
+}
+
+void chime_jugg_replay(ChimeConnection *cxn, const gchar *msg, gsize len)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+
+	if (priv->subscriptions)
+		handle_callback(cxn, msg, len);
 }
 
 static void jugg_send(ChimeConnection *cxn, const gchar *fmt, ...)
@@ -120,7 +237,7 @@ static void jugg_send(ChimeConnection *cxn, const gchar *fmt, ...)
 	str = g_strdup_vprintf(fmt, args);
 	va_end(args);
 
-	chime_connection_log(cxn, CHIME_LOGLVL_MISC, "Send juggernaut msg: %s\n", str);
+	chime_connection_log_ratelimited(cxn, CHIME_LOGLVL_MISC, "Send juggernaut msg: %s\n", str);
 	soup_websocket_connection_send_text(priv->ws_conn, str);
 	g_free(str);
 }
@@ -130,24 +247,233 @@ static void send_subscription_message(ChimeConnection *cxn, const gchar *type, c
 	jugg_send(cxn, "3:::{\"type\":\"%s\",\"channel\":\"%s\"}", type, channel);
 }
 
+/* A socket.io (v0.9) frame is 'type:id:endpoint[:data]'. Find the fields
+ * in place; field_len[] excludes the separators, and data is only present
+ * (with nfields == 4) if there was a third colon. */
+struct jugg_frame {
+	const gchar *field[4];
+	gsize field_len[4];
+	int nfields;
+};
+
+static void split_frame(const gchar *data, gsize len, struct jugg_frame *f)
+{
+	const gchar *end = data + len;
+
+	f->nfields = 0;
+	while (f->nfields < 3) {
+		const gchar *colon = memchr(data, ':', end - data);
+
+		f->field[f->nfields] = data;
+		if (!colon) {
+			f->field_len[f->nfields++] = end - data;
+			return;
+		}
+		f->field_len[f->nfields++] = colon - data;
+		data = colon + 1;
+	}
+	f->field[3] = data;
+	f->field_len[3] = end - data;
+	f->nfields = 4;
+}
+
+#define FRAME_IS(_d, _l, _s) ((_l) == sizeof(_s) - 1 && !memcmp((_d), (_s), (_l)))
+
+static void send_ack(ChimeConnection *cxn, const gchar *id, gsize id_len)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	gchar ack[32];
+
+	if (id_len > sizeof(ack) - 5) {
+		jugg_send(cxn, "6:::%.*s", (int)id_len, id);
+		return;
+	}
+
+	memcpy(ack, "6:::", 4);
+	memcpy(ack + 4, id, id_len);
+	ack[4 + id_len] = 0;
+
+	chime_connection_log_ratelimited(cxn, CHIME_LOGLVL_MISC, "Send juggernaut msg: %s\n", ack);
+	soup_websocket_connection_send_text(priv->ws_conn, ack);
+}
+
+static void flush_ack(ChimeConnection *cxn)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	gchar id[24];
+
+	if (priv->jugg_ack_timer) {
+		g_source_remove(priv->jugg_ack_timer);
+		priv->jugg_ack_timer = 0;
+	}
+	if (!priv->jugg_acks_pending)
+		return;
+
+	priv->jugg_acks_pending = 0;
+	if (priv->ws_conn) {
+		g_snprintf(id, sizeof(id), "%" G_GUINT64_FORMAT, priv->jugg_ack_id);
+		send_ack(cxn, id, strlen(id));
+	}
+}
+
+static gboolean ack_timeout(gpointer _cxn)
+{
+	ChimeConnection *cxn = _cxn;
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+
+	priv->jugg_ack_timer = 0;
+	flush_ack(cxn);
+	return FALSE;
+}
+
+static void queue_ack(ChimeConnection *cxn, const gchar *id, gsize id_len)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	guint64 val = 0;
+	gsize i;
+
+	for (i = 0; i < id_len && i < 19; i++) {
+		if (!g_ascii_isdigit(id[i]))
+			break;
+		val = val * 10 + id[i] - '0';
+	}
+	if (i < id_len) {
+		flush_ack(cxn);
+		send_ack(cxn, id, id_len);
+		return;
+	}
+
+	if (!priv->jugg_acks_pending || val > priv->jugg_ack_id)
+		priv->jugg_ack_id = val;
+
+	if (++priv->jugg_acks_pending >= JUGG_ACK_MAX_PENDING)
+		flush_ack(cxn);
+	else if (!priv->jugg_ack_timer)
+		priv->jugg_ack_timer = g_timeout_add(JUGG_ACK_DELAY, ack_timeout, cxn);
+}
+
+/*
+ * While the websocket is down, we miss messages. On reconnection, fetch
+ * anything newer than the last message we saw in each room/conversation
+ * in which we have seen any traffic since we logged in. The "message"
+ * signals from the fetch go to the same handlers as the juggernaut ones,
+ * which already cope with duplicates.
+ */
+struct jugg_msg_time {
+	ChimeObject *obj;	/* Not a reference; see msg_time_obj_disposed() */
+	gulong disposed_id;
+	gchar *created;
+};
+
+static void free_msg_time(gpointer _mt)
+{
+	struct jugg_msg_time *mt = _mt;
+
+	g_signal_handler_disconnect(mt->obj, mt->disposed_id);
+	g_free(mt->created);
+	g_free(mt);
+}
+
+static void msg_time_obj_disposed(ChimeObject *obj, gpointer _cxn)
+{
+	chime_jugg_forget_messages(_cxn, obj);
+}
+
+void chime_jugg_note_message(ChimeConnection *cxn, ChimeObject *obj, JsonNode *record)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	struct jugg_msg_time *mt;
+	const gchar *created;
+
+	if (!parse_string(record, "CreatedOn", &created))
+		return;
+
+	if (!priv->jugg_msg_times)
+		priv->jugg_msg_times = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+							     NULL, free_msg_time);
+
+	/* The timestamps are all ISO8601 in UTC, so compare as strings */
+	mt = g_hash_table_lookup(priv->jugg_msg_times, obj);
+	if (!mt) {
+		mt = g_new0(struct jugg_msg_time, 1);
+		mt->obj = obj;
+		mt->disposed_id = g_signal_connect(obj, "disposed",
+						   G_CALLBACK(msg_time_obj_disposed), cxn);
+		mt->created = g_strdup(created);
+		g_hash_table_insert(priv->jugg_msg_times, obj, mt);
+	} else if (strcmp(created, mt->created) > 0) {
+		g_free(mt->created);
+		mt->created = g_strdup(created);
+	}
+}
+
+/* No more gaps to fill once it's closed, or gone */
+void chime_jugg_forget_messages(ChimeConnection *cxn, ChimeObject *obj)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+
+	if (priv->jugg_msg_times)
+		g_hash_table_remove(priv->jugg_msg_times, obj);
+}
+
+static void gap_fetched(GObject *source, GAsyncResult *result, gpointer _obj)
+{
+	ChimeConnection *cxn = CHIME_CONNECTION(source);
+	GError *error = NULL;
+
+	if (!chime_connection_fetch_messages_finish(cxn, result, &error)) {
+		chime_connection_log(cxn, CHIME_LOGLVL_WARNING,
+				     "Failed to fetch missed messages for %s: %s\n",
+				     chime_object_get_id(_obj), error->message);
+		g_clear_error(&error);
+	}
+	g_object_unref(_obj);
+}
+
+static void fill_gaps(ChimeConnection *cxn)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	GHashTableIter iter;
+	gpointer obj, _mt;
+
+	if (!priv->jugg_msg_times)
+		return;
+
+	chime_connection_log(cxn, CHIME_LOGLVL_INFO, "Fetching messages missed in %u rooms/conversations\n",
+			     g_hash_table_size(priv->jugg_msg_times));
+
+	g_hash_table_iter_init(&iter, priv->jugg_msg_times);
+	while (g_hash_table_iter_next(&iter, &obj, &_mt)) {
+		struct jugg_msg_time *mt = _mt;
+
+		if (chime_object_is_dead(obj)) {
+			g_hash_table_iter_remove(&iter);
+			continue;
+		}
+		chime_connection_fetch_messages_async(cxn, obj, NULL, mt->created, NULL,
+						      gap_fetched, g_object_ref(obj));
+	}
+}
+
 static void on_websocket_message(SoupWebsocketConnection *ws, gint type,
 				 GBytes *message, gpointer _cxn)
 {
 	ChimeConnection *cxn = _cxn;
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
-	gchar **parms;
-	gconstpointer data;
+	struct jugg_frame f;
+	const gchar *data;
+	gsize len;
 
 	if (type != SOUP_WEBSOCKET_DATA_TEXT)
 		return;
 
-	data = g_bytes_get_data(message, NULL);
+	data = g_bytes_get_data(message, &len);
 
-	chime_connection_log(cxn, CHIME_LOGLVL_MISC,
-			     "websocket message received:\n'%s'\n", (char *)data);
+	chime_connection_log_ratelimited(cxn, CHIME_LOGLVL_MISC,
+					 "websocket message received:\n'%.*s'\n", (int)len, data);
 
 	/* DISCONNECT */
-	if (!strcmp(data, "0::")) {
+	if (FRAME_IS(data, len, "0::")) {
 		/* Do not attempt to reconnect */
 		priv->jugg_online = FALSE;
 		chime_connection_fail(cxn, CHIME_ERROR_NETWORK,
@@ -155,28 +481,36 @@ static void on_websocket_message(SoupWebsocketConnection *ws, gint type,
 		return;
 	}
 	/* CONNECT */
-	if (!strcmp(data, "1::")) {
+	if (FRAME_IS(data, len, "1::")) {
+		/* Only fetch what was missed once we're listening again, or
+		 * anything sent in between is lost after all. */
+		if (priv->subscriptions)
+			send_resubscribe_message(cxn);
+		chime_metrics_jugg_connected(cxn);
 		if (!priv->jugg_online) {
 			priv->jugg_online = TRUE;
 			chime_connection_calculate_online(cxn);
+		} else {
+			fill_gaps(cxn);
+			chime_refresh_presences(cxn);
 		}
 		priv->jugg_connected = TRUE;
 		return;
 	}
 	/* Keepalive */
-	if (!strcmp(data, "2::")) {
+	if (FRAME_IS(data, len, "2::")) {
 		jugg_send(cxn, "2::");
 		return;
 	}
-	parms = g_strsplit(data, ":", 4);
-	if (parms[0] && parms[1] && *parms[1] && parms[2]) {
-		/* Send an ack */
-		jugg_send(cxn, "6:::%s", parms[1]);
 
-		if (priv->subscriptions && !strcmp(parms[0], "3") && parms[3])
-			handle_callback(cxn, parms[3]);
+	split_frame(data, len, &f);
+	if (f.nfields >= 3 && f.field_len[1]) {
+		queue_ack(cxn, f.field[1], f.field_len[1]);
+
+		if (priv->subscriptions && f.nfields == 4 &&
+		    FRAME_IS(f.field[0], f.field_len[0], "3"))
+			handle_callback(cxn, f.field[3], f.field_len[3]);
 	}
-	g_strfreev(parms);
 }
 
 static gboolean pong_timeout(gpointer _cxn)
@@ -205,7 +539,7 @@ static void on_websocket_pong(SoupWebsocketConnection *ws,
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
 
 	chime_connection_log(cxn, CHIME_LOGLVL_MISC, "WebSocket pong received (%s)\n",
-			     g_bytes_get_data(data, NULL));
+			     (const gchar *)g_bytes_get_data(data, NULL));
 
 	g_source_remove(priv->keepalive_timer);
 	priv->keepalive_timer = g_timeout_add_seconds(KEEPALIVE_INTERVAL * 3, pong_timeout, cxn);
@@ -263,10 +597,8 @@ static void jugg_ws_connect_cb(GObject *obj, GAsyncResult *res, gpointer _cxn)
 
 	priv->keepalive_timer = g_timeout_add_seconds(KEEPALIVE_INTERVAL * 3, pong_timeout, cxn);
 
+	/* The subscriptions are renewed when the server says we're connected */
 	jugg_send(cxn, "1::");
-
-	if (priv->subscriptions)
-		send_resubscribe_message(cxn);
 }
 
 static void ws_key_cb(ChimeConnection *cxn, SoupMessage *msg, JsonNode *node, gpointer _unused)
@@ -303,6 +635,8 @@ static void ws_key_cb(ChimeConnection *cxn, SoupMessage *msg, JsonNode *node, gp
 	msg = soup_message_new_from_uri("GET", uri);
 	soup_uri_free(uri);
 
+	/* Juggernaut traffic is all JSON, which compresses well */
+	chime_websocket_offer_deflate(msg);
 	chime_connection_websocket_connect_async(cxn, msg, NULL, NULL, NULL,
 						 jugg_ws_connect_cb, cxn);
 }
@@ -317,7 +651,6 @@ static gboolean chime_sublist_destroy(gpointer k, gpointer v, gpointer _cxn)
 	if (priv->ws_conn)
 		send_subscription_message(_cxn, "unsubscribe", k);
 
-	g_list_free_full(v, free_jugg_subscription);
 	return TRUE;
 }
 
@@ -339,6 +672,7 @@ void chime_destroy_juggernaut(ChimeConnection *cxn)
 
 	/* The ChimeConnection is going away, so disconnect the signals which
 	 * refer to it...*/
+	flush_ack(cxn);
 	if (priv->ws_conn) {
 		g_signal_handlers_disconnect_matched(G_OBJECT(priv->ws_conn), G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, cxn);
 
@@ -359,6 +693,8 @@ void chime_destroy_juggernaut(ChimeConnection *cxn)
 	}
 
 	g_clear_pointer(&priv->ws_key, g_free);
+	g_clear_object(&priv->jugg_parser);
+	g_clear_pointer(&priv->jugg_msg_times, g_hash_table_destroy);
 }
 
 static void connect_jugg(ChimeConnection *cxn)
@@ -367,6 +703,14 @@ static void connect_jugg(ChimeConnection *cxn)
 	SoupURI *uri = soup_uri_new_printf(priv->websocket_url, "/1");
 
 	priv->jugg_connected = FALSE;
+	priv->metrics.jugg_connects++;
+
+	/* Acks for the old connection mean nothing on the new one */
+	if (priv->jugg_ack_timer) {
+		g_source_remove(priv->jugg_ack_timer);
+		priv->jugg_ack_timer = 0;
+	}
+	priv->jugg_acks_pending = 0;
 
 	if (priv->keepalive_timer) {
 		g_source_remove(priv->keepalive_timer);
@@ -406,76 +750,94 @@ gboolean chime_connection_jugg_send(ChimeConnection *cxn, JsonNode *node)
  * We allow multiple subscribers to a channel, as long as {cb, cb_data, klass}
  * is unique.
  *
- * priv->subscriptions is a GHashTable with 'channel' as key.
- *
- * Each value is a GList, containing the set of {cb,cb_data} subscribers.
+ * priv->subscriptions is a GHashTable with 'channel' as key, and a
+ * struct jugg_channel as value. That holds the subscribers for each
+ * klass in a hash table keyed by the interned klass string, so that
+ * dispatch only visits the subscribers which actually want the message.
  *
  * We send the server a subscribe request when the first subscription to a
  * channel occurs, and an unsubscribe request when the last one goes away.
  */
-static gboolean compare_sub(gconstpointer _a, gconstpointer _b)
+static GList *find_sub(GList *l, JuggernautCallback cb, gpointer cb_data)
 {
-	const struct jugg_subscription *a = _a;
-	const struct jugg_subscription *b = _b;
-
-	return !(a->cb == b->cb && a->cb_data == b->cb_data && !g_strcmp0(a->klass, b->klass));
+	for (; l; l = l->next) {
+		struct jugg_subscription *sub = l->data;
+		if (sub->cb == cb && sub->cb_data == cb_data)
+			return l;
+	}
+	return NULL;
 }
 
 void chime_jugg_subscribe(ChimeConnection *cxn, const gchar *channel, const gchar *klass,
 			  JuggernautCallback cb, gpointer cb_data)
 {
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
-	struct jugg_subscription *sub = g_new0(struct jugg_subscription, 1);
+	struct jugg_channel *chan;
 	GList *l;
 
-	sub->cb = cb;
-	sub->cb_data = cb_data;
-	if (klass)
-		sub->klass = g_strdup(klass);
 	if (!priv->subscriptions)
-		priv->subscriptions = g_hash_table_new_full(g_str_hash, g_str_equal,
-							   g_free, NULL);
-
-	l = g_hash_table_lookup(priv->subscriptions, channel);
-	if (!l && priv->ws_conn)
-		send_subscription_message(cxn, "subscribe", channel);
+		priv->subscriptions = g_hash_table_new_full(g_str_hash, chime_id_equal,
+							   NULL, (GDestroyNotify)jugg_channel_free);
+
+	chan = g_hash_table_lookup(priv->subscriptions, channel);
+	if (!chan) {
+		if (priv->ws_conn)
+			send_subscription_message(cxn, "subscribe", channel);
+		chan = jugg_channel_new();
+		g_hash_table_insert(priv->subscriptions,
+				    (gpointer)chime_connection_intern(cxn, channel), chan);
+	}
 
-	if (g_list_find_custom(l, sub, compare_sub)) {
-		free_jugg_subscription(sub);
+	klass = g_intern_string(klass);
+	l = klass ? g_hash_table_lookup(chan->by_klass, klass) : chan->any;
+	if (find_sub(l, cb, cb_data))
 		return;
-	}
+
+	struct jugg_subscription *sub = g_new0(struct jugg_subscription, 1);
+	sub->refcount = 1;
+	sub->cb = cb;
+	sub->cb_data = cb_data;
+	sub->klass = klass;
 
 	l = g_list_append(l, sub);
-	g_hash_table_replace(priv->subscriptions, g_strdup(channel), l);
+	if (klass)
+		g_hash_table_insert(chan->by_klass, (gpointer)klass, l);
+	else
+		chan->any = l;
 }
 
 void chime_jugg_unsubscribe(ChimeConnection *cxn, const gchar *channel, const gchar *klass,
 			    JuggernautCallback cb, gpointer cb_data)
 {
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
-	struct jugg_subscription sub;
+	struct jugg_channel *chan;
 	GList *l, *item;
 
 	if (!priv->subscriptions)
 		return;
 
-	l = g_hash_table_lookup(priv->subscriptions, channel);
-	if (!l)
+	chan = g_hash_table_lookup(priv->subscriptions, channel);
+	if (!chan)
+		return;
+
+	klass = g_intern_string(klass);
+	l = klass ? g_hash_table_lookup(chan->by_klass, klass) : chan->any;
+	item = find_sub(l, cb, cb_data);
+	if (!item)
 		return;
 
-	sub.cb = cb;
-	sub.cb_data = cb_data;
-	sub.klass = (gchar *)klass;
-
-	item = g_list_find_custom(l, &sub, compare_sub);
-	if (item) {
-		free_jugg_subscription(item->data);
-		l = g_list_delete_link(l, item);
-		if (!l) {
-			g_hash_table_remove(priv->subscriptions, channel);
-			if (priv->ws_conn)
-				send_subscription_message(cxn, "unsubscribe", channel);
-		} else
-			g_hash_table_replace(priv->subscriptions, g_strdup(channel), l);
+	jugg_sub_cancel(item->data);
+	l = g_list_delete_link(l, item);
+	if (!klass)
+		chan->any = l;
+	else if (l)
+		g_hash_table_insert(chan->by_klass, (gpointer)klass, l);
+	else
+		g_hash_table_remove(chan->by_klass, klass);
+
+	if (jugg_channel_empty(chan)) {
+		g_hash_table_remove(priv->subscriptions, channel);
+		if (priv->ws_conn)
+			send_subscription_message(cxn, "unsubscribe", channel);
 	}
 }
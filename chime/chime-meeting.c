@@ -77,6 +77,20 @@ struct _ChimeMeeting {
 	/* For open meetings */
 	guint opens;
 	ChimeConnection *cxn;
+
+	/* What we're indexed under in priv->meetings_by_pin */
+	gchar *pin_keys[2];
+};
+
+/* Results of asking the server about PINs which aren't the passcode or
+ * display ID of any meeting we know, such as a personal PIN. */
+#define PIN_LOOKUP_CACHE_SIZE	8
+#define PIN_LOOKUP_CACHE_AGE	(10 * 60 * G_USEC_PER_SEC)
+
+struct pin_lookup {
+	gchar *pin;
+	gchar *meeting_id;
+	gint64 when;
 };
 
 G_DEFINE_TYPE(ChimeMeeting, chime_meeting, CHIME_TYPE_OBJECT)
@@ -88,6 +102,7 @@ CHIME_DEFINE_ENUM_TYPE(ChimeMeetingType, chime_meeting_type,
        CHIME_ENUM_VALUE(CHIME_MEETING_TYPE_WEBINAR,		"Webinar"))
 
 static void close_meeting(gpointer key, gpointer val, gpointer data);
+static void unindex_meeting_pins(ChimeMeeting *meeting);
 
 static void
 chime_meeting_dispose(GObject *object)
@@ -97,6 +112,7 @@ chime_meeting_dispose(GObject *object)
 	chime_debug("Meeting disposed: %p\n", self);
 
 	close_meeting(NULL, self, NULL);
+	unindex_meeting_pins(self);
 	g_signal_emit(self, signals[ENDED], 0, NULL);
 
 	g_clear_object(&self->call);
@@ -301,6 +317,49 @@ static gboolean parse_meeting_type(JsonNode *node, const gchar *member, ChimeMee
 	return TRUE;
 }
 
+static void unindex_meeting_pins(ChimeMeeting *meeting)
+{
+	int i;
+
+	for (i = 0; i < G_N_ELEMENTS(meeting->pin_keys); i++) {
+		gchar *key = meeting->pin_keys[i];
+
+		if (!key)
+			continue;
+
+		ChimeConnection *cxn = chime_object_get_connection(CHIME_OBJECT(meeting));
+		if (cxn) {
+			ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE(cxn);
+
+			if (priv->meetings_by_pin &&
+			    g_hash_table_lookup(priv->meetings_by_pin, key) == meeting)
+				g_hash_table_remove(priv->meetings_by_pin, key);
+		}
+		g_free(key);
+		meeting->pin_keys[i] = NULL;
+	}
+}
+
+static void index_meeting_pins(ChimeConnection *cxn, ChimeMeeting *meeting)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE(cxn);
+	const gchar *pins[2] = { meeting->passcode, meeting->meeting_id_for_display };
+	int i;
+
+	if (!g_strcmp0(pins[0], meeting->pin_keys[0]) &&
+	    !g_strcmp0(pins[1], meeting->pin_keys[1]))
+		return;
+
+	unindex_meeting_pins(meeting);
+	for (i = 0; i < G_N_ELEMENTS(pins); i++) {
+		if (!pins[i] || !pins[i][0])
+			continue;
+
+		meeting->pin_keys[i] = g_strdup(pins[i]);
+		g_hash_table_insert(priv->meetings_by_pin, g_strdup(pins[i]), meeting);
+	}
+}
+
 static ChimeMeeting *chime_connection_parse_meeting(ChimeConnection *cxn, JsonNode *node,
 						    GError **error)
 {
@@ -368,6 +427,7 @@ static ChimeMeeting *chime_connection_parse_meeting(ChimeConnection *cxn, JsonNo
 		g_object_unref(organiser);
 		meeting->call = call;
 		chime_object_collection_hash_object(&priv->meetings, CHIME_OBJECT(meeting), TRUE);
+		index_meeting_pins(cxn, meeting);
 
 		/* Emit signal on ChimeConnection to admit existence of new meeting */
 		chime_connection_new_meeting(cxn, meeting);
@@ -407,6 +467,7 @@ static ChimeMeeting *chime_connection_parse_meeting(ChimeConnection *cxn, JsonNo
 	g_object_unref(call);
 
 	chime_object_collection_hash_object(&priv->meetings, CHIME_OBJECT(meeting), TRUE);
+	index_meeting_pins(cxn, meeting);
 
 	return meeting;
 }
@@ -448,8 +509,9 @@ static void fetch_meetings(ChimeConnection *cxn, const gchar *next_token)
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
 
 	SoupURI *uri = soup_uri_new_printf(priv->conference_url, "/joinable_meetings");
-	chime_connection_queue_http_request(cxn, NULL, uri, "GET", meetings_cb,
-					    NULL);
+	chime_connection_queue_http_request_prio(cxn, NULL, uri, "GET",
+						 CHIME_REQ_BACKGROUND, meetings_cb,
+						 NULL);
 }
 
 static gboolean meeting_jugg_cb(ChimeConnection *cxn, gpointer _unused, JsonNode *data_node)
@@ -492,6 +554,8 @@ void chime_init_meetings(ChimeConnection *cxn)
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
 
 	chime_object_collection_init(cxn, &priv->meetings);
+	priv->meetings_by_pin = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	g_queue_init(&priv->pin_lookups);
 
 	chime_jugg_subscribe(cxn, priv->device_channel, "JoinableMeetings",
 			     joinable_meetings_jugg_cb, NULL);
@@ -506,6 +570,15 @@ void chime_init_meetings(ChimeConnection *cxn)
 	fetch_meetings(cxn, NULL);
 }
 
+static void free_pin_lookup(gpointer _l)
+{
+	struct pin_lookup *l = _l;
+
+	g_free(l->pin);
+	g_free(l->meeting_id);
+	g_free(l);
+}
+
 void chime_destroy_meetings(ChimeConnection *cxn)
 {
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
@@ -524,6 +597,10 @@ void chime_destroy_meetings(ChimeConnection *cxn)
 	if (priv->meetings.by_id)
 		g_hash_table_foreach(priv->meetings.by_id, close_meeting, NULL);
 
+	g_clear_pointer(&priv->meetings_by_pin, g_hash_table_destroy);
+	g_queue_free_full(&priv->pin_lookups, free_pin_lookup);
+	g_queue_init(&priv->pin_lookups);
+
 	chime_object_collection_destroy(&priv->meetings);
 }
 
@@ -533,6 +610,64 @@ gboolean chime_meeting_match_pin(ChimeMeeting *self, const gchar *pin)
 		!g_strcmp0(pin, self->meeting_id_for_display);
 }
 
+/* A meeting we already know by this PIN, without asking the server */
+ChimeMeeting *chime_connection_meeting_by_pin(ChimeConnection *cxn, const gchar *pin)
+{
+	g_return_val_if_fail(CHIME_IS_CONNECTION(cxn), NULL);
+	g_return_val_if_fail(pin != NULL, NULL);
+
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE(cxn);
+	ChimeMeeting *mtg = NULL;
+
+	if (priv->meetings_by_pin)
+		mtg = g_hash_table_lookup(priv->meetings_by_pin, pin);
+
+	if (!mtg) {
+		gint64 cutoff = g_get_monotonic_time() - PIN_LOOKUP_CACHE_AGE;
+		GList *l;
+
+		for (l = priv->pin_lookups.head; l; l = l->next) {
+			struct pin_lookup *pl = l->data;
+
+			if (pl->when < cutoff)
+				break;
+			if (!strcmp(pl->pin, pin)) {
+				mtg = g_hash_table_lookup(priv->meetings.by_id, pl->meeting_id);
+				break;
+			}
+		}
+	}
+
+	if (mtg && chime_object_is_dead(CHIME_OBJECT(mtg)))
+		mtg = NULL;
+	return mtg;
+}
+
+static void remember_pin_lookup(ChimeConnection *cxn, const gchar *pin, ChimeMeeting *mtg)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE(cxn);
+	GList *l;
+
+	for (l = priv->pin_lookups.head; l; l = l->next) {
+		struct pin_lookup *pl = l->data;
+
+		if (!strcmp(pl->pin, pin)) {
+			g_queue_delete_link(&priv->pin_lookups, l);
+			free_pin_lookup(pl);
+			break;
+		}
+	}
+
+	struct pin_lookup *pl = g_new0(struct pin_lookup, 1);
+	pl->pin = g_strdup(pin);
+	pl->meeting_id = g_strdup(chime_object_get_id(CHIME_OBJECT(mtg)));
+	pl->when = g_get_monotonic_time();
+	g_queue_push_head(&priv->pin_lookups, pl);
+
+	while (priv->pin_lookups.length > PIN_LOOKUP_CACHE_SIZE)
+		free_pin_lookup(g_queue_pop_tail(&priv->pin_lookups));
+}
+
 ChimeMeeting *chime_connection_meeting_by_name(ChimeConnection *cxn,
 					 const gchar *name)
 {
@@ -722,9 +857,10 @@ static void pin_join_cb(ChimeConnection *cxn, SoupMessage *msg,
 
 		ChimeMeeting *mtg = chime_connection_parse_meeting(cxn, node, &error);
 		/* This returns a *hashed* meeting, which we don't own. So ref it. */
-		if (mtg)
+		if (mtg) {
+			remember_pin_lookup(cxn, g_object_get_data(G_OBJECT(task), "pin"), mtg);
 			g_task_return_pointer(task, g_object_ref(mtg), (GDestroyNotify)g_object_unref);
-		else
+		} else
 			g_task_return_error(task, error);
 	} else {
 		const gchar *reason;
@@ -754,6 +890,15 @@ void chime_connection_lookup_meeting_by_pin_async(ChimeConnection *cxn,
 
 	GTask *task = g_task_new(cxn, cancellable, callback, user_data);
 
+	/* If juggernaut has already told us about it, go straight to joining */
+	ChimeMeeting *mtg = chime_connection_meeting_by_pin(cxn, pin);
+	if (mtg) {
+		g_task_return_pointer(task, g_object_ref(mtg), (GDestroyNotify)g_object_unref);
+		g_object_unref(task);
+		return;
+	}
+	g_object_set_data_full(G_OBJECT(task), "pin", g_strdup(pin), g_free);
+
 	JsonBuilder *jb = json_builder_new();
 	jb = json_builder_begin_object(jb);
 	jb = json_builder_set_member_name(jb, "pin");
@@ -55,6 +55,7 @@ ChimeRoom *chime_meeting_get_chat_room(ChimeMeeting *self);;
 ChimeCall *chime_meeting_get_call(ChimeMeeting *self);
 
 gboolean chime_meeting_match_pin(ChimeMeeting *self, const gchar *pin);
+ChimeMeeting *chime_connection_meeting_by_pin(ChimeConnection *cxn, const gchar *pin);
 
 ChimeMeeting *chime_connection_meeting_by_name(ChimeConnection *cxn,
 					 const gchar *name);
@@ -0,0 +1,373 @@
+/*
+ * Pidgin/libpurple Chime client plugin
+ *
+ * Copyright © 2017 Amazon.com, Inc. or its affiliates.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Counters which are cheap enough to keep all the time, so that slow
+ * endpoints and reconnect storms can be spotted without turning on
+ * logging. chime_connection_get_metrics() snapshots them as JSON.
+ */
+
+#include "chime-connection-private.h"
+
+#include <string.h>
+
+/* Upper bounds of the latency histogram buckets, in milliseconds.
+ * Anything slower lands in the final bucket. */
+static const guint latency_buckets[CHIME_METRICS_BUCKETS - 1] = {
+	10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000,
+};
+
+/* Likewise for the time taken to handle a juggernaut message, in µs */
+static const guint dispatch_buckets[CHIME_METRICS_BUCKETS - 1] = {
+	50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+};
+
+/* Minimum period over which the juggernaut message rate is averaged */
+#define JUGG_RATE_WINDOW (10 * G_USEC_PER_SEC)
+
+struct chime_endpoint_stats {
+	guint64 count, errors;
+	gint64 total_us, max_us;
+	guint64 buckets[CHIME_METRICS_BUCKETS];
+};
+
+void chime_metrics_init(ChimeConnection *cxn)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+
+	priv->metrics.http = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	priv->metrics.created = g_get_monotonic_time();
+	priv->metrics.jugg_window_start = priv->metrics.created;
+}
+
+void chime_metrics_destroy(ChimeConnection *cxn)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+
+	g_clear_pointer(&priv->metrics.http, g_hash_table_destroy);
+}
+
+/* Path components which look like IDs are replaced with '*', so that
+ * requests are grouped by what they do rather than what to. */
+static gchar *endpoint_name(SoupURI *uri)
+{
+	GString *str = g_string_new(uri->host);
+	const gchar *p = uri->path;
+
+	while (p && *p) {
+		const gchar *end;
+		gboolean digits = FALSE;
+
+		while (*p == '/')
+			p++;
+		for (end = p; *end && *end != '/'; end++)
+			digits |= g_ascii_isdigit(*end);
+		if (end == p)
+			break;
+
+		g_string_append_c(str, '/');
+		if (digits && end - p >= 8)
+			g_string_append_c(str, '*');
+		else
+			g_string_append_len(str, p, end - p);
+		p = end;
+	}
+	return g_string_free(str, FALSE);
+}
+
+static guint bucket_for(const guint *bounds, gint64 val)
+{
+	guint i;
+
+	for (i = 0; i < CHIME_METRICS_BUCKETS - 1; i++) {
+		if (val <= bounds[i])
+			break;
+	}
+	return i;
+}
+
+/* The upper bound of the bucket in which the pct'th percentile falls.
+ * For the final bucket, which has none, the worst case seen is used. */
+static gint64 percentile(const guint64 *buckets, const guint *bounds, guint pct, gint64 max)
+{
+	guint64 count = 0, seen = 0;
+	guint i;
+
+	for (i = 0; i < CHIME_METRICS_BUCKETS; i++)
+		count += buckets[i];
+	if (!count)
+		return 0;
+
+	guint64 want = (count * pct + 99) / 100;
+	for (i = 0; i < CHIME_METRICS_BUCKETS - 1; i++) {
+		seen += buckets[i];
+		if (seen >= want)
+			return bounds[i];
+	}
+	return max;
+}
+
+void chime_metrics_http(ChimeConnection *cxn, SoupMessage *msg, gint64 started)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+
+	if (!priv->metrics.http || !started)
+		return;
+
+	gchar *name = endpoint_name(soup_message_get_uri(msg));
+	struct chime_endpoint_stats *st = g_hash_table_lookup(priv->metrics.http, name);
+	if (st)
+		g_free(name);
+	else {
+		st = g_new0(struct chime_endpoint_stats, 1);
+		g_hash_table_insert(priv->metrics.http, name, st);
+	}
+
+	gint64 us = g_get_monotonic_time() - started;
+
+	st->buckets[bucket_for(latency_buckets, us / 1000)]++;
+	st->count++;
+	if (!SOUP_STATUS_IS_SUCCESSFUL(msg->status_code))
+		st->errors++;
+	st->total_us += us;
+	if (us > st->max_us)
+		st->max_us = us;
+}
+
+void chime_metrics_jugg_message(ChimeConnection *cxn)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+
+	priv->metrics.jugg_messages++;
+}
+
+/* Time spent without the websocket doesn't count towards the rate */
+void chime_metrics_jugg_connected(ChimeConnection *cxn)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+
+	priv->metrics.jugg_window_start = g_get_monotonic_time();
+	priv->metrics.jugg_window_base = priv->metrics.jugg_messages;
+}
+
+void chime_metrics_jugg_dispatch(ChimeConnection *cxn, gint64 started)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	gint64 us = g_get_monotonic_time() - started;
+
+	priv->metrics.jugg_dispatch[bucket_for(dispatch_buckets, us)]++;
+	priv->metrics.jugg_dispatch_total_us += us;
+	if (us > priv->metrics.jugg_dispatch_max_us)
+		priv->metrics.jugg_dispatch_max_us = us;
+}
+
+/* Averaged over at least JUGG_RATE_WINDOW, up to whenever we were last asked */
+static double jugg_rate(ChimeConnectionPrivate *priv)
+{
+	gint64 now = g_get_monotonic_time();
+	gint64 elapsed = now - priv->metrics.jugg_window_start;
+
+	if (elapsed >= JUGG_RATE_WINDOW) {
+		priv->metrics.jugg_rate = (double)(priv->metrics.jugg_messages -
+						   priv->metrics.jugg_window_base) *
+			G_USEC_PER_SEC / elapsed;
+		priv->metrics.jugg_window_base = priv->metrics.jugg_messages;
+		priv->metrics.jugg_window_start = now;
+	}
+	return priv->metrics.jugg_rate;
+}
+
+static void add_uint(JsonBuilder *jb, const gchar *name, guint64 val)
+{
+	jb = json_builder_set_member_name(jb, name);
+	jb = json_builder_add_int_value(jb, val);
+}
+
+static void add_http(gpointer _name, gpointer _st, gpointer _jb)
+{
+	struct chime_endpoint_stats *st = _st;
+	JsonBuilder *jb = _jb;
+	int i;
+
+	jb = json_builder_set_member_name(jb, _name);
+	jb = json_builder_begin_object(jb);
+	add_uint(jb, "count", st->count);
+	add_uint(jb, "errors", st->errors);
+	add_uint(jb, "mean-us", st->count ? st->total_us / st->count : 0);
+	add_uint(jb, "max-us", st->max_us);
+	add_uint(jb, "p50-ms", percentile(st->buckets, latency_buckets, 50, st->max_us / 1000));
+	add_uint(jb, "p99-ms", percentile(st->buckets, latency_buckets, 99, st->max_us / 1000));
+	jb = json_builder_set_member_name(jb, "histogram-ms");
+	jb = json_builder_begin_object(jb);
+	for (i = 0; i < CHIME_METRICS_BUCKETS; i++) {
+		gchar name[16];
+
+		if (i < G_N_ELEMENTS(latency_buckets))
+			snprintf(name, sizeof(name), "%u", latency_buckets[i]);
+		else
+			strcpy(name, "inf");
+		add_uint(jb, name, st->buckets[i]);
+	}
+	jb = json_builder_end_object(jb);
+	jb = json_builder_end_object(jb);
+}
+
+static void add_dispatch(JsonBuilder *jb, ChimeMetrics *m)
+{
+	guint64 handled = 0;
+	int i;
+
+	for (i = 0; i < CHIME_METRICS_BUCKETS; i++)
+		handled += m->jugg_dispatch[i];
+
+	jb = json_builder_set_member_name(jb, "dispatch");
+	jb = json_builder_begin_object(jb);
+	add_uint(jb, "mean-us", handled ? m->jugg_dispatch_total_us / handled : 0);
+	add_uint(jb, "max-us", m->jugg_dispatch_max_us);
+	add_uint(jb, "p50-us", percentile(m->jugg_dispatch, dispatch_buckets, 50,
+					  m->jugg_dispatch_max_us));
+	add_uint(jb, "p99-us", percentile(m->jugg_dispatch, dispatch_buckets, 99,
+					  m->jugg_dispatch_max_us));
+	jb = json_builder_end_object(jb);
+}
+
+static void add_collection(JsonBuilder *jb, const gchar *name, ChimeObjectCollection *coll)
+{
+	jb = json_builder_set_member_name(jb, name);
+	jb = json_builder_begin_object(jb);
+	add_uint(jb, "total", coll->by_id ? g_hash_table_size(coll->by_id) : 0);
+	add_uint(jb, "live", coll->live_objects.length);
+	jb = json_builder_end_object(jb);
+}
+
+static void add_media(JsonBuilder *jb, const gchar *name, ChimeMediaStats *st)
+{
+	jb = json_builder_set_member_name(jb, name);
+	jb = json_builder_begin_object(jb);
+	add_uint(jb, "tx-packets", st->tx_packets);
+	add_uint(jb, "tx-bytes", st->tx_bytes);
+	add_uint(jb, "rx-packets", st->rx_packets);
+	add_uint(jb, "rx-bytes", st->rx_bytes);
+	jb = json_builder_end_object(jb);
+}
+
+static void add_int(JsonBuilder *jb, const gchar *name, gint64 val)
+{
+	jb = json_builder_set_member_name(jb, name);
+	jb = json_builder_add_int_value(jb, val);
+}
+
+static void add_audio_quality(JsonBuilder *jb, ChimeCallAudioStats *st)
+{
+	static const gchar *transports[] = { "none", "dtls", "websocket" };
+
+	jb = json_builder_set_member_name(jb, "audio-quality");
+	jb = json_builder_begin_object(jb);
+	jb = json_builder_set_member_name(jb, "transport");
+	jb = json_builder_add_string_value(jb, transports[st->transport]);
+	add_uint(jb, "reconnects", st->reconnects);
+	add_uint(jb, "rx-frames", st->rx_frames);
+	add_uint(jb, "rx-lost", st->rx_lost);
+	add_uint(jb, "rx-reordered", st->rx_reordered);
+	add_uint(jb, "rx-duplicates", st->rx_duplicates);
+	add_uint(jb, "tx-frames", st->tx_frames);
+	add_uint(jb, "tx-frames-missed", st->tx_frames_missed);
+	add_int(jb, "rtt-us", st->rtt_us);
+	add_int(jb, "srtt-us", st->srtt_us);
+	add_int(jb, "jitter-us", st->jitter_us);
+	add_int(jb, "tx-jitter-us", st->tx_jitter_us);
+	add_int(jb, "tx-cost-us", st->tx_cost_us);
+	jb = json_builder_end_object(jb);
+}
+
+static void add_call(ChimeConnection *cxn, ChimeObject *obj, gpointer _jb)
+{
+	JsonBuilder *jb = _jb;
+	ChimeMediaStats audio, screen;
+	ChimeCallAudioStats quality;
+
+	if (!chime_call_get_media_stats(CHIME_CALL(obj), &audio, &screen))
+		return;
+
+	jb = json_builder_set_member_name(jb, chime_call_get_uuid(CHIME_CALL(obj)));
+	jb = json_builder_begin_object(jb);
+	add_media(jb, "audio", &audio);
+	add_media(jb, "screen", &screen);
+	if (chime_call_get_audio_stats(CHIME_CALL(obj), &quality))
+		add_audio_quality(jb, &quality);
+	jb = json_builder_end_object(jb);
+}
+
+JsonNode *chime_connection_get_metrics(ChimeConnection *self)
+{
+	g_return_val_if_fail(CHIME_IS_CONNECTION(self), NULL);
+
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (self);
+	JsonBuilder *jb = json_builder_new();
+	int prio;
+
+	jb = json_builder_begin_object(jb);
+	add_uint(jb, "uptime", (g_get_monotonic_time() - priv->metrics.created) / G_USEC_PER_SEC);
+
+	jb = json_builder_set_member_name(jb, "requests");
+	jb = json_builder_begin_object(jb);
+	add_uint(jb, "in-flight", priv->msgs_queued ? g_queue_get_length(priv->msgs_queued) : 0);
+	add_uint(jb, "pending-auth", priv->msgs_pending_auth ? g_queue_get_length(priv->msgs_pending_auth) : 0);
+	jb = json_builder_set_member_name(jb, "waiting");
+	jb = json_builder_begin_array(jb);
+	for (prio = 0; prio < CHIME_REQ_N_PRIORITIES; prio++)
+		jb = json_builder_add_int_value(jb, chime_connection_get_queue_depth(self, prio));
+	jb = json_builder_end_array(jb);
+	jb = json_builder_end_object(jb);
+
+	jb = json_builder_set_member_name(jb, "http");
+	jb = json_builder_begin_object(jb);
+	if (priv->metrics.http)
+		g_hash_table_foreach(priv->metrics.http, add_http, jb);
+	jb = json_builder_end_object(jb);
+
+	jb = json_builder_set_member_name(jb, "juggernaut");
+	jb = json_builder_begin_object(jb);
+	jb = json_builder_set_member_name(jb, "online");
+	jb = json_builder_add_boolean_value(jb, priv->jugg_online);
+	add_uint(jb, "messages", priv->metrics.jugg_messages);
+	jb = json_builder_set_member_name(jb, "messages-per-sec");
+	jb = json_builder_add_double_value(jb, jugg_rate(priv));
+	add_uint(jb, "connects", priv->metrics.jugg_connects);
+	add_uint(jb, "subscriptions", priv->subscriptions ? g_hash_table_size(priv->subscriptions) : 0);
+	add_dispatch(jb, &priv->metrics);
+	jb = json_builder_end_object(jb);
+
+	jb = json_builder_set_member_name(jb, "objects");
+	jb = json_builder_begin_object(jb);
+	add_collection(jb, "contacts", &priv->contacts);
+	add_collection(jb, "rooms", &priv->rooms);
+	add_collection(jb, "conversations", &priv->conversations);
+	add_collection(jb, "meetings", &priv->meetings);
+	add_collection(jb, "calls", &priv->calls);
+	jb = json_builder_end_object(jb);
+
+	jb = json_builder_set_member_name(jb, "calls");
+	jb = json_builder_begin_object(jb);
+	if (priv->calls.by_id)
+		chime_object_collection_foreach_object(self, &priv->calls, add_call, jb);
+	jb = json_builder_end_object(jb);
+
+	jb = json_builder_end_object(jb);
+
+	JsonNode *node = json_builder_get_root(jb);
+	g_object_unref(jb);
+	return node;
+}
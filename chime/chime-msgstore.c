@@ -0,0 +1,456 @@
+/*
+ * Pidgin/libpurple Chime client plugin
+ *
+ * Copyright © 2017 Amazon.com, Inc. or its affiliates.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+/*
+ * Local message history, so that we don't have to fetch it all again
+ * from the server every time.
+ *
+ * For each room or conversation there is a log of messages, one JSON
+ * object per line, and an index of fixed-size (CreatedOn, UpdatedOn,
+ * offset, length) entries sorted by CreatedOn. The index header records
+ * the time period which the store covers completely; anything in the
+ * index after 'end' was written by an append that never finished.
+ *
+ * Only the results of completed fetches are added to the store, and only
+ * when they extend it contiguously. Messages received over juggernaut
+ * are not, since we may have missed others while it was disconnected.
+ * The exception is an edit of a message which is already stored.
+ *
+ * Messages are told apart by MessageId and UpdatedOn. An edited message
+ * gets a further entry after the earlier version, and replay emits both
+ * in that order, so the newer one wins as it does when fetched.
+ */
+
+#include "chime-connection-private.h"
+
+#include <glib/gstdio.h>
+#include <string.h>
+
+#define MSGSTORE_MAGIC		0x6d736368	/* "hcsm" */
+#define MSGSTORE_VERSION	2
+
+struct msgstore_hdr {
+	guint32 magic;
+	guint32 version;
+	gint64 start;
+	gint64 end;
+};
+
+struct msgstore_ent {
+	gint64 created;
+	gint64 updated;
+	guint64 offset;
+	guint32 len;
+	guint32 reserved;
+};
+
+struct msgstore_map {
+	GMappedFile *idx_file, *log_file;
+	const struct msgstore_hdr *hdr;
+	const struct msgstore_ent *ents;
+	gsize n_ents;
+	gboolean torn;	/* Unfinished entries after the valid ones */
+	const gchar *log;
+	gsize log_len;
+};
+
+static gchar *msgstore_path(ChimeConnection *cxn, ChimeObject *obj, const gchar *ext)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+
+	if (!priv->cache_dir || !priv->message_store)
+		return NULL;
+
+	gchar *name = g_strdup_printf("%s-%s.%s", CHIME_IS_ROOM(obj) ? "room" : "conversation",
+				      chime_object_get_id(obj), ext);
+	gchar *path = g_build_filename(priv->cache_dir, "messages", name, NULL);
+	g_free(name);
+
+	return path;
+}
+
+static void unmap_store(struct msgstore_map *m)
+{
+	if (m->idx_file)
+		g_mapped_file_unref(m->idx_file);
+	if (m->log_file)
+		g_mapped_file_unref(m->log_file);
+	memset(m, 0, sizeof(*m));
+}
+
+static gboolean map_store(ChimeConnection *cxn, ChimeObject *obj, struct msgstore_map *m)
+{
+	gchar *idx_path = msgstore_path(cxn, obj, "idx");
+	gchar *log_path = msgstore_path(cxn, obj, "log");
+	gboolean ret = FALSE;
+
+	memset(m, 0, sizeof(*m));
+	if (!idx_path)
+		goto out;
+
+	m->idx_file = g_mapped_file_new(idx_path, FALSE, NULL);
+	m->log_file = g_mapped_file_new(log_path, FALSE, NULL);
+	if (!m->idx_file || !m->log_file)
+		goto out;
+
+	gsize idx_len = g_mapped_file_get_length(m->idx_file);
+	if (idx_len < sizeof(*m->hdr))
+		goto out;
+
+	m->hdr = (void *)g_mapped_file_get_contents(m->idx_file);
+	if (m->hdr->magic != MSGSTORE_MAGIC || m->hdr->version != MSGSTORE_VERSION)
+		goto out;
+
+	m->log = g_mapped_file_get_contents(m->log_file);
+	m->log_len = g_mapped_file_get_length(m->log_file);
+	m->ents = (void *)(m->hdr + 1);
+
+	gsize i, n = (idx_len - sizeof(*m->hdr)) / sizeof(*m->ents);
+	for (i = 0; i < n; i++) {
+		if (m->ents[i].created > m->hdr->end ||
+		    m->ents[i].offset + m->ents[i].len > m->log_len)
+			break;
+	}
+	m->n_ents = i;
+	m->torn = (i != n || (idx_len - sizeof(*m->hdr)) % sizeof(*m->ents));
+	ret = TRUE;
+ out:
+	if (!ret)
+		unmap_store(m);
+	g_free(idx_path);
+	g_free(log_path);
+	return ret;
+}
+
+/* First entry created after 'when' */
+static gsize find_after(struct msgstore_map *m, gint64 when)
+{
+	gsize lo = 0, hi = m->n_ents;
+
+	while (lo < hi) {
+		gsize mid = (lo + hi) / 2;
+
+		if (m->ents[mid].created <= when)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Emit "message" on the object for each stored message created in the range
+ * (after, before). Returns TRUE if the store covered all of that range.
+ * Otherwise *resume is set to the time from which to fetch the rest from
+ * the server (and record it with chime_msgstore_append()), or -1 if the
+ * store can't be extended to cover this fetch. */
+gboolean chime_msgstore_replay(ChimeConnection *cxn, ChimeObject *obj,
+			       gint64 before, gint64 after, gint64 *resume)
+{
+	struct msgstore_map m;
+
+	*resume = -1;
+
+	if (!map_store(cxn, obj, &m)) {
+		/* No store yet, so start one from here */
+		gchar *path = msgstore_path(cxn, obj, "idx");
+		if (path)
+			*resume = after;
+		g_free(path);
+		return FALSE;
+	}
+
+	if (after < m.hdr->start) {
+		unmap_store(&m);
+		return FALSE;
+	}
+
+	JsonParser *parser = json_parser_new();
+	gsize i;
+	guint count = 0;
+
+	for (i = find_after(&m, after); i < m.n_ents; i++) {
+		const struct msgstore_ent *ent = &m.ents[i];
+
+		if (before && ent->created >= before)
+			break;
+
+		if (!json_parser_load_from_data(parser, m.log + ent->offset, ent->len, NULL))
+			continue;
+
+		g_signal_emit_by_name(obj, "message", json_parser_get_root(parser));
+		count++;
+	}
+	g_object_unref(parser);
+
+	chime_connection_log(cxn, CHIME_LOGLVL_MISC, "Replayed %u stored messages for %s\n",
+			     count, chime_object_get_id(obj));
+
+	gboolean covered = before && before <= m.hdr->end + 1;
+	if (!covered)
+		*resume = MAX(after, m.hdr->end);
+
+	unmap_store(&m);
+	return covered;
+}
+
+static gboolean parse_msg_times(JsonNode *node, gint64 *created, gint64 *updated)
+{
+	const gchar *str;
+
+	if (!parse_string(node, "CreatedOn", &str) || !chime_parse_time_us(str, created))
+		return FALSE;
+	if (!parse_string(node, "UpdatedOn", &str) || !chime_parse_time_us(str, updated))
+		*updated = *created;
+	return TRUE;
+}
+
+static gint compare_created(gconstpointer _a, gconstpointer _b)
+{
+	JsonNode *a = *(JsonNode **)_a, *b = *(JsonNode **)_b;
+	gint64 a_us = 0, b_us = 0, a_upd = 0, b_upd = 0;
+
+	parse_msg_times(a, &a_us, &a_upd);
+	parse_msg_times(b, &b_us, &b_upd);
+
+	if (a_us != b_us)
+		return (a_us > b_us) - (a_us < b_us);
+	return (a_upd > b_upd) - (a_upd < b_upd);
+}
+
+/* The newest UpdatedOn stored for the message, or -1 if it isn't there */
+static gint64 stored_version(const struct msgstore_map *m, JsonParser *parser,
+			     const gchar *id, gint64 created)
+{
+	gint64 best = -1;
+	gsize i;
+
+	for (i = find_after((struct msgstore_map *)m, created - 1);
+	     i < m->n_ents && m->ents[i].created == created; i++) {
+		const struct msgstore_ent *ent = &m->ents[i];
+		const gchar *ent_id;
+
+		if (ent->updated <= best ||
+		    !json_parser_load_from_data(parser, m->log + ent->offset, ent->len, NULL))
+			continue;
+
+		if (parse_string(json_parser_get_root(parser), "MessageId", &ent_id) &&
+		    !strcmp(ent_id, id))
+			best = ent->updated;
+	}
+	return best;
+}
+
+static void reset_store(gchar *idx_path, gchar *log_path)
+{
+	g_unlink(idx_path);
+	g_unlink(log_path);
+}
+
+/*
+ * Add msgs to the store, whose existing contents (if any) are mapped in m,
+ * skipping any version of a message that it already has. Anything newer
+ * than the store's end is appended to the index; an edit of an older
+ * message means rewriting the index to keep it in order.
+ */
+static gboolean write_msgs(struct msgstore_map *m, struct msgstore_hdr *hdr,
+			   const gchar *idx_path, const gchar *log_path,
+			   GPtrArray *msgs, gint64 before)
+{
+	gsize n_ents = m ? m->n_ents : 0;
+	GArray *ents = g_array_new(FALSE, FALSE, sizeof(struct msgstore_ent));
+	JsonParser *parser = json_parser_new();
+	gboolean in_order = TRUE, ok = FALSE;
+	FILE *idx = NULL, *log = NULL;
+	gint64 last = n_ents ? m->ents[n_ents - 1].created : G_MININT64;
+
+	gchar *dir = g_path_get_dirname(idx_path);
+	int ret = g_mkdir_with_parents(dir, 0700);
+	g_free(dir);
+	if (ret)
+		goto out;
+
+	log = g_fopen(log_path, n_ents ? "ab" : "wb");
+	idx = g_fopen(idx_path, n_ents ? "r+b" : "w+b");
+	if (!log || !idx || fseek(log, 0, SEEK_END))
+		goto out;
+
+	g_ptr_array_sort(msgs, compare_created);
+
+	gint64 end = hdr->end;
+	guint i;
+	for (i = 0; i < msgs->len; i++) {
+		JsonNode *node = msgs->pdata[i];
+		const gchar *id;
+		struct msgstore_ent ent;
+
+		if (!parse_string(node, "MessageId", &id) ||
+		    !parse_msg_times(node, &ent.created, &ent.updated) ||
+		    ent.created < hdr->start)
+			continue;
+
+		/* Sharing a timestamp with what we have doesn't make it a
+		 * duplicate; the same version of the same message does. */
+		if (n_ents && ent.created <= m->ents[n_ents - 1].created &&
+		    stored_version(m, parser, id, ent.created) >= ent.updated)
+			continue;
+
+		gsize len;
+		gchar *str = json_to_string(node, FALSE);
+		len = strlen(str);
+
+		ent.offset = ftell(log);
+		ent.len = len;
+		ent.reserved = 0;
+		ret = fwrite(str, len, 1, log) != 1 || fputc('\n', log) == EOF;
+		g_free(str);
+		if (ret)
+			goto out;
+
+		if (ent.created < last)
+			in_order = FALSE;
+		last = MAX(last, ent.created);
+		end = MAX(end, ent.created);
+		g_array_append_val(ents, ent);
+	}
+
+	if (in_order) {
+		if (fseek(idx, sizeof(*hdr) + n_ents * sizeof(struct msgstore_ent), SEEK_SET) ||
+		    (ents->len && fwrite(ents->data, sizeof(struct msgstore_ent), ents->len, idx) != ents->len))
+			goto out;
+	} else {
+		/* Merge, with each new version after any earlier one */
+		GArray *all = g_array_sized_new(FALSE, FALSE, sizeof(struct msgstore_ent),
+						n_ents + ents->len);
+		gsize j = 0, k = 0;
+
+		while (j < n_ents || k < ents->len) {
+			const struct msgstore_ent *new_ent = k < ents->len ?
+				&g_array_index(ents, struct msgstore_ent, k) : NULL;
+
+			if (j < n_ents && (!new_ent || m->ents[j].created <= new_ent->created))
+				g_array_append_val(all, m->ents[j++]);
+			else {
+				g_array_append_vals(all, new_ent, 1);
+				k++;
+			}
+		}
+		ret = fseek(idx, sizeof(*hdr), SEEK_SET) ||
+			fwrite(all->data, sizeof(struct msgstore_ent), all->len, idx) != all->len;
+		g_array_free(all, TRUE);
+		if (ret)
+			goto out;
+	}
+
+	/* The entries only count once the header says so */
+	if (before)
+		end = MAX(end, before - 1);
+	hdr->end = end;
+	if (fflush(log) || fflush(idx) || fseek(idx, 0, SEEK_SET) ||
+	    fwrite(hdr, sizeof(*hdr), 1, idx) != 1 || fflush(idx))
+		goto out;
+
+	ok = TRUE;
+ out:
+	if (log && fclose(log))
+		ok = FALSE;
+	if (idx && fclose(idx))
+		ok = FALSE;
+	g_object_unref(parser);
+	g_array_free(ents, TRUE);
+	return ok;
+}
+
+/* Record the messages from a completed fetch of the range (from, before),
+ * where 'from' was the *resume value given by chime_msgstore_replay(). */
+void chime_msgstore_append(ChimeConnection *cxn, ChimeObject *obj,
+			   gint64 from, gint64 before, GPtrArray *msgs)
+{
+	gchar *idx_path = msgstore_path(cxn, obj, "idx");
+	gchar *log_path = msgstore_path(cxn, obj, "log");
+	struct msgstore_hdr hdr;
+	struct msgstore_map m;
+	gboolean mapped = FALSE;
+
+	if (!idx_path)
+		goto out;
+
+	if (map_store(cxn, obj, &m)) {
+		hdr = *m.hdr;
+		mapped = TRUE;
+
+		/* Someone else may have extended the store meanwhile; that's fine
+		 * as long as this fetch still joins on to what it covers. If it
+		 * doesn't, but it does reach the present, start again from it. */
+		gboolean torn = m.torn;
+		if (from < hdr.start || from > hdr.end) {
+			if (before)
+				goto out;
+			torn = TRUE;
+		}
+		if (torn) {
+			unmap_store(&m);
+			mapped = FALSE;
+			reset_store(idx_path, log_path);
+		}
+	}
+	if (!mapped) {
+		hdr.magic = MSGSTORE_MAGIC;
+		hdr.version = MSGSTORE_VERSION;
+		hdr.start = hdr.end = from;
+	}
+
+	if (!write_msgs(mapped ? &m : NULL, &hdr, idx_path, log_path, msgs, before)) {
+		chime_connection_log(cxn, CHIME_LOGLVL_WARNING, "Failed to write message store %s\n",
+				     idx_path);
+		/* Don't let a half-written store be trusted */
+		reset_store(idx_path, log_path);
+	}
+ out:
+	if (mapped)
+		unmap_store(&m);
+	g_free(idx_path);
+	g_free(log_path);
+}
+
+/* A message that arrived live. If it's a newer version of one which is
+ * already stored, keep that instead; nothing else is stored from here. */
+void chime_msgstore_update(ChimeConnection *cxn, ChimeObject *obj, JsonNode *node)
+{
+	gint64 created, updated;
+	struct msgstore_map m;
+
+	/* Only an edit can be of anything we have */
+	if (!parse_msg_times(node, &created, &updated) || updated <= created ||
+	    !map_store(cxn, obj, &m))
+		return;
+
+	if (!m.torn && created >= m.hdr->start && created <= m.hdr->end) {
+		gchar *idx_path = msgstore_path(cxn, obj, "idx");
+		gchar *log_path = msgstore_path(cxn, obj, "log");
+		struct msgstore_hdr hdr = *m.hdr;
+		GPtrArray *msgs = g_ptr_array_new();
+
+		g_ptr_array_add(msgs, node);
+		if (!write_msgs(&m, &hdr, idx_path, log_path, msgs, 0)) {
+			chime_connection_log(cxn, CHIME_LOGLVL_WARNING,
+					     "Failed to write message store %s\n", idx_path);
+			reset_store(idx_path, log_path);
+		}
+		g_ptr_array_unref(msgs);
+		g_free(idx_path);
+		g_free(log_path);
+	}
+	unmap_store(&m);
+}
@@ -25,10 +25,16 @@
 typedef struct {
 	GObject parent_instance;
 
-	gchar *id;
+	gchar *id;		/* Interned in the connection once we have one */
 	gchar *name;
+	gboolean id_interned;
 
 	gint64 generation;
+	/* In collection->live_objects, while live. Its data is the object. */
+	GList gen_link;
+
+	/* The node we were last parsed from, if the collection is snapshotted */
+	JsonNode *snapshot_node;
 
 	/* While the obiect is live and discoverable, we hold a refcount to it
 	 * But once it's dead, it remains in the hash table to avoid duplicates
@@ -60,6 +66,26 @@ enum {
 
 static guint signals[LAST_SIGNAL];
 
+/* The live objects in a collection are kept on a queue in order of
+ * generation, using a list node embedded in each object. Since the
+ * generation only ever goes up, moving an object to the tail whenever
+ * it is (re)hashed keeps the queue sorted without any allocation. */
+static void gen_unlink(ChimeObjectCollection *coll, ChimeObjectPrivate *priv)
+{
+	if (priv->gen_link.data) {
+		g_queue_unlink(&coll->live_objects, &priv->gen_link);
+		priv->gen_link.data = NULL;
+	}
+}
+
+static void gen_touch(ChimeObjectCollection *coll, ChimeObjectPrivate *priv,
+		      ChimeObject *self)
+{
+	gen_unlink(coll, priv);
+	priv->gen_link.data = self;
+	g_queue_push_tail_link(&coll->live_objects, &priv->gen_link);
+}
+
 static void
 chime_object_dispose(GObject *object)
 {
@@ -69,17 +95,19 @@ chime_object_dispose(GObject *object)
 	priv = chime_object_get_instance_private (self);
 
 	if (priv->collection) {
+		gen_unlink(priv->collection, priv);
 		g_hash_table_remove(priv->collection->by_name, priv->name);
 		g_hash_table_remove(priv->collection->by_id, priv->id);
 	}
 
 	chime_debug("Object disposed: %p\n", self);
 
+	/* Handlers may still want the connection, so let it go after */
+	g_signal_emit(object, signals[DISPOSED], 0);
+
 	if (priv->cxn)
 		g_clear_object(&priv->cxn);
 
-	g_signal_emit(object, signals[DISPOSED], 0);
-
 	G_OBJECT_CLASS(chime_object_parent_class)->dispose(object);
 }
 
@@ -91,8 +119,11 @@ chime_object_finalize(GObject *object)
 
 	priv = chime_object_get_instance_private (self);
 
-	g_free(priv->id);
+	if (!priv->id_interned)
+		g_free(priv->id);
 	g_free(priv->name);
+	if (priv->snapshot_node)
+		json_node_unref(priv->snapshot_node);
 
 	G_OBJECT_CLASS(chime_object_parent_class)->finalize(object);
 }
@@ -271,12 +302,24 @@ void chime_object_collection_hash_object(ChimeObjectCollection *collection, Chim
 	if (!priv->cxn)
 		priv->cxn = g_object_ref(collection->cxn);
 
+	if (!priv->id_interned && priv->id) {
+		gchar *id = (gchar *)chime_connection_intern(priv->cxn, priv->id);
+		g_free(priv->id);
+		priv->id = id;
+		priv->id_interned = TRUE;
+	}
+
 	if (!priv->collection) {
 		priv->collection = collection;
 		g_hash_table_insert(collection->by_id, priv->id, object);
 		g_hash_table_insert(collection->by_name, priv->name, object);
 	}
 
+	if (live)
+		gen_touch(priv->collection, priv, object);
+	else
+		gen_unlink(priv->collection, priv);
+
 	if (live && priv->is_dead) {
 		g_object_ref(object);
 		priv->is_dead = FALSE;
@@ -288,21 +331,44 @@ void chime_object_collection_hash_object(ChimeObjectCollection *collection, Chim
 	}
 }
 
+/* Only the objects at the head of the queue can be out of date */
 void chime_object_collection_expire_outdated(ChimeObjectCollection *coll)
 {
-	GList *objects = g_hash_table_get_values(coll->by_id);
-	while (objects) {
-		ChimeObject *object = CHIME_OBJECT(objects->data);
+	GList *l;
+
+	while ((l = coll->live_objects.head)) {
+		ChimeObject *object = CHIME_OBJECT(l->data);
 		ChimeObjectPrivate *priv;
 
 		priv = chime_object_get_instance_private (object);
 
-		if (!priv->is_dead && priv->generation != coll->generation) {
+		if (priv->generation == coll->generation)
+			break;
+
+		gen_unlink(coll, priv);
+		if (!priv->is_dead) {
 			priv->is_dead = TRUE;
 			g_object_notify(G_OBJECT(object), "dead");
 			g_object_unref(object);
 		}
-		objects = g_list_remove(objects, object);
+	}
+}
+
+void chime_object_collection_foreach_since(ChimeConnection *cxn, ChimeObjectCollection *coll,
+					   gint64 generation, ChimeObjectCB cb, gpointer cbdata)
+{
+	GList *l, *prev;
+
+	for (l = coll->live_objects.tail; l; l = prev) {
+		ChimeObject *object = CHIME_OBJECT(l->data);
+		ChimeObjectPrivate *priv;
+
+		priv = chime_object_get_instance_private (object);
+		if (priv->generation < generation)
+			break;
+
+		prev = l->prev;
+		cb(cxn, object, cbdata);
 	}
 }
 
@@ -314,6 +380,8 @@ static void unhash_object(gpointer _object)
 	priv = chime_object_get_instance_private (object);
 
 	/* Now it's unhashed, it doesn't need to unhash itself on dispose() */
+	if (priv->collection)
+		gen_unlink(priv->collection, priv);
 	priv->collection = NULL;
 
 	if (!priv->is_dead) {
@@ -324,10 +392,11 @@ static void unhash_object(gpointer _object)
 
 void chime_object_collection_init(ChimeConnection *cxn, ChimeObjectCollection *coll)
 {
-	coll->by_id = g_hash_table_new_full(g_str_hash, g_str_equal,
-						    NULL, unhash_object);
+	coll->by_id = g_hash_table_new_full(g_str_hash, chime_id_equal,
+					    NULL, unhash_object);
 	coll->by_name = g_hash_table_new(g_str_hash, g_str_equal);
 	coll->generation = 0;
+	g_queue_init(&coll->live_objects);
 	coll->cxn = cxn;
 }
 
@@ -335,6 +404,138 @@ void chime_object_collection_destroy(ChimeObjectCollection *coll)
 {
 	g_clear_pointer(&coll->by_name, g_hash_table_unref);
 	g_clear_pointer(&coll->by_id, g_hash_table_unref);
+	g_clear_pointer(&coll->snapshot_file, g_free);
+}
+
+#define CHIME_SNAPSHOT_VERSION 1
+
+void chime_object_set_snapshot_node(ChimeObject *self, JsonNode *node)
+{
+	ChimeObjectPrivate *priv;
+
+	g_return_if_fail(CHIME_IS_OBJECT(self));
+
+	priv = chime_object_get_instance_private (self);
+
+	/* Don't keep the nodes around unless we're actually going to save them */
+	if (!priv->collection || !priv->collection->snapshot_file)
+		return;
+
+	if (priv->snapshot_node)
+		json_node_unref(priv->snapshot_node);
+	priv->snapshot_node = json_node_copy(node);
+}
+
+/* Objects loaded from the snapshot are hashed as live in the current
+ * generation. The caller then kicks off the normal fetch, which bumps the
+ * generation, and anything the server doesn't tell us about any more will
+ * be killed by chime_object_collection_expire_outdated() at the end of it. */
+gboolean chime_object_collection_load_snapshot(ChimeObjectCollection *coll, const gchar *name,
+					       ChimeObjectParseCB parse)
+{
+	ChimeConnectionPrivate *cxn_priv = CHIME_CONNECTION_GET_PRIVATE (coll->cxn);
+	JsonParser *parser;
+	GError *error = NULL;
+	gint64 version;
+	int i, len, loaded = 0;
+
+	g_clear_pointer(&coll->snapshot_file, g_free);
+	if (!cxn_priv->cache_dir)
+		return FALSE;
+
+	gchar *fname = g_strdup_printf("%s.json", name);
+	coll->snapshot_file = g_build_filename(cxn_priv->cache_dir, fname, NULL);
+	g_free(fname);
+
+	parser = json_parser_new();
+	if (!json_parser_load_from_file(parser, coll->snapshot_file, &error)) {
+		if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+			chime_connection_log(coll->cxn, CHIME_LOGLVL_WARNING,
+					     "Failed to load %s snapshot: %s\n",
+					     name, error->message);
+		g_error_free(error);
+		g_object_unref(parser);
+		return FALSE;
+	}
+
+	JsonNode *root = json_parser_get_root(parser);
+	JsonNode *objs_node = NULL;
+	if (root && JSON_NODE_HOLDS_OBJECT(root) &&
+	    parse_int(root, "Version", &version) && version == CHIME_SNAPSHOT_VERSION)
+		objs_node = json_object_get_member(json_node_get_object(root), "Objects");
+
+	if (!objs_node || !JSON_NODE_HOLDS_ARRAY(objs_node)) {
+		chime_connection_log(coll->cxn, CHIME_LOGLVL_INFO,
+				     "Ignoring stale or invalid %s snapshot\n", name);
+		g_object_unref(parser);
+		return FALSE;
+	}
+
+	JsonArray *arr = json_node_get_array(objs_node);
+	len = json_array_get_length(arr);
+	for (i = 0; i < len; i++) {
+		if (parse(coll->cxn, json_array_get_element(arr, i), NULL))
+			loaded++;
+	}
+	g_object_unref(parser);
+
+	chime_connection_log(coll->cxn, CHIME_LOGLVL_MISC,
+			     "Loaded %d of %d objects from %s snapshot\n",
+			     loaded, len, name);
+	return loaded > 0;
+}
+
+static void snapshot_object_cb(gpointer key, gpointer value, gpointer _arr)
+{
+	ChimeObject *object = CHIME_OBJECT(value);
+	ChimeObjectPrivate *priv;
+
+	priv = chime_object_get_instance_private (object);
+
+	if (!priv->is_dead && priv->snapshot_node)
+		json_array_add_element(_arr, json_node_ref(priv->snapshot_node));
+}
+
+void chime_object_collection_save_snapshot(ChimeObjectCollection *coll)
+{
+	ChimeConnectionPrivate *cxn_priv = CHIME_CONNECTION_GET_PRIVATE (coll->cxn);
+	GError *error = NULL;
+
+	if (!coll->snapshot_file || !coll->by_id)
+		return;
+
+	if (g_mkdir_with_parents(cxn_priv->cache_dir, 0700)) {
+		chime_connection_log(coll->cxn, CHIME_LOGLVL_WARNING,
+				     "Failed to create cache directory %s\n",
+				     cxn_priv->cache_dir);
+		return;
+	}
+
+	JsonArray *arr = json_array_new();
+	g_hash_table_foreach(coll->by_id, snapshot_object_cb, arr);
+
+	JsonObject *obj = json_object_new();
+	json_object_set_int_member(obj, "Version", CHIME_SNAPSHOT_VERSION);
+	json_object_set_array_member(obj, "Objects", arr);
+
+	JsonNode *root = json_node_new(JSON_NODE_OBJECT);
+	json_node_take_object(root, obj);
+
+	JsonGenerator *gen = json_generator_new();
+	json_generator_set_root(gen, root);
+	gsize len;
+	gchar *data = json_generator_to_data(gen, &len);
+
+	if (!g_file_set_contents(coll->snapshot_file, data, len, &error)) {
+		chime_connection_log(coll->cxn, CHIME_LOGLVL_WARNING,
+				     "Failed to save snapshot %s: %s\n",
+				     coll->snapshot_file, error->message);
+		g_error_free(error);
+	}
+
+	g_free(data);
+	g_object_unref(gen);
+	json_node_unref(root);
 }
 
 struct foreach_object_st {
@@ -33,7 +33,9 @@ typedef struct {
 	GHashTable *by_id;
 	GHashTable *by_name;
 	gint64 generation;
+	GQueue live_objects;	/* Oldest generation first */
 	ChimeConnection *cxn;
+	gchar *snapshot_file;
 } ChimeObjectCollection;
 
 struct _ChimeObjectClass {
@@ -65,6 +67,20 @@ void chime_object_collection_foreach_object(ChimeConnection *cxn, ChimeObjectCol
 
 void chime_object_collection_expire_outdated(ChimeObjectCollection *coll);
 
+/* Live objects which have been (re)hashed since 'generation' began,
+ * most recent first. */
+void chime_object_collection_foreach_since(ChimeConnection *cxn, ChimeObjectCollection *coll,
+					   gint64 generation, ChimeObjectCB cb, gpointer cbdata);
+
+/* On-disk snapshots of a collection, to populate it at startup before
+ * the server has been asked. Each object keeps the JSON node that it
+ * was last parsed from, and the snapshot is just an array of those. */
+typedef ChimeObject *(*ChimeObjectParseCB) (ChimeConnection *, JsonNode *, GError **);
+void chime_object_set_snapshot_node(ChimeObject *self, JsonNode *node);
+gboolean chime_object_collection_load_snapshot(ChimeObjectCollection *coll, const gchar *name,
+					       ChimeObjectParseCB parse);
+void chime_object_collection_save_snapshot(ChimeObjectCollection *coll);
+
 void             chime_connection_send_message_async         (ChimeConnection    *self,
                                                               ChimeObject        *obj,
                                                               const gchar        *message,
@@ -89,6 +105,18 @@ gboolean         chime_connection_fetch_messages_finish      (ChimeConnection  *
                                                               GAsyncResult     *result,
                                                               GError          **error);
 
+void             chime_connection_fetch_message_async        (ChimeConnection    *self,
+                                                              ChimeObject        *obj,
+                                                              const gchar        *msg_id,
+                                                              const gchar        *created_on,
+                                                              GCancellable       *cancellable,
+                                                              GAsyncReadyCallback callback,
+                                                              gpointer            user_data);
+
+JsonNode        *chime_connection_fetch_message_finish       (ChimeConnection  *self,
+                                                              GAsyncResult     *result,
+                                                              GError          **error);
+
 void             chime_connection_update_last_read_async     (ChimeConnection    *self,
                                                               ChimeObject        *obj,
                                                               const gchar        *msg_id,
@@ -63,10 +63,16 @@
 	name, low,
 #define CHIME_PROPS_NEWOBJ STRING_PROPS(_chime_prop_newobj) BOOL_PROPS(_chime_prop_newobj)
 
+/* Optionally invalidate anything derived from the strings, before notifying */
+#ifndef CHIME_PROP_STR_CHANGED
+#define CHIME_PROP_STR_CHANGED(obj)
+#endif
+
 #define _chime_prop_update_str(low, up, json, name, nick, req)	\
 	if (low && g_strcmp0(low, CHIME_PROP_OBJ_VAR->low)) {		\
 		g_free(CHIME_PROP_OBJ_VAR->low);			\
 		CHIME_PROP_OBJ_VAR->low = g_strdup(low);		\
+		CHIME_PROP_STR_CHANGED(CHIME_PROP_OBJ_VAR);		\
 		g_object_notify(G_OBJECT(CHIME_PROP_OBJ_VAR), name);	\
 	}
 #define _chime_prop_update_bool(low, up, json, name, nick, req)	\
@@ -33,6 +33,7 @@
 	x(last_read, LAST_READ, "LastRead", "last-read", "last read", FALSE) \
 	x(last_mentioned, LAST_MENTIONED, "LastMentioned", "last-mentioned", "last mentioned", FALSE)
 #define CHIME_PROP_OBJ_VAR room
+#define CHIME_PROP_STR_CHANGED(obj) room_times_changed(obj)
 #include "chime-props.h"
 
 
@@ -47,6 +48,8 @@ enum
 
 	PROP_MOBILE_NOTIFICATION_PREFS,
 	PROP_DESKTOP_NOTIFICATION_PREFS,
+	PROP_UNREAD_COUNT,
+	PROP_MENTION_COUNT,
 	LAST_PROP,
 };
 
@@ -70,6 +73,16 @@ struct _ChimeRoom {
 
 	CHIME_PROPS_VARS
 
+	/* Parsed from the strings above when next needed; 0 if absent */
+	gboolean times_valid;
+	gint64 last_sent_us, last_read_us, last_mentioned_us;
+
+	/* Messages from others since the newest we've read, counted as they
+	 * arrive so they needn't be worked out again when asked */
+	guint unread_count, mention_count;
+	gint64 newest_us;
+	gchar *newest_id;
+
 	ChimeNotifyPref mobile_notification;
 	ChimeNotifyPref desktop_notification;
 
@@ -79,6 +92,7 @@ struct _ChimeRoom {
 	ChimeConnection *cxn;
 	GHashTable *members;
 	gboolean members_done[2];
+	SoupMessage *members_msg;	/* The member fetch for this open */
 };
 
 G_DEFINE_TYPE(ChimeRoom, chime_room, CHIME_TYPE_OBJECT)
@@ -114,6 +128,8 @@ chime_room_finalize(GObject *object)
 
 	CHIME_PROPS_FREE
 
+	g_free(self->newest_id);
+
 	if (self->members)
 		g_hash_table_destroy(self->members);
 
@@ -144,6 +160,12 @@ static void chime_room_get_property(GObject *object, guint prop_id,
 	case PROP_DESKTOP_NOTIFICATION_PREFS:
 		g_value_set_enum(value, self->desktop_notification);
 		break;
+	case PROP_UNREAD_COUNT:
+		g_value_set_uint(value, self->unread_count);
+		break;
+	case PROP_MENTION_COUNT:
+		g_value_set_uint(value, self->mention_count);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
 		break;
@@ -155,6 +177,8 @@ static void chime_room_set_property(GObject *object, guint prop_id,
 {
 	ChimeRoom *self = CHIME_ROOM(object);
 
+	self->times_valid = FALSE;
+
 	switch (prop_id) {
 	case PROP_PRIVACY:
 		self->privacy = g_value_get_boolean(value);
@@ -240,6 +264,22 @@ static void chime_room_class_init(ChimeRoomClass *klass)
 				  G_PARAM_CONSTRUCT |
 				  G_PARAM_STATIC_STRINGS);
 
+	props[PROP_UNREAD_COUNT] =
+		g_param_spec_uint("unread-count",
+				  "unread count",
+				  "unread count",
+				  0, G_MAXUINT, 0,
+				  G_PARAM_READABLE |
+				  G_PARAM_STATIC_STRINGS);
+
+	props[PROP_MENTION_COUNT] =
+		g_param_spec_uint("mention-count",
+				  "mention count",
+				  "mention count",
+				  0, G_MAXUINT, 0,
+				  G_PARAM_READABLE |
+				  G_PARAM_STATIC_STRINGS);
+
 	g_object_class_install_properties(object_class, LAST_PROP, props);
 
 	signals[MESSAGE] =
@@ -326,34 +366,124 @@ const gchar *chime_room_get_created_on(ChimeRoom *self)
 	return self->created_on;
 }
 
-static gboolean cmp_time(const char *ev, const char *last_read)
+static gint64 time_us(const gchar *str)
 {
-	GTimeVal ev_time, read_time;
+	gint64 us;
 
-	if (!ev || !g_time_val_from_iso8601(ev, &ev_time))
-		return FALSE;
+	return chime_parse_time_us(str, &us) ? us : 0;
+}
 
-	if (!last_read || !g_time_val_from_iso8601(last_read, &read_time))
-		return TRUE;
+static void update_times(ChimeRoom *self)
+{
+	if (self->times_valid)
+		return;
+
+	self->last_sent_us = time_us(self->last_sent);
+	self->last_read_us = time_us(self->last_read);
+	self->last_mentioned_us = time_us(self->last_mentioned);
+	self->times_valid = TRUE;
+}
+
+gint64 chime_room_get_last_mentioned_time(ChimeRoom *self)
+{
+	g_return_val_if_fail(CHIME_IS_ROOM(self), 0);
+
+	update_times(self);
+	return self->last_mentioned_us;
+}
+
+gint64 chime_room_get_last_read_time(ChimeRoom *self)
+{
+	g_return_val_if_fail(CHIME_IS_ROOM(self), 0);
+
+	update_times(self);
+	return self->last_read_us;
+}
+
+gint64 chime_room_get_last_sent_time(ChimeRoom *self)
+{
+	g_return_val_if_fail(CHIME_IS_ROOM(self), 0);
 
-	return (ev_time.tv_sec > read_time.tv_sec ||
-		(ev_time.tv_sec == read_time.tv_sec && ev_time.tv_usec > read_time.tv_usec));
+	update_times(self);
+	return self->last_sent_us;
 }
 
 gboolean chime_room_has_mention(ChimeRoom *self)
 {
 	g_return_val_if_fail(CHIME_IS_ROOM(self), FALSE);
 
-	return cmp_time(self->last_mentioned, self->last_read);
+	update_times(self);
+	return self->last_mentioned_us && self->last_mentioned_us > self->last_read_us;
 }
 
 gboolean chime_room_has_unread(ChimeRoom *self)
 {
 	g_return_val_if_fail(CHIME_IS_ROOM(self), FALSE);
 
-	return cmp_time(self->last_sent, self->last_read);
+	update_times(self);
+	return self->last_sent_us && self->last_sent_us > self->last_read_us;
+}
+
+gboolean chime_room_is_open(ChimeRoom *self)
+{
+	g_return_val_if_fail(CHIME_IS_ROOM(self), FALSE);
+
+	return self->opens > 0;
+}
+
+guint chime_room_get_unread_count(ChimeRoom *self)
+{
+	g_return_val_if_fail(CHIME_IS_ROOM(self), 0);
+
+	return self->unread_count;
+}
+
+guint chime_room_get_mention_count(ChimeRoom *self)
+{
+	g_return_val_if_fail(CHIME_IS_ROOM(self), 0);
+
+	return self->mention_count;
 }
 
+static void set_counts(ChimeRoom *self, guint unread, guint mentions)
+{
+	if (self->unread_count != unread) {
+		self->unread_count = unread;
+		g_object_notify(G_OBJECT(self), "unread-count");
+	}
+	if (self->mention_count != mentions) {
+		self->mention_count = mentions;
+		g_object_notify(G_OBJECT(self), "mention-count");
+	}
+}
+
+/* We only know where the newest counted message falls, so a read of
+ * anything short of that leaves the counts alone. */
+static void read_to(ChimeRoom *self, const gchar *msg_id, gint64 last_read_us)
+{
+	if (!self->unread_count)
+		return;
+
+	if ((msg_id && !g_strcmp0(msg_id, self->newest_id)) ||
+	    last_read_us >= self->newest_us)
+		set_counts(self, 0, 0);
+}
+
+/* A new LastRead from the server may cover what we've counted */
+static void room_times_changed(ChimeRoom *self)
+{
+	self->times_valid = FALSE;
+
+	if (self->unread_count) {
+		update_times(self);
+		read_to(self, NULL, self->last_read_us);
+	}
+}
+
+void chime_room_messages_read(ChimeRoom *self, const gchar *msg_id)
+{
+	read_to(self, msg_id, 0);
+}
 
 static gboolean parse_privacy(JsonNode *node, const gchar *member, gboolean *val)
 {
@@ -393,6 +523,7 @@ static ChimeRoom *chime_connection_parse_room(ChimeConnection *cxn, JsonNode *no
 					      GError **error)
 {
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE(cxn);
+	JsonNode *room_node = node;
 	const gchar *id, *name;
 	gboolean privacy, visibility;
 	ChimeRoomType type;
@@ -438,6 +569,7 @@ static ChimeRoom *chime_connection_parse_room(ChimeConnection *cxn, JsonNode *no
 				    NULL);
 
 		chime_object_collection_hash_object(&priv->rooms, CHIME_OBJECT(room), TRUE);
+		chime_object_set_snapshot_node(CHIME_OBJECT(room), room_node);
 
 		/* Emit signal on ChimeConnection to admit existence of new room */
 		chime_connection_new_room(cxn, room);
@@ -474,10 +606,17 @@ static ChimeRoom *chime_connection_parse_room(ChimeConnection *cxn, JsonNode *no
 	}
 
 	chime_object_collection_hash_object(&priv->rooms, CHIME_OBJECT(room), TRUE);
+	chime_object_set_snapshot_node(CHIME_OBJECT(room), room_node);
 
 	return room;
 }
 
+static ChimeObject *parse_snapshot_room(ChimeConnection *cxn, JsonNode *node,
+					GError **error)
+{
+	return (ChimeObject *)chime_connection_parse_room(cxn, node, error);
+}
+
 static void fetch_rooms(ChimeConnection *cxn, const gchar *next_token);
 
 static void rooms_cb(ChimeConnection *cxn, SoupMessage *msg, JsonNode *node,
@@ -516,6 +655,7 @@ static void rooms_cb(ChimeConnection *cxn, SoupMessage *msg, JsonNode *node,
 			priv->rooms_sync = CHIME_SYNC_IDLE;
 
 			chime_object_collection_expire_outdated(&priv->rooms);
+			chime_object_collection_save_snapshot(&priv->rooms);
 
 			if (!priv->rooms_online) {
 				priv->rooms_online = TRUE;
@@ -557,8 +697,9 @@ static void fetch_rooms(ChimeConnection *cxn, const gchar *next_token)
 	soup_uri_set_query_from_fields(uri, "max-results", "50",
 				       next_token ? "next-token" : NULL, next_token,
 				       NULL);
-	chime_connection_queue_http_request(cxn, NULL, uri, "GET", rooms_cb,
-					    NULL);
+	chime_connection_queue_http_request_prio(cxn, NULL, uri, "GET",
+						 CHIME_REQ_BACKGROUND, rooms_cb,
+						 NULL);
 }
 
 static gboolean visible_rooms_jugg_cb(ChimeConnection *cxn, gpointer _unused, JsonNode *data_node)
@@ -567,6 +708,38 @@ static gboolean visible_rooms_jugg_cb(ChimeConnection *cxn, gpointer _unused, Js
 	return TRUE;
 }
 
+/* Open rooms get each message on both channels; duplicates aren't counted.
+ * Nor is anything we sent ourselves, which shows we've read all before it. */
+static void count_message(ChimeConnection *cxn, ChimeRoom *room, JsonNode *record)
+{
+	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE (cxn);
+	const gchar *id, *created, *sender, *content;
+	gint64 created_us;
+
+	if (!parse_string(record, "MessageId", &id) ||
+	    !parse_string(record, "CreatedOn", &created) ||
+	    !chime_parse_time_us(created, &created_us))
+		return;
+
+	if (parse_string(record, "Sender", &sender) &&
+	    !g_strcmp0(sender, priv->profile_id)) {
+		set_counts(room, 0, 0);
+		return;
+	}
+
+	update_times(room);
+	if (created_us <= room->last_read_us || created_us <= room->newest_us)
+		return;
+
+	room->newest_us = created_us;
+	g_free(room->newest_id);
+	room->newest_id = g_strdup(id);
+
+	gboolean mention = parse_string(record, "Content", &content) &&
+		chime_connection_mentions_us(cxn, content);
+	set_counts(room, room->unread_count + 1, room->mention_count + mention);
+}
+
 static gboolean room_msg_jugg_cb(ChimeConnection *cxn, gpointer _room, JsonNode *data_node)
 {
 	ChimeRoom *room = CHIME_ROOM(_room);
@@ -579,6 +752,9 @@ static gboolean room_msg_jugg_cb(ChimeConnection *cxn, gpointer _room, JsonNode
 	if (!parse_string(record, "MessageId", &id))
 		return FALSE;
 
+	chime_jugg_note_message(cxn, CHIME_OBJECT(room), record);
+	chime_msgstore_update(cxn, CHIME_OBJECT(room), record);
+	count_message(cxn, room, record);
 	g_signal_emit(room, signals[MESSAGE], 0, record);
 	return TRUE;
 }
@@ -624,6 +800,8 @@ static gboolean demux_room_msg_jugg_cb(ChimeConnection *cxn, gpointer _room, Jso
 	if (room->opens)
 		return room_msg_jugg_cb(cxn, room, data_node);
 
+	count_message(cxn, room, record);
+
 	g_signal_emit_by_name(cxn, "room-mention", room, record);
 	return TRUE;
 }
@@ -659,6 +837,10 @@ void chime_init_rooms(ChimeConnection *cxn)
 
 	chime_object_collection_init(cxn, &priv->rooms);
 
+	if (chime_object_collection_load_snapshot(&priv->rooms, "rooms",
+						  parse_snapshot_room))
+		priv->rooms_online = TRUE;
+
 	chime_jugg_subscribe(cxn, priv->profile_channel, "VisibleRooms",
 			     visible_rooms_jugg_cb, NULL);
 	if (0) chime_jugg_subscribe(cxn, priv->device_channel, "JoinableMeetings",
@@ -794,11 +976,11 @@ gboolean chime_connection_open_room(ChimeConnection *cxn, ChimeRoom *room)
 		chime_jugg_subscribe(cxn, room->channel, "Room", room_jugg_cb, NULL);
 		chime_jugg_subscribe(cxn, room->channel, "RoomMessage", room_msg_jugg_cb, room);
 		chime_jugg_subscribe(cxn, room->channel, "RoomMembership", room_membership_jugg_cb, room);
+		/* Inactive members follow once the active ones are in */
 		fetch_room_memberships(cxn, room, TRUE, NULL);
-		fetch_room_memberships(cxn, room, FALSE, NULL);
 	}
 
-	return room->members_done[0] && room->members_done[1];
+	return room->members_done[FALSE];
 }
 
 static void close_room(gpointer key, gpointer val, gpointer data)
@@ -808,6 +990,7 @@ static void close_room(gpointer key, gpointer val, gpointer data)
 		chime_jugg_unsubscribe(room->cxn, room->channel, "Room", room_jugg_cb, NULL);
 		chime_jugg_unsubscribe(room->cxn, room->channel, "RoomMessage", room_msg_jugg_cb, room);
 		chime_jugg_unsubscribe(room->cxn, room->channel, "RoomMembership", room_membership_jugg_cb, room);
+		chime_jugg_forget_messages(room->cxn, CHIME_OBJECT(room));
 		room->cxn = NULL;
 	}
 	if (room->members) {
@@ -815,6 +998,7 @@ static void close_room(gpointer key, gpointer val, gpointer data)
 		room->members = NULL;
 	}
 	room->members_done[0] = room->members_done[1] = FALSE;
+	room->members_msg = NULL;
 }
 
 void chime_connection_close_room(ChimeConnection *cxn, ChimeRoom *room)
@@ -834,6 +1018,11 @@ static void fetch_members_cb(ChimeConnection *cxn, SoupMessage *msg, JsonNode *n
 	gboolean active = (unsigned long) _roomx & 1;
 	const gchar *next_token;
 
+	/* Closed while we were fetching, and perhaps opened again with a
+	 * new fetch of its own. This is only a stale response. */
+	if (msg != room->members_msg)
+		return;
+
 	if (!SOUP_STATUS_IS_SUCCESSFUL(msg->status_code)) {
 		const gchar *reason = msg->reason_phrase;
 
@@ -841,7 +1030,7 @@ static void fetch_members_cb(ChimeConnection *cxn, SoupMessage *msg, JsonNode *n
 			parse_string(node, "error", &reason);
 
 		g_warning("Failed to fetch room memberships: %d %s\n", msg->status_code, reason);
- 	} else {
+	} else {
 		JsonObject *obj = json_node_get_object(node);
 		JsonNode *members_node = json_object_get_member(obj, "RoomMemberships");
 		JsonArray *members_array = json_node_get_array(members_node);
@@ -858,8 +1047,15 @@ static void fetch_members_cb(ChimeConnection *cxn, SoupMessage *msg, JsonNode *n
 		}
 	}
 	room->members_done[active] = TRUE;
-	if (room->members_done[!active])
+
+	/* Messages from former members need the inactive ones too, or
+	 * they would be shown from an unknown sender. */
+	if (active)
+		fetch_room_memberships(cxn, room, FALSE, NULL);
+	else {
+		room->members_msg = NULL;
 		g_signal_emit(room, signals[MEMBERS_DONE], 0);
+	}
 }
 
 void fetch_room_memberships(ChimeConnection *cxn, ChimeRoom *room, gboolean active, const gchar *next_token)
@@ -881,12 +1077,54 @@ void fetch_room_memberships(ChimeConnection *cxn, ChimeRoom *room, gboolean acti
 	}
 
 	soup_uri_set_query_from_fields(uri, "max-results", "50", opts[0], opts[1], opts[2], opts[3], NULL);
-	chime_connection_queue_http_request(cxn, NULL, uri, "GET", fetch_members_cb, (void *)((unsigned long)room | active));
+
+	/* The history of an open chat is held back until "members-done" */
+	ChimeRequestPriority prio = chime_room_is_open(room) ? CHIME_REQ_INTERACTIVE :
+		CHIME_REQ_BACKGROUND;
+	room->members_msg = chime_connection_queue_http_request_prio(cxn, NULL, uri, "GET", prio,
+								     fetch_members_cb, (void *)((unsigned long)room | active));
 }
 
 GList *chime_room_get_members(ChimeRoom *room)
 {
-	return g_hash_table_get_values(room->members);
+	g_return_val_if_fail(CHIME_IS_ROOM(room), NULL);
+
+	return room->members ? g_hash_table_get_values(room->members) : NULL;
+}
+
+ChimeRoomMember *chime_room_lookup_member(ChimeRoom *room, const gchar *profile_id)
+{
+	g_return_val_if_fail(CHIME_IS_ROOM(room), NULL);
+	g_return_val_if_fail(profile_id != NULL, NULL);
+
+	return room->members ? g_hash_table_lookup(room->members, profile_id) : NULL;
+}
+
+guint chime_room_get_n_members(ChimeRoom *room)
+{
+	g_return_val_if_fail(CHIME_IS_ROOM(room), 0);
+
+	return room->members ? g_hash_table_size(room->members) : 0;
+}
+
+void chime_room_member_iter_init(ChimeRoom *room, ChimeRoomMemberIter *iter)
+{
+	g_return_if_fail(CHIME_IS_ROOM(room));
+	g_return_if_fail(iter != NULL);
+
+	iter->valid = !!room->members;
+	if (iter->valid)
+		g_hash_table_iter_init(&iter->iter, room->members);
+}
+
+gboolean chime_room_member_iter_next(ChimeRoomMemberIter *iter, ChimeRoomMember **member)
+{
+	g_return_val_if_fail(iter != NULL, FALSE);
+
+	if (!iter->valid)
+		return FALSE;
+
+	return g_hash_table_iter_next(&iter->iter, NULL, (gpointer *)member);
 }
 
 static void member_added_cb(ChimeConnection *cxn, SoupMessage *msg,
@@ -1044,7 +1282,8 @@ void chime_connection_fetch_room_async(ChimeConnection *cxn, const gchar *room_i
 	GTask *task = g_task_new(cxn, cancellable, callback, user_data);
 
 	SoupURI *uri = soup_uri_new_printf(priv->messaging_url, "/rooms/%s", room_id);
-	chime_connection_queue_http_request(cxn, NULL, uri, "GET", fetch_new_room_cb, task);
+	chime_connection_queue_http_request_full(cxn, NULL, uri, "GET", CHIME_REQ_INTERACTIVE,
+						 cancellable, fetch_new_room_cb, task);
 }
 
 ChimeRoom *chime_connection_fetch_room_finish(ChimeConnection *cxn, GAsyncResult *result, GError **error)
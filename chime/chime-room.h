@@ -52,10 +52,23 @@ const gchar *chime_room_get_channel(ChimeRoom *self);
 const gchar *chime_room_get_last_mentioned(ChimeRoom *self);
 const gchar *chime_room_get_last_read(ChimeRoom *self);
 const gchar *chime_room_get_last_sent(ChimeRoom *self);
+
+/* The same times, parsed, in microseconds since the epoch (0 if unset) */
+gint64 chime_room_get_last_mentioned_time(ChimeRoom *self);
+gint64 chime_room_get_last_read_time(ChimeRoom *self);
+gint64 chime_room_get_last_sent_time(ChimeRoom *self);
+
 const gchar *chime_room_get_created_on(ChimeRoom *self);
 
 gboolean chime_room_has_mention(ChimeRoom *self);
 gboolean chime_room_has_unread(ChimeRoom *self);
+/* Between chime_connection_open_room() and chime_connection_close_room() */
+gboolean chime_room_is_open(ChimeRoom *self);
+
+/* Messages from others since the last one read, as seen since connecting.
+ * Also notified as the "unread-count" and "mention-count" properties. */
+guint chime_room_get_unread_count(ChimeRoom *self);
+guint chime_room_get_mention_count(ChimeRoom *self);
 
 ChimeRoom *chime_connection_room_by_name(ChimeConnection *cxn,
 					 const gchar *name);
@@ -76,10 +89,25 @@ typedef struct {
 	char *last_delivered;
 } ChimeRoomMember;
 
+/* Returns TRUE once all the members, inactive ones too, are known;
+ * "members-done" says when */
 gboolean chime_connection_open_room(ChimeConnection *cxn, ChimeRoom *room);
 void chime_connection_close_room(ChimeConnection *cxn, ChimeRoom *room);
 
 GList *chime_room_get_members(ChimeRoom *room);
+ChimeRoomMember *chime_room_lookup_member(ChimeRoom *room, const gchar *profile_id);
+guint chime_room_get_n_members(ChimeRoom *room);
+
+/* Walks the members of an open room in place. The room's membership
+ * mustn't change while it's in use, so don't hold one across a return
+ * to the main loop. */
+typedef struct {
+	GHashTableIter iter;
+	gboolean valid;
+} ChimeRoomMemberIter;
+
+void chime_room_member_iter_init(ChimeRoom *room, ChimeRoomMemberIter *iter);
+gboolean chime_room_member_iter_next(ChimeRoomMemberIter *iter, ChimeRoomMember **member);
 
 void chime_connection_add_room_member_async(ChimeConnection *cxn,
 					    ChimeRoom *room,
@@ -22,6 +22,12 @@
 
 #include <string.h>
 
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#elif defined (__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include <libsoup/soup.h>
 #include "chime-websocket-connection.h"
 
@@ -125,20 +131,44 @@ struct _ChimeWebsocketConnectionPrivate {
 	GPollableInputStream *input;
 	GSource *input_source;
 	GByteArray *incoming;
+	GBytes *incoming_burst;	/* Replaces incoming while messages are sliced from it */
+	gsize incoming_start;	/* Where the unparsed data in it begins */
+	gsize incoming_need;	/* Size of the frame there, if known */
 
 	GPollableOutputStream *output;
 	GSource *output_source;
 	GQueue outgoing;
+	gint buffered_amount;	/* Atomic; bytes of outgoing not yet written */
+	gsize max_coalesce;	/* Most bytes of several frames written together */
 
 	/* Current message being assembled */
 	guint8 message_opcode;
 	GByteArray *message_data;
+	gboolean message_compressed;
+
+	/* RFC7692 permessage-deflate, if it was negotiated */
+	gboolean deflate;
+	gboolean deflate_out;		/* FALSE if we can't meet the server's terms */
+	gboolean deflate_binary;
+	gboolean client_no_context_takeover;
+	gboolean server_no_context_takeover;
+	GConverter *compressor;
+	GConverter *decompressor;
 
 	GSource *keepalive_timeout;
 };
 
 #define MAX_INCOMING_PAYLOAD_SIZE_DEFAULT   128 * 1024
 
+/* The least we ask the stream for at a time, and the most buffer we'll
+ * allocate ahead of the data actually arriving */
+#define INCOMING_READ_SIZE     16 * 1024
+#define INCOMING_PREALLOC_MAX  4 * 1024 * 1024
+
+/* One TLS record's worth */
+#define MAX_COALESCE_DEFAULT   16 * 1024
+#define MAX_WRITE_VECTORS      16
+
 G_DEFINE_TYPE_WITH_PRIVATE (ChimeWebsocketConnection, chime_websocket_connection, G_TYPE_OBJECT)
 
 typedef enum {
@@ -168,8 +198,9 @@ chime_websocket_connection_init (ChimeWebsocketConnection *self)
 
 	pv = self->pv = chime_websocket_connection_get_instance_private (self);
 
-	pv->incoming = g_byte_array_sized_new (1024);
+	pv->incoming = g_byte_array_sized_new (INCOMING_READ_SIZE);
 	g_queue_init (&pv->outgoing);
+	pv->max_coalesce = MAX_COALESCE_DEFAULT;
 	pv->main_context = g_main_context_ref_thread_default ();
 }
 
@@ -321,28 +352,172 @@ close_io_after_timeout (ChimeWebsocketConnection *self)
 	g_source_attach (pv->close_timeout, pv->main_context);
 }
 
+/* Copy and mask in the same pass, 'offset' bytes into the payload. The
+ * mask is laid out in a 16-byte pattern starting at the right phase, so
+ * that it can be applied a vector or a word at a time. SSE2 is always
+ * there on x86_64, and NEON on aarch64; for anything wider the copy is
+ * bound by memory bandwidth anyway. */
+static void
+copy_with_mask (const guint8 *mask,
+		gsize offset,
+		guint8 *dest,
+		const guint8 *src,
+		gsize len)
+{
+	guint8 pattern[16];
+	guint64 word;
+	gsize n = 0;
+
+	for (n = 0; n < sizeof (pattern); n++)
+		pattern[n] = mask[(offset + n) & 3];
+	n = 0;
+
+#if defined (__SSE2__)
+	__m128i vmask = _mm_loadu_si128 ((const __m128i *)pattern);
+	for (; n + 16 <= len; n += 16)
+		_mm_storeu_si128 ((__m128i *)(dest + n),
+				  _mm_xor_si128 (_mm_loadu_si128 ((const __m128i *)(src + n)), vmask));
+#elif defined (__ARM_NEON)
+	uint8x16_t vmask = vld1q_u8 (pattern);
+	for (; n + 16 <= len; n += 16)
+		vst1q_u8 (dest + n, veorq_u8 (vld1q_u8 (src + n), vmask));
+#endif
+
+	memcpy (&word, pattern, sizeof (word));
+	for (; n + sizeof (word) <= len; n += sizeof (word)) {
+		guint64 w;
+
+		memcpy (&w, src + n, sizeof (w));
+		w ^= word;
+		memcpy (dest + n, &w, sizeof (w));
+	}
+
+	for (; n < len; n++)
+		dest[n] = src[n] ^ pattern[n & 3];
+}
+
 static void
 xor_with_mask (const guint8 *mask,
 	       guint8 *data,
 	       gsize len)
 {
-	gsize n;
+	copy_with_mask (mask, 0, data, data, len);
+}
+
+/* Run data through a zlib converter with a sync flush at the end, which
+ * leaves the stream at a byte boundary for the next message. */
+static gboolean
+run_converter (GConverter *conv,
+	       GByteArray *out,
+	       const guint8 *in,
+	       gsize in_len,
+	       gboolean flush,
+	       guint64 max_len,
+	       GError **error)
+{
+	gsize used = out->len, cap = MAX (used + in_len * 2, used + 256);
+
+	g_byte_array_set_size (out, cap);
+	for (;;) {
+		GError *err = NULL;
+		gsize r = 0, w = 0;
+		GConverterResult res;
+
+		if (cap - used < 64) {
+			cap *= 2;
+			g_byte_array_set_size (out, cap);
+		}
 
-	/* Do the masking */
-	for (n = 0; n < len; n++)
-		data[n] ^= mask[n & 3];
+		res = g_converter_convert (conv, in, in_len, out->data + used, cap - used,
+					   flush ? G_CONVERTER_FLUSH : G_CONVERTER_NO_FLAGS,
+					   &r, &w, &err);
+		if (res == G_CONVERTER_ERROR) {
+			/* With room to spare, that means there was nothing left to do */
+			if (g_error_matches (err, G_IO_ERROR, G_IO_ERROR_NO_SPACE) && !in_len) {
+				g_clear_error (&err);
+				break;
+			}
+			g_propagate_error (error, err);
+			out->len = used;
+			return FALSE;
+		}
+		in += r;
+		in_len -= r;
+		used += w;
+
+		if (max_len && used > max_len) {
+			g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_MESSAGE_TOO_LARGE,
+					     "Decompressed message too large");
+			out->len = used;
+			return FALSE;
+		}
+		if (res == G_CONVERTER_FLUSHED || res == G_CONVERTER_FINISHED)
+			break;
+		/* zlib only stops short of filling the output when it's done */
+		if (!in_len && used < cap)
+			break;
+	}
+	out->len = used;
+	return TRUE;
+}
+
+static gboolean
+should_deflate (ChimeWebsocketConnection *self,
+		guint8 opcode,
+		gsize length)
+{
+	ChimeWebsocketConnectionPrivate *pv = self->pv;
+
+	/* Tiny messages would only grow */
+	if (!pv->deflate_out || length < 32)
+		return FALSE;
+
+	return opcode == 0x01 || (opcode == 0x02 && pv->deflate_binary);
 }
 
+static GByteArray *
+deflate_message (ChimeWebsocketConnection *self,
+		 const GOutputVector *vectors,
+		 gsize n_vectors)
+{
+	ChimeWebsocketConnectionPrivate *pv = self->pv;
+	GByteArray *out = g_byte_array_new ();
+	GError *error = NULL;
+	gsize i;
+
+	for (i = 0; i < n_vectors; i++) {
+		if (!run_converter (pv->compressor, out, vectors[i].buffer, vectors[i].size,
+				    i == n_vectors - 1, 0, &error)) {
+			g_debug ("deflate failed: %s", error->message);
+			g_clear_error (&error);
+			g_byte_array_unref (out);
+			/* The stream is now unusable, so stop compressing */
+			pv->deflate_out = FALSE;
+			return NULL;
+		}
+	}
+
+	/* The sync flush ends with an empty stored block, which is left off */
+	if (out->len >= 4 && !memcmp (out->data + out->len - 4, "\0\0\xff\xff", 4))
+		out->len -= 4;
+
+	if (pv->client_no_context_takeover)
+		g_converter_reset (pv->compressor);
+	return out;
+}
+
+/* The frame is built directly from the caller's vectors, so there is
+ * only the one copy of the payload, which is where it gets masked. */
 static void
-send_message (ChimeWebsocketConnection *self,
-	      ChimeWebsocketQueueFlags flags,
-	      guint8 opcode,
-	      const guint8 *data,
-	      gsize length)
+send_message_vectors (ChimeWebsocketConnection *self,
+		      ChimeWebsocketQueueFlags flags,
+		      guint8 opcode,
+		      const GOutputVector *vectors,
+		      gsize n_vectors)
 {
-	gsize buffered_amount = length;
-	GByteArray *bytes;
-	gsize frame_len;
+	gsize length = 0, buffered_amount, frame_len, done, i;
+	GByteArray *deflated = NULL;
+	GOutputVector deflated_vector;
 	guint8 *outer;
 	guint8 *mask = 0;
 	guint8 *at;
@@ -352,9 +527,19 @@ send_message (ChimeWebsocketConnection *self,
 		return;
 	}
 
-	bytes = g_byte_array_sized_new (14 + length);
-	outer = bytes->data;
-	outer[0] = 0x80 | opcode;
+	for (i = 0; i < n_vectors; i++)
+		length += vectors[i].size;
+	buffered_amount = length;
+
+	if (should_deflate (self, opcode, length)) {
+		deflated = deflate_message (self, vectors, n_vectors);
+		if (deflated) {
+			deflated_vector.buffer = deflated->data;
+			deflated_vector.size = length = deflated->len;
+			vectors = &deflated_vector;
+			n_vectors = 1;
+		}
+	}
 
 	/* If control message, truncate payload */
 	if (opcode & 0x08) {
@@ -366,14 +551,19 @@ send_message (ChimeWebsocketConnection *self,
 		buffered_amount = 0;
 	}
 
+	outer = g_malloc (14 + length);
+	outer[0] = 0x80 | opcode;
+	if (deflated)
+		outer[0] |= 0x40; /* RSV1: compressed */
+
 	if (length < 126) {
 		outer[1] = (0xFF & length); /* mask | 7-bit-len */
-		bytes->len = 2;
+		frame_len = 2;
 	} else if (length < 65536) {
 		outer[1] = 126; /* mask | 16-bit-len */
 		outer[2] = (length >> 8) & 0xFF;
 		outer[3] = (length >> 0) & 0xFF;
-		bytes->len = 4;
+		frame_len = 4;
 	} else {
 		outer[1] = 127; /* mask | 64-bit-len */
 #if GLIB_SIZEOF_SIZE_T > 4
@@ -388,31 +578,51 @@ send_message (ChimeWebsocketConnection *self,
 		outer[7] = (length >> 16) & 0xFF;
 		outer[8] = (length >> 8) & 0xFF;
 		outer[9] = (length >> 0) & 0xFF;
-		bytes->len = 10;
+		frame_len = 10;
 	}
 
 	/* The server side doesn't need to mask, so we don't. There's
 	 * probably a client somewhere that's not expecting it.
 	 */
 	if (self->pv->connection_type == SOUP_WEBSOCKET_CONNECTION_CLIENT) {
+		guint32 key = g_random_int ();
+
 		outer[1] |= 0x80;
-		mask = outer + bytes->len;
-		* ((guint32 *)mask) = g_random_int ();
-		bytes->len += 4;
+		mask = outer + frame_len;
+		memcpy (mask, &key, 4);
+		frame_len += 4;
 	}
 
-	at = bytes->data + bytes->len;
-	g_byte_array_append (bytes, data, length);
+	at = outer + frame_len;
+	for (i = 0, done = 0; i < n_vectors && done < length; i++) {
+		gsize len = MIN (vectors[i].size, length - done);
 
-	if (self->pv->connection_type == SOUP_WEBSOCKET_CONNECTION_CLIENT)
-		xor_with_mask (mask, at, length);
+		if (mask)
+			copy_with_mask (mask, done, at + done, vectors[i].buffer, len);
+		else
+			memcpy (at + done, vectors[i].buffer, len);
+		done += len;
+	}
+	frame_len += length;
+	if (deflated)
+		g_byte_array_unref (deflated);
 
-	frame_len = bytes->len;
-	queue_frame (self, flags, g_byte_array_free (bytes, FALSE),
-		     frame_len, buffered_amount);
+	queue_frame (self, flags, outer, frame_len, buffered_amount);
 	g_debug ("queued %d frame of len %u", (int)opcode, (guint)frame_len);
 }
 
+static void
+send_message (ChimeWebsocketConnection *self,
+	      ChimeWebsocketQueueFlags flags,
+	      guint8 opcode,
+	      const guint8 *data,
+	      gsize length)
+{
+	GOutputVector vector = { data, length };
+
+	send_message_vectors (self, flags, opcode, &vector, 1);
+}
+
 static void
 send_close (ChimeWebsocketConnection *self,
 	    ChimeWebsocketQueueFlags flags,
@@ -654,10 +864,52 @@ receive_pong (ChimeWebsocketConnection *self,
 	g_bytes_unref (bytes);
 }
 
+/* Replaces the compressed message_data with its inflated contents */
+static gboolean
+inflate_message (ChimeWebsocketConnection *self)
+{
+	ChimeWebsocketConnectionPrivate *pv = self->pv;
+	GByteArray *compressed = pv->message_data;
+	GByteArray *out = g_byte_array_sized_new (compressed->len * 4 + 1);
+	GError *error = NULL;
+
+	/* Put back the empty stored block which the sender left off */
+	g_byte_array_append (compressed, (guint8 *)"\0\0\xff\xff", 4);
+
+	if (run_converter (pv->decompressor, out, compressed->data, compressed->len,
+			   TRUE, pv->max_incoming_payload_size, &error) &&
+	    (pv->message_opcode != 0x01 ||
+	     g_utf8_validate ((char *)out->data, out->len, NULL))) {
+		if (pv->server_no_context_takeover)
+			g_converter_reset (pv->decompressor);
+		g_byte_array_unref (compressed);
+		pv->message_data = out;
+		pv->message_compressed = FALSE;
+		return TRUE;
+	}
+
+	g_byte_array_unref (compressed);
+	pv->message_data = NULL;
+	pv->message_opcode = 0;
+	pv->message_compressed = FALSE;
+
+	if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_MESSAGE_TOO_LARGE)) {
+		too_big_error_and_close (self, out->len);
+	} else {
+		g_debug ("received invalid compressed data: %s",
+			 error ? error->message : "not UTF-8");
+		bad_data_error_and_close (self);
+	}
+	g_clear_error (&error);
+	g_byte_array_unref (out);
+	return FALSE;
+}
+
 static void
 process_contents (ChimeWebsocketConnection *self,
 		  gboolean control,
 		  gboolean fin,
+		  gboolean compressed,
 		  guint8 opcode,
 		  gconstpointer payload,
 		  gsize payload_len)
@@ -731,10 +983,19 @@ process_contents (ChimeWebsocketConnection *self,
 
 		if (opcode) {
 			pv->message_opcode = opcode;
+			pv->message_compressed = compressed;
 			pv->message_data = g_byte_array_sized_new (payload_len + 1);
+		} else if (compressed) {
+			/* Only the first frame of a message carries RSV1 */
+			g_debug ("received continuation frame with RSV1 set");
+			protocol_error_and_close (self);
+			return;
 		}
 
-		switch (pv->message_opcode) {
+		/* Compressed text can only be validated once it's inflated */
+		if (pv->message_compressed) {
+			g_byte_array_append (pv->message_data, payload, payload_len);
+		} else switch (pv->message_opcode) {
 		case 0x01:
 			if (!g_utf8_validate ((char *)payload, payload_len, NULL)) {
 				g_debug ("received invalid non-UTF8 text data");
@@ -757,6 +1018,8 @@ process_contents (ChimeWebsocketConnection *self,
 		}
 
 		/* Actually deliver the message? */
+		if (fin && pv->message_compressed && !inflate_message (self))
+			return;
 		if (fin) {
 			/* Always null terminate, as a convenience */
 			g_byte_array_append (pv->message_data, (guchar *)"\0", 1);
@@ -776,6 +1039,46 @@ process_contents (ChimeWebsocketConnection *self,
 	}
 }
 
+/* Binary messages at least this big are handed out as a slice of the
+ * incoming buffer, instead of being copied out of it */
+#define IN_PLACE_MIN_PAYLOAD 4096
+
+/* The data read so far, whichever of incoming and incoming_burst holds it */
+static guint8 *
+incoming_data (ChimeWebsocketConnectionPrivate *pv,
+	       gsize *len)
+{
+	/* The burst is still ours to unmask in place: the slices handed
+	 * out of it only cover frames which have already been parsed */
+	if (pv->incoming_burst)
+		return (guint8 *)g_bytes_get_data (pv->incoming_burst, len);
+
+	*len = pv->incoming->len;
+	return pv->incoming->data;
+}
+
+/* The first of these in a read turns the incoming buffer into a GBytes,
+ * and every message is a slice of that. Nothing is copied until
+ * process_incoming() moves any partial frame left over, once. */
+static void
+deliver_in_place (ChimeWebsocketConnection *self,
+		  gsize at,
+		  gsize payload_len)
+{
+	ChimeWebsocketConnectionPrivate *pv = self->pv;
+	GBytes *message;
+
+	if (!pv->incoming_burst) {
+		pv->incoming_burst = g_byte_array_free_to_bytes (pv->incoming);
+		pv->incoming = NULL;
+	}
+	message = g_bytes_new_from_bytes (pv->incoming_burst, at, payload_len);
+
+	g_debug ("message: delivering 2 with %d length in place", (int)payload_len);
+	g_signal_emit (self, signals[MESSAGE], 0, 2, message);
+	g_bytes_unref (message);
+}
+
 static gboolean
 process_frame (ChimeWebsocketConnection *self)
 {
@@ -786,19 +1089,31 @@ process_frame (ChimeWebsocketConnection *self)
 	gboolean fin;
 	gboolean control;
 	gboolean masked;
+	gboolean rsv1;
 	guint8 opcode;
 	gsize len;
 	gsize at;
 
-	len = self->pv->incoming->len;
+	/* Frames are parsed where they lie; the consumed ones are only
+	 * dropped from the buffer once per read, in process_incoming() */
+	header = incoming_data (self->pv, &len);
+	len -= self->pv->incoming_start;
 	if (len < 2)
 		return FALSE; /* need more data */
 
-	header = self->pv->incoming->data;
+	header += self->pv->incoming_start;
 	fin = ((header[0] & 0x80) != 0);
 	control = header[0] & 0x08;
 	opcode = header[0] & 0x0f;
 	masked = ((header[1] & 0x80) != 0);
+	rsv1 = ((header[0] & 0x40) != 0);
+
+	/* RSV1 marks a compressed message, and only if we agreed to that */
+	if (rsv1 && (control || !self->pv->deflate)) {
+		g_debug ("received frame with unexpected RSV1 bit");
+		protocol_error_and_close (self);
+		return FALSE;
+	}
 
 	switch (header[1] & 0x7f) {
 	case 126:
@@ -834,18 +1149,18 @@ process_frame (ChimeWebsocketConnection *self)
 		return FALSE;
 	}
 
-	if (len < at + payload_len)
+	if (masked)
+		at += 4;
+	if (len < at + payload_len) {
+		self->pv->incoming_need = at + payload_len;
 		return FALSE; /* need more data */
+	}
+	self->pv->incoming_need = 0;
 
 	payload = header + at;
 
 	if (masked) {
-		mask = header + at;
-		payload += 4;
-		at += 4;
-
-		if (len < at + payload_len)
-			return FALSE; /* need more data */
+		mask = payload - 4;
 
 		xor_with_mask (mask, payload, payload_len);
 	}
@@ -853,18 +1168,40 @@ process_frame (ChimeWebsocketConnection *self)
 	/* Note that now that we've unmasked, we've modified the buffer, we can
 	 * only return below via discarding or processing the message
 	 */
-	process_contents (self, control, fin, opcode, payload, payload_len);
+	if (!control && fin && !rsv1 && opcode == 0x02 && payload_len >= IN_PLACE_MIN_PAYLOAD &&
+	    !self->pv->message_data && !self->pv->close_received)
+		deliver_in_place (self, self->pv->incoming_start + at, payload_len);
+	else
+		process_contents (self, control, fin, rsv1, opcode, payload, payload_len);
 
 	/* Move past the parsed frame */
-	g_byte_array_remove_range (self->pv->incoming, 0, at + payload_len);
+	self->pv->incoming_start += at + payload_len;
 	return TRUE;
 }
 
 static void
 process_incoming (ChimeWebsocketConnection *self)
 {
+	ChimeWebsocketConnectionPrivate *pv = self->pv;
+
 	while (process_frame (self))
 		;
+
+	/* Only a partial frame is left to move, and that happens at most
+	 * once for each frame, however many reads it takes to arrive */
+	if (pv->incoming_burst) {
+		gsize len;
+		const guint8 *data = g_bytes_get_data (pv->incoming_burst, &len);
+		gsize rest = len - pv->incoming_start;
+
+		pv->incoming = g_byte_array_sized_new (MAX (rest, INCOMING_READ_SIZE));
+		g_byte_array_append (pv->incoming, data + pv->incoming_start, rest);
+		g_clear_pointer (&pv->incoming_burst, g_bytes_unref);
+		pv->incoming_start = 0;
+	} else if (pv->incoming_start) {
+		g_byte_array_remove_range (pv->incoming, 0, pv->incoming_start);
+		pv->incoming_start = 0;
+	}
 }
 
 static gboolean
@@ -876,15 +1213,20 @@ on_web_socket_input (GObject *pollable_stream,
 	GError *error = NULL;
 	gboolean end = FALSE;
 	gssize count;
-	gsize len;
+	gsize len, want;
 
 	do {
+		/* Make room for the whole of a frame we know is coming at once,
+		 * rather than growing the buffer a piece at a time */
 		len = pv->incoming->len;
-		g_byte_array_set_size (pv->incoming, len + 1024);
+		want = INCOMING_READ_SIZE;
+		if (pv->incoming_need > len + want)
+			want = MIN (pv->incoming_need - len, INCOMING_PREALLOC_MAX);
+		g_byte_array_set_size (pv->incoming, len + want);
 
 		count = g_pollable_input_stream_read_nonblocking (pv->input,
 								  pv->incoming->data + len,
-								  1024, NULL, &error);
+								  want, NULL, &error);
 
 		if (count < 0) {
 			if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK)) {
@@ -917,13 +1259,74 @@ on_web_socket_input (GObject *pollable_stream,
 	return TRUE;
 }
 
+/* Write as many of the queued frames as will go in one call, up to
+ * max_coalesce bytes, so that a burst of small messages can share TLS
+ * records and syscalls. */
+static gssize
+write_frames (ChimeWebsocketConnection *self,
+	      GError **error)
+{
+	ChimeWebsocketConnectionPrivate *pv = self->pv;
+	GOutputVector vectors[MAX_WRITE_VECTORS];
+	gsize n_vectors = 0, total = 0, len;
+	const guint8 *data;
+	GList *l;
+
+	for (l = pv->outgoing.head; l && n_vectors < MAX_WRITE_VECTORS; l = l->next) {
+		Frame *frame = l->data;
+
+		data = g_bytes_get_data (frame->data, &len);
+		g_assert (len > frame->sent);
+		if (n_vectors && total + len - frame->sent > pv->max_coalesce)
+			break;
+
+		vectors[n_vectors].buffer = data + frame->sent;
+		vectors[n_vectors].size = len - frame->sent;
+		total += vectors[n_vectors++].size;
+
+		/* Nothing may follow the close */
+		if (frame->last)
+			break;
+	}
+
+#if GLIB_CHECK_VERSION(2, 60, 0)
+	gsize written = 0;
+
+	switch (g_pollable_output_stream_writev_nonblocking (pv->output, vectors, n_vectors,
+							      &written, NULL, error)) {
+	case G_POLLABLE_RETURN_OK:
+		return written;
+	case G_POLLABLE_RETURN_WOULD_BLOCK:
+		return 0;
+	default:
+		return -1;
+	}
+#else
+	if (n_vectors == 1)
+		return g_pollable_output_stream_write_nonblocking (pv->output, vectors[0].buffer,
+								   vectors[0].size, NULL, error);
+
+	/* Without writev, it's still worth gathering small frames */
+	guint8 *buf = g_malloc (total), *p = buf;
+	gssize count;
+	gsize i;
+
+	for (i = 0; i < n_vectors; i++) {
+		memcpy (p, vectors[i].buffer, vectors[i].size);
+		p += vectors[i].size;
+	}
+	count = g_pollable_output_stream_write_nonblocking (pv->output, buf, total, NULL, error);
+	g_free (buf);
+	return count;
+#endif
+}
+
 static gboolean
 on_web_socket_output (GObject *pollable_stream,
 		      gpointer user_data)
 {
 	ChimeWebsocketConnection *self = CHIME_WEBSOCKET_CONNECTION (user_data);
 	ChimeWebsocketConnectionPrivate *pv = self->pv;
-	const guint8 *data;
 	GError *error = NULL;
 	Frame *frame;
 	gssize count;
@@ -935,23 +1338,13 @@ on_web_socket_output (GObject *pollable_stream,
 		return TRUE;
 	}
 
-	frame = g_queue_peek_head (&pv->outgoing);
-
 	/* No more frames to send */
-	if (frame == NULL) {
+	if (g_queue_is_empty (&pv->outgoing)) {
 		stop_output (self);
 		return TRUE;
 	}
 
-	data = g_bytes_get_data (frame->data, &len);
-	g_assert (len > 0);
-	g_assert (len > frame->sent);
-
-	count = g_pollable_output_stream_write_nonblocking (pv->output,
-							    data + frame->sent,
-							    len - frame->sent,
-							    NULL, &error);
-
+	count = write_frames (self, &error);
 	if (count < 0) {
 		if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK)) {
 			g_clear_error (&error);
@@ -962,8 +1355,16 @@ on_web_socket_output (GObject *pollable_stream,
 		}
 	}
 
-	frame->sent += count;
-	if (frame->sent >= len) {
+	g_atomic_int_add (&pv->buffered_amount, -(gint)count);
+	while (count > 0) {
+		frame = g_queue_peek_head (&pv->outgoing);
+		g_bytes_get_data (frame->data, &len);
+		if ((gsize)count < len - frame->sent) {
+			frame->sent += count;
+			break;
+		}
+
+		count -= len - frame->sent;
 		g_debug ("sent frame");
 		g_queue_pop_head (&pv->outgoing);
 
@@ -1015,6 +1416,7 @@ queue_frame (ChimeWebsocketConnection *self,
 	frame->data = g_bytes_new_take (data, len);
 	frame->amount = amount;
 	frame->last = (flags & CHIME_WEBSOCKET_QUEUE_LAST) ? TRUE : FALSE;
+	g_atomic_int_add (&pv->buffered_amount, len);
 
 	/* If urgent put at front of queue */
 	if (flags & CHIME_WEBSOCKET_QUEUE_URGENT) {
@@ -1183,6 +1585,8 @@ chime_websocket_connection_finalize (GObject *object)
 
 	if (pv->incoming)
 		g_byte_array_free (pv->incoming, TRUE);
+	if (pv->incoming_burst)
+		g_bytes_unref (pv->incoming_burst);
 	while (!g_queue_is_empty (&pv->outgoing))
 		frame_free (g_queue_pop_head (&pv->outgoing));
 
@@ -1197,6 +1601,9 @@ chime_websocket_connection_finalize (GObject *object)
 	if (pv->message_data)
 		g_byte_array_free (pv->message_data, TRUE);
 
+	g_clear_object (&pv->compressor);
+	g_clear_object (&pv->decompressor);
+
 	if (pv->uri)
 		soup_uri_free (pv->uri);
 	g_free (pv->origin);
@@ -1705,6 +2112,156 @@ chime_websocket_connection_send_binary (ChimeWebsocketConnection *self,
 	send_message (self, CHIME_WEBSOCKET_QUEUE_NORMAL, 0x02, data, length);
 }
 
+/**
+ * chime_websocket_connection_send_binaryv:
+ * @self: the WebSocket
+ * @vectors: (array length=n_vectors): the pieces of the message, in order
+ * @n_vectors: the number of @vectors
+ *
+ * Send a binary message made up of several buffers, without first
+ * joining them together. They are copied while the frame is built, so
+ * they needn't outlive the call.
+ */
+void
+chime_websocket_connection_send_binaryv (ChimeWebsocketConnection *self,
+					const GOutputVector *vectors,
+					gsize n_vectors)
+{
+	g_return_if_fail (CHIME_IS_WEBSOCKET_CONNECTION (self));
+	g_return_if_fail (chime_websocket_connection_get_state (self) == SOUP_WEBSOCKET_STATE_OPEN);
+	g_return_if_fail (vectors != NULL || !n_vectors);
+
+	send_message_vectors (self, CHIME_WEBSOCKET_QUEUE_NORMAL, 0x02, vectors, n_vectors);
+}
+
+/**
+ * chime_websocket_connection_get_buffered_amount:
+ * @self: the WebSocket
+ *
+ * Get the number of bytes which have been queued to send but not yet
+ * written to the stream, including the framing. This may be called from
+ * any thread.
+ *
+ * Returns: the number of bytes buffered
+ */
+gsize
+chime_websocket_connection_get_buffered_amount (ChimeWebsocketConnection *self)
+{
+	g_return_val_if_fail (CHIME_IS_WEBSOCKET_CONNECTION (self), 0);
+
+	return g_atomic_int_get (&self->pv->buffered_amount);
+}
+
+static gboolean
+parse_window_bits (const char *value,
+		   guint *bits)
+{
+	char *end;
+	guint64 val;
+
+	if (!value)
+		return FALSE;
+	val = g_ascii_strtoull (value, &end, 10);
+	if (*end || end == value || val < 8 || val > 15)
+		return FALSE;
+	*bits = val;
+	return TRUE;
+}
+
+/**
+ * chime_websocket_connection_enable_deflate:
+ * @self: the WebSocket
+ * @extension: the permessage-deflate extension as accepted by the server,
+ *   from its Sec-WebSocket-Extensions header
+ *
+ * Enable RFC 7692 compression on the terms the server gave. The server
+ * may compress anything it sends; text messages are compressed in return
+ * unless the server asked for a smaller window than zlib will let us use.
+ *
+ * Returns: %FALSE if the server's response was invalid, in which case
+ *   the connection should be failed.
+ */
+gboolean
+chime_websocket_connection_enable_deflate (ChimeWebsocketConnection *self,
+					   const char *extension)
+{
+	ChimeWebsocketConnectionPrivate *pv;
+	GHashTable *params = NULL;
+	GHashTableIter iter;
+	gpointer key, value;
+	const char *p;
+	gboolean ret = TRUE;
+	guint bits;
+
+	g_return_val_if_fail (CHIME_IS_WEBSOCKET_CONNECTION (self), FALSE);
+	pv = self->pv;
+	g_return_val_if_fail (!pv->deflate, FALSE);
+
+	while (g_ascii_isspace (*extension))
+		extension++;
+	if (g_ascii_strncasecmp (extension, "permessage-deflate", 18))
+		return FALSE;
+	p = extension + 18;
+	while (g_ascii_isspace (*p))
+		p++;
+	if (*p == ';')
+		params = soup_header_parse_semi_param_list (p + 1);
+	else if (*p)
+		return FALSE;
+
+	pv->deflate_out = TRUE;
+	if (params) {
+		g_hash_table_iter_init (&iter, params);
+		while (ret && g_hash_table_iter_next (&iter, &key, &value)) {
+			if (!g_ascii_strcasecmp (key, "server_no_context_takeover") && !value) {
+				pv->server_no_context_takeover = TRUE;
+			} else if (!g_ascii_strcasecmp (key, "client_no_context_takeover") && !value) {
+				pv->client_no_context_takeover = TRUE;
+			} else if (!g_ascii_strcasecmp (key, "server_max_window_bits")) {
+				/* Inflating with the full window copes with any smaller one */
+				ret = parse_window_bits (value, &bits);
+			} else if (!g_ascii_strcasecmp (key, "client_max_window_bits")) {
+				/* GZlibCompressor always uses a 15-bit window */
+				ret = parse_window_bits (value, &bits);
+				if (ret && bits < 15)
+					pv->deflate_out = FALSE;
+			} else {
+				g_debug ("unknown permessage-deflate parameter %s", (char *)key);
+				ret = FALSE;
+			}
+		}
+		soup_header_free_param_list (params);
+	}
+	if (!ret) {
+		pv->deflate_out = FALSE;
+		pv->server_no_context_takeover = pv->client_no_context_takeover = FALSE;
+		return FALSE;
+	}
+
+	pv->deflate = TRUE;
+	pv->compressor = G_CONVERTER (g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_RAW, -1));
+	pv->decompressor = G_CONVERTER (g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_RAW));
+	return TRUE;
+}
+
+/**
+ * chime_websocket_connection_set_deflate_binary:
+ * @self: the WebSocket
+ * @deflate_binary: whether to compress binary messages
+ *
+ * Binary messages are usually media which is compressed already, so
+ * they are only deflated when this is set. It has no effect unless
+ * chime_websocket_connection_enable_deflate() succeeded.
+ */
+void
+chime_websocket_connection_set_deflate_binary (ChimeWebsocketConnection *self,
+					       gboolean deflate_binary)
+{
+	g_return_if_fail (CHIME_IS_WEBSOCKET_CONNECTION (self));
+
+	self->pv->deflate_binary = deflate_binary;
+}
+
 /**
  * chime_websocket_connection_close:
  * @self: the WebSocket
@@ -1790,6 +2347,24 @@ chime_websocket_connection_set_max_incoming_payload_size (ChimeWebsocketConnecti
 	}
 }
 
+/**
+ * chime_websocket_connection_set_max_coalesce:
+ * @self: the WebSocket
+ * @max_coalesce: the most bytes to write at once from several frames
+ *
+ * Queued frames are written together until they add up to this much,
+ * so that small messages can share TLS records. A frame bigger than
+ * this is still written, on its own. Zero stops frames being combined.
+ */
+void
+chime_websocket_connection_set_max_coalesce (ChimeWebsocketConnection *self,
+					     gsize max_coalesce)
+{
+	g_return_if_fail (CHIME_IS_WEBSOCKET_CONNECTION (self));
+
+	self->pv->max_coalesce = max_coalesce;
+}
+
 /**
  * chime_websocket_connection_get_keepalive_interval:
  * @self: the WebSocket
@@ -89,6 +89,16 @@ void                chime_websocket_connection_send_text      (ChimeWebsocketCon
 void                chime_websocket_connection_send_binary    (ChimeWebsocketConnection *self,
 							      gconstpointer data,
 							      gsize length);
+void                chime_websocket_connection_send_binaryv   (ChimeWebsocketConnection *self,
+							      const GOutputVector *vectors,
+							      gsize n_vectors);
+
+gsize               chime_websocket_connection_get_buffered_amount (ChimeWebsocketConnection *self);
+
+gboolean            chime_websocket_connection_enable_deflate (ChimeWebsocketConnection *self,
+							      const char *extension);
+void                chime_websocket_connection_set_deflate_binary (ChimeWebsocketConnection *self,
+								  gboolean deflate_binary);
 
 void                chime_websocket_connection_close          (ChimeWebsocketConnection *self,
 							      gushort code,
@@ -99,6 +109,9 @@ guint64             chime_websocket_connection_get_max_incoming_payload_size (Ch
 void                chime_websocket_connection_set_max_incoming_payload_size (ChimeWebsocketConnection *self,
                                                                              guint64                  max_incoming_payload_size);
 
+void                chime_websocket_connection_set_max_coalesce (ChimeWebsocketConnection *self,
+								gsize max_coalesce);
+
 guint               chime_websocket_connection_get_keepalive_interval (ChimeWebsocketConnection *self);
 
 void                chime_websocket_connection_set_keepalive_interval (ChimeWebsocketConnection *self,
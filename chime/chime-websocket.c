@@ -17,6 +17,7 @@
 #include <libsoup/soup.h>
 
 #include <glib/gi18n.h>
+#include <string.h>
 
 #include "chime-connection.h"
 #include "chime-connection-private.h"
@@ -37,6 +38,34 @@ websocket_connect_async_complete (SoupSession *session, SoupMessage *msg, gpoint
 	g_object_unref (task);
 }
 
+#ifndef USE_LIBSOUP_WEBSOCKETS
+/* Apply what the server made of our offer, if anything */
+static gboolean
+websocket_accept_deflate (SoupMessage *msg, SoupWebsocketConnection *client,
+			  const char *accepted, GError **error)
+{
+	const char *offer = soup_message_headers_get_one (msg->request_headers, "Sec-WebSocket-Extensions");
+	gboolean ret = TRUE;
+	GSList *exts, *l;
+
+	if (!accepted)
+		return TRUE;
+
+	exts = soup_header_parse_list (accepted);
+	for (l = exts; l && ret; l = l->next) {
+		if (!offer || l != exts ||
+		    !chime_websocket_connection_enable_deflate (client, l->data))
+			ret = FALSE;
+	}
+	soup_header_free_list (exts);
+
+	if (!ret)
+		g_set_error (error, SOUP_WEBSOCKET_ERROR, SOUP_WEBSOCKET_ERROR_BAD_HANDSHAKE,
+			     _("Server requested unsupported extension: %s"), accepted);
+	return ret;
+}
+#endif
+
 static void
 websocket_connect_async_stop (SoupMessage *msg, gpointer user_data)
 {
@@ -50,6 +79,12 @@ websocket_connect_async_stop (SoupMessage *msg, gpointer user_data)
 					      0, 0, NULL, NULL, task);
 
 	g_object_ref(msg);
+#ifndef USE_LIBSOUP_WEBSOCKETS
+	/* libsoup refuses any extensions at all, so we deal with them ourselves */
+	gchar *extensions = g_strdup (soup_message_headers_get_list (msg->response_headers,
+								     "Sec-WebSocket-Extensions"));
+	soup_message_headers_remove (msg->response_headers, "Sec-WebSocket-Extensions");
+#endif
 	if (soup_websocket_client_verify_handshake (msg, &error)) {
 		GIOStream *stream = soup_session_steal_connection (priv->soup_sess, msg);
 		SoupWebsocketConnection *client = soup_websocket_connection_new (stream,
@@ -59,9 +94,18 @@ websocket_connect_async_stop (SoupMessage *msg, gpointer user_data)
 				 soup_message_headers_get_one (msg->response_headers, "Sec-WebSocket-Protocol"));
 		g_object_unref (stream);
 
+#ifndef USE_LIBSOUP_WEBSOCKETS
+		if (!websocket_accept_deflate (msg, client, extensions, &error)) {
+			g_object_unref (client);
+			g_task_return_error (task, error);
+		} else
+#endif
 		g_task_return_pointer (task, client, g_object_unref);
 	} else
 		g_task_return_error (task, error);
+#ifndef USE_LIBSOUP_WEBSOCKETS
+	g_free (extensions);
+#endif
 
 	g_object_unref (msg);
 	g_object_unref (task);
@@ -151,3 +195,50 @@ chime_connection_websocket_connect_finish (ChimeConnection  *cxn,
 	return g_task_propagate_pointer (G_TASK (result), error);
 }
 
+void
+chime_websocket_offer_deflate (SoupMessage *msg)
+{
+#ifndef USE_LIBSOUP_WEBSOCKETS
+	soup_message_headers_replace (msg->request_headers, "Sec-WebSocket-Extensions",
+				      "permessage-deflate");
+#endif
+}
+
+void
+chime_websocket_send_binaryv (SoupWebsocketConnection *ws,
+			      const GOutputVector     *vectors,
+			      gsize                    n_vectors)
+{
+#ifndef USE_LIBSOUP_WEBSOCKETS
+	chime_websocket_connection_send_binaryv (ws, vectors, n_vectors);
+#else
+	/* libsoup copies the message into its frame anyway, so there's no
+	 * avoiding gathering it first unless it's already in one piece */
+	if (n_vectors == 1) {
+		soup_websocket_connection_send_binary (ws, vectors[0].buffer, vectors[0].size);
+		return;
+	}
+
+	gsize len = 0, i;
+	for (i = 0; i < n_vectors; i++)
+		len += vectors[i].size;
+
+	guint8 *buf = g_malloc (len), *p = buf;
+	for (i = 0; i < n_vectors; i++) {
+		memcpy (p, vectors[i].buffer, vectors[i].size);
+		p += vectors[i].size;
+	}
+	soup_websocket_connection_send_binary (ws, buf, len);
+	g_free (buf);
+#endif
+}
+
+gsize
+chime_websocket_get_buffered_amount (SoupWebsocketConnection *ws)
+{
+#ifndef USE_LIBSOUP_WEBSOCKETS
+	return chime_websocket_connection_get_buffered_amount (ws);
+#else
+	return 0;
+#endif
+}
@@ -33,7 +33,10 @@
 #include <json-glib/json-glib.h>
 
 struct conv_data {
-	GList *l;
+	/* Outbound messages not yet seen, ordered by creation time */
+	GPtrArray *marks;
+	/* The newest LastRead from any member; anything older changes nothing */
+	GTimeVal last_read;
 };
 
 struct msg_mark {
@@ -41,6 +44,30 @@ struct msg_mark {
 	GtkTextMark *mark;
 };
 
+static gint timeval_cmp(const GTimeVal *a, const GTimeVal *b)
+{
+	if (a->tv_sec != b->tv_sec)
+		return a->tv_sec < b->tv_sec ? -1 : 1;
+	return (a->tv_usec > b->tv_usec) - (a->tv_usec < b->tv_usec);
+}
+
+/* Index of the first mark created after 'tv' */
+static guint find_after(GPtrArray *marks, const GTimeVal *tv)
+{
+	guint lo = 0, hi = marks->len;
+
+	while (lo < hi) {
+		guint mid = (lo + hi) / 2;
+		struct msg_mark *m = marks->pdata[mid];
+
+		if (timeval_cmp(&m->created, tv) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
 static gboolean parse_string(JsonNode *parent, const gchar *name, const gchar **res)
 {
         JsonObject *obj;
@@ -67,6 +94,15 @@ static gboolean parse_string(JsonNode *parent, const gchar *name, const gchar **
         return TRUE;
 }
 
+/* Show that the message has been seen, and forget about it */
+static void tick_mark(GtkTextBuffer *buffer, struct msg_mark *m)
+{
+	GtkTextIter iter;
+
+	gtk_text_buffer_get_iter_at_mark(buffer, &iter, m->mark);
+	gtk_text_buffer_insert(buffer, &iter, "  ✓", -1);
+	gtk_text_buffer_delete_mark(buffer, m->mark);
+}
 
 static void
 conv_seen_cb(PurpleConversation *conv, JsonNode *member)
@@ -78,29 +114,19 @@ conv_seen_cb(PurpleConversation *conv, JsonNode *member)
 		return;
 
 	struct conv_data *cd = purple_conversation_get_data(conv, "chime-seen");
-	if (!cd)
+	if (!cd || timeval_cmp(&tv, &cd->last_read) <= 0)
 		return;
 
-	while (cd->l) {
-		struct msg_mark *m = cd->l->data;
-
-		if (tv.tv_sec < m->created.tv_sec ||
-		    (tv.tv_sec == m->created.tv_sec &&
-		     tv.tv_usec < m->created.tv_usec)) {
-			break;
-		}
+	cd->last_read = tv;
 
-		cd->l = g_list_remove(cd->l, m);
+	guint i, n = find_after(cd->marks, &tv);
+	if (!n)
+		return;
 
-		GtkIMHtml *imhtml = GTK_IMHTML(PIDGIN_CONVERSATION(conv)->imhtml);
-		GtkTextIter iter;
-		gtk_text_buffer_get_iter_at_mark(imhtml->text_buffer,
-						 &iter, m->mark);
-		gtk_text_buffer_insert(imhtml->text_buffer,
-				       &iter, "  ✓", -1);
-		gtk_text_buffer_delete_mark(imhtml->text_buffer, m->mark);
-		g_free(m);
-	}
+	GtkIMHtml *imhtml = GTK_IMHTML(PIDGIN_CONVERSATION(conv)->imhtml);
+	for (i = 0; i < n; i++)
+		tick_mark(imhtml->text_buffer, cd->marks->pdata[i]);
+	g_ptr_array_remove_range(cd->marks, 0, n);
 }
 
 static void
@@ -130,9 +156,17 @@ got_convmsg_cb(PurpleConversation *conv, gboolean outbound, JsonNode *msgnode)
 	struct conv_data *cd = purple_conversation_get_data(conv, "chime-seen");
 	if (!cd) {
 		cd = g_new0(struct conv_data, 1);
+		cd->marks = g_ptr_array_new_with_free_func(g_free);
 		purple_conversation_set_data(conv, "chime-seen", cd);
 	};
-	cd->l = g_list_append(cd->l, m);
+	/* Someone may already have read past it if it arrived late */
+	if (timeval_cmp(&m->created, &cd->last_read) <= 0) {
+		tick_mark(imhtml->text_buffer, m);
+		g_free(m);
+		return;
+	}
+	/* Usually at the end, but not if messages were delivered out of order */
+	g_ptr_array_insert(cd->marks, find_after(cd->marks, &m->created), m);
 }
 
 static void
@@ -143,7 +177,7 @@ deleting_conv_cb(PurpleConversation *conv)
 		return;
 
 	/* The marks themselves will die with the GtkTextBuffer */
-	g_list_free_full(cd->l, g_free);
+	g_ptr_array_free(cd->marks, TRUE);
 	g_free(cd);
 	purple_conversation_set_data(conv, "chime-seen", NULL);
 }
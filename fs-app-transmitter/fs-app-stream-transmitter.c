@@ -43,6 +43,10 @@
  * Typically the application would give a unique name to the appsrc and
  * appsink elements, so that gst_bin_get_by_name() can be used to find
  * and interact with them.
+ *
+ * The receive pipeline may push #GstBufferList<!-- -->s, for instance
+ * with gst_app_src_push_buffer_list(); they go on into the conference
+ * as lists.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -139,6 +143,9 @@ fs_app_stream_transmitter_add_sink (FsAppStreamTransmitter *self,
 static GObjectClass *parent_class = NULL;
 // static guint signals[LAST_SIGNAL] = { 0 };
 
+/* Emitted for every packet, so looked up once rather than by name */
+static guint known_source_packet_received_signal = 0;
+
 static GType type = 0;
 
 GType
@@ -177,6 +184,10 @@ fs_app_stream_transmitter_class_init (FsAppStreamTransmitterClass *klass)
 
   parent_class = g_type_class_peek_parent (klass);
 
+  known_source_packet_received_signal =
+    g_signal_lookup ("known-source-packet-received",
+        FS_TYPE_STREAM_TRANSMITTER);
+
   gobject_class->set_property = fs_app_stream_transmitter_set_property;
   gobject_class->get_property = fs_app_stream_transmitter_get_property;
 
@@ -301,7 +312,7 @@ got_buffer_func (GstBuffer *buffer, guint component, gpointer data)
 {
   FsAppStreamTransmitter *self = FS_APP_STREAM_TRANSMITTER_CAST (data);
 
-  g_signal_emit_by_name (self, "known-source-packet-received", component,
+  g_signal_emit (self, known_source_packet_received_signal, 0, component,
       buffer);
 }
 
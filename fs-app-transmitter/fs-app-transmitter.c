@@ -582,11 +582,23 @@ static GstPadProbeReturn
 src_buffer_probe_cb (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
 {
   AppSrc *app = user_data;
-  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
 
-  app->got_buffer_func (buffer, app->component, app->cb_data);
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+  {
+    GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
+    guint i, len = gst_buffer_list_length (list);
+
+    for (i = 0; i < len; i++)
+      app->got_buffer_func (gst_buffer_list_get (list, i), app->component,
+          app->cb_data);
+  }
+  else
+  {
+    app->got_buffer_func (GST_PAD_PROBE_INFO_BUFFER (info), app->component,
+        app->cb_data);
+  }
 
-  return TRUE;
+  return GST_PAD_PROBE_OK;
 }
 
 
@@ -665,7 +677,7 @@ fs_app_transmitter_get_app_src (FsAppTransmitter *self,
 
   if (got_buffer_func)
     app->buffer_probe = gst_pad_add_probe (app->funnelpad,
-        GST_PAD_PROBE_TYPE_BUFFER,
+        GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
         src_buffer_probe_cb, app, NULL);
 
   if (!gst_element_sync_state_with_parent (app->src))
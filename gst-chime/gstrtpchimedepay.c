@@ -28,6 +28,7 @@
 #include <gst/rtp/gstrtpbuffer.h>
 #include <gst/audio/audio.h>
 #include "gstrtpchimedepay.h"
+#include "gstrtpchimemeta.h"
 
 GST_DEBUG_CATEGORY_STATIC (rtpchimedepay_debug);
 #define GST_CAT_DEFAULT (rtpchimedepay_debug)
@@ -58,14 +59,28 @@ static gboolean gst_rtp_chime_depay_setcaps (GstRTPBaseDepayload * depayload,
 G_DEFINE_TYPE (GstRTPChimeDepay, gst_rtp_chime_depay,
     GST_TYPE_RTP_BASE_DEPAYLOAD);
 
+static void
+gst_rtp_chime_depay_finalize (GObject * object)
+{
+  GstRTPChimeDepay *rtpchimedepay = GST_RTP_CHIME_DEPAY (object);
+
+  g_hash_table_destroy (rtpchimedepay->meta_apis);
+
+  G_OBJECT_CLASS (gst_rtp_chime_depay_parent_class)->finalize (object);
+}
+
 static void
 gst_rtp_chime_depay_class_init (GstRTPChimeDepayClass * klass)
 {
   GstRTPBaseDepayloadClass *gstbasertpdepayload_class;
   GstElementClass *element_class;
+  GObjectClass *gobject_class;
 
   element_class = GST_ELEMENT_CLASS (klass);
   gstbasertpdepayload_class = (GstRTPBaseDepayloadClass *) klass;
+  gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->finalize = gst_rtp_chime_depay_finalize;
 
   gst_element_class_add_pad_template (element_class,
       gst_static_pad_template_get (&gst_rtp_chime_depay_src_template));
@@ -86,7 +101,7 @@ gst_rtp_chime_depay_class_init (GstRTPChimeDepayClass * klass)
 static void
 gst_rtp_chime_depay_init (GstRTPChimeDepay * rtpchimedepay)
 {
-
+  rtpchimedepay->meta_apis = g_hash_table_new (NULL, NULL);
 }
 
 static gboolean
@@ -143,11 +158,8 @@ foreach_metadata (GstBuffer * inbuf, GstMeta ** meta, gpointer user_data)
 {
   GstRTPChimeDepay *depay = user_data;
   const GstMetaInfo *info = (*meta)->info;
-  const gchar *const *tags = gst_meta_api_type_get_tags (info->api);
 
-  if (!tags || (g_strv_length ((gchar **) tags) == 1
-          && gst_meta_api_type_has_tag (info->api,
-              g_quark_from_string (GST_META_TAG_AUDIO_STR)))) {
+  if (gst_rtp_chime_meta_applies (depay->meta_apis, info->api)) {
     GST_DEBUG_OBJECT (depay, "keeping metadata %s", g_type_name (info->api));
   } else {
     GST_DEBUG_OBJECT (depay, "dropping metadata %s", g_type_name (info->api));
@@ -44,6 +44,8 @@ struct _GstRTPChimeDepay
 {
   GstRTPBaseDepayload depayload;
 
+  /* Meta API GType -> whether to keep it on the payload */
+  GHashTable *meta_apis;
 };
 
 struct _GstRTPChimeDepayClass
@@ -0,0 +1,46 @@
+/*
+ * Chime RTP (de)payloader metadata handling
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <gst/audio/audio.h>
+#include "gstrtpchimemeta.h"
+
+/* Metas with no tags, or only the audio one, still apply to the packets
+ * and to the payload taken out of them. The tags never change, so that's
+ * only looked up once for each API. */
+gboolean
+gst_rtp_chime_meta_applies (GHashTable * cache, GType api)
+{
+  gpointer val;
+
+  if (!g_hash_table_lookup_extended (cache, GSIZE_TO_POINTER (api),
+          NULL, &val)) {
+    const gchar *const *tags = gst_meta_api_type_get_tags (api);
+    GQuark audio_tag = g_quark_from_static_string (GST_META_TAG_AUDIO_STR);
+
+    val = GINT_TO_POINTER (!tags || (g_strv_length ((gchar **) tags) == 1
+            && gst_meta_api_type_has_tag (api, audio_tag)));
+    g_hash_table_insert (cache, GSIZE_TO_POINTER (api), val);
+  }
+
+  return GPOINTER_TO_INT (val);
+}
@@ -0,0 +1,34 @@
+/*
+ * Chime RTP (de)payloader metadata handling
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_RTP_CHIME_META_H__
+#define __GST_RTP_CHIME_META_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Whether metas of @api still apply once the audio is (de)payloaded.
+ * @cache maps the meta API GType to the answer, and is owned by the
+ * element, which creates it with g_hash_table_new (NULL, NULL). */
+gboolean gst_rtp_chime_meta_applies (GHashTable * cache, GType api);
+
+G_END_DECLS
+
+#endif /* __GST_RTP_CHIME_META_H__ */
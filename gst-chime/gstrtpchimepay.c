@@ -29,6 +29,7 @@
 #include <gst/audio/audio.h>
 
 #include "gstrtpchimepay.h"
+#include "gstrtpchimemeta.h"
 
 GST_DEBUG_CATEGORY_STATIC (rtpchimepay_debug);
 #define GST_CAT_DEFAULT (rtpchimepay_debug)
@@ -60,17 +61,33 @@ static GstCaps *gst_rtp_chime_pay_getcaps (GstRTPBasePayload * payload,
     GstPad * pad, GstCaps * filter);
 static GstFlowReturn gst_rtp_chime_pay_handle_buffer (GstRTPBasePayload *
     payload, GstBuffer * buffer);
+static GstFlowReturn gst_rtp_chime_pay_chain_list (GstPad * pad,
+    GstObject * parent, GstBufferList * list);
 
 G_DEFINE_TYPE (GstRtpCHIMEPay, gst_rtp_chime_pay, GST_TYPE_RTP_BASE_PAYLOAD);
 
+static void
+gst_rtp_chime_pay_finalize (GObject * object)
+{
+  GstRtpCHIMEPay *rtpchimepay = GST_RTP_CHIME_PAY (object);
+
+  g_hash_table_destroy (rtpchimepay->meta_apis);
+
+  G_OBJECT_CLASS (gst_rtp_chime_pay_parent_class)->finalize (object);
+}
+
 static void
 gst_rtp_chime_pay_class_init (GstRtpCHIMEPayClass * klass)
 {
   GstRTPBasePayloadClass *gstbasertppayload_class;
   GstElementClass *element_class;
+  GObjectClass *gobject_class;
 
   gstbasertppayload_class = (GstRTPBasePayloadClass *) klass;
   element_class = GST_ELEMENT_CLASS (klass);
+  gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->finalize = gst_rtp_chime_pay_finalize;
 
   gstbasertppayload_class->set_caps = gst_rtp_chime_pay_setcaps;
   gstbasertppayload_class->get_caps = gst_rtp_chime_pay_getcaps;
@@ -94,6 +111,12 @@ gst_rtp_chime_pay_class_init (GstRtpCHIMEPayClass * klass)
 static void
 gst_rtp_chime_pay_init (GstRtpCHIMEPay * rtpchimepay)
 {
+  GstPad *sinkpad = GST_RTP_BASE_PAYLOAD_SINKPAD (rtpchimepay);
+
+  rtpchimepay->meta_apis = g_hash_table_new (NULL, NULL);
+
+  rtpchimepay->chain = GST_PAD_CHAINFUNC (sinkpad);
+  gst_pad_set_chain_list_function (sinkpad, gst_rtp_chime_pay_chain_list);
 }
 
 static gboolean
@@ -175,11 +198,8 @@ foreach_metadata (GstBuffer * inbuf, GstMeta ** meta, gpointer user_data)
   GstRtpCHIMEPay *pay = data->pay;
   GstBuffer *outbuf = data->outbuf;
   const GstMetaInfo *info = (*meta)->info;
-  const gchar *const *tags = gst_meta_api_type_get_tags (info->api);
 
-  if (!tags || (g_strv_length ((gchar **) tags) == 1
-          && gst_meta_api_type_has_tag (info->api,
-              g_quark_from_string (GST_META_TAG_AUDIO_STR)))) {
+  if (gst_rtp_chime_meta_applies (pay->meta_apis, info->api)) {
     GstMetaTransformCopy copy_data = { FALSE, 0, -1 };
     GST_DEBUG_OBJECT (pay, "copy metadata %s", g_type_name (info->api));
     /* simply copy then */
@@ -196,6 +216,7 @@ static GstFlowReturn
 gst_rtp_chime_pay_handle_buffer (GstRTPBasePayload * basepayload,
     GstBuffer * buffer)
 {
+  GstRtpCHIMEPay *rtpchimepay = GST_RTP_CHIME_PAY (basepayload);
   GstBuffer *outbuf;
   GstClockTime pts, dts, duration;
   CopyMetaData data;
@@ -205,7 +226,7 @@ gst_rtp_chime_pay_handle_buffer (GstRTPBasePayload * basepayload,
   duration = GST_BUFFER_DURATION (buffer);
 
   outbuf = gst_rtp_buffer_new_allocate (0, 0, 0);
-  data.pay = GST_RTP_CHIME_PAY (basepayload);
+  data.pay = rtpchimepay;
   data.outbuf = outbuf;
   gst_buffer_foreach_meta (buffer, foreach_metadata, &data);
   outbuf = gst_buffer_append (outbuf, buffer);
@@ -214,10 +235,48 @@ gst_rtp_chime_pay_handle_buffer (GstRTPBasePayload * basepayload,
   GST_BUFFER_DTS (outbuf) = dts;
   GST_BUFFER_DURATION (outbuf) = duration;
 
+  /* Part of a list, which will be pushed as one when it's all done */
+  if (rtpchimepay->pending) {
+    gst_buffer_list_add (rtpchimepay->pending, outbuf);
+    return GST_FLOW_OK;
+  }
+
   /* Push out */
   return gst_rtp_base_payload_push (basepayload, outbuf);
 }
 
+/* The base class only knows about single buffers, so feed it those and
+ * push the packets from a whole list downstream together */
+static GstFlowReturn
+gst_rtp_chime_pay_chain_list (GstPad * pad, GstObject * parent,
+    GstBufferList * list)
+{
+  GstRtpCHIMEPay *rtpchimepay = GST_RTP_CHIME_PAY (parent);
+  GstFlowReturn ret = GST_FLOW_OK, push_ret;
+  guint i, len;
+
+  len = gst_buffer_list_length (list);
+  rtpchimepay->pending = gst_buffer_list_new_sized (len);
+
+  for (i = 0; i < len && ret == GST_FLOW_OK; i++)
+    ret = rtpchimepay->chain (pad, parent,
+        gst_buffer_ref (gst_buffer_list_get (list, i)));
+  gst_buffer_list_unref (list);
+
+  list = rtpchimepay->pending;
+  rtpchimepay->pending = NULL;
+
+  if (gst_buffer_list_length (list) == 0) {
+    gst_buffer_list_unref (list);
+    return ret;
+  }
+
+  /* Whatever was payloaded before any failure still goes out */
+  push_ret = gst_rtp_base_payload_push_list (GST_RTP_BASE_PAYLOAD (parent),
+      list);
+  return ret == GST_FLOW_OK ? push_ret : ret;
+}
+
 static GstCaps *
 gst_rtp_chime_pay_getcaps (GstRTPBasePayload * payload,
     GstPad * pad, GstCaps * filter)
@@ -44,6 +44,14 @@ typedef struct _GstRtpCHIMEPayClass GstRtpCHIMEPayClass;
 struct _GstRtpCHIMEPay
 {
   GstRTPBasePayload payload;
+
+  /* The base class's chain function, which we call for each buffer of a
+   * list while collecting the packets in @pending to push together */
+  GstPadChainFunction chain;
+  GstBufferList *pending;
+
+  /* Meta API GType -> whether to copy it to the packets */
+  GHashTable *meta_apis;
 };
 
 struct _GstRtpCHIMEPayClass
@@ -28,10 +28,18 @@
  * available to also capture your mouse pointer.  By default it will fixate to
  * 25 frames per second.
  *
+ * With a 32 bits per pixel display, downstream may also ask for a smaller
+ * size than the screen or the region selected with #GstXcbImageSrc:startx
+ * and friends, in which case the captured image is scaled down with a box
+ * filter before it is pushed.
+ *
  * ## Example pipelines
  * |[
  * gst-launch-1.0 xcbimagesrc ! video/x-raw,framerate=5/1 ! videoconvert ! theoraenc ! oggmux ! filesink location=desktop.ogg
  * ]| Encodes your X display to an Ogg theora video at 5 frames per second.
+ * |[
+ * gst-launch-1.0 xcbimagesrc ! video/x-raw,width=1280,height=720 ! videoconvert ! autovideosink
+ * ]| Shows your X display scaled down to 720p.
  *
  */
 
@@ -42,6 +50,9 @@
 
 #include <string.h>
 #include <stdlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
@@ -80,44 +91,16 @@ enum
   PROP_REMOTE,
   PROP_XID,
   PROP_XNAME,
+  PROP_USE_SHM,
+  PROP_CAPTURE_THREAD,
 };
 
 #define gst_xcbimage_src_parent_class parent_class
 G_DEFINE_TYPE (GstXcbImageSrc, gst_xcbimage_src, GST_TYPE_PUSH_SRC);
 
 static GstCaps *gst_xcbimage_src_fixate (GstBaseSrc * bsrc, GstCaps * caps);
-static void gst_xcbimage_src_clear_bufpool (GstXcbImageSrc * xcbimagesrc);
-
-/* Called when a buffer is returned from the pipeline */
-static gboolean
-gst_xcbimage_src_return_buf (GstXcbImageSrc * xcbimagesrc, GstBuffer * xcbimage)
-{
-  GstMetaXcbImage *meta = GST_META_XCBIMAGE_GET (xcbimage);
-  /* True will make dispose free the buffer, while false will keep it */
-  gboolean ret = TRUE;
-
-  /* If our geometry changed we can't reuse that image. */
-  if ((meta->width != xcbimagesrc->width) || (meta->height != xcbimagesrc->height)) {
-    GST_DEBUG_OBJECT (xcbimagesrc,
-        "destroy image %p as its size changed %dx%d vs current %dx%d",
-        xcbimage, meta->width, meta->height, xcbimagesrc->width, xcbimagesrc->height);
-    g_mutex_lock (&xcbimagesrc->x_lock);
-    gst_xcbimageutil_xcbimage_destroy (xcbimagesrc->xcontext, xcbimage);
-    g_mutex_unlock (&xcbimagesrc->x_lock);
-  } else {
-    /* In that case we can reuse the image and add it to our image pool. */
-    GST_LOG_OBJECT (xcbimagesrc, "recycling image %p in pool", xcbimage);
-    /* need to increment the refcount again to recycle */
-    gst_buffer_ref (xcbimage);
-    g_mutex_lock (&xcbimagesrc->pool_lock);
-    GST_BUFFER_FLAGS (GST_BUFFER (xcbimage)) = 0; /* clear out any flags from the previous use */
-    xcbimagesrc->buffer_pool = g_slist_prepend (xcbimagesrc->buffer_pool, xcbimage);
-    g_mutex_unlock (&xcbimagesrc->pool_lock);
-    ret = FALSE;
-  }
-
-  return ret;
-}
+static void gst_xcbimage_src_stop_capture_thread (GstXcbImageSrc * src);
+static void gst_xcbimage_src_clear_scaling (GstXcbImageSrc * s);
 
 static Window
 gst_xcbimage_src_find_window (GstXcbImageSrc * src, Window root, const char *name)
@@ -165,6 +148,8 @@ gst_xcbimage_src_open_display (GstXcbImageSrc * s, const gchar * name)
         ("NULL returned from getting xcontext"));
     return FALSE;
   }
+  if (!s->use_shm)
+    s->xcontext->use_xshm = FALSE;
   s->width = s->xcontext->width;
   s->height = s->xcontext->height;
 
@@ -304,13 +289,22 @@ gst_xcbimage_src_stop (GstBaseSrc * basesrc)
 {
   GstXcbImageSrc *src = GST_XCBIMAGE_SRC (basesrc);
 
+  gst_xcbimage_src_stop_capture_thread (src);
+
 #ifdef HAVE_XDAMAGE
   if (src->last_ximage)
     gst_buffer_unref (GST_BUFFER_CAST (src->last_ximage));
   src->last_ximage = NULL;
 #endif
 
-  gst_xcbimage_src_clear_bufpool (src);
+  /* The images have to go while we still have the display they're on;
+   * basesrc would only deactivate the pool after this */
+  gst_xcbimage_src_clear_scaling (src);
+  if (src->pool) {
+    gst_buffer_pool_set_active (src->pool, FALSE);
+    gst_object_unref (src->pool);
+    src->pool = NULL;
+  }
 
 #ifdef HAVE_XFIXES
   if (src->cursor_image)
@@ -349,7 +343,13 @@ gst_xcbimage_src_unlock (GstBaseSrc * basesrc)
 {
   GstXcbImageSrc *src = GST_XCBIMAGE_SRC (basesrc);
 
-  /* Awaken the create() func if it's waiting on the clock */
+  /* Awaken the create() func if it's waiting on the clock, or for
+   * the capture thread */
+  g_mutex_lock (&src->capture_lock);
+  src->capture_flushing = TRUE;
+  g_cond_broadcast (&src->capture_cond);
+  g_mutex_unlock (&src->capture_lock);
+
   GST_OBJECT_LOCK (src);
   if (src->clock_id) {
     GST_DEBUG_OBJECT (src, "Waking up waiting clock");
@@ -360,6 +360,25 @@ gst_xcbimage_src_unlock (GstBaseSrc * basesrc)
   return TRUE;
 }
 
+static gboolean
+gst_xcbimage_src_unlock_stop (GstBaseSrc * basesrc)
+{
+  GstXcbImageSrc *src = GST_XCBIMAGE_SRC (basesrc);
+
+  /* Whatever was captured before the flush is stale now */
+  g_mutex_lock (&src->capture_lock);
+  src->capture_flushing = FALSE;
+  src->capture_ret = GST_FLOW_OK;
+  if (src->captured) {
+    gst_buffer_unref (src->captured);
+    src->captured = NULL;
+  }
+  g_cond_broadcast (&src->capture_cond);
+  g_mutex_unlock (&src->capture_lock);
+
+  return TRUE;
+}
+
 static gboolean
 gst_xcbimage_src_recalc (GstXcbImageSrc * src)
 {
@@ -391,18 +410,18 @@ gst_xcbimage_is_pointer_in_region (GstXcbImageSrc * src)
 #endif
 
 #ifdef HAVE_XFIXES
+/* x / 255, exactly, for anything up to 255 * 255 and a bit */
+#define DIV255(x) (((x) + 1 + ((x) >> 8)) >> 8)
+
 static void
 composite_pixel (GstXContext * xcontext, guchar * dest, guchar * src)
 {
-  guint8 r = src[2];
-  guint8 g = src[1];
-  guint8 b = src[0];
-  guint8 a = src[3];
-  guint8 dr, dg, db;
+  guint r = src[2];
+  guint g = src[1];
+  guint b = src[0];
+  guint a = src[3];
+  guint dr, dg, db;
   guint32 color;
-  gint r_shift, r_max, r_shift_out;
-  gint g_shift, g_max, g_shift_out;
-  gint b_shift, b_max, b_shift_out;
 
   switch (xcontext->bpp) {
     case 8:
@@ -419,40 +438,20 @@ composite_pixel (GstXContext * xcontext, guchar * dest, guchar * src)
       g_return_if_reached ();
   }
 
-  /* possible optimisation:
-   * move the code that finds shift and max in the _link function */
-  for (r_shift = 0; !(xcontext->visual->red_mask & (1 << r_shift)); r_shift++);
-  for (g_shift = 0; !(xcontext->visual->green_mask & (1 << g_shift));
-      g_shift++);
-  for (b_shift = 0; !(xcontext->visual->blue_mask & (1 << b_shift)); b_shift++);
-
-  for (r_shift_out = 0; !(xcontext->visual->red_mask & (1 << r_shift_out));
-      r_shift_out++);
-  for (g_shift_out = 0; !(xcontext->visual->green_mask & (1 << g_shift_out));
-      g_shift_out++);
-  for (b_shift_out = 0; !(xcontext->visual->blue_mask & (1 << b_shift_out));
-      b_shift_out++);
-
-
-  r_max = (xcontext->visual->red_mask >> r_shift);
-  b_max = (xcontext->visual->blue_mask >> b_shift);
-  g_max = (xcontext->visual->green_mask >> g_shift);
-
-#define RGBXXX_R(x)  (((x)>>r_shift) & (r_max))
-#define RGBXXX_G(x)  (((x)>>g_shift) & (g_max))
-#define RGBXXX_B(x)  (((x)>>b_shift) & (b_max))
+  dr = (((color >> xcontext->r_shift) & xcontext->r_max) * 255) /
+      xcontext->r_max;
+  dg = (((color >> xcontext->g_shift) & xcontext->g_max) * 255) /
+      xcontext->g_max;
+  db = (((color >> xcontext->b_shift) & xcontext->b_max) * 255) /
+      xcontext->b_max;
 
-  dr = (RGBXXX_R (color) * 255) / r_max;
-  dg = (RGBXXX_G (color) * 255) / g_max;
-  db = (RGBXXX_B (color) * 255) / b_max;
+  dr = DIV255 (r * a + (0xff - a) * dr);
+  dg = DIV255 (g * a + (0xff - a) * dg);
+  db = DIV255 (b * a + (0xff - a) * db);
 
-  dr = (r * a + (0xff - a) * dr) / 0xff;
-  dg = (g * a + (0xff - a) * dg) / 0xff;
-  db = (b * a + (0xff - a) * db) / 0xff;
-
-  color = (((dr * r_max) / 255) << r_shift_out) +
-      (((dg * g_max) / 255) << g_shift_out) +
-      (((db * b_max) / 255) << b_shift_out);
+  color = (DIV255 (dr * xcontext->r_max) << xcontext->r_shift) +
+      (DIV255 (dg * xcontext->g_max) << xcontext->g_shift) +
+      (DIV255 (db * xcontext->b_max) << xcontext->b_shift);
 
   switch (xcontext->bpp) {
     case 8:
@@ -468,6 +467,96 @@ composite_pixel (GstXContext * xcontext, guchar * dest, guchar * src)
       g_warning ("bpp %d not supported\n", xcontext->bpp);
   }
 }
+
+/* Whether the image is 32bpp xRGB, in which case it has the same layout
+ * as the cursor and can be blended with it a byte at a time */
+static gboolean
+is_xrgb32 (GstXContext * xcontext)
+{
+  return G_BYTE_ORDER == G_LITTLE_ENDIAN && xcontext->bpp == 32 &&
+      xcontext->r_shift == 16 && xcontext->g_shift == 8 &&
+      xcontext->b_shift == 0 && xcontext->r_max == 0xff &&
+      xcontext->g_max == 0xff && xcontext->b_max == 0xff;
+}
+
+#ifdef __SSE2__
+/* Two pixels, widened to 16 bits per channel */
+static inline __m128i
+blend_2_sse2 (__m128i s, __m128i d)
+{
+  const __m128i ff = _mm_set1_epi16 (0xff);
+  const __m128i one = _mm_set1_epi16 (1);
+  __m128i a, t;
+
+  a = _mm_shufflelo_epi16 (s, _MM_SHUFFLE (3, 3, 3, 3));
+  a = _mm_shufflehi_epi16 (a, _MM_SHUFFLE (3, 3, 3, 3));
+  t = _mm_add_epi16 (_mm_mullo_epi16 (s, a),
+      _mm_mullo_epi16 (d, _mm_sub_epi16 (ff, a)));
+  return _mm_srli_epi16 (_mm_add_epi16 (_mm_add_epi16 (t, one),
+          _mm_srli_epi16 (t, 8)), 8);
+}
+#endif
+
+static void
+blend_row_xrgb32 (guint8 * dest, const guint32 * src, gint n)
+{
+  gint i = 0, k;
+
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i rgb = _mm_set1_epi32 (0x00ffffff);
+
+  for (; i + 4 <= n; i += 4) {
+    __m128i s = _mm_loadu_si128 ((const __m128i *) (src + i));
+    __m128i d = _mm_loadu_si128 ((const __m128i *) (dest + i * 4));
+    __m128i lo = blend_2_sse2 (_mm_unpacklo_epi8 (s, zero),
+        _mm_unpacklo_epi8 (d, zero));
+    __m128i hi = blend_2_sse2 (_mm_unpackhi_epi8 (s, zero),
+        _mm_unpackhi_epi8 (d, zero));
+
+    _mm_storeu_si128 ((__m128i *) (dest + i * 4),
+        _mm_and_si128 (_mm_packus_epi16 (lo, hi), rgb));
+  }
+#endif
+  for (; i < n; i++) {
+    const guint8 *sp = (const guint8 *) (src + i);
+    guint8 *dp = dest + i * 4;
+    guint a = sp[3];
+
+    for (k = 0; k < 3; k++)
+      dp[k] = DIV255 (sp[k] * a + dp[k] * (0xff - a));
+    dp[3] = 0;
+  }
+}
+
+/* Blend @n pixels of a row of the XFixes cursor, which are ARGB values
+ * in unsigned longs, onto the image */
+static void
+composite_row (GstXContext * xcontext, guint8 * dest,
+    const unsigned long *src, gint n)
+{
+  gboolean xrgb32 = is_xrgb32 (xcontext);
+  gint bytes = xcontext->bpp / 8;
+  guint32 argb[64];
+  gint i, chunk;
+
+  while (n > 0) {
+    chunk = MIN (n, G_N_ELEMENTS (argb));
+    for (i = 0; i < chunk; i++)
+      argb[i] = GUINT32_TO_LE (src[i]);
+
+    if (xrgb32) {
+      blend_row_xrgb32 (dest, argb, chunk);
+    } else {
+      for (i = 0; i < chunk; i++)
+        composite_pixel (xcontext, dest + i * bytes, (guint8 *) & argb[i]);
+    }
+
+    dest += chunk * bytes;
+    src += chunk;
+    n -= chunk;
+  }
+}
 #endif
 
 #ifdef HAVE_XDAMAGE
@@ -480,51 +569,207 @@ copy_buffer (GstBuffer * dest, GstBuffer * src)
   gst_buffer_fill (dest, 0, map.data, map.size);
   gst_buffer_unmap (src, &map);
 }
+
+/* Frames which were built on the previous one carry a "damage" region
+ * of interest for each area which changed, in image co-ordinates. They
+ * are still complete raw frames, so they aren't flagged DELTA_UNIT. A
+ * frame with no damage at all is to be taken as entirely new. */
+static GQuark
+damage_quark (void)
+{
+  static GQuark q;
+
+  if (!q)
+    q = g_quark_from_static_string ("damage");
+  return q;
+}
+
+static gboolean
+remove_damage_meta (GstBuffer * buf, GstMeta ** meta, gpointer user_data)
+{
+  if ((*meta)->info->api == GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE &&
+      ((GstVideoRegionOfInterestMeta *) * meta)->roi_type == damage_quark ())
+    *meta = NULL;
+  return TRUE;
+}
+
+static void
+clear_damage (GstBuffer * buf)
+{
+  gst_buffer_foreach_meta (buf, remove_damage_meta, NULL);
+}
+
+/* Takes screen co-ordinates, and clips them to the image */
+static void
+add_damage (GstXcbImageSrc * src, GstBuffer * buf, gint x, gint y,
+    gint width, gint height)
+{
+  gint x1 = MAX (x - (gint) src->startx, 0);
+  gint y1 = MAX (y - (gint) src->starty, 0);
+  gint x2 = MIN (x + width - (gint) src->startx, (gint) src->width);
+  gint y2 = MIN (y + height - (gint) src->starty, (gint) src->height);
+
+  if (x2 > x1 && y2 > y1)
+    gst_buffer_add_video_region_of_interest_meta_id (buf, damage_quark (),
+        x1, y1, x2 - x1, y2 - y1);
+}
+
+/* Carry the damage over to a scaled down copy of the frame */
+static void
+scale_damage (GstXcbImageSrc * src, GstBuffer * dest, GstBuffer * buf)
+{
+  gpointer state = NULL;
+  GstMeta *meta;
+
+  while ((meta = gst_buffer_iterate_meta (buf, &state))) {
+    GstVideoRegionOfInterestMeta *roi = (GstVideoRegionOfInterestMeta *) meta;
+    guint x1, y1, x2, y2;
+
+    if (meta->info->api != GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE ||
+        roi->roi_type != damage_quark ())
+      continue;
+
+    x1 = (guint64) roi->x * src->out_width / src->width;
+    y1 = (guint64) roi->y * src->out_height / src->height;
+    x2 = ((guint64) (roi->x + roi->w) * src->out_width + src->width -
+        1) / src->width;
+    y2 = ((guint64) (roi->y + roi->h) * src->out_height + src->height -
+        1) / src->height;
+    gst_buffer_add_video_region_of_interest_meta_id (dest, damage_quark (),
+        x1, y1, x2 - x1, y2 - y1);
+  }
+}
 #endif
 
-/* Retrieve an XcbImageSrcBuffer, preferably from our
- * pool of existing images and populate it from the window */
+/* Add a row of @n bytes into per-byte sums */
+static void
+accumulate_row (guint32 * sums, const guint8 * src, gint n)
+{
+  gint i = 0;
+
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128 ();
+
+  for (; i + 16 <= n; i += 16) {
+    __m128i p = _mm_loadu_si128 ((const __m128i *) (src + i));
+    __m128i lo = _mm_unpacklo_epi8 (p, zero);
+    __m128i hi = _mm_unpackhi_epi8 (p, zero);
+    __m128i *d = (__m128i *) (sums + i);
+
+    _mm_storeu_si128 (d, _mm_add_epi32 (_mm_loadu_si128 (d),
+            _mm_unpacklo_epi16 (lo, zero)));
+    _mm_storeu_si128 (d + 1, _mm_add_epi32 (_mm_loadu_si128 (d + 1),
+            _mm_unpackhi_epi16 (lo, zero)));
+    _mm_storeu_si128 (d + 2, _mm_add_epi32 (_mm_loadu_si128 (d + 2),
+            _mm_unpacklo_epi16 (hi, zero)));
+    _mm_storeu_si128 (d + 3, _mm_add_epi32 (_mm_loadu_si128 (d + 3),
+            _mm_unpackhi_epi16 (hi, zero)));
+  }
+#endif
+  for (; i < n; i++)
+    sums[i] += src[i];
+}
+
+/* Box filter a 32bpp image down to the output size. Each output row
+ * sums its source rows column by column first, so every source pixel
+ * is only read once; the channels are averaged byte by byte, which
+ * works whatever order they are in. */
+static void
+downscale_32 (GstXcbImageSrc * s, XImage * dest, const XImage * src)
+{
+  gint sw = s->width, sh = s->height;
+  gint dw = s->out_width, dh = s->out_height;
+  gint x, y, j, k, c;
+
+  for (y = 0; y < dh; y++) {
+    gint y0 = (gint64) y * sh / dh;
+    gint y1 = (gint64) (y + 1) * sh / dh;
+    guint8 *d = (guint8 *) dest->data + y * dest->bytes_per_line;
+
+    memset (s->scale_sums, 0, sw * 4 * sizeof (guint32));
+    for (j = y0; j < y1; j++)
+      accumulate_row (s->scale_sums,
+          (const guint8 *) src->data + j * src->bytes_per_line, sw * 4);
+
+    for (x = 0; x < dw; x++) {
+      gint x0 = s->scale_cols[x], x1 = s->scale_cols[x + 1];
+      guint n = (x1 - x0) * (y1 - y0);
+
+      for (c = 0; c < 4; c++) {
+        guint32 sum = 0;
+
+        for (k = x0; k < x1; k++)
+          sum += s->scale_sums[k * 4 + c];
+        d[x * 4 + c] = (sum + n / 2) / n;
+      }
+    }
+  }
+}
+
+/* Scale a full size capture down into one of the images we push */
 static GstBuffer *
-gst_xcbimage_src_xcbimage_get (GstXcbImageSrc * xcbimagesrc)
+gst_xcbimage_src_scale (GstXcbImageSrc * s, GstBuffer * image,
+    GstFlowReturn * ret)
 {
-  GstBuffer *xcbimage = NULL;
-  GstMetaXcbImage *meta;
+  GstBuffer *scaled = NULL;
 
-  g_mutex_lock (&xcbimagesrc->pool_lock);
-  while (xcbimagesrc->buffer_pool != NULL) {
-    xcbimage = xcbimagesrc->buffer_pool->data;
+  if (s->pool == NULL) {
+    *ret = GST_FLOW_NOT_NEGOTIATED;
+    return NULL;
+  }
+  *ret = gst_buffer_pool_acquire_buffer (s->pool, &scaled, NULL);
+  if (*ret != GST_FLOW_OK)
+    return NULL;
 
-    meta = GST_META_XCBIMAGE_GET (xcbimage);
+  downscale_32 (s, GST_META_XCBIMAGE_GET (scaled)->ximage,
+      GST_META_XCBIMAGE_GET (image)->ximage);
+#ifdef HAVE_XDAMAGE
+  scale_damage (s, scaled, image);
+#endif
 
-    xcbimagesrc->buffer_pool = g_slist_delete_link (xcbimagesrc->buffer_pool,
-        xcbimagesrc->buffer_pool);
+  return scaled;
+}
 
-    if ((meta->width == xcbimagesrc->width) ||
-        (meta->height == xcbimagesrc->height))
-      break;
+/* Retrieve an XcbImageSrcBuffer, preferably from our
+ * pool of existing images and populate it from the window.
+ * If there isn't one, *ret says why. */
+static GstBuffer *
+gst_xcbimage_src_xcbimage_get (GstXcbImageSrc * xcbimagesrc,
+    GstFlowReturn * ret)
+{
+  GstBuffer *xcbimage = NULL;
+  GstMetaXcbImage *meta;
 
-    gst_xcbimage_buffer_free (xcbimage);
-    xcbimage = NULL;
+#ifdef HAVE_XDAMAGE
+  gboolean partial = FALSE;
+  gboolean in_place = FALSE;
+
+  /* If nothing downstream still has the last frame, it can be patched
+   * up where it is rather than copied into another buffer. Take our
+   * reference over, so that it stays writable while we do. */
+  if (xcbimagesrc->have_xdamage && xcbimagesrc->use_damage &&
+      xcbimagesrc->last_ximage != NULL &&
+      gst_buffer_is_writable (xcbimagesrc->last_ximage) &&
+      gst_buffer_is_all_memory_writable (xcbimagesrc->last_ximage)) {
+    GST_LOG_OBJECT (xcbimagesrc, "Reusing last frame in place");
+    xcbimage = xcbimagesrc->last_ximage;
+    xcbimagesrc->last_ximage = NULL;
+    in_place = TRUE;
   }
-  g_mutex_unlock (&xcbimagesrc->pool_lock);
+#endif
 
   if (xcbimage == NULL) {
-    GST_DEBUG_OBJECT (xcbimagesrc, "creating image (%dx%d)",
-        xcbimagesrc->width, xcbimagesrc->height);
-
-    g_mutex_lock (&xcbimagesrc->x_lock);
-    xcbimage = gst_xcbimageutil_xcbimage_new (xcbimagesrc->xcontext,
-        GST_ELEMENT (xcbimagesrc), xcbimagesrc->width, xcbimagesrc->height,
-        (BufferReturnFunc) (gst_xcbimage_src_return_buf));
-    if (xcbimage == NULL) {
-      GST_ELEMENT_ERROR (xcbimagesrc, RESOURCE, WRITE, (NULL),
-          ("could not create a %dx%d xcbimage", xcbimagesrc->width,
-              xcbimagesrc->height));
-      g_mutex_unlock (&xcbimagesrc->x_lock);
+    GstBufferPool *pool = xcbimagesrc->capture_pool ?
+        xcbimagesrc->capture_pool : xcbimagesrc->pool;
+
+    if (pool == NULL) {
+      *ret = GST_FLOW_NOT_NEGOTIATED;
       return NULL;
     }
-
-    g_mutex_unlock (&xcbimagesrc->x_lock);
+    /* FLUSHING while basesrc has the pool inactive */
+    *ret = gst_buffer_pool_acquire_buffer (pool, &xcbimage, NULL);
+    if (*ret != GST_FLOW_OK)
+      return NULL;
   }
 
   g_return_val_if_fail (GST_IS_XCBIMAGE_SRC (xcbimagesrc), NULL);
@@ -532,14 +777,17 @@ gst_xcbimage_src_xcbimage_get (GstXcbImageSrc * xcbimagesrc)
   meta = GST_META_XCBIMAGE_GET (xcbimage);
 
 #ifdef HAVE_XDAMAGE
+  clear_damage (xcbimage);
   if (xcbimagesrc->have_xdamage && xcbimagesrc->use_damage &&
-      xcbimagesrc->last_ximage != NULL) {
+      (in_place || xcbimagesrc->last_ximage != NULL)) {
     XEvent ev;
     gboolean have_damage = FALSE;
 
     /* have_frame is TRUE when either the entire screen has been
      * grabbed or when the last image has been copied */
-    gboolean have_frame = FALSE;
+    gboolean have_frame = in_place;
+
+    partial = TRUE;
 
     GST_DEBUG_OBJECT (xcbimagesrc, "Retrieving screen using XDamage");
 
@@ -613,6 +861,7 @@ gst_xcbimage_src_xcbimage_get (GstXcbImageSrc * xcbimagesrc)
                   startx, starty, width, height, AllPlanes, ZPixmap,
                   meta->ximage, startx - xcbimagesrc->startx,
                   starty - xcbimagesrc->starty);
+              add_damage (xcbimagesrc, xcbimage, startx, starty, width, height);
             }
           } else {
 
@@ -624,6 +873,8 @@ gst_xcbimage_src_xcbimage_get (GstXcbImageSrc * xcbimagesrc)
                 rects[i].x, rects[i].y,
                 rects[i].width, rects[i].height,
                 AllPlanes, ZPixmap, meta->ximage, rects[i].x, rects[i].y);
+            add_damage (xcbimagesrc, xcbimage, rects[i].x, rects[i].y,
+                rects[i].width, rects[i].height);
           }
         }
         XFree (rects);
@@ -686,12 +937,14 @@ gst_xcbimage_src_xcbimage_get (GstXcbImageSrc * xcbimagesrc)
               startx, starty, iwidth, iheight, AllPlanes, ZPixmap,
               meta->ximage, startx - xcbimagesrc->startx,
               starty - xcbimagesrc->starty);
+          add_damage (xcbimagesrc, xcbimage, startx, starty, iwidth, iheight);
         }
       } else {
 
         GST_DEBUG_OBJECT (xcbimagesrc, "Removing cursor from %d,%d", x, y);
         XGetSubImage (xcbimagesrc->xcontext->disp, xcbimagesrc->xwindow,
             x, y, width, height, AllPlanes, ZPixmap, meta->ximage, x, y);
+        add_damage (xcbimagesrc, xcbimage, x, y, width, height);
       }
     }
 #endif
@@ -735,7 +988,7 @@ gst_xcbimage_src_xcbimage_get (GstXcbImageSrc * xcbimagesrc)
       XFree (xcbimagesrc->cursor_image);
     xcbimagesrc->cursor_image = XFixesGetCursorImage (xcbimagesrc->xcontext->disp);
     if (xcbimagesrc->cursor_image != NULL) {
-      int cx, cy, i, j, count;
+      int cx, cy, j;
       int startx, starty, iwidth, iheight;
       gboolean cursor_in_image = TRUE;
 
@@ -743,7 +996,6 @@ gst_xcbimage_src_xcbimage_get (GstXcbImageSrc * xcbimagesrc)
           xcbimagesrc->x;
       cy = xcbimagesrc->cursor_image->y - xcbimagesrc->cursor_image->yhot -
           xcbimagesrc->y;
-      count = xcbimagesrc->cursor_image->width * xcbimagesrc->cursor_image->height;
 
       /* only get where cursor last was, if it is in our range */
       if (xcbimagesrc->endx > xcbimagesrc->startx &&
@@ -778,32 +1030,35 @@ gst_xcbimage_src_xcbimage_get (GstXcbImageSrc * xcbimagesrc)
       }
 
       if (cursor_in_image) {
+        gint endx, endy;
+
         GST_DEBUG_OBJECT (xcbimagesrc, "Cursor is in image so trying to draw it");
-        for (i = 0; i < count; i++)
-          xcbimagesrc->cursor_image->pixels[i] =
-              GUINT_TO_LE (xcbimagesrc->cursor_image->pixels[i]);
-        /* copy those pixels across */
-        for (j = starty;
-            j < starty + iheight
-            && j < xcbimagesrc->starty + xcbimagesrc->height; j++) {
-          for (i = startx;
-              i < startx + iwidth
-              && i < xcbimagesrc->startx + xcbimagesrc->width; i++) {
-            guint8 *src, *dest;
-
-            src =
-                (guint8 *) & (xcbimagesrc->cursor_image->pixels[((j -
-                            cy) * xcbimagesrc->cursor_image->width + (i - cx))]);
-            dest =
-                (guint8 *) & (meta->ximage->data[((j -
-                            xcbimagesrc->starty) * xcbimagesrc->width + (i -
-                            xcbimagesrc->startx)) *
-                    (xcbimagesrc->xcontext->bpp / 8)]);
-
-            composite_pixel (xcbimagesrc->xcontext, (guint8 *) dest,
-                (guint8 *) src);
-          }
+        /* clip to the image, a row at a time */
+        endx = MIN (startx + iwidth,
+            (gint) (xcbimagesrc->startx + xcbimagesrc->width));
+        endy = MIN (starty + iheight,
+            (gint) (xcbimagesrc->starty + xcbimagesrc->height));
+        startx = MAX (startx, (gint) xcbimagesrc->startx);
+        starty = MAX (starty, (gint) xcbimagesrc->starty);
+
+        for (j = starty; j < endy && startx < endx; j++) {
+          const unsigned long *src;
+          guint8 *dest;
+
+          src = &xcbimagesrc->cursor_image->pixels[(j - cy) *
+              xcbimagesrc->cursor_image->width + (startx - cx)];
+          dest = (guint8 *) & (meta->ximage->data[((j -
+                          xcbimagesrc->starty) * xcbimagesrc->width + (startx -
+                          xcbimagesrc->startx)) *
+                  (xcbimagesrc->xcontext->bpp / 8)]);
+
+          composite_row (xcbimagesrc->xcontext, dest, src, endx - startx);
         }
+#ifdef HAVE_XDAMAGE
+        if (partial)
+          add_damage (xcbimagesrc, xcbimage, startx, starty, endx - startx,
+              endy - starty);
+#endif
       }
     }
   }
@@ -822,15 +1077,16 @@ gst_xcbimage_src_xcbimage_get (GstXcbImageSrc * xcbimagesrc)
   return xcbimage;
 }
 
+/* Wait for the next multiple of the frame rate, and grab a frame */
 static GstFlowReturn
-gst_xcbimage_src_create (GstPushSrc * bs, GstBuffer ** buf)
+gst_xcbimage_src_capture (GstXcbImageSrc * s, GstBuffer ** buf)
 {
-  GstXcbImageSrc *s = GST_XCBIMAGE_SRC (bs);
   GstBuffer *image;
   GstClockTime base_time;
   GstClockTime next_capture_ts;
   GstClockTime dur;
   gint64 next_frame_no;
+  GstFlowReturn ret;
 
   if (!gst_xcbimage_src_recalc (s)) {
     GST_ELEMENT_ERROR (s, RESOURCE, FAILED,
@@ -906,9 +1162,18 @@ gst_xcbimage_src_create (GstPushSrc * bs, GstBuffer ** buf)
   s->last_frame_no = next_frame_no;
   GST_OBJECT_UNLOCK (s);
 
-  image = gst_xcbimage_src_xcbimage_get (s);
+  image = gst_xcbimage_src_xcbimage_get (s, &ret);
   if (!image)
-    return GST_FLOW_ERROR;
+    return ret;
+
+  if (s->capture_pool) {
+    GstBuffer *scaled = gst_xcbimage_src_scale (s, image, &ret);
+
+    gst_buffer_unref (image);
+    if (!scaled)
+      return ret;
+    image = scaled;
+  }
 
   *buf = image;
   GST_BUFFER_DTS (*buf) = GST_CLOCK_TIME_NONE;
@@ -918,6 +1183,105 @@ gst_xcbimage_src_create (GstPushSrc * bs, GstBuffer ** buf)
   return GST_FLOW_OK;
 }
 
+/* Captures on the frame clock whether or not downstream has kept up,
+ * keeping only the newest frame for create() to collect */
+static gpointer
+gst_xcbimage_src_capture_loop (gpointer data)
+{
+  GstXcbImageSrc *s = data;
+
+  g_mutex_lock (&s->capture_lock);
+  while (!s->capture_stop) {
+    GstBuffer *image = NULL;
+    GstFlowReturn ret;
+
+    if (s->capture_flushing || s->capture_ret != GST_FLOW_OK) {
+      g_cond_wait (&s->capture_cond, &s->capture_lock);
+      continue;
+    }
+    g_mutex_unlock (&s->capture_lock);
+
+    ret = gst_xcbimage_src_capture (s, &image);
+
+    g_mutex_lock (&s->capture_lock);
+    if (ret == GST_FLOW_OK) {
+      if (s->captured) {
+        GST_DEBUG_OBJECT (s, "Dropping frame which downstream didn't take");
+        gst_buffer_unref (s->captured);
+      }
+      s->captured = image;
+      g_cond_broadcast (&s->capture_cond);
+    } else if (ret != GST_FLOW_FLUSHING) {
+      s->capture_ret = ret;
+      g_cond_broadcast (&s->capture_cond);
+    }
+  }
+  g_mutex_unlock (&s->capture_lock);
+
+  return NULL;
+}
+
+static void
+gst_xcbimage_src_stop_capture_thread (GstXcbImageSrc * src)
+{
+  GThread *thread;
+
+  g_mutex_lock (&src->capture_lock);
+  thread = src->capture_thread;
+  src->capture_thread = NULL;
+  src->capture_stop = TRUE;
+  g_cond_broadcast (&src->capture_cond);
+  g_mutex_unlock (&src->capture_lock);
+
+  if (thread) {
+    GST_OBJECT_LOCK (src);
+    if (src->clock_id)
+      gst_clock_id_unschedule (src->clock_id);
+    GST_OBJECT_UNLOCK (src);
+
+    g_thread_join (thread);
+  }
+
+  g_mutex_lock (&src->capture_lock);
+  if (src->captured) {
+    gst_buffer_unref (src->captured);
+    src->captured = NULL;
+  }
+  src->capture_stop = FALSE;
+  src->capture_ret = GST_FLOW_OK;
+  g_mutex_unlock (&src->capture_lock);
+}
+
+static GstFlowReturn
+gst_xcbimage_src_create (GstPushSrc * bs, GstBuffer ** buf)
+{
+  GstXcbImageSrc *s = GST_XCBIMAGE_SRC (bs);
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  if (!s->use_capture_thread)
+    return gst_xcbimage_src_capture (s, buf);
+
+  g_mutex_lock (&s->capture_lock);
+  if (!s->capture_thread)
+    s->capture_thread = g_thread_new ("xcbimagesrc-capture",
+        gst_xcbimage_src_capture_loop, s);
+
+  while (!s->captured && !s->capture_flushing && s->capture_ret == GST_FLOW_OK)
+    g_cond_wait (&s->capture_cond, &s->capture_lock);
+
+  if (s->capture_flushing) {
+    ret = GST_FLOW_FLUSHING;
+  } else if (s->captured) {
+    *buf = s->captured;
+    s->captured = NULL;
+  } else {
+    ret = s->capture_ret;
+  }
+  g_mutex_unlock (&s->capture_lock);
+
+  return ret;
+}
+
 static void
 gst_xcbimage_src_set_property (GObject * object, guint prop_id,
     const GValue * value, GParamSpec * pspec)
@@ -966,6 +1330,16 @@ gst_xcbimage_src_set_property (GObject * object, guint prop_id,
       g_free (src->xname);
       src->xname = g_strdup (g_value_get_string (value));
       break;
+    case PROP_USE_SHM:
+      if (src->xcontext != NULL) {
+        g_warning ("xcbimagesrc use-shm must be set before opening display");
+        break;
+      }
+      src->use_shm = g_value_get_boolean (value);
+      break;
+    case PROP_CAPTURE_THREAD:
+      src->use_capture_thread = g_value_get_boolean (value);
+      break;
     default:
       break;
   }
@@ -1012,36 +1386,21 @@ gst_xcbimage_src_get_property (GObject * object, guint prop_id,
     case PROP_XNAME:
       g_value_set_string (value, src->xname);
       break;
+    case PROP_USE_SHM:
+      if (src->xcontext)
+        g_value_set_boolean (value, src->xcontext->use_xshm);
+      else
+        g_value_set_boolean (value, src->use_shm);
+      break;
+    case PROP_CAPTURE_THREAD:
+      g_value_set_boolean (value, src->use_capture_thread);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
   }
 }
 
-static void
-gst_xcbimage_src_clear_bufpool (GstXcbImageSrc * xcbimagesrc)
-{
-  g_mutex_lock (&xcbimagesrc->pool_lock);
-  while (xcbimagesrc->buffer_pool != NULL) {
-    GstBuffer *xcbimage = xcbimagesrc->buffer_pool->data;
-
-    gst_xcbimage_buffer_free (xcbimage);
-
-    xcbimagesrc->buffer_pool = g_slist_delete_link (xcbimagesrc->buffer_pool,
-        xcbimagesrc->buffer_pool);
-  }
-  g_mutex_unlock (&xcbimagesrc->pool_lock);
-}
-
-static void
-gst_xcbimage_src_dispose (GObject * object)
-{
-  /* Drop references in the buffer_pool */
-  gst_xcbimage_src_clear_bufpool (GST_XCBIMAGE_SRC (object));
-
-  G_OBJECT_CLASS (parent_class)->dispose (object);
-}
-
 static void
 gst_xcbimage_src_finalize (GObject * object)
 {
@@ -1051,8 +1410,9 @@ gst_xcbimage_src_finalize (GObject * object)
     xcbimageutil_xcontext_clear (src->xcontext);
 
   g_free (src->xname);
-  g_mutex_clear (&src->pool_lock);
   g_mutex_clear (&src->x_lock);
+  g_mutex_clear (&src->capture_lock);
+  g_cond_clear (&src->capture_cond);
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
@@ -1065,6 +1425,7 @@ gst_xcbimage_src_get_caps (GstBaseSrc * bs, GstCaps * filter)
   gint width, height;
   GstVideoFormat format;
   guint32 alpha_mask;
+  GstCaps *caps;
 
   if ((!s->xcontext) && (!gst_xcbimage_src_open_display (s, s->display_name)))
     return gst_pad_get_pad_template_caps (GST_BASE_SRC (s)->srcpad);
@@ -1128,13 +1489,99 @@ gst_xcbimage_src_get_caps (GstBaseSrc * bs, GstCaps * filter)
       xcontext->endianness, xcontext->r_mask_output,
       xcontext->g_mask_output, xcontext->b_mask_output, alpha_mask);
 
-  return gst_caps_new_simple ("video/x-raw",
+  caps = gst_caps_new_simple ("video/x-raw",
       "format", G_TYPE_STRING, gst_video_format_to_string (format),
       "width", G_TYPE_INT, width,
       "height", G_TYPE_INT, height,
       "framerate", GST_TYPE_FRACTION_RANGE, 1, G_MAXINT, G_MAXINT, 1,
       "pixel-aspect-ratio", GST_TYPE_FRACTION, xcontext->par_n,
       xcontext->par_d, NULL);
+
+  /* We'd rather not, but we can scale down 32bpp captures */
+  if (xcontext->bpp == 32 && width > 1 && height > 1) {
+    GstStructure *scaled = gst_structure_copy (gst_caps_get_structure (caps,
+            0));
+
+    /* Not necessarily keeping the shape, so the PAR is worked out in
+       fixate once the size is known */
+    gst_structure_set (scaled, "width", GST_TYPE_INT_RANGE, 1, width,
+        "height", GST_TYPE_INT_RANGE, 1, height,
+        "pixel-aspect-ratio", GST_TYPE_FRACTION_RANGE, 1, G_MAXINT, G_MAXINT, 1,
+        NULL);
+    gst_caps_append_structure (caps, scaled);
+  }
+
+  return caps;
+}
+
+static void
+gst_xcbimage_src_clear_scaling (GstXcbImageSrc * s)
+{
+#ifdef HAVE_XDAMAGE
+  /* While scaling, the last frame is a full size one from the pool */
+  if (s->capture_pool && s->last_ximage) {
+    gst_buffer_unref (s->last_ximage);
+    s->last_ximage = NULL;
+  }
+#endif
+  if (s->capture_pool) {
+    gst_buffer_pool_set_active (s->capture_pool, FALSE);
+    gst_object_unref (s->capture_pool);
+    s->capture_pool = NULL;
+  }
+  g_free (s->scale_sums);
+  s->scale_sums = NULL;
+  g_free (s->scale_cols);
+  s->scale_cols = NULL;
+  s->out_width = s->out_height = 0;
+}
+
+static gboolean
+gst_xcbimage_src_setup_scaling (GstXcbImageSrc * s, GstCaps * caps,
+    gint width, gint height)
+{
+  GstStructure *config;
+  GstVideoInfo info;
+  GstCaps *full;
+  gint x;
+
+  if (s->xcontext->bpp != 32 || width > s->width || height > s->height) {
+    GST_WARNING_OBJECT (s, "Cannot scale %dx%d capture to %dx%d",
+        s->width, s->height, width, height);
+    return FALSE;
+  }
+
+  full = gst_caps_copy (caps);
+  gst_caps_set_simple (full, "width", G_TYPE_INT, s->width,
+      "height", G_TYPE_INT, s->height, NULL);
+  if (!gst_video_info_from_caps (&info, full)) {
+    gst_caps_unref (full);
+    return FALSE;
+  }
+
+  /* One being captured and, with XDamage, the last */
+  s->capture_pool = gst_xcbimage_buffer_pool_new (s);
+  config = gst_buffer_pool_get_config (s->capture_pool);
+  gst_buffer_pool_config_set_params (config, full, GST_VIDEO_INFO_SIZE (&info),
+      2, 0);
+  gst_caps_unref (full);
+  if (!gst_buffer_pool_set_config (s->capture_pool, config) ||
+      !gst_buffer_pool_set_active (s->capture_pool, TRUE)) {
+    GST_WARNING_OBJECT (s, "Failed to set up pool for full size captures");
+    gst_xcbimage_src_clear_scaling (s);
+    return FALSE;
+  }
+
+  s->out_width = width;
+  s->out_height = height;
+  s->scale_sums = g_new (guint32, s->width * 4);
+  s->scale_cols = g_new (gint, width + 1);
+  for (x = 0; x <= width; x++)
+    s->scale_cols[x] = (gint64) x * s->width / width;
+
+  GST_INFO_OBJECT (s, "Scaling %dx%d capture down to %dx%d",
+      s->width, s->height, width, height);
+  return TRUE;
 }
 
 static gboolean
@@ -1143,15 +1590,26 @@ gst_xcbimage_src_set_caps (GstBaseSrc * bs, GstCaps * caps)
   GstXcbImageSrc *s = GST_XCBIMAGE_SRC (bs);
   GstStructure *structure;
   const GValue *new_fps;
+  gint width, height;
 
   /* If not yet opened, disallow setcaps until later */
   if (!s->xcontext)
     return FALSE;
 
-  /* The only thing that can change is the framerate downstream wants */
+  /* Downstream gets to choose the framerate, and a smaller size */
   structure = gst_caps_get_structure (caps, 0);
   new_fps = gst_structure_get_value (structure, "framerate");
-  if (!new_fps)
+  if (!new_fps ||
+      !gst_structure_get_int (structure, "width", &width) ||
+      !gst_structure_get_int (structure, "height", &height))
+    return FALSE;
+
+  /* The capture thread uses the pools and last_ximage unlocked; create()
+   * starts it again once we're done */
+  gst_xcbimage_src_stop_capture_thread (s);
+  gst_xcbimage_src_clear_scaling (s);
+  if ((width != s->width || height != s->height) &&
+      !gst_xcbimage_src_setup_scaling (s, caps, width, height))
     return FALSE;
 
   /* Store this FPS for use when generating buffers */
@@ -1163,10 +1621,69 @@ gst_xcbimage_src_set_caps (GstBaseSrc * bs, GstCaps * caps)
   return TRUE;
 }
 
+/* Downstream can't give us XImages, so it always gets our pool, but it
+ * does get a say in how many buffers there are */
+static gboolean
+gst_xcbimage_src_decide_allocation (GstBaseSrc * bs, GstQuery * query)
+{
+  GstXcbImageSrc *s = GST_XCBIMAGE_SRC (bs);
+  GstBufferPool *pool;
+  GstStructure *config;
+  GstCaps *caps;
+  GstVideoInfo info;
+  guint size, min = 0, max = 0;
+
+  gst_query_parse_allocation (query, &caps, NULL);
+  if (caps == NULL || !gst_video_info_from_caps (&info, caps)) {
+    GST_WARNING_OBJECT (s, "No usable caps in allocation query");
+    return FALSE;
+  }
+
+  if (gst_query_get_n_allocation_pools (query) > 0)
+    gst_query_parse_nth_allocation_pool (query, 0, NULL, NULL, &min, &max);
+
+  /* One downstream, one being captured and, with XDamage, the last */
+  min = MAX (min, 3);
+  if (max && max < min)
+    max = min;
+  size = GST_VIDEO_INFO_SIZE (&info);
+
+  pool = gst_xcbimage_buffer_pool_new (s);
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, caps, size, min, max);
+  if (!gst_buffer_pool_set_config (pool, config)) {
+    GST_WARNING_OBJECT (s, "Failed to configure buffer pool");
+    gst_object_unref (pool);
+    return FALSE;
+  }
+
+  if (gst_query_get_n_allocation_pools (query) > 0)
+    gst_query_set_nth_allocation_pool (query, 0, pool, size, min, max);
+  else
+    gst_query_add_allocation_pool (query, pool, size, min, max);
+
+  /* basesrc activates it; any old one is only ours to drop, once the
+   * capture thread is no longer using it */
+  gst_xcbimage_src_stop_capture_thread (s);
+#ifdef HAVE_XDAMAGE
+  if (s->last_ximage)
+    gst_buffer_unref (s->last_ximage);
+  s->last_ximage = NULL;
+#endif
+  if (s->pool) {
+    gst_buffer_pool_set_active (s->pool, FALSE);
+    gst_object_unref (s->pool);
+  }
+  s->pool = pool;
+
+  return TRUE;
+}
+
 static GstCaps *
 gst_xcbimage_src_fixate (GstBaseSrc * bsrc, GstCaps * caps)
 {
-  gint i;
+  GstXcbImageSrc *s = GST_XCBIMAGE_SRC (bsrc);
+  gint i, out_width, out_height;
   GstStructure *structure;
 
   caps = gst_caps_make_writable (caps);
@@ -1175,6 +1692,22 @@ gst_xcbimage_src_fixate (GstBaseSrc * bsrc, GstCaps * caps)
     structure = gst_caps_get_structure (caps, i);
 
     gst_structure_fixate_field_nearest_fraction (structure, "framerate", 25, 1);
+    /* Left to itself, scale as little as possible */
+    gst_structure_fixate_field_nearest_int (structure, "width", s->width);
+    gst_structure_fixate_field_nearest_int (structure, "height", s->height);
+
+    /* Keep the picture the shape it is on screen, whatever it's scaled to */
+    if (s->xcontext && gst_structure_has_field (structure, "pixel-aspect-ratio")
+        && gst_structure_get_int (structure, "width", &out_width)
+        && gst_structure_get_int (structure, "height", &out_height)
+        && out_width > 0 && out_height > 0 && s->width > 0 && s->height > 0) {
+      gint par_n, par_d;
+
+      if (gst_util_fraction_multiply (s->xcontext->par_n, s->xcontext->par_d,
+              s->width * out_height, s->height * out_width, &par_n, &par_d))
+        gst_structure_fixate_field_nearest_fraction (structure,
+            "pixel-aspect-ratio", par_n, par_d);
+    }
   }
   caps = GST_BASE_SRC_CLASS (parent_class)->fixate (bsrc, caps);
 
@@ -1191,7 +1724,6 @@ gst_xcbimage_src_class_init (GstXcbImageSrcClass * klass)
 
   gc->set_property = gst_xcbimage_src_set_property;
   gc->get_property = gst_xcbimage_src_get_property;
-  gc->dispose = gst_xcbimage_src_dispose;
   gc->finalize = gst_xcbimage_src_finalize;
 
   g_object_class_install_property (gc, PROP_DISPLAY_NAME,
@@ -1279,6 +1811,31 @@ gst_xcbimage_src_class_init (GstXcbImageSrcClass * klass)
       g_param_spec_string ("xname", "Window name",
           "Window name to capture from", NULL,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  /**
+   * GstXcbImageSrc:use-shm:
+   *
+   * Have the X server write frames straight into shared memory which
+   * the buffers wrap, rather than sending them over the socket. Falls
+   * back to XGetImage if the server can't share memory with us, such as
+   * when it's remote. Once the display is open, reads whether it's
+   * actually in use.
+   */
+  g_object_class_install_property (gc, PROP_USE_SHM,
+      g_param_spec_boolean ("use-shm", "Use MIT-SHM",
+          "Capture through shared memory (if MIT-SHM extension enabled)", TRUE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  /**
+   * GstXcbImageSrc:capture-thread:
+   *
+   * Capture from a thread of our own, exactly on the frame clock, so
+   * that time spent downstream doesn't delay the next capture. Frames
+   * which downstream hasn't taken by the time the next is ready are
+   * dropped. Takes effect when streaming starts.
+   */
+  g_object_class_install_property (gc, PROP_CAPTURE_THREAD,
+      g_param_spec_boolean ("capture-thread", "Capture thread",
+          "Capture from a dedicated thread on the frame clock", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
   gst_element_class_set_static_metadata (ec, "XcbImage video source",
       "Source/Video",
@@ -1294,6 +1851,8 @@ gst_xcbimage_src_class_init (GstXcbImageSrcClass * klass)
   bc->start = gst_xcbimage_src_start;
   bc->stop = gst_xcbimage_src_stop;
   bc->unlock = gst_xcbimage_src_unlock;
+  bc->unlock_stop = gst_xcbimage_src_unlock_stop;
+  bc->decide_allocation = gst_xcbimage_src_decide_allocation;
   push_class->create = gst_xcbimage_src_create;
 }
 
@@ -1303,8 +1862,9 @@ gst_xcbimage_src_init (GstXcbImageSrc * xcbimagesrc)
   gst_base_src_set_format (GST_BASE_SRC (xcbimagesrc), GST_FORMAT_TIME);
   gst_base_src_set_live (GST_BASE_SRC (xcbimagesrc), TRUE);
 
-  g_mutex_init (&xcbimagesrc->pool_lock);
   g_mutex_init (&xcbimagesrc->x_lock);
+  g_mutex_init (&xcbimagesrc->capture_lock);
+  g_cond_init (&xcbimagesrc->capture_cond);
   xcbimagesrc->show_pointer = TRUE;
   xcbimagesrc->use_damage = TRUE;
   xcbimagesrc->startx = 0;
@@ -1312,6 +1872,7 @@ gst_xcbimage_src_init (GstXcbImageSrc * xcbimagesrc)
   xcbimagesrc->endx = 0;
   xcbimagesrc->endy = 0;
   xcbimagesrc->remote = FALSE;
+  xcbimagesrc->use_shm = TRUE;
 }
 
 static gboolean
@@ -22,6 +22,7 @@
 #include <gst/gst.h>
 #include <gst/base/gstpushsrc.h>
 #include "xcbimageutil.h"
+#include "xcbimagepool.h"
 
 #ifdef HAVE_XFIXES
 #include <X11/extensions/Xfixes.h>
@@ -72,9 +73,26 @@ struct _GstXcbImageSrc
   /* Protect X Windows calls */
   GMutex  x_lock;
 
-  /* Gathered pool of emitted buffers */
-  GMutex  pool_lock;
-  GSList *buffer_pool;
+  /* Pool of images we push, set up by decide_allocation */
+  GstBufferPool *pool;
+
+  /* When downstream wants a smaller size than we capture, we capture
+   * into full size images from here and box filter them down */
+  GstBufferPool *capture_pool;
+  gint out_width;
+  gint out_height;
+  guint32 *scale_sums;          /* one row of per-channel column sums */
+  gint *scale_cols;             /* first source column of each output one */
+
+  /* Optional thread which captures on the frame clock by itself */
+  gboolean use_capture_thread;
+  GThread *capture_thread;
+  GMutex capture_lock;
+  GCond capture_cond;
+  GstBuffer *captured;          /* newest frame not yet pushed */
+  GstFlowReturn capture_ret;    /* why the thread stopped capturing */
+  gboolean capture_flushing;
+  gboolean capture_stop;
 
   /* XFixes and XDamage support */
   gboolean have_xfixes;
@@ -91,6 +109,9 @@ struct _GstXcbImageSrc
   /* whether to use remote friendly calls */
   gboolean remote;
 
+  /* whether to capture through MIT-SHM, if we can */
+  gboolean use_shm;
+
 #ifdef HAVE_XFIXES
   int fixes_event_base;
   XFixesCursorImage *cursor_image;
@@ -0,0 +1,149 @@
+/* GStreamer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "xcbimagepool.h"
+#include "gstxcbimagesrc.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_debug_xcbimage_pool);
+#define GST_CAT_DEFAULT gst_debug_xcbimage_pool
+
+#define gst_xcbimage_buffer_pool_parent_class parent_class
+G_DEFINE_TYPE_WITH_CODE (GstXcbImageBufferPool, gst_xcbimage_buffer_pool,
+    GST_TYPE_BUFFER_POOL,
+    GST_DEBUG_CATEGORY_INIT (gst_debug_xcbimage_pool, "xcbimagepool", 0,
+        "xcbimagesrc buffer pool"));
+
+static gboolean
+xcbimage_buffer_pool_set_config (GstBufferPool * pool, GstStructure * config)
+{
+  GstXcbImageBufferPool *xpool = GST_XCBIMAGE_BUFFER_POOL_CAST (pool);
+  GstCaps *caps;
+  GstVideoInfo info;
+
+  if (!gst_buffer_pool_config_get_params (config, &caps, NULL, NULL, NULL) ||
+      caps == NULL) {
+    GST_WARNING_OBJECT (pool, "no caps in config");
+    return FALSE;
+  }
+
+  if (!gst_video_info_from_caps (&info, caps)) {
+    GST_WARNING_OBJECT (pool, "failed getting geometry from caps %"
+        GST_PTR_FORMAT, caps);
+    return FALSE;
+  }
+
+  GST_LOG_OBJECT (pool, "%dx%d, caps %" GST_PTR_FORMAT, info.width,
+      info.height, caps);
+  xpool->info = info;
+
+  return GST_BUFFER_POOL_CLASS (parent_class)->set_config (pool, config);
+}
+
+static GstFlowReturn
+xcbimage_buffer_pool_alloc (GstBufferPool * pool, GstBuffer ** buffer,
+    GstBufferPoolAcquireParams * params)
+{
+  GstXcbImageBufferPool *xpool = GST_XCBIMAGE_BUFFER_POOL_CAST (pool);
+  GstXcbImageSrc *src = xpool->src;
+  GstMetaXcbImage *meta;
+  GstBuffer *xcbimage;
+
+  g_mutex_lock (&src->x_lock);
+  xcbimage = gst_xcbimageutil_xcbimage_new (src->xcontext, GST_ELEMENT (src),
+      GST_VIDEO_INFO_WIDTH (&xpool->info), GST_VIDEO_INFO_HEIGHT (&xpool->info),
+      NULL);
+  g_mutex_unlock (&src->x_lock);
+
+  if (xcbimage == NULL) {
+    GST_ELEMENT_ERROR (src, RESOURCE, WRITE, (NULL),
+        ("could not create a %dx%d xcbimage",
+            GST_VIDEO_INFO_WIDTH (&xpool->info),
+            GST_VIDEO_INFO_HEIGHT (&xpool->info)));
+    return GST_FLOW_ERROR;
+  }
+
+  /* The image goes round with the buffer */
+  meta = GST_META_XCBIMAGE_GET (xcbimage);
+  GST_META_FLAG_SET (meta, GST_META_FLAG_POOLED | GST_META_FLAG_LOCKED);
+
+  GST_LOG_OBJECT (pool, "created image %p", xcbimage);
+  *buffer = xcbimage;
+  return GST_FLOW_OK;
+}
+
+static void
+xcbimage_buffer_pool_free (GstBufferPool * pool, GstBuffer * buffer)
+{
+  GstXcbImageBufferPool *xpool = GST_XCBIMAGE_BUFFER_POOL_CAST (pool);
+  GstXcbImageSrc *src = xpool->src;
+
+  GST_LOG_OBJECT (pool, "destroying image %p", buffer);
+  g_mutex_lock (&src->x_lock);
+  gst_xcbimageutil_xcbimage_destroy (src->xcontext, buffer);
+  g_mutex_unlock (&src->x_lock);
+
+  GST_BUFFER_POOL_CLASS (parent_class)->free_buffer (pool, buffer);
+}
+
+static void
+gst_xcbimage_buffer_pool_finalize (GObject * object)
+{
+  GstXcbImageBufferPool *xpool = GST_XCBIMAGE_BUFFER_POOL_CAST (object);
+
+  gst_object_unref (xpool->src);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_xcbimage_buffer_pool_class_init (GstXcbImageBufferPoolClass * klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+  GstBufferPoolClass *gstbufferpool_class = (GstBufferPoolClass *) klass;
+
+  gobject_class->finalize = gst_xcbimage_buffer_pool_finalize;
+
+  gstbufferpool_class->set_config = xcbimage_buffer_pool_set_config;
+  gstbufferpool_class->alloc_buffer = xcbimage_buffer_pool_alloc;
+  gstbufferpool_class->free_buffer = xcbimage_buffer_pool_free;
+}
+
+static void
+gst_xcbimage_buffer_pool_init (GstXcbImageBufferPool * pool)
+{
+  gst_video_info_init (&pool->info);
+}
+
+GstBufferPool *
+gst_xcbimage_buffer_pool_new (GstXcbImageSrc * src)
+{
+  GstXcbImageBufferPool *pool;
+
+  g_return_val_if_fail (GST_IS_XCBIMAGE_SRC (src), NULL);
+
+  pool = g_object_new (GST_TYPE_XCBIMAGE_BUFFER_POOL, NULL);
+  pool->src = gst_object_ref (src);
+
+  GST_LOG_OBJECT (pool, "new xcbimage buffer pool %p", pool);
+
+  return GST_BUFFER_POOL_CAST (pool);
+}
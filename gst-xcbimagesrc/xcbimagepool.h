@@ -0,0 +1,62 @@
+/* GStreamer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_XCBIMAGEPOOL_H__
+#define __GST_XCBIMAGEPOOL_H__
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GstXcbImageBufferPool GstXcbImageBufferPool;
+typedef struct _GstXcbImageBufferPoolClass GstXcbImageBufferPoolClass;
+
+#define GST_TYPE_XCBIMAGE_BUFFER_POOL      (gst_xcbimage_buffer_pool_get_type())
+#define GST_IS_XCBIMAGE_BUFFER_POOL(obj)   (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_XCBIMAGE_BUFFER_POOL))
+#define GST_XCBIMAGE_BUFFER_POOL(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_XCBIMAGE_BUFFER_POOL, GstXcbImageBufferPool))
+#define GST_XCBIMAGE_BUFFER_POOL_CAST(obj) ((GstXcbImageBufferPool*)(obj))
+
+/**
+ * GstXcbImageBufferPool:
+ * @src: the source whose X context the images belong to
+ * @info: the video format which the images are made for
+ *
+ * A pool of buffers each wrapping an XImage, which xcbimagesrc captures
+ * straight into.
+ */
+struct _GstXcbImageBufferPool
+{
+  GstBufferPool bufferpool;
+
+  struct _GstXcbImageSrc *src;
+  GstVideoInfo info;
+};
+
+struct _GstXcbImageBufferPoolClass
+{
+  GstBufferPoolClass parent_class;
+};
+
+GType gst_xcbimage_buffer_pool_get_type (void);
+
+GstBufferPool *gst_xcbimage_buffer_pool_new (struct _GstXcbImageSrc * src);
+
+G_END_DECLS
+
+#endif /* __GST_XCBIMAGEPOOL_H__ */
@@ -86,6 +86,16 @@ get_xcb_connection (Display *dpy)
   return conn;
 }
 
+static void
+mask_shift_max (gulong mask, guint * shift, guint * max)
+{
+  *shift = 0;
+  if (mask)
+    while (!(mask & (1UL << *shift)))
+      (*shift)++;
+  *max = mask >> *shift;
+}
+
 /* This function gets the X Display and global info about it. Everything is
    stored in our object and will be cleaned when the object is disposed. Note
    here that caps for supported format are generated without any window or
@@ -109,6 +119,12 @@ xcbimageutil_xcontext_get (GstElement * parent, const gchar * display_name)
   xcontext->screen = xcb_setup_roots_iterator (xcb_get_setup (xcontext->conn)).data;
   // TODO
   xcontext->visual = DefaultVisualOfScreen (DefaultScreenOfDisplay (xcontext->disp));
+  mask_shift_max (xcontext->visual->red_mask, &xcontext->r_shift,
+      &xcontext->r_max);
+  mask_shift_max (xcontext->visual->green_mask, &xcontext->g_shift,
+      &xcontext->g_max);
+  mask_shift_max (xcontext->visual->blue_mask, &xcontext->b_shift,
+      &xcontext->b_max);
   xcontext->root = xcontext->screen->root;
   xcontext->white = xcontext->screen->white_pixel;
   xcontext->black = xcontext->screen->black_pixel;
@@ -282,6 +298,35 @@ gst_xcbimage_buffer_free (GstBuffer * xcbimage)
 }
 
 /* This function handles GstXcbImageSrcBuffer creation depending on XShm availability */
+#ifdef HAVE_XSHM
+static gboolean shm_error;
+
+static int
+shm_error_handler (Display * disp, XErrorEvent * ev)
+{
+  shm_error = TRUE;
+  return 0;
+}
+
+/* A remote server can't attach our segment, and only says so with an
+ * X error, which would otherwise be fatal. The caller holds the X lock. */
+static gboolean
+shm_attach (GstXContext * xcontext, XShmSegmentInfo * info)
+{
+  int (*handler) (Display *, XErrorEvent *);
+
+  XSync (xcontext->disp, FALSE);
+  shm_error = FALSE;
+  handler = XSetErrorHandler (shm_error_handler);
+  if (!XShmAttach (xcontext->disp, info))
+    shm_error = TRUE;
+  XSync (xcontext->disp, FALSE);
+  XSetErrorHandler (handler);
+
+  return !shm_error;
+}
+#endif /* HAVE_XSHM */
+
 GstBuffer *
 gst_xcbimageutil_xcbimage_new (GstXContext * xcontext,
     GstElement * parent, int width, int height, BufferReturnFunc return_func)
@@ -291,8 +336,11 @@ gst_xcbimageutil_xcbimage_new (GstXContext * xcontext,
   gboolean succeeded = FALSE;
 
   xcbimage = gst_buffer_new ();
-  GST_MINI_OBJECT_CAST (xcbimage)->dispose =
-      (GstMiniObjectDisposeFunction) gst_xcbimagesrc_buffer_dispose;
+  /* Without a return_func, the buffer belongs to a GstBufferPool, which
+   * needs the usual dispose to get it back */
+  if (return_func)
+    GST_MINI_OBJECT_CAST (xcbimage)->dispose =
+        (GstMiniObjectDisposeFunction) gst_xcbimagesrc_buffer_dispose;
 
   meta = GST_META_XCBIMAGE_ADD (xcbimage);
   meta->width = width;
@@ -332,10 +380,19 @@ gst_xcbimageutil_xcbimage_new (GstXContext * xcontext,
     meta->ximage->data = meta->SHMInfo.shmaddr;
     meta->SHMInfo.readOnly = FALSE;
 
-    if (XShmAttach (xcontext->disp, &meta->SHMInfo) == 0)
-      goto beach;
+    if (!shm_attach (xcontext, &meta->SHMInfo)) {
+      GST_WARNING_OBJECT (parent,
+          "X server could not attach shared memory, using XGetImage instead");
 
-    XSync (xcontext->disp, FALSE);
+      shmdt (meta->SHMInfo.shmaddr);
+      meta->SHMInfo.shmaddr = ((void *) -1);
+      meta->SHMInfo.shmid = -1;
+      XDestroyImage (meta->ximage);
+      meta->ximage = NULL;
+
+      xcontext->use_xshm = FALSE;
+      goto no_xshm;
+    }
   } else
   no_xshm:
 #endif /* HAVE_XSHM */
@@ -386,7 +443,9 @@ gst_xcbimageutil_xcbimage_destroy (GstXContext * xcontext, GstBuffer * xcbimage)
   g_return_if_fail (xcbimage != NULL);
 
 #ifdef HAVE_XSHM
-  if (xcontext->use_xshm) {
+  /* Going by the buffer itself, since use_xshm may have been turned
+   * off after it was made */
+  if (meta->SHMInfo.shmid != -1) {
     if (meta->SHMInfo.shmaddr != ((void *) -1)) {
       XShmDetach (xcontext->disp, &meta->SHMInfo);
       XSync (xcontext->disp, 0);
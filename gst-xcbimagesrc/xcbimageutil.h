@@ -99,6 +99,10 @@ struct _GstXContext {
    * and are in big endian */
   guint32 r_mask_output, g_mask_output, b_mask_output;
 
+  /* where each channel sits in a pixel of @visual, and its maximum */
+  guint r_shift, g_shift, b_shift;
+  guint r_max, g_max, b_max;
+
   guint par_n;                  /* calculated pixel aspect ratio numerator */
   guint par_d;                  /* calculated pixel aspect ratio denumerator */
 
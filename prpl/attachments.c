@@ -18,14 +18,29 @@
 #include <errno.h>
 #include <libgen.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
+#include <core.h>
 #include <debug.h>
 #include "chime.h"
 #include "chime-connection-private.h"
 
 // According to http://docs.aws.amazon.com/chime/latest/ug/chime-ug.pdf this is the maximum allowed size for attachments.
-// (The default limit for purple_util_fetch_url() is 512 kB.)
 #define ATTACHMENT_MAX_SIZE (50*1000*1000)
 
+/* Downloads from the same host which may be in flight at once */
+#define ATTACHMENT_MAX_DOWNLOADS 4
+
+/* Images are shown inline using the largest variant which fits in this */
+#define ATTACHMENT_INLINE_MAX 640
+
+/* Links to the originals of that many of them are remembered at most */
+#define ATTACHMENT_FULL_SIZE_MAX 200
+
+/* Uploads are read from disk this much at a time */
+#define UPLOAD_CHUNK_SIZE (256*1024)
+/* Times to try the PUT again if the connection fails or S3 has a problem */
+#define UPLOAD_MAX_RETRIES 3
+
 /*
  * Writes to the IM conversation handling the case where the user sent message
  * from other client.
@@ -51,10 +66,18 @@ static void write_conversation_message(const char *from, const char *im_email,
 	}
 }
 
-static void img_message(AttachmentContext *ctx, int image_id)
+static void img_message(AttachmentContext *ctx, int image_id, const gchar *full_uri)
 {
 	PurpleMessageFlags flags = PURPLE_MESSAGE_IMAGES;
-	gchar *msg = g_strdup_printf("<br><img id=\"%u\">", image_id);
+	gchar *msg;
+
+	if (full_uri) {
+		gchar *href = g_markup_escape_text(full_uri, -1);
+		msg = g_strdup_printf("<br><img id=\"%u\"><br><a href=\"%s\">%s</a>",
+				      image_id, href, _("Full size"));
+		g_free(href);
+	} else
+		msg = g_strdup_printf("<br><img id=\"%u\">", image_id);
 	if (ctx->chat_id != -1) {
 		serv_got_chat_in(ctx->conn, ctx->chat_id, ctx->from, flags, msg, ctx->when);
 	} else {
@@ -73,7 +96,8 @@ static void sys_message(AttachmentContext *ctx, const gchar *msg, PurpleMessageF
 	}
 }
 
-static void insert_image_from_file(AttachmentContext *ctx, const gchar *path)
+static void insert_image_from_file(AttachmentContext *ctx, const gchar *path,
+				   const gchar *full_uri)
 {
 	gchar *contents;
 	gsize size;
@@ -93,67 +117,465 @@ static void insert_image_from_file(AttachmentContext *ctx, const gchar *path)
 		g_free(msg);
 		return;
 	}
-	img_message(ctx, img_id);
+	img_message(ctx, img_id, full_uri);
 }
 
+/*
+ * Downloads are streamed to a ".part" file next to the final one, which is
+ * renamed into place when complete. If we're disconnected part way through,
+ * the partial file is kept and the next attempt asks only for the rest.
+ */
 typedef struct _DownloadCallbackData {
+	struct purple_chime *pc; /* NULL once the connection is closing */
 	ChimeAttachment *att;
 	AttachmentContext *ctx;
-	gchar *path;
+	gchar *from, *im_email;
+	gchar *path, *part_path;
+	SoupMessage *msg;
+	FILE *file;
+	gboolean full_size; /* The original of an image shown from a variant */
+	goffset offset, received, total;
+	guint last_percent;
+	gchar *error;
 } DownloadCallbackData;
 
+static void free_attachment(ChimeAttachment *att)
+{
+	g_free(att->message_id);
+	g_free(att->filename);
+	g_free(att->url);
+	g_free(att->content_type);
+	g_free(att->original_url);
+	g_free(att->created_on);
+	g_free(att);
+}
+
 static void deep_free_download_data(DownloadCallbackData *data)
 {
-	g_free(data->att->message_id);
-	g_free(data->att->filename);
-	g_free(data->att->url);
-	g_free(data->att->content_type);
-	g_free(data->att);
+	if (data->file)
+		fclose(data->file);
+	free_attachment(data->att);
+	if (data->ctx->obj)
+		g_object_unref(data->ctx->obj);
 	g_free(data->ctx);
+	g_free(data->from);
+	g_free(data->im_email);
 	g_free(data->path);
+	g_free(data->part_path);
+	g_free(data->error);
 	g_free(data);
 }
 
-static void download_callback(PurpleUtilFetchUrlData *url_data, gpointer user_data, const gchar *url_text, gsize len, const gchar *error_message)
+static void fetch_attachment(struct purple_chime *pc, ChimeAttachment *att,
+			     AttachmentContext *ctx, gboolean full_size);
+
+static gchar *attachment_path(struct purple_chime *pc, ChimeAttachment *att, gboolean variant)
+{
+	/* Both are keyed by MessageId, so replayed history finds them again */
+	return g_strdup_printf("%s/chime/%s/%s/%s-%s", purple_user_dir(),
+			       chime_connection_get_email(pc->cxn),
+			       variant ? "thumbnails" : "downloads",
+			       att->message_id, att->filename);
+}
+
+/*
+ * The presigned URL of the original expires within the hour, and most
+ * originals are never looked at, so they aren't fetched up front. Unless
+ * it's already in the downloads directory, the link names the message
+ * instead. Following it asks the server for the message again, with a
+ * fresh URL, and the original is downloaded from that. Our chime:// links
+ * reach us through chime-auth.py and purple's "uri-handler" signal.
+ */
+struct full_size_req {
+	ChimeObject *obj;
+	gchar *msg_id, *created_on, *filename;
+	AttachmentContext ctx;
+	gchar *from, *im_email;
+	GCancellable *cancel; /* Set while the message is being fetched */
+	GList *order;	/* In pc->full_size_order */
+};
+
+static void free_full_size_req(gpointer _req)
+{
+	struct full_size_req *req = _req;
+
+	if (req->cancel) {
+		g_cancellable_cancel(req->cancel);
+		g_object_unref(req->cancel);
+	}
+	g_object_unref(req->obj);
+	g_free(req->msg_id);
+	g_free(req->created_on);
+	g_free(req->filename);
+	g_free(req->from);
+	g_free(req->im_email);
+	g_free(req);
+}
+
+/* Once the original is downloaded, or it is long forgotten. Either way,
+ * the room or conversation needn't be kept for it any more. */
+static void drop_full_size_req(struct purple_chime *pc, struct full_size_req *req)
+{
+	g_queue_delete_link(&pc->full_size_order, req->order);
+	g_hash_table_remove(pc->full_size, req->msg_id);
+}
+
+static gchar *full_size_uri(struct purple_chime *pc, DownloadCallbackData *data)
+{
+	AttachmentContext *ctx = data->ctx;
+	ChimeAttachment *att = data->att;
+
+	if (!ctx->obj || !att->created_on)
+		return NULL;
+
+	struct full_size_req *req = g_hash_table_lookup(pc->full_size, att->message_id);
+	if (req) {
+		g_queue_unlink(&pc->full_size_order, req->order);
+		g_queue_push_tail_link(&pc->full_size_order, req->order);
+	} else {
+		if (pc->full_size_order.length >= ATTACHMENT_FULL_SIZE_MAX)
+			drop_full_size_req(pc, g_queue_peek_head(&pc->full_size_order));
+
+		req = g_new0(struct full_size_req, 1);
+
+		req->obj = g_object_ref(ctx->obj);
+		req->msg_id = g_strdup(att->message_id);
+		req->created_on = g_strdup(att->created_on);
+		req->filename = g_strdup(att->filename);
+		req->ctx = *ctx;
+		req->ctx.from = req->from = g_strdup(ctx->from);
+		req->ctx.im_email = req->im_email = g_strdup(ctx->im_email);
+		req->ctx.obj = NULL;
+		g_hash_table_insert(pc->full_size, req->msg_id, req);
+		g_queue_push_tail(&pc->full_size_order, req);
+		req->order = pc->full_size_order.tail;
+	}
+
+	gchar *query = soup_form_encode("account", chime_connection_get_email(pc->cxn),
+					"message", att->message_id, NULL);
+	gchar *uri = g_strdup_printf("chime://attachment?%s", query);
+	g_free(query);
+	return uri;
+}
+
+static void full_size_link(DownloadCallbackData *data)
+{
+	struct purple_chime *pc = purple_connection_get_protocol_data(data->ctx->conn);
+	gchar *full_path = attachment_path(pc, data->att, FALSE);
+	gchar *uri;
+
+	if (g_file_test(full_path, G_FILE_TEST_IS_REGULAR))
+		uri = g_strdup_printf("file://%s", full_path);
+	else
+		uri = full_size_uri(pc, data);
+
+	insert_image_from_file(data->ctx, data->path, uri);
+	g_free(uri);
+	g_free(full_path);
+}
+
+static void full_size_msg_cb(GObject *source, GAsyncResult *result, gpointer _req)
+{
+	ChimeConnection *cxn = CHIME_CONNECTION(source);
+	GError *error = NULL;
+	JsonNode *node = chime_connection_fetch_message_finish(cxn, result, &error);
+
+	/* The request has gone with the connection */
+	if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+		g_error_free(error);
+		return;
+	}
+
+	struct full_size_req *req = _req;
+	struct purple_chime *pc = purple_connection_get_protocol_data(req->ctx.conn);
+	ChimeAttachment *att = node ? extract_attachment(node) : NULL;
+
+	g_clear_object(&req->cancel);
+
+	if (att && att->original_url) {
+		/* It's the original we want this time, not a variant */
+		g_free(att->url);
+		att->url = att->original_url;
+		att->original_url = NULL;
+
+		AttachmentContext *ctx = g_memdup(&req->ctx, sizeof(req->ctx));
+		ctx->obj = g_object_ref(req->obj);
+		fetch_attachment(pc, att, ctx, TRUE);
+	} else {
+		gchar *msg = g_strdup_printf(_("Could not fetch %s: %s"), req->filename,
+					     error ? error->message : _("No full size image"));
+		sys_message(&req->ctx, msg, PURPLE_MESSAGE_ERROR);
+		g_free(msg);
+		if (att)
+			free_attachment(att);
+	}
+
+	g_clear_error(&error);
+	if (node)
+		json_node_unref(node);
+}
+
+static gboolean full_size_uri_cb(const gchar *proto, const gchar *cmd,
+				 GHashTable *params, PurpleConnection *conn)
+{
+	struct purple_chime *pc = purple_connection_get_protocol_data(conn);
+	const gchar *account, *msg_id;
+
+	if (g_ascii_strcasecmp(proto, "chime") || !params)
+		return FALSE;
+
+	while (*cmd == '/')
+		cmd++;
+	if (strcmp(cmd, "attachment"))
+		return FALSE;
+
+	/* Every Chime account sees this; only answer for our own */
+	account = g_hash_table_lookup(params, "account");
+	msg_id = g_hash_table_lookup(params, "message");
+	if (!account || !msg_id || strcmp(account, chime_connection_get_email(pc->cxn)))
+		return FALSE;
+
+	struct full_size_req *req = g_hash_table_lookup(pc->full_size, msg_id);
+	if (!req)
+		return FALSE;
+
+	if (!req->cancel) {
+		req->cancel = g_cancellable_new();
+		chime_connection_fetch_message_async(pc->cxn, req->obj, req->msg_id,
+						     req->created_on, req->cancel,
+						     full_size_msg_cb, req);
+	}
+	return TRUE;
+}
+
+static void download_complete(DownloadCallbackData *data)
+{
+	gchar *href = g_markup_escape_text(data->path, -1);
+	gchar *name = g_markup_escape_text(data->att->filename, -1);
+	gchar *msg = NULL;
+
+	if (data->full_size) {
+		struct purple_chime *pc = purple_connection_get_protocol_data(data->ctx->conn);
+		struct full_size_req *req = g_hash_table_lookup(pc->full_size, data->att->message_id);
+
+		if (req)
+			drop_full_size_req(pc, req);
+		msg = g_strdup_printf(_("Full size: <a href=\"file://%s\">%s</a>"), href, name);
+	} else if (g_content_type_is_a(data->att->content_type, "image/*")) {
+		if (data->att->original_url)
+			full_size_link(data);
+		else
+			insert_image_from_file(data->ctx, data->path, NULL);
+	} else {
+		msg = g_strdup_printf(_("%s has attached <a href=\"file://%s\">%s</a>"), data->ctx->from, href, name);
+	}
+	if (msg)
+		sys_message(data->ctx, msg, PURPLE_MESSAGE_SYSTEM);
+	g_free(msg);
+	g_free(name);
+	g_free(href);
+}
+
+static void download_fail(DownloadCallbackData *data, gchar *error)
+{
+	g_free(data->error);
+	data->error = error;
+	soup_session_cancel_message(data->pc->dl_session, data->msg, SOUP_STATUS_IO_ERROR);
+}
+
+static void download_got_headers(SoupMessage *msg, gpointer user_data)
 {
 	DownloadCallbackData *data = user_data;
 
-	if (error_message != NULL) {
-		sys_message(data->ctx, error_message, PURPLE_MESSAGE_ERROR);
-		deep_free_download_data(data);
+	if (msg->status_code == SOUP_STATUS_PARTIAL_CONTENT && data->offset) {
+		data->file = fopen(data->part_path, "ab");
+	} else if (SOUP_STATUS_IS_SUCCESSFUL(msg->status_code)) {
+		/* The server ignored the Range, so start again */
+		data->offset = 0;
+		data->file = fopen(data->part_path, "wb");
+	} else
+		return;
+
+	if (!data->file) {
+		download_fail(data, g_strdup_printf(_("Could not write %s: %s"),
+						    data->part_path, g_strerror(errno)));
 		return;
 	}
 
-	if (len <= 0 || url_text == NULL ){
-		sys_message(data->ctx, _("Downloaded empty contents."), PURPLE_MESSAGE_ERROR);
-		deep_free_download_data(data);
+	goffset len = soup_message_headers_get_content_length(msg->response_headers);
+	data->total = len ? data->offset + len : 0;
+	if (data->total > ATTACHMENT_MAX_SIZE)
+		download_fail(data, g_strdup(_("Attachment is too large to download.")));
+}
+
+static void download_got_chunk(SoupMessage *msg, SoupBuffer *chunk, gpointer user_data)
+{
+	DownloadCallbackData *data = user_data;
+
+	if (!data->file || !data->pc)
+		return;
+
+	if (fwrite(chunk->data, chunk->length, 1, data->file) != 1) {
+		download_fail(data, g_strdup_printf(_("Could not write %s: %s"),
+						    data->part_path, g_strerror(errno)));
+		return;
+	}
+	data->received += chunk->length;
+	if (data->offset + data->received > ATTACHMENT_MAX_SIZE) {
+		download_fail(data, g_strdup(_("Attachment is too large to download.")));
 		return;
 	}
 
-	GError *err = NULL;
-	if (!g_file_set_contents(data->path, url_text, len, &err)) {
-		sys_message(data->ctx, err->message, PURPLE_MESSAGE_ERROR);
-		g_error_free(err);
+	if (data->total) {
+		guint percent = (data->offset + data->received) * 100 / data->total;
+		if (percent / 10 != data->last_percent / 10)
+			purple_debug_misc("chime", "Downloading %s: %u%%\n", data->att->filename, percent);
+		data->last_percent = percent;
+	}
+}
+
+/* We asked for the range after a .part which turns out to hold it all */
+static gboolean part_is_complete(DownloadCallbackData *data, SoupMessage *msg)
+{
+	goffset start, end, total;
+
+	return msg->status_code == SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE &&
+		data->offset &&
+		soup_message_headers_get_content_range(msg->response_headers,
+						       &start, &end, &total) &&
+		total == data->offset;
+}
+
+static void download_callback(SoupSession *session, SoupMessage *msg, gpointer user_data)
+{
+	DownloadCallbackData *data = user_data;
+	gboolean ok = SOUP_STATUS_IS_SUCCESSFUL(msg->status_code) && data->file;
+
+	if (data->pc)
+		g_hash_table_remove(data->pc->downloads, data->path);
+
+	if (data->file) {
+		if (fclose(data->file) && ok) {
+			ok = FALSE;
+			data->error = g_strdup_printf(_("Could not write %s: %s"),
+						      data->part_path, g_strerror(errno));
+		}
+		data->file = NULL;
+	}
+
+	/* Closing: keep what we have, to resume from next time */
+	if (!data->pc) {
 		deep_free_download_data(data);
 		return;
 	}
 
-	if (g_content_type_is_a(data->att->content_type, "image/*")) {
-		insert_image_from_file(data->ctx, data->path);
+	if (!data->error && part_is_complete(data, msg))
+		ok = TRUE;
+	if (ok && !data->offset && !data->received) {
+		ok = FALSE;
+		data->error = g_strdup(_("Downloaded empty contents."));
+	}
+	if (ok && g_rename(data->part_path, data->path)) {
+		ok = FALSE;
+		data->error = g_strdup_printf(_("Could not rename %s: %s"),
+					      data->part_path, g_strerror(errno));
+	}
+
+	if (ok) {
+		download_complete(data);
 	} else {
-		gchar *msg = g_strdup_printf(_("%s has attached <a href=\"file://%s\">%s</a>"), data->ctx->from, data->path, data->att->filename);
-		sys_message(data->ctx, msg, PURPLE_MESSAGE_SYSTEM);
-		g_free(msg);
+		/* Only a dropped connection or a server having a bad
+		 * moment is worth resuming from */
+		if (data->error || !(SOUP_STATUS_IS_TRANSPORT_ERROR(msg->status_code) ||
+				     SOUP_STATUS_IS_SERVER_ERROR(msg->status_code)))
+			g_unlink(data->part_path);
+		sys_message(data->ctx, data->error ? : msg->reason_phrase, PURPLE_MESSAGE_ERROR);
 	}
 
 	deep_free_download_data(data);
 }
 
+static void cancel_download(gpointer _path, gpointer _data, gpointer _unused)
+{
+	DownloadCallbackData *data = _data;
+
+	data->pc = NULL;
+}
+
+void purple_chime_init_attachments(PurpleConnection *conn)
+{
+	struct purple_chime *pc = purple_connection_get_protocol_data(conn);
+
+	pc->full_size = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_full_size_req);
+
+	purple_signal_connect(purple_get_core(), "uri-handler", conn,
+			      PURPLE_CALLBACK(full_size_uri_cb), conn);
+}
+
+void purple_chime_destroy_attachments(PurpleConnection *conn)
+{
+	struct purple_chime *pc = purple_connection_get_protocol_data(conn);
+
+	purple_signal_disconnect(purple_get_core(), "uri-handler", conn,
+				 PURPLE_CALLBACK(full_size_uri_cb));
+	g_queue_clear(&pc->full_size_order);
+	g_clear_pointer(&pc->full_size, g_hash_table_destroy);
+
+	if (pc->downloads) {
+		g_hash_table_foreach(pc->downloads, cancel_download, NULL);
+		g_clear_pointer(&pc->downloads, g_hash_table_destroy);
+	}
+	if (pc->dl_session) {
+		soup_session_abort(pc->dl_session);
+		g_clear_object(&pc->dl_session);
+	}
+}
+
+/* Of the AttachmentVariants of an image, the largest which fits inline, or
+ * failing that the smallest. Those without dimensions count as fitting. */
+static JsonNode *pick_variant(JsonNode *record)
+{
+	JsonObject *robj = json_node_get_object(record);
+	JsonNode *node = json_object_get_member(robj, "AttachmentVariants");
+	JsonNode *best = NULL;
+	gint64 best_size = 0;
+	gboolean best_fits = FALSE;
+
+	if (!node || !JSON_NODE_HOLDS_ARRAY(node))
+		return NULL;
+
+	JsonArray *arr = json_node_get_array(node);
+	guint i, len = json_array_get_length(arr);
+	for (i = 0; i < len; i++) {
+		JsonNode *var = json_array_get_element(arr, i);
+		const gchar *url, *content_type;
+		gint64 width = 0, height = 0;
+
+		if (!parse_string(var, "Url", &url) ||
+		    !parse_string(var, "ContentType", &content_type) ||
+		    !g_content_type_is_a(content_type, "image/*"))
+			continue;
+
+		parse_int(var, "Width", &width);
+		parse_int(var, "Height", &height);
+
+		gint64 size = MAX(width, height);
+		gboolean fits = size <= ATTACHMENT_INLINE_MAX;
+		if (!best || (fits && !best_fits) ||
+		    (fits == best_fits && (fits ? size > best_size : size < best_size))) {
+			best = var;
+			best_size = size;
+			best_fits = fits;
+		}
+	}
+	return best;
+}
+
 ChimeAttachment *extract_attachment(JsonNode *record)
 {
 	JsonObject *robj;
-	JsonNode *node;
-	const gchar *msg_id, *filename, *url, *content_type;
+	JsonNode *node, *var = NULL;
+	const gchar *msg_id, *filename, *url, *content_type, *created_on = NULL;
 
 	g_return_val_if_fail(record != NULL, NULL);
 	robj = json_node_get_object(record);
@@ -166,33 +588,108 @@ ChimeAttachment *extract_attachment(JsonNode *record)
 	g_return_val_if_fail(parse_string(node, "FileName", &filename), NULL);
 	g_return_val_if_fail(parse_string(node, "Url", &url), NULL);
 	g_return_val_if_fail(parse_string(node, "ContentType", &content_type), NULL);
+	parse_string(record, "CreatedOn", &created_on);
+
+	if (g_content_type_is_a(content_type, "image/*"))
+		var = pick_variant(record);
 
 	ChimeAttachment *att = g_new0(ChimeAttachment, 1);
 	att->message_id = g_strdup(msg_id);
 	att->filename = g_strdup(filename);
-	att->url = g_strdup(url);
 	att->content_type = g_strdup(content_type);
+	att->created_on = g_strdup(created_on);
+	if (var) {
+		const gchar *var_url, *var_type;
+
+		parse_string(var, "Url", &var_url);
+		parse_string(var, "ContentType", &var_type);
+		att->url = g_strdup(var_url);
+		g_free(att->content_type);
+		att->content_type = g_strdup(var_type);
+		att->original_url = g_strdup(url);
+	} else
+		att->url = g_strdup(url);
 
 	return att;
 }
 
 void download_attachment(ChimeConnection *cxn, ChimeAttachment *att, AttachmentContext *ctx)
 {
-	const gchar *username = chime_connection_get_email(cxn);
-	gchar *dir = g_build_filename(purple_user_dir(), "chime", username, "downloads", NULL);
+	fetch_attachment(purple_connection_get_protocol_data(ctx->conn), att, ctx, FALSE);
+}
+
+static void fetch_attachment(struct purple_chime *pc, ChimeAttachment *att,
+			     AttachmentContext *ctx, gboolean full_size)
+{
+	DownloadCallbackData *data = g_new0(DownloadCallbackData, 1);
+	data->path = attachment_path(pc, att, att->original_url != NULL);
+	data->part_path = g_strdup_printf("%s.part", data->path);
+	data->full_size = full_size;
+	data->att = att;
+	data->ctx = ctx;
+	if (ctx->obj)
+		g_object_ref(ctx->obj);
+
+	gchar *dir = g_path_get_dirname(data->path);
 	if (g_mkdir_with_parents(dir, 0755) == -1) {
 		gchar *error_msg = g_strdup_printf(_("Could not make dir %s,will not fetch file/image (errno=%d, errstr=%s)"), dir, errno, g_strerror(errno));
 		sys_message(ctx, error_msg, PURPLE_MESSAGE_ERROR);
 		g_free(dir);
 		g_free(error_msg);
+		deep_free_download_data(data);
 		return;
 	}
-	DownloadCallbackData *data = g_new0(DownloadCallbackData, 1);
-	data->path = g_strdup_printf("%s/%s-%s", dir, att->message_id, att->filename);
 	g_free(dir);
-	data->att = att;
-	data->ctx = ctx;
-	purple_util_fetch_url_len(att->url, TRUE, NULL, FALSE, ATTACHMENT_MAX_SIZE, download_callback, data);
+
+	/* The context points into the message, which we'll outlive */
+	data->from = g_strdup(ctx->from);
+	data->im_email = g_strdup(ctx->im_email);
+	ctx->from = data->from;
+	ctx->im_email = data->im_email;
+
+	/* Seen before, perhaps as history which is being fetched again */
+	if (g_file_test(data->path, G_FILE_TEST_IS_REGULAR)) {
+		download_complete(data);
+		deep_free_download_data(data);
+		return;
+	}
+	/* Two downloads can't share the .part file */
+	if (pc->downloads && g_hash_table_contains(pc->downloads, data->path)) {
+		deep_free_download_data(data);
+		return;
+	}
+
+	data->msg = soup_message_new("GET", att->url);
+	if (!data->msg) {
+		sys_message(ctx, _("Invalid attachment URL"), PURPLE_MESSAGE_ERROR);
+		deep_free_download_data(data);
+		return;
+	}
+
+	GStatBuf st;
+	if (!g_stat(data->part_path, &st) && st.st_size > 0) {
+		data->offset = st.st_size;
+		soup_message_headers_set_range(data->msg->request_headers, data->offset, -1);
+		purple_debug_info("chime", "Resuming download of %s from %" G_GINT64_FORMAT "\n",
+				  att->filename, (gint64)data->offset);
+	}
+
+	/* Write each chunk out as it arrives, rather than keeping it all */
+	soup_message_body_set_accumulate(data->msg->response_body, FALSE);
+	g_signal_connect(data->msg, "got-headers", G_CALLBACK(download_got_headers), data);
+	g_signal_connect(data->msg, "got-chunk", G_CALLBACK(download_got_chunk), data);
+
+	if (!pc->dl_session) {
+		pc->dl_session = soup_session_new_with_options(SOUP_SESSION_USER_AGENT,
+							       "Pidgin-Chime " PACKAGE_VERSION " ",
+							       SOUP_SESSION_MAX_CONNS_PER_HOST,
+							       ATTACHMENT_MAX_DOWNLOADS,
+							       NULL);
+		pc->downloads = g_hash_table_new(g_str_hash, g_str_equal);
+	}
+	data->pc = pc;
+	g_hash_table_insert(pc->downloads, data->path, data);
+	soup_session_queue_message(pc->dl_session, data->msg, download_callback, data);
 }
 
 /*
@@ -222,6 +719,10 @@ void download_attachment(ChimeConnection *cxn, ChimeAttachment *att, AttachmentC
  * The interaction with S3 is transparent. All the necessary parameters
  * are embedded on the url returned by the Chime Server. All we need to
  * do is to make a PUT request to that url.
+ *
+ * It's a single presigned PUT, so there's no multipart upload to resume
+ * by part. The body is read from the file a chunk at a time as it's being
+ * sent, and if the PUT fails it's simply tried again from the start.
  */
 
 typedef struct _AttachmentUpload {
@@ -231,9 +732,11 @@ typedef struct _AttachmentUpload {
 	SoupSession *soup_session;
 	SoupMessage *soup_message;
 
-	gchar *content;
+	FILE *file;
 	gsize content_length;
+	gsize content_queued; /* Read from the file into the current PUT */
 	gchar *content_type;
+	guint retries;
 
 	gchar *upload_id;
 	gchar *upload_url;
@@ -250,8 +753,10 @@ static void deep_free_upload_data(PurpleXfer *xfer)
 	}
 
 	g_clear_object(&data->obj);
+	g_clear_object(&data->soup_session);
 
-	g_free(data->content);
+	if (data->file)
+		fclose(data->file);
 	g_free(data->content_type);
 	g_free(data->upload_id);
 	g_free(data->upload_url);
@@ -323,14 +828,25 @@ static void send_upload_confirmation(PurpleXfer *xfer, const gchar *etag)
 	g_object_unref(jb);
 }
 
+static void put_file(ChimeConnection *cxn, PurpleXfer *xfer);
+
+static gboolean should_retry_put(AttachmentUpload *data, SoupMessage *msg)
+{
+	if (msg->status_code == SOUP_STATUS_CANCELLED ||
+	    data->retries >= UPLOAD_MAX_RETRIES)
+		return FALSE;
+
+	return SOUP_STATUS_IS_TRANSPORT_ERROR(msg->status_code) ||
+		SOUP_STATUS_IS_SERVER_ERROR(msg->status_code);
+}
+
 static void put_file_callback(SoupSession *session, SoupMessage *msg, gpointer user_data)
 {
 	purple_debug_misc("chime", "Put file request finished\n");
 	PurpleXfer *xfer = (PurpleXfer*)user_data;
 	AttachmentUpload *data = (AttachmentUpload*)xfer->data;
 
-	// This is freed by libsoup
-	data->soup_session = NULL;
+	// The message is freed by libsoup
 	data->soup_message = NULL;
 
 	if (purple_xfer_is_canceled(xfer))
@@ -341,6 +857,14 @@ static void put_file_callback(SoupSession *session, SoupMessage *msg, gpointer u
 						   msg->status_code,
 						   msg->reason_phrase);
 		purple_debug_misc("chime", "%s\n", error_msg);
+		if (should_retry_put(data, msg)) {
+			data->retries++;
+			purple_debug_info("chime", "Retrying upload (%u/%u)\n",
+					  data->retries, UPLOAD_MAX_RETRIES);
+			g_free(error_msg);
+			put_file(data->conn, xfer);
+			return;
+		}
 		purple_xfer_conversation_write(xfer, error_msg, TRUE);
 		g_free(error_msg);
 		deep_free_upload_data(xfer);
@@ -371,41 +895,95 @@ static void update_progress(SoupMessage *msg, SoupBuffer *chunk, gpointer user_d
 	purple_xfer_update_progress(xfer);
 }
 
+/* Give libsoup the next chunk of the file once it has written the last one,
+ * so only one chunk at a time is held in memory. */
+static void queue_next_chunk(SoupMessage *msg, gpointer user_data)
+{
+	PurpleXfer *xfer = (PurpleXfer*)user_data;
+	AttachmentUpload *data = (AttachmentUpload*)xfer->data;
+	gsize len = MIN(UPLOAD_CHUNK_SIZE, data->content_length - data->content_queued);
+
+	if (!len) {
+		soup_message_body_complete(msg->request_body);
+		return;
+	}
+
+	gchar *buf = g_malloc(len);
+	if (fread(buf, len, 1, data->file) != 1) {
+		purple_debug_error("chime", "Could not read file '%s' (errno=%d, errstr=%s)\n",
+				   xfer->local_filename, errno, g_strerror(errno));
+		g_free(buf);
+		soup_session_cancel_message(data->soup_session, msg, SOUP_STATUS_IO_ERROR);
+		return;
+	}
+	data->content_queued += len;
+	soup_message_body_append_take(msg->request_body, (guchar *)buf, len);
+}
+
+/* Each attempt starts again from the beginning */
+static void rewind_upload(PurpleXfer *xfer)
+{
+	AttachmentUpload *data = (AttachmentUpload*)xfer->data;
+
+	rewind(data->file);
+	data->content_queued = 0;
+	xfer->bytes_sent = 0;
+	xfer->bytes_remaining = data->content_length;
+}
+
+/* A redirect or auth retry resends the body, which we've already thrown
+ * away; queue it again from the start when the headers are written. */
+static void put_file_restarted(SoupMessage *msg, gpointer user_data)
+{
+	PurpleXfer *xfer = (PurpleXfer*)user_data;
+
+	soup_message_body_truncate(msg->request_body);
+	rewind_upload(xfer);
+}
+
 static void put_file(ChimeConnection *cxn, PurpleXfer *xfer)
 {
 	purple_debug_misc("chime", "Submitting put file request\n");
 
 	AttachmentUpload *data = (AttachmentUpload*)xfer->data;
-	gchar *content_length = g_strdup_printf("%lu", data->content_length);
+
+	rewind_upload(xfer);
 
 	SoupMessage *msg;
 	data->soup_message = msg = soup_message_new("PUT", data->upload_url);
 
-	soup_message_set_request(msg, data->content_type, SOUP_MEMORY_TEMPORARY,
-				 data->content, data->content_length);
+	/* S3 needs the length up front; the body follows a chunk at a time */
+	soup_message_headers_set_content_type(msg->request_headers, data->content_type, NULL);
+	soup_message_headers_set_content_length(msg->request_headers, data->content_length);
+	/* Without CAN_REBUILD, libsoup keeps every chunk of a client request
+	 * until it's finished, whether or not the body accumulates. */
+	soup_message_body_set_accumulate(msg->request_body, FALSE);
+	soup_message_set_flags(msg, SOUP_MESSAGE_CAN_REBUILD);
 	soup_message_headers_append(msg->request_headers, "Cache-Control", "no-cache");
 	soup_message_headers_append(msg->request_headers, "Pragma", "no-cache");
 	soup_message_headers_append(msg->request_headers, "Accept", "*/*");
-	soup_message_headers_append(msg->request_headers, "Content-length", content_length);
 
+	g_signal_connect(msg, "wrote-headers", (GCallback)queue_next_chunk, xfer);
+	g_signal_connect(msg, "wrote-chunk", (GCallback)queue_next_chunk, xfer);
 	g_signal_connect(msg, "wrote-body-data", (GCallback)update_progress, xfer);
-
-	data->soup_session = soup_session_new_with_options(SOUP_SESSION_ADD_FEATURE_BY_TYPE,
-							   SOUP_TYPE_CONTENT_SNIFFER,
-							   SOUP_SESSION_USER_AGENT,
-							   "Pidgin-Chime " PACKAGE_VERSION " ",
-							   NULL);
-
-	if (getenv("CHIME_DEBUG") && atoi(getenv("CHIME_DEBUG")) > 0) {
-		SoupLogger *l = soup_logger_new(SOUP_LOGGER_LOG_BODY, -1);
-		soup_session_add_feature(data->soup_session, SOUP_SESSION_FEATURE(l));
-		g_object_unref(l);
-		g_object_set(data->soup_session, "ssl-strict", FALSE, NULL);
+	g_signal_connect(msg, "restarted", (GCallback)put_file_restarted, xfer);
+
+	if (!data->soup_session) {
+		data->soup_session = soup_session_new_with_options(SOUP_SESSION_ADD_FEATURE_BY_TYPE,
+								   SOUP_TYPE_CONTENT_SNIFFER,
+								   SOUP_SESSION_USER_AGENT,
+								   "Pidgin-Chime " PACKAGE_VERSION " ",
+								   NULL);
+
+		if (getenv("CHIME_DEBUG") && atoi(getenv("CHIME_DEBUG")) > 0) {
+			SoupLogger *l = soup_logger_new(SOUP_LOGGER_LOG_HEADERS, -1);
+			soup_session_add_feature(data->soup_session, SOUP_SESSION_FEATURE(l));
+			g_object_unref(l);
+			g_object_set(data->soup_session, "ssl-strict", FALSE, NULL);
+		}
 	}
 
 	soup_session_queue_message(data->soup_session, msg, put_file_callback, xfer);
-
-	g_free(content_length);
 }
 
 static void request_upload_url_callback(ChimeConnection *cxn, SoupMessage *msg,
@@ -557,22 +1135,25 @@ static void chime_send_init(PurpleXfer *xfer)
 	g_return_if_fail(CHIME_IS_CONNECTION(pc->cxn));
 	ChimeConnectionPrivate *priv = CHIME_CONNECTION_GET_PRIVATE(pc->cxn);
 
-	char *file_contents;
-	gsize length;
-	GError *error = NULL;
-	if (!g_file_get_contents(xfer->local_filename, &file_contents, &length, &error)) {
-		purple_xfer_conversation_write(xfer, error->message, TRUE);
+	/* Only opened here; it's read as it's sent */
+	GStatBuf st;
+	FILE *file = g_stat(xfer->local_filename, &st) ? NULL : g_fopen(xfer->local_filename, "rb");
+	if (!file) {
+		int err = errno;
+		gchar *error_msg = g_strdup_printf(_("Could not read file '%s': %s"),
+						   xfer->local_filename, g_strerror(err));
+		purple_xfer_conversation_write(xfer, error_msg, TRUE);
 		purple_debug_error("chime", _("Could not read file '%s' (errno=%d, errstr=%s)\n"),
-				   xfer->local_filename, error->code, error->message);
-		g_clear_error(&error);
+				   xfer->local_filename, err, g_strerror(err));
+		g_free(error_msg);
 		g_object_unref(obj);
 		return;
 	}
 	AttachmentUpload *data = g_new0(AttachmentUpload, 1);
 	data->conn = pc->cxn;
 	data->obj = obj;
-	data->content = file_contents;
-	data->content_length = length;
+	data->file = file;
+	data->content_length = st.st_size;
 	get_mime_type(xfer->local_filename, &data->content_type);
 
 	xfer->data = data;
@@ -595,9 +1176,11 @@ static void chime_send_cancel(PurpleXfer *xfer)
 	purple_debug_info("chime", "chime_send_cancel\n");
 	AttachmentUpload *data = (AttachmentUpload*)xfer->data;
 	if (data && data->soup_session && data->soup_message) {
-		soup_session_cancel_message(data->soup_session, data->soup_message, SOUP_STATUS_CANCELLED);
-		data->soup_session = NULL;
+		SoupMessage *msg = data->soup_message;
+
+		/* The callback may run, and free data, from within this */
 		data->soup_message = NULL;
+		soup_session_cancel_message(data->soup_session, msg, SOUP_STATUS_CANCELLED);
 	}
 }
 
@@ -61,6 +61,7 @@ struct chime_chat {
 	ChimeMeeting *meeting;
 	ChimeCall *call;
 	void *participants_ui;
+	struct participant_rows *participant_rows;
 	PurpleMedia *media;
 	gboolean media_connected;
 
@@ -72,6 +73,8 @@ struct chime_chat {
 	void *share_select_ui;
 	PurpleMedia *share_media;
 	PurpleMedia *webcam_media;
+
+	struct mention_matcher *mentions;
 };
 
 /*
@@ -80,63 +83,211 @@ struct chime_chat {
  * <@all|All members> becomes All members
  * <@present|Present members> becomes Present members
  * <@75f50e24-d59d-40e4-996b-6ba3ff3f371f|Surname, Name> becomes Surname, Name
+ *
+ * The message has already been escaped, so these are "&lt;@id|Name&gt;".
  */
-#define MENTION_PATTERN "&lt;@([\\w\\-]+)\\|(.*?)&gt;"
-#define MENTION_REPLACEMENT "<b>\\2</b>"
+#define MENTION_START "&lt;@"
+#define MENTION_END "&gt;"
 
-/*
- * Returns whether `me` was mentioned in the Chime `message`, and allocates a
- * new string in `*parsed`.
- */
-static int parse_inbound_mentions(ChimeConnection *cxn, GRegex *mention_regex, const char *message, char **parsed)
+static gboolean id_is(const gchar *id, gsize len, const gchar *str)
 {
-	*parsed = g_regex_replace(mention_regex, message, -1, 0, MENTION_REPLACEMENT, 0, NULL);
-	return strstr(message, chime_connection_get_profile_id(cxn)) || strstr(message, "&lt;@all|") ||
-		strstr(message, "&lt;@present|");
+	return str && strlen(str) == len && !strncmp(id, str, len);
 }
 
-static void replace(gchar **dst, const gchar *pattern, const gchar *replacement)
+/*
+ * Rewrites the mentions in the (escaped) Chime `message` into `parsed`, in
+ * one pass which also returns whether `me`, or everyone, was mentioned.
+ */
+static gboolean parse_inbound_mentions(ChimeConnection *cxn, const char *message, GString *parsed)
 {
-	GRegex *regex = g_regex_new(pattern, 0, 0, NULL);
-	gchar* replaced = g_regex_replace_literal(regex, *dst, -1, 0, replacement, 0, NULL);
-	g_regex_unref(regex);
-	g_free(*dst);
-	*dst = replaced;
+	const gchar *me = chime_connection_get_profile_id(cxn);
+	const gchar *p = message, *copied = message;
+	gboolean mentioned = FALSE;
+
+	g_string_truncate(parsed, 0);
+
+	while ((p = strstr(p, MENTION_START))) {
+		const gchar *id = p + strlen(MENTION_START), *name;
+		const gchar *end;
+
+		for (name = id; g_ascii_isalnum(*name) || *name == '_' || *name == '-'; name++)
+			;
+		if (name == id || *name != '|') {
+			p = id;
+			continue;
+		}
+
+		gsize id_len = name - id;
+		if (id_is(id, id_len, me) || id_is(id, id_len, "all") || id_is(id, id_len, "present"))
+			mentioned = TRUE;
+
+		name++;
+		for (end = name; *end && *end != '\n' && strncmp(end, MENTION_END, strlen(MENTION_END)); end++)
+			;
+		if (*end != MENTION_END[0]) {
+			p = name;
+			continue;
+		}
+
+		g_string_append_len(parsed, copied, p - copied);
+		g_string_append(parsed, "<b>");
+		g_string_append_len(parsed, name, end - name);
+		g_string_append(parsed, "</b>");
+		p = copied = end + strlen(MENTION_END);
+	}
+	g_string_append(parsed, copied);
+
+	return mentioned;
 }
 
 /*
- * This will simple look for all chat members mentions and replace them with
- * the Chime format for mentioning. As a special case we expand "@all" and
- * "@present".
+ * Outbound mentions are found with a byte trie of the active members'
+ * display names, built on first use after the membership changes. Each
+ * message is then rewritten in a single pass, taking the longest name
+ * which starts at each position (subject to the same word boundaries
+ * as before). As a special case we expand "@all" and "@present".
  */
-static gchar *parse_outbound_mentions(ChimeRoom *room, const gchar *message)
+struct mention_node {
+	guint32 child;		/* First child, or 0 */
+	guint32 sibling;	/* Next sibling, or 0 */
+	gint32 mention;		/* Index into matcher->mentions, or -1 */
+	guchar c;
+};
+
+struct mention {
+	gchar *text;
+	gboolean word;		/* Must start and end at word boundaries */
+};
+
+struct mention_matcher {
+	GArray *nodes;		/* Node 0 is the root */
+	GArray *mentions;
+};
+
+#define MNODE(mm, i) (&g_array_index((mm)->nodes, struct mention_node, (i)))
+
+static guint32 matcher_child(struct mention_matcher *mm, guint32 parent, guchar c, gboolean create)
 {
-	GList *members = chime_room_get_members(room);
+	guint32 i;
 
-	gchar *parsed = g_strdup(message);
-	replace(&parsed, "@all", "<@all|All Members>");
-	replace(&parsed, "@present", "<@present|Present Members>");
-	while (members) {
-		ChimeRoomMember *member = members->data;
+	for (i = MNODE(mm, parent)->child; i; i = MNODE(mm, i)->sibling) {
+		if (MNODE(mm, i)->c == c)
+			return i;
+	}
+	if (!create)
+		return 0;
+
+	struct mention_node node = { 0, MNODE(mm, parent)->child, -1, c };
+	g_array_append_val(mm->nodes, node);
+	i = mm->nodes->len - 1;
+	MNODE(mm, parent)->child = i;
+	return i;
+}
+
+static void matcher_add(struct mention_matcher *mm, const gchar *name, gchar *text, gboolean word)
+{
+	guint32 node = 0;
+
+	while (*name)
+		node = matcher_child(mm, node, *name++, TRUE);
+
+	/* The first member with a given name wins, as it always did */
+	if (!node || MNODE(mm, node)->mention >= 0) {
+		g_free(text);
+		return;
+	}
 
+	struct mention m = { text, word };
+	g_array_append_val(mm->mentions, m);
+	MNODE(mm, node)->mention = mm->mentions->len - 1;
+}
+
+static void free_mention_matcher(struct mention_matcher *mm)
+{
+	guint i;
+
+	for (i = 0; i < mm->mentions->len; i++)
+		g_free(g_array_index(mm->mentions, struct mention, i).text);
+	g_array_free(mm->mentions, TRUE);
+	g_array_free(mm->nodes, TRUE);
+	g_free(mm);
+}
+
+static struct mention_matcher *build_mention_matcher(ChimeRoom *room)
+{
+	struct mention_matcher *mm = g_new0(struct mention_matcher, 1);
+	struct mention_node root = { 0, 0, -1, 0 };
+	ChimeRoomMemberIter iter;
+	ChimeRoomMember *member;
+
+	mm->nodes = g_array_new(FALSE, FALSE, sizeof(struct mention_node));
+	mm->mentions = g_array_new(FALSE, FALSE, sizeof(struct mention));
+	g_array_append_val(mm->nodes, root);
+
+	matcher_add(mm, "@all", g_strdup("<@all|All Members>"), FALSE);
+	matcher_add(mm, "@present", g_strdup("<@present|Present Members>"), FALSE);
+
+	chime_room_member_iter_init(room, &iter);
+	while (chime_room_member_iter_next(&iter, &member)) {
 		if (member->active) {
 			const gchar *id = chime_contact_get_profile_id(member->contact);
 			const gchar *display_name = chime_contact_get_display_name(member->contact);
 
-			if (strstr(parsed, display_name)) {
-				gchar *display_name_escaped = g_regex_escape_string(display_name, -1);
-				gchar *search = g_strdup_printf("(?<!\\|)\\b%s\\b", display_name_escaped);
-				g_free(display_name_escaped);
-				gchar *chime_mention = g_strdup_printf("<@%s|%s>", id, display_name);
-				replace(&parsed, search, chime_mention);
-				g_free(search);
-				g_free(chime_mention);
+			if (display_name && display_name[0])
+				matcher_add(mm, display_name,
+					    g_strdup_printf("<@%s|%s>", id, display_name), TRUE);
+		}
+	}
+	return mm;
+}
+
+/* Approximately GRegex's \w, which is Unicode-aware: treat any non-ASCII
+ * byte as part of a word, so names like "José" still end at a boundary. */
+static gboolean is_word_char(gchar c)
+{
+	return g_ascii_isalnum(c) || c == '_' || (guchar)c >= 0x80;
+}
+
+static gchar *parse_outbound_mentions(struct mention_matcher *mm, const gchar *message)
+{
+	GString *parsed = g_string_sized_new(strlen(message));
+	const gchar *p = message, *copied = message;
+
+	while (*p) {
+		const struct mention *found = NULL;
+		const gchar *found_end = NULL;
+
+		/* Don't expand names within an existing <@id|Name> */
+		if (p == message || p[-1] != '|') {
+			gboolean start_ok = (p == message ? FALSE : is_word_char(p[-1])) != is_word_char(*p);
+			guint32 node = 0;
+			const gchar *q = p;
+
+			while (*q && (node = matcher_child(mm, node, *q, FALSE))) {
+				gint32 idx = MNODE(mm, node)->mention;
+
+				q++;
+				if (idx < 0)
+					continue;
+
+				const struct mention *m = &g_array_index(mm->mentions, struct mention, idx);
+				if (!m->word || (start_ok && is_word_char(q[-1]) != is_word_char(*q))) {
+					found = m;
+					found_end = q;
+				}
 			}
 		}
 
-		members = g_list_remove(members, member);
+		if (found) {
+			g_string_append_len(parsed, copied, p - copied);
+			g_string_append(parsed, found->text);
+			p = copied = found_end;
+		} else
+			p++;
 	}
-	return parsed;
+	g_string_append(parsed, copied);
+
+	return g_string_free(parsed, FALSE);
 }
 
 static void do_chat_deliver_msg(ChimeConnection *cxn, struct chime_msgs *msgs,
@@ -172,6 +323,7 @@ static void do_chat_deliver_msg(ChimeConnection *cxn, struct chime_msgs *msgs,
 		ctx->from = from;
 		ctx->im_email = "";
 		ctx->when = msg_time;
+		ctx->obj = chat->m.obj;
 		/* The attachment and context structs will be owned by the code doing the download and will be disposed of at the end. */
 		download_attachment(cxn, att, ctx);
 	}
@@ -183,27 +335,25 @@ static void do_chat_deliver_msg(ChimeConnection *cxn, struct chime_msgs *msgs,
 	if (parse_string(node, "Content", &content)) {
 		gchar *escaped = g_markup_escape_text(content, -1);
 
-		gchar *parsed = NULL;
+		const gchar *parsed = escaped;
 		if (CHIME_IS_ROOM(chat->m.obj)) {
-			if (parse_inbound_mentions(cxn, pc->mention_regex, escaped, &parsed)
+			if (parse_inbound_mentions(cxn, escaped, pc->mention_buf)
 					&& (msg_flags & PURPLE_MESSAGE_RECV)) {
 				// Presumably this will trigger a notification.
 				msg_flags |= PURPLE_MESSAGE_NICK;
 			}
-			g_free(escaped);
-		} else
-			parsed = escaped;
+			parsed = pc->mention_buf->str;
+		}
 
 		/* Process markdown */
+		gchar *processed = NULL;
 		if (g_str_has_prefix(parsed, "/md") && (parsed[3] == ' ' || parsed[3] == '\n')) {
-			gchar *processed;
-			if (!do_markdown(parsed + 4, &processed)) {
-				g_free(parsed);
+			if (!do_markdown(parsed + 4, &processed))
 				parsed = processed;
-			}
 		}
 		serv_got_chat_in(conn, id, from, msg_flags, parsed, msg_time);
-		g_free(parsed);
+		g_free(processed);
+		g_free(escaped);
 	}
 	/* If the conversation already had focus and unseen-count didn't change, fake
 	   a PURPLE_CONV_UPDATE_UNSEEN notification anyway, so that we see that it's
@@ -211,16 +361,161 @@ static void do_chat_deliver_msg(ChimeConnection *cxn, struct chime_msgs *msgs,
 	purple_conversation_update(chat->conv, PURPLE_CONV_UPDATE_UNSEEN);
 }
 
-static gint participant_sort(gconstpointer a, gconstpointer b)
+/*
+ * The participants window is kept as a sorted sequence of rendered rows,
+ * which the "participant-changed" deltas update in place. Only when one
+ * of the rows actually changes do we push them all to the UI again.
+ */
+#define PARTICIPANT_COLS 5
+
+struct participant_row {
+	ChimeCallParticipationStatus status;
+	GSequenceIter *iter;
+	gchar *cols[PARTICIPANT_COLS];
+};
+
+struct participant_rows {
+	GHashTable *by_id;	/* participant_id → struct participant_row */
+	GSequence *sorted;
+	gboolean dirty;
+};
+
+static gint participant_sort(gconstpointer a, gconstpointer b, gpointer unused)
 {
-	const ChimeCallParticipant *pa = a, *pb = b;
+	const struct participant_row *pa = a, *pb = b;
 
 	if (pa->status == pb->status)
-		return g_strcmp0(pa->full_name, pb->full_name);
+		return g_strcmp0(pa->cols[0], pb->cols[0]);
 	else
 		return pa->status - pb->status;
 }
 
+static void free_participant_row(gpointer _row)
+{
+	struct participant_row *row = _row;
+	int i;
+
+	for (i = 0; i < PARTICIPANT_COLS; i++)
+		g_free(row->cols[i]);
+	g_free(row);
+}
+
+static void free_participant_rows(struct participant_rows *rows)
+{
+	g_hash_table_destroy(rows->by_id);
+	g_sequence_free(rows->sorted);
+	g_free(rows);
+}
+
+static void render_participant(ChimeCallParticipant *p, gchar **cols)
+{
+	static gpointer klass;
+
+	if (!klass)
+		klass = g_type_class_ref(CHIME_TYPE_CALL_PARTICIPATION_STATUS);
+
+	cols[0] = g_strdup(p->full_name);
+	GEnumValue *val = g_enum_get_value(klass, p->status);
+	cols[1] = g_strdup(_(val->value_nick));
+
+	const gchar *screen_icon;
+	if (p->shared_screen == CHIME_SHARED_SCREEN_VIEWING)
+		screen_icon = "👁";
+	else if (p->shared_screen == CHIME_SHARED_SCREEN_PRESENTING)
+		screen_icon = "🗔";
+	else
+		screen_icon = "";
+	cols[2] = g_strdup(screen_icon);
+
+	const gchar *vol_icon;
+	if (p->status != CHIME_PARTICIPATION_PRESENT)
+		vol_icon = "";
+	else if (p->volume == -128)
+		vol_icon = "🔇";
+	else if (p->volume < -64)
+		vol_icon = "🔈";
+	else if (p->volume < -32)
+		vol_icon = "🔉";
+	else
+		vol_icon = "🔊";
+	cols[3] = g_strdup(vol_icon);
+
+	const gchar *video_or_phone_icon;
+	if (p->video_present == TRUE)
+		video_or_phone_icon = "🎥";
+	else if (p->pots == TRUE)
+		video_or_phone_icon = "📞";
+	else
+		video_or_phone_icon = "";
+	cols[4] = g_strdup(video_or_phone_icon);
+}
+
+static void update_participant_row(struct participant_rows *rows, ChimeCallParticipant *p,
+				   ChimeCallParticipantChange change)
+{
+	struct participant_row *row = g_hash_table_lookup(rows->by_id, p->participant_id);
+	gchar *cols[PARTICIPANT_COLS];
+	int i;
+
+	if (change == CHIME_PARTICIPANT_LEFT) {
+		if (row) {
+			g_hash_table_remove(rows->by_id, p->participant_id);
+			g_sequence_remove(row->iter);
+			rows->dirty = TRUE;
+		}
+		return;
+	}
+
+	render_participant(p, cols);
+
+	if (!row) {
+		row = g_new0(struct participant_row, 1);
+		row->status = p->status;
+		memcpy(row->cols, cols, sizeof(cols));
+		/* The row is owned by the sequence */
+		g_hash_table_insert(rows->by_id, g_strdup(p->participant_id), row);
+		row->iter = g_sequence_insert_sorted(rows->sorted, row, participant_sort, NULL);
+		rows->dirty = TRUE;
+		return;
+	}
+
+	gboolean changed = row->status != p->status;
+	for (i = 0; i < PARTICIPANT_COLS; i++) {
+		if (!changed && strcmp(row->cols[i], cols[i]))
+			changed = TRUE;
+	}
+	if (!changed) {
+		for (i = 0; i < PARTICIPANT_COLS; i++)
+			g_free(cols[i]);
+		return;
+	}
+
+	gboolean resort = row->status != p->status || strcmp(row->cols[0], cols[0]);
+	for (i = 0; i < PARTICIPANT_COLS; i++)
+		g_free(row->cols[i]);
+	memcpy(row->cols, cols, sizeof(cols));
+	row->status = p->status;
+	if (resort)
+		g_sequence_sort_changed(row->iter, participant_sort, NULL);
+	rows->dirty = TRUE;
+}
+
+static struct participant_rows *new_participant_rows(GHashTable *participants)
+{
+	struct participant_rows *rows = g_new0(struct participant_rows, 1);
+	GHashTableIter iter;
+	gpointer p;
+
+	rows->by_id = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	rows->sorted = g_sequence_new(free_participant_row);
+
+	g_hash_table_iter_init(&iter, participants);
+	while (g_hash_table_iter_next(&iter, NULL, &p))
+		update_participant_row(rows, p, CHIME_PARTICIPANT_JOINED);
+
+	return rows;
+}
+
 struct ccb {
 	ChimeContact *contact;
 	const gchar *name;
@@ -250,7 +545,7 @@ static void open_participant_im(PurpleConnection *conn, GList *row, gpointer _ch
 	}
 }
 
-static PurpleNotifySearchResults *generate_sr_participants(GHashTable *participants)
+static PurpleNotifySearchResults *generate_sr_participants(struct participant_rows *rows)
 {
 	PurpleNotifySearchResults *results = purple_notify_searchresults_new();
 	PurpleNotifySearchColumn *column;
@@ -268,58 +563,26 @@ static PurpleNotifySearchResults *generate_sr_participants(GHashTable *participa
 
 	purple_notify_searchresults_button_add(results, PURPLE_NOTIFY_BUTTON_IM, open_participant_im);
 
-	gpointer klass = g_type_class_ref(CHIME_TYPE_CALL_PARTICIPATION_STATUS);
-
-	GList *pl = g_hash_table_get_values(participants);
-	pl = g_list_sort(pl, participant_sort);
-	while (pl) {
-		ChimeCallParticipant *p = pl->data;
+	/* The results own their rows, so they get copies */
+	GSequenceIter *iter;
+	for (iter = g_sequence_get_begin_iter(rows->sorted); !g_sequence_iter_is_end(iter);
+	     iter = g_sequence_iter_next(iter)) {
+		struct participant_row *prow = g_sequence_get(iter);
 		GList *row = NULL;
-		row = g_list_append(row, g_strdup(p->full_name));
-		GEnumValue *val = g_enum_get_value(klass, p->status);
-		row = g_list_append(row, g_strdup(_(val->value_nick)));
-
-		const gchar *screen_icon;
-		if (p->shared_screen == CHIME_SHARED_SCREEN_VIEWING)
-			screen_icon = "👁";
-		else if (p->shared_screen == CHIME_SHARED_SCREEN_PRESENTING)
-			screen_icon = "🗔";
-		else
-			screen_icon = "";
-		row = g_list_append(row, g_strdup(screen_icon));
-
-		const gchar *vol_icon;
-		if (p->status != CHIME_PARTICIPATION_PRESENT)
-			vol_icon = "";
-		else if (p->volume == -128)
-			vol_icon = "🔇";
-		else if (p->volume < -64)
-			vol_icon = "🔈";
-		else if (p->volume < -32)
-			vol_icon = "🔉";
-		else
-			vol_icon = "🔊";
-		row = g_list_append(row, g_strdup(vol_icon));
-
-		const gchar *video_or_phone_icon;
-		if (p->video_present == TRUE)
-			video_or_phone_icon = "🎥";
-		else if (p->pots == TRUE)
-			video_or_phone_icon = "📞";
-		else
-			video_or_phone_icon = "";
-		row = g_list_append(row, g_strdup(video_or_phone_icon));
+		int i;
 
+		for (i = PARTICIPANT_COLS - 1; i >= 0; i--)
+			row = g_list_prepend(row, g_strdup(prow->cols[i]));
 		purple_notify_searchresults_row_add(results, row);
-
-		pl = g_list_remove(pl, p);
 	}
-	g_type_class_unref(klass);
+	rows->dirty = FALSE;
 
 	return results;
-
 }
+
 static void on_call_participants(ChimeCall *call, GHashTable *participants, struct chime_chat *chat);
+static void on_call_participant(ChimeCall *call, ChimeCallParticipant *p,
+				ChimeCallParticipantChange change, struct chime_chat *chat);
 
 static void participants_closed_cb(gpointer _chat)
 {
@@ -327,6 +590,9 @@ static void participants_closed_cb(gpointer _chat)
 	chat->participants_ui = NULL;
 	g_signal_handlers_disconnect_matched(chat->call, G_SIGNAL_MATCH_FUNC|G_SIGNAL_MATCH_DATA,
 					     0, 0, NULL, G_CALLBACK(on_call_participants), chat);
+	g_signal_handlers_disconnect_matched(chat->call, G_SIGNAL_MATCH_FUNC|G_SIGNAL_MATCH_DATA,
+					     0, 0, NULL, G_CALLBACK(on_call_participant), chat);
+	g_clear_pointer(&chat->participant_rows, free_participant_rows);
 }
 
 static void call_stream_info(PurpleMedia *media, PurpleMediaInfoType type, gchar *id, const gchar *participant, gboolean local, struct chime_chat *chat)
@@ -469,11 +735,25 @@ static void on_audio_state(ChimeCall *call, ChimeAudioState audio_state,
 	}
 }
 
+static void on_call_participant(ChimeCall *call, ChimeCallParticipant *p,
+				ChimeCallParticipantChange change, struct chime_chat *chat)
+{
+	/* Until the window is open, it'll start from the full set */
+	if (chat->participant_rows)
+		update_participant_row(chat->participant_rows, p, change);
+}
+
 static void on_call_participants(ChimeCall *call, GHashTable *participants, struct chime_chat *chat)
 {
-	PurpleNotifySearchResults *results = generate_sr_participants(participants);
 	PurpleConnection *conn = chat->conv->account->gc;
 
+	if (!chat->participant_rows)
+		chat->participant_rows = new_participant_rows(participants);
+	else if (!chat->participant_rows->dirty && chat->participants_ui)
+		return;
+
+	PurpleNotifySearchResults *results = generate_sr_participants(chat->participant_rows);
+
 	if (!chat->participants_ui) {
 		chat->participants_ui = purple_notify_searchresults(conn, _("Call Participants"),
 								    chime_meeting_get_name(chat->meeting),
@@ -487,6 +767,9 @@ static void on_room_membership(ChimeRoom *room, ChimeRoomMember *member, struct
 {
 	const gchar *who = chime_contact_get_email(member->contact);
 
+	/* Rebuilt when next needed, rather than for each of a big room's members */
+	g_clear_pointer(&chat->mentions, free_mention_matcher);
+
 	if (!member->active) {
 		if (purple_conv_chat_find_user(PURPLE_CONV_CHAT(chat->conv), who))
 			purple_conv_chat_remove_user(PURPLE_CONV_CHAT(chat->conv), who, NULL);
@@ -856,6 +1139,8 @@ void chime_destroy_chat(struct chime_chat *chat)
 	}
 	g_hash_table_remove(pc->live_chats, GUINT_TO_POINTER(id));
 	g_hash_table_remove(pc->chats_by_room, chat->m.obj);
+	g_clear_pointer(&chat->mentions, free_mention_matcher);
+	g_clear_pointer(&chat->participant_rows, free_participant_rows);
 	cleanup_msgs(&chat->m);
 	/* chat == &chat->m, and it's freed by cleanup_msgs */
 	purple_debug(PURPLE_DEBUG_INFO, "chime", "Destroyed chat %p\n", chat);
@@ -894,14 +1179,18 @@ struct chime_chat *do_join_chat(PurpleConnection *conn, ChimeConnection *cxn, Ch
 
 	g_hash_table_insert(pc->live_chats, GUINT_TO_POINTER(chat_id), chat);
 	g_hash_table_insert(pc->chats_by_room, obj, chat);
-	init_msgs(conn, &chat->m, obj, do_chat_deliver_msg, name, first_msg);
-
-	g_signal_connect(obj, "notify::name", G_CALLBACK(on_chat_name), chat);
 
+	/* Before init_msgs(), so that the history is fetched as for an open room */
 	if (CHIME_IS_ROOM(obj)) {
 		g_signal_connect(obj, "membership", G_CALLBACK(on_room_membership), chat);
 		chime_connection_open_room(cxn, CHIME_ROOM(obj));
-	} else {
+	}
+
+	init_msgs(conn, &chat->m, obj, do_chat_deliver_msg, name, first_msg);
+
+	g_signal_connect(obj, "notify::name", G_CALLBACK(on_chat_name), chat);
+
+	if (!CHIME_IS_ROOM(obj)) {
 		g_signal_handlers_disconnect_matched(chat->m.obj, G_SIGNAL_MATCH_FUNC|G_SIGNAL_MATCH_DATA, 0, 0, NULL,
 						     G_CALLBACK(on_group_conv_msg), conn);
 
@@ -920,6 +1209,7 @@ struct chime_chat *do_join_chat(PurpleConnection *conn, ChimeConnection *cxn, Ch
 		if (chat->call) {
 			g_signal_connect(chat->call, "screen-state", G_CALLBACK(on_screen_state), chat);
 			g_signal_connect(chat->call, "audio-state", G_CALLBACK(on_audio_state), chat);
+			g_signal_connect(chat->call, "participant-changed", G_CALLBACK(on_call_participant), chat);
 			g_signal_connect(chat->call, "participants-changed", G_CALLBACK(on_call_participants), chat);
 			g_signal_connect(chat->call, "new-presenter", G_CALLBACK(on_call_presenter), chat);
 
@@ -1009,7 +1299,9 @@ int chime_purple_chat_send(PurpleConnection *conn, int id, const char *message,
 
 	if (CHIME_IS_ROOM(chat->m.obj)) {
 		/* Expand member names into the format Chime understands */
-		expanded = parse_outbound_mentions(CHIME_ROOM(chat->m.obj), unescaped);
+		if (!chat->mentions)
+			chat->mentions = build_mention_matcher(CHIME_ROOM(chat->m.obj));
+		expanded = parse_outbound_mentions(chat->mentions, unescaped);
 		g_free(unescaped);
 	} else
 		expanded = unescaped;
@@ -1027,7 +1319,7 @@ void purple_chime_init_chats(PurpleConnection *conn)
 	pc->live_chats = g_hash_table_new(g_direct_hash, g_direct_equal);
 	pc->chats_by_room = g_hash_table_new(g_direct_hash, g_direct_equal);
 
-	pc->mention_regex = g_regex_new(MENTION_PATTERN, G_REGEX_EXTENDED, 0, NULL);
+	pc->mention_buf = g_string_new(NULL);
 
 }
 
@@ -1041,7 +1333,10 @@ void purple_chime_destroy_chats(PurpleConnection *conn)
 	}
 	g_clear_pointer(&pc->live_chats, g_hash_table_unref);
 	g_clear_pointer(&pc->chats_by_room, g_hash_table_unref);
-	g_clear_pointer(&pc->mention_regex, g_regex_unref);
+	if (pc->mention_buf) {
+		g_string_free(pc->mention_buf, TRUE);
+		pc->mention_buf = NULL;
+	}
 }
 
 static void on_chime_room_mentioned(ChimeConnection *cxn, ChimeObject *obj, JsonNode *node, PurpleConnection *conn)
@@ -1055,26 +1350,23 @@ static void on_chime_room_mentioned(ChimeConnection *cxn, ChimeObject *obj, Json
 
 static void on_chime_new_room(ChimeConnection *cxn, ChimeRoom *room, PurpleConnection *conn)
 {
-	const gchar *last_mentioned;
-	GTimeVal mention_tv;
+	gint64 mention_us;
 
 	/* If no LastMentioned or we can't parse it, nothing to do */
-	last_mentioned = chime_room_get_last_mentioned(room);
-	if (!last_mentioned || !g_time_val_from_iso8601(last_mentioned, &mention_tv))
+	mention_us = chime_room_get_last_mentioned_time(room);
+	if (!mention_us)
 		return;
 
 	const gchar *msg_time;
-	GTimeVal msg_tv;
+	gint64 msg_us;
 
 	/* For a new installation which hasn't seen this room at all yet,
 	 * use the server's idea of LastRead instead of the local one. Otherwise
 	 * we end up spending hours fetching *all* old rooms and messages. */
 	if ( (chime_read_last_msg(conn, CHIME_OBJECT(room), &msg_time, NULL) &&
-	      g_time_val_from_iso8601(msg_time, &msg_tv)) ||
-	     ((msg_time = chime_room_get_last_read(room)) &&
-	      g_time_val_from_iso8601(msg_time, &msg_tv)) ) {
-		if (mention_tv.tv_sec < msg_tv.tv_sec ||
-		    (mention_tv.tv_sec == msg_tv.tv_sec && mention_tv.tv_usec <= msg_tv.tv_usec)) {
+	      chime_parse_time_us(msg_time, &msg_us)) ||
+	     (msg_us = chime_room_get_last_read_time(room)) ) {
+		if (mention_us <= msg_us) {
 			/* LastMentioned is older than we've already seen. Nothing to do. */
 			return;
 		}
@@ -1086,22 +1378,18 @@ static void on_chime_new_room(ChimeConnection *cxn, ChimeRoom *room, PurpleConne
 
 void on_chime_new_group_conv(ChimeConnection *cxn, ChimeConversation *conv, PurpleConnection *conn)
 {
-	const gchar *last_sent;
-	GTimeVal sent_tv;
+	gint64 sent_us;
 
 	/* If no LastMentioned or we can't parse it, nothing to do */
-	last_sent = chime_conversation_get_last_sent(conv);
-	if (!last_sent || !g_time_val_from_iso8601(last_sent, &sent_tv) ||
-	    (!sent_tv.tv_sec && !sent_tv.tv_usec))
+	sent_us = chime_conversation_get_last_sent_time(conv);
+	if (!sent_us)
 		return;
 
 	const gchar *seen_time;
-	GTimeVal seen_tv;
+	gint64 seen_us;
 
 	if (chime_read_last_msg(conn, CHIME_OBJECT(conv), &seen_time, NULL) &&
-	    g_time_val_from_iso8601(seen_time, &seen_tv) &&
-	    (sent_tv.tv_sec < seen_tv.tv_sec ||
-	     (sent_tv.tv_sec == seen_tv.tv_sec && sent_tv.tv_usec <= seen_tv.tv_usec))) {
+	    chime_parse_time_us(seen_time, &seen_us) && sent_us <= seen_us) {
 		/* LastSent is older than we've already seen. Nothing to do except
 		 * hook up the signal to open the "chat" when a message comes in */
 		g_signal_connect(conv, "message", G_CALLBACK(on_group_conv_msg), conn);
@@ -1193,7 +1481,12 @@ static void show_participants(PurpleBuddy *buddy, gpointer _chat)
 	if (chat->call) {
 		g_signal_handlers_disconnect_matched(chat->call, G_SIGNAL_MATCH_FUNC|G_SIGNAL_MATCH_DATA,
 						     0, 0, NULL, G_CALLBACK(on_call_participants), chat);
+		g_signal_handlers_disconnect_matched(chat->call, G_SIGNAL_MATCH_FUNC|G_SIGNAL_MATCH_DATA,
+						     0, 0, NULL, G_CALLBACK(on_call_participant), chat);
+		g_signal_connect(chat->call, "participant-changed", G_CALLBACK(on_call_participant), chat);
 		g_signal_connect(chat->call, "participants-changed", G_CALLBACK(on_call_participants), chat);
+		/* Start again from the full set */
+		g_clear_pointer(&chat->participant_rows, free_participant_rows);
 		chime_call_emit_participants(chat->call);
 	}
 }
@@ -23,6 +23,7 @@
 #include <status.h>
 #include <debug.h>
 #include <request.h>
+#include <util.h>
 
 #include <glib/gi18n.h>
 #include <glib/gstrfuncs.h>
@@ -158,6 +159,23 @@ static void on_chime_log_message(ChimeConnection *cxn, ChimeLogLevel lvl, const
 	purple_debug(purple_level_from_chime(lvl), "chime", "%s", str);
 }
 
+/* Don't even format the chatter nobody is going to look at. This is
+ * asked each time, because a debug window can be opened (or its level
+ * changed) at any point. purple_debug_is_enabled() only says whether
+ * it goes to the console. */
+static gboolean chime_log_wanted(ChimeLogLevel lvl, gpointer _unused)
+{
+	PurpleDebugUiOps *ops = purple_debug_get_ui_ops();
+
+	if (ops && ops->print &&
+	    (!ops->is_enabled || ops->is_enabled(purple_level_from_chime(lvl), "chime")))
+		return TRUE;
+
+	/* The console gets the per-frame chatter only if it's verbose */
+	return purple_debug_is_enabled() &&
+		(lvl > CHIME_LOGLVL_MISC || purple_debug_is_verbose());
+}
+
 static void on_session_token_changed(ChimeConnection *connection, GParamSpec *pspec, PurpleConnection *conn)
 {
 	purple_debug(PURPLE_DEBUG_INFO, "chime", "Session token changed\n");
@@ -233,10 +251,18 @@ static void chime_purple_login(PurpleAccount *account)
 	purple_chime_init_conversations(conn);
 	purple_chime_init_chats(conn);
 	purple_chime_init_messages(conn);
+	purple_chime_init_attachments(conn);
 
 	pc->cxn = chime_connection_new(purple_account_get_username(account),
 				       server, devtoken, token);
 
+	gchar *cache_dir = g_build_filename(purple_user_dir(), "chime",
+					    purple_account_get_username(account), NULL);
+	chime_connection_set_cache_dir(pc->cxn, cache_dir);
+	g_free(cache_dir);
+	chime_connection_set_message_store(pc->cxn,
+					   purple_account_get_bool(account, "message-store", FALSE));
+
 	g_signal_connect(pc->cxn, "notify::session-token",
 			 G_CALLBACK(on_session_token_changed), conn);
 	g_signal_connect(pc->cxn, "authenticate",
@@ -255,6 +281,9 @@ static void chime_purple_login(PurpleAccount *account)
 	   on close, and it doesn't use it anyway. */
 	g_signal_connect(pc->cxn, "log-message",
 			 G_CALLBACK(on_chime_log_message), NULL);
+	chime_connection_set_log_level(pc->cxn, CHIME_LOGLVL_MISC,
+				       !purple_debug_is_verbose());
+	chime_connection_set_log_filter(pc->cxn, chime_log_wanted, NULL);
 
 	chime_connection_connect(pc->cxn);
 }
@@ -266,6 +295,20 @@ static void disconnect_contact(ChimeConnection *cxn, ChimeContact *contact,
 					     0, 0, NULL, NULL, conn);
 }
 
+gchar *chime_get_metrics(PurpleAccount *account)
+{
+	PurpleConnection *conn = purple_account_get_connection(account);
+	struct purple_chime *pc = conn ? purple_connection_get_protocol_data(conn) : NULL;
+
+	if (!pc || !pc->cxn)
+		return g_strdup("{}");
+
+	JsonNode *node = chime_connection_get_metrics(pc->cxn);
+	gchar *str = json_to_string(node, FALSE);
+	json_node_unref(node);
+	return str;
+}
+
 static void chime_purple_close(PurpleConnection *conn)
 {
 	struct purple_chime *pc = purple_connection_get_protocol_data(conn);
@@ -279,6 +322,7 @@ static void chime_purple_close(PurpleConnection *conn)
 	purple_chime_destroy_messages(conn);
 	purple_chime_destroy_conversations(conn);
 	purple_chime_destroy_chats(conn);
+	purple_chime_destroy_attachments(conn);
 
 	chime_connection_disconnect(pc->cxn);
 	g_clear_object(&pc->cxn);
@@ -518,6 +562,10 @@ static void chime_purple_init_plugin(PurplePlugin *plugin)
 	opt = purple_account_option_string_new(_("Token"), "token", NULL);
 	opts = g_list_append(opts, opt);
 
+	opt = purple_account_option_bool_new(_("Keep local message history"),
+					     "message-store", FALSE);
+	opts = g_list_append(opts, opt);
+
 	chime_prpl_info.protocol_options = opts;
 
 #ifndef HAVE_CHAT_SEND_FILE
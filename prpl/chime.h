@@ -38,19 +38,29 @@ struct purple_chime {
 	GHashTable *ims_by_email;
 	GHashTable *ims_by_profile_id;
 
-	GRegex *mention_regex;
+	GString *mention_buf;		/* Reused for each inbound chat message */
 	GHashTable *chats_by_room;
 	GHashTable *live_chats;
 	int chat_id;
 
 	void *convlist_handle;
 	guint convlist_refresh_id;
+	GHashTable *convlist_rows;
 
 	void *joinable_handle;
 	guint joinable_refresh_id;
+	GHashTable *joinable_rows;
+	GQueue joinable_order;
 
 	/* Allow pin_join to abort a 'joinable meetings' popup */
 	GSList *pin_joins;
+
+	/* Attachments being downloaded */
+	SoupSession *dl_session;
+	GHashTable *downloads;
+	/* Originals of inline images, fetched when their link is followed */
+	GHashTable *full_size;
+	GQueue full_size_order;	/* Least recently shown first */
 };
 
 #define PURPLE_CHIME_CXN(conn) (CHIME_CONNECTION(((struct purple_chime *)purple_connection_get_protocol_data(conn))->cxn))
@@ -63,6 +73,7 @@ void purple_request_credentials(PurpleConnection *conn, ChimeConnection *cxn, gb
    for that one day, but it's convenient for now... */
 gboolean chime_read_last_msg(PurpleConnection *conn, ChimeObject *obj,
 			     const gchar **msg_time, gchar **msg_id);
+gchar *chime_get_metrics(PurpleAccount *account);
 
 /* buddy.c */
 void on_chime_new_contact(ChimeConnection *cxn, ChimeContact *contact, PurpleConnection *conn);
@@ -130,10 +141,15 @@ struct chime_msgs {
 	PurpleConnection *conn;
 	ChimeObject *obj;
 	gchar *last_seen;
+	gchar *last_seen_id;
+	guint save_id;	/* Saving last_seen is batched */
 	gchar *fetch_until;
-	GQueue *seen_msgs;
+	GHashTable *seen_msgs;
+	GQueue seen_order;
 	gboolean unseen;
 	GHashTable *msg_gather;
+	GPtrArray *deliver_queue;
+	guint deliver_idx, deliver_id;
 	chime_msg_cb cb;
 	gboolean msgs_done, members_done, msgs_failed;
 };
@@ -160,6 +176,11 @@ typedef struct _ChimeAttachment {
 	gchar *filename;
 	gchar *url; /* Valid for 1 hour */
 	gchar *content_type;
+
+	/* Set when url is for one of the smaller variants of an image */
+	gchar *original_url;
+	/* For fetching the message again once the URLs have expired */
+	gchar *created_on;
 } ChimeAttachment;
 
 typedef struct _AttachmentContext {
@@ -168,11 +189,14 @@ typedef struct _AttachmentContext {
 	const char *im_email; /* Email identifying the IM conversation. May be the the same as `from` */
 	time_t when;
 	int chat_id; /* -1 for IM */
+	ChimeObject *obj; /* The room or conversation the message is in */
 } AttachmentContext;
 
 ChimeAttachment *extract_attachment(JsonNode *record);
 
 void download_attachment(ChimeConnection *cxn, ChimeAttachment *att, AttachmentContext *ctx);
+void purple_chime_init_attachments(PurpleConnection *conn);
+void purple_chime_destroy_attachments(PurpleConnection *conn);
 void chime_send_file(PurpleConnection *gc, const char *who, const char *filename);
 void chime_send_file_object(PurpleConnection *gc, ChimeObject *obj, const char *who, const char *filename);
 
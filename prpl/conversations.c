@@ -68,6 +68,7 @@ static gboolean do_conv_deliver_msg(ChimeConnection *cxn, struct chime_im *im,
 		ctx->from = from;
 		ctx->im_email = email;
 		ctx->when = msg_time;
+		ctx->obj = im->m.obj;
 		/* The attachment and context structs will be owned by the code doing the download and will be disposed of at the end. */
 		download_attachment(cxn, att, ctx);
 	}
@@ -405,10 +406,30 @@ int chime_purple_send_im(PurpleConnection *gc, const char *who, const char *mess
 	return 0;
 }
 
-static void unsub_conv_object(ChimeConnection *cxn, ChimeObject *obj, PurpleConnection *conn)
+/*
+ * The rendered rows of the Recent Conversations window. Each one is
+ * only rendered again when its own conversation or peer changes, and
+ * libchime keeps the conversations in order for us.
+ */
+struct convlist_row {
+	PurpleConnection *conn;
+	ChimeConversation *conv;
+	ChimeContact *peer;
+	GList *cols;		/* NULL when it needs to be rendered again */
+};
+
+static void free_convlist_row(gpointer _row)
 {
-	g_signal_handlers_disconnect_matched(obj, G_SIGNAL_MATCH_FUNC|G_SIGNAL_MATCH_DATA, 0, 0, NULL,
-					     G_CALLBACK(refresh_convlist), conn);
+	struct convlist_row *row = _row;
+
+	g_signal_handlers_disconnect_matched(row->conv, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, row);
+	g_object_unref(row->conv);
+	if (row->peer) {
+		g_signal_handlers_disconnect_matched(row->peer, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, row);
+		g_object_unref(row->peer);
+	}
+	g_list_free_full(row->cols, g_free);
+	g_free(row);
 }
 
 static void convlist_closed_cb(gpointer _conn)
@@ -426,9 +447,7 @@ static void convlist_closed_cb(gpointer _conn)
 	pc->convlist_handle = NULL;
 
 	/* Unsubscribe from all the signals that were updating the dialog contents */
-	chime_connection_foreach_conversation(PURPLE_CHIME_CXN(conn), (void *)unsub_conv_object, conn);
-	chime_connection_foreach_contact(PURPLE_CHIME_CXN(conn), (void *)unsub_conv_object, conn);
-
+	g_clear_pointer(&pc->convlist_rows, g_hash_table_destroy);
 }
 
 static void open_im_conv(PurpleConnection *conn, GList *row, gpointer _unused)
@@ -451,22 +470,70 @@ static void open_im_conv(PurpleConnection *conn, GList *row, gpointer _unused)
 	}
 }
 
-static gint compare_conv_date(ChimeConversation *a, ChimeConversation *b)
+static void convlist_row_changed(GObject *obj, GParamSpec *pspec, struct convlist_row *row)
 {
-	return g_strcmp0(chime_conversation_get_updated_on(b),
-			 chime_conversation_get_updated_on(a));
+	g_list_free_full(row->cols, g_free);
+	row->cols = NULL;
+	refresh_convlist(NULL, NULL, row->conn);
 }
 
-static void insert_conv(ChimeConnection *cxn, ChimeConversation *conv, gpointer _convs)
+/* Gone from the connection's collection, so it's no longer listed either */
+static void convlist_row_dead(GObject *obj, GParamSpec *pspec, struct convlist_row *row)
+{
+	PurpleConnection *conn = row->conn;
+	struct purple_chime *pc = purple_connection_get_protocol_data(conn);
+
+	if (!chime_object_is_dead(CHIME_OBJECT(obj)))
+		return;
+
+	g_hash_table_remove(pc->convlist_rows, obj);
+	refresh_convlist(NULL, NULL, conn);
+}
+
+struct convlist_build {
+	PurpleConnection *conn;
+	PurpleNotifySearchResults *results;
+};
+
+static void add_convlist_row(ChimeConnection *cxn, ChimeConversation *conv, gpointer _b)
 {
-	GList **convs = _convs;
+	struct convlist_build *b = _b;
+	PurpleConnection *conn = b->conn;
+	struct purple_chime *pc = purple_connection_get_protocol_data(conn);
+	struct convlist_row *row = g_hash_table_lookup(pc->convlist_rows, conv);
+
+	if (!row) {
+		row = g_new0(struct convlist_row, 1);
+		row->conn = conn;
+		row->conv = g_object_ref(conv);
+		if (!is_group_conv(cxn, conv, &row->peer))
+			g_signal_connect(row->peer, "notify::availability",
+					 G_CALLBACK(convlist_row_changed), row);
+		g_signal_connect(conv, "notify::name", G_CALLBACK(convlist_row_changed), row);
+		g_signal_connect(conv, "notify::updated-on", G_CALLBACK(convlist_row_changed), row);
+		g_signal_connect(conv, "notify::dead", G_CALLBACK(convlist_row_dead), row);
+		g_hash_table_insert(pc->convlist_rows, conv, row);
+	}
 
-	/* We don't ref it as we'll use it immediately before anything else can happen */
-	*convs = g_list_insert_sorted(*convs, conv, (GCompareFunc) compare_conv_date);
+	if (!row->cols) {
+		row->cols = g_list_append(row->cols, g_strdup(chime_conversation_get_name(conv)));
+		row->cols = g_list_append(row->cols, g_strdup(chime_conversation_get_updated_on(conv)));
+		if (row->peer) {
+			gpointer klass = g_type_class_ref(CHIME_TYPE_AVAILABILITY);
+			GEnumValue *val = g_enum_get_value(klass, chime_contact_get_availability(row->peer));
+			row->cols = g_list_append(row->cols, g_strdup(_(val->value_nick)));
+			g_type_class_unref(klass);
+		} else
+			row->cols = g_list_append(row->cols, g_strdup("(N/A)"));
+	}
+
+	/* The results own their rows, so they get copies */
+	purple_notify_searchresults_row_add(b->results, g_list_copy_deep(row->cols, (GCopyFunc)g_strdup, NULL));
 }
 
 static PurpleNotifySearchResults *generate_recent_convs(PurpleConnection *conn)
 {
+	struct purple_chime *pc = purple_connection_get_protocol_data(conn);
 	PurpleNotifySearchResults *results = purple_notify_searchresults_new();
 	PurpleNotifySearchColumn *column;
 
@@ -479,40 +546,13 @@ static PurpleNotifySearchResults *generate_recent_convs(PurpleConnection *conn)
 
 	purple_notify_searchresults_button_add(results, PURPLE_NOTIFY_BUTTON_IM, open_im_conv);
 
-	GList *convs = NULL;
-	chime_connection_foreach_conversation(PURPLE_CHIME_CXN(conn), insert_conv, &convs);
-
-	gpointer klass = g_type_class_ref(CHIME_TYPE_AVAILABILITY);
-
-	while (convs) {
-		ChimeConversation *conv = convs->data;
-		convs = g_list_delete_link(convs, convs);
+	if (!pc->convlist_rows)
+		pc->convlist_rows = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+							  NULL, free_convlist_row);
 
-		GList *row = NULL;
-		row = g_list_append(row, g_strdup(chime_conversation_get_name(conv)));
-		row = g_list_append(row, g_strdup(chime_conversation_get_updated_on(conv)));
+	struct convlist_build b = { conn, results };
+	chime_connection_foreach_recent_conversation(PURPLE_CHIME_CXN(conn), add_convlist_row, &b);
 
-		ChimeContact *peer = NULL;
-		if (is_group_conv(PURPLE_CHIME_CXN(conn), conv, &peer)) {
-			row = g_list_append(row, g_strdup("(N/A)"));
-		} else {
-			GEnumValue *val = g_enum_get_value(klass, chime_contact_get_availability(peer));
-			row = g_list_append(row, g_strdup(_(val->value_nick)));
-			g_signal_handlers_disconnect_matched(peer, G_SIGNAL_MATCH_FUNC|G_SIGNAL_MATCH_DATA, 0, 0, NULL,
-						     G_CALLBACK(refresh_convlist), conn);
-			g_signal_connect(peer, "notify::availability", G_CALLBACK(refresh_convlist), conn);
-			g_object_unref(peer);
-		}
-
-		purple_notify_searchresults_row_add(results, row);
-
-		g_signal_handlers_disconnect_matched(conv, G_SIGNAL_MATCH_FUNC|G_SIGNAL_MATCH_DATA, 0, 0, NULL,
-						     G_CALLBACK(refresh_convlist), conn);
-		g_signal_connect(conv, "notify::name", G_CALLBACK(refresh_convlist), conn);
-		g_signal_connect(conv, "notify::updated_on", G_CALLBACK(refresh_convlist), conn);
-	}
-
-	g_type_class_unref(klass);
 	return results;
 }
 
@@ -528,6 +568,9 @@ static gboolean update_convlist(gpointer _conn)
 	return FALSE;
 }
 
+/* Coalesce bursts of changes, such as a batch of conversations being fetched */
+#define CONVLIST_REFRESH_DELAY 250
+
 static void refresh_convlist(ChimeObject *obj, GParamSpec *pspec, PurpleConnection *conn)
 {
 	struct purple_chime *pc = purple_connection_get_protocol_data(conn);
@@ -535,7 +578,7 @@ static void refresh_convlist(ChimeObject *obj, GParamSpec *pspec, PurpleConnecti
 	if (!pc->convlist_handle || pc->convlist_refresh_id)
 		return;
 
-	pc->convlist_refresh_id = g_idle_add(update_convlist, conn);
+	pc->convlist_refresh_id = g_timeout_add(CONVLIST_REFRESH_DELAY, update_convlist, conn);
 }
 
 void chime_purple_recent_conversations(PurplePluginAction *action)
@@ -589,8 +632,11 @@ static void chime_conv_created_cb(PurpleConversation *conv, PurpleConnection *co
 	/* If the conversation isn't already known, find or create it.
 	 * Use the chime_purple_send_im() call chain to do that, with
 	 * a NULL message. */
-	if (!g_hash_table_lookup(pc->ims_by_email, conv->name))
+	struct chime_im *im = g_hash_table_lookup(pc->ims_by_email, conv->name);
+	if (!im)
 		chime_purple_send_im(conn, conv->name, NULL, 0);
+	else
+		chime_conversation_hydrate(pc->cxn, CHIME_CONVERSATION(im->m.obj));
 }
 
 void purple_chime_init_conversations(PurpleConnection *conn)
@@ -28,3 +28,11 @@ extern PurpleDBusBinding chime_purple_dbus_bindings[];
  */
 DBUS_EXPORT void chime_add_joinable_meeting(PurpleAccount *account,
 					    const gchar *pin);
+
+/**
+ * ChimeGetMetrics - Request, sync and call statistics for the account
+ *
+ * @param account   (in) libpurple account
+ * @return          JSON object; empty if the account is not connected
+ */
+DBUS_EXPORT gchar *chime_get_metrics(PurpleAccount *account);
@@ -340,25 +340,48 @@ static void join_joinable(PurpleConnection *conn, GList *row, gpointer _unused)
 	do_join_joinable(conn, row, TRUE);
 }
 
-static void append_mtg(ChimeConnection *cxn, ChimeMeeting *mtg, gpointer _results)
-{
-	PurpleNotifySearchResults *results = _results;
-	ChimeContact *organiser = chime_meeting_get_organiser(mtg);
+/*
+ * The joinable meetings window keeps a rendered row for each meeting, in
+ * the order they arrived. Meetings coming, going and changing only touch
+ * their own row, and the window is repainted shortly afterwards, once for
+ * each burst of changes.
+ */
+struct joinable_row {
+	PurpleConnection *conn;
+	ChimeMeeting *mtg;	/* Not a reference; "ended" comes from its dispose */
+	GList link;		/* In pc->joinable_order */
+	GList *cols;		/* NULL when it needs to be rendered again */
+};
+
+#define JOINABLE_REFRESH_DELAY 250
 
-	GList *row = NULL;
-	row = g_list_append(row, format_pin(chime_meeting_get_passcode(mtg)));
-	row = g_list_append(row, g_strdup(chime_meeting_get_name(mtg)));
-	row = g_list_append(row, g_strdup_printf("%s <%s>", chime_contact_get_display_name(organiser),
-						 chime_contact_get_email(organiser)));
+static void free_joinable_row(gpointer _row)
+{
+	struct joinable_row *row = _row;
+	struct purple_chime *pc = purple_connection_get_protocol_data(row->conn);
 
-	purple_notify_searchresults_row_add(results, row);
+	g_signal_handlers_disconnect_matched(row->mtg, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, row);
+	g_queue_unlink(&pc->joinable_order, &row->link);
+	g_list_free_full(row->cols, g_free);
+	g_free(row);
 }
 
+static void render_joinable_row(struct joinable_row *row)
+{
+	ChimeContact *organiser = chime_meeting_get_organiser(row->mtg);
+
+	row->cols = g_list_append(row->cols, format_pin(chime_meeting_get_passcode(row->mtg)));
+	row->cols = g_list_append(row->cols, g_strdup(chime_meeting_get_name(row->mtg)));
+	row->cols = g_list_append(row->cols, g_strdup_printf("%s <%s>", chime_contact_get_display_name(organiser),
+							     chime_contact_get_email(organiser)));
+}
 
 static PurpleNotifySearchResults *generate_joinable_results(PurpleConnection *conn)
 {
+	struct purple_chime *pc = purple_connection_get_protocol_data(conn);
 	PurpleNotifySearchResults *results = purple_notify_searchresults_new();
 	PurpleNotifySearchColumn *column;
+	GList *l;
 
 	column = purple_notify_searchresults_column_new(_("Passcode"));
 	purple_notify_searchresults_column_add(results, column);
@@ -371,7 +394,15 @@ static PurpleNotifySearchResults *generate_joinable_results(PurpleConnection *co
 	/* This doesn't show up in Pidgin < 2.13: https://developer.pidgin.im/ticket/17188 */
 	purple_notify_searchresults_button_add_labeled(results, _("Join with audio"), join_joinable_audio);
 
-	chime_connection_foreach_meeting(PURPLE_CHIME_CXN(conn), append_mtg, results);
+	for (l = pc->joinable_order.head; l; l = l->next) {
+		struct joinable_row *row = l->data;
+
+		if (!row->cols)
+			render_joinable_row(row);
+
+		/* The results own their rows, so they get copies */
+		purple_notify_searchresults_row_add(results, g_list_copy_deep(row->cols, (GCopyFunc)g_strdup, NULL));
+	}
 	return results;
 }
 
@@ -387,46 +418,36 @@ static gboolean update_joinable(gpointer _conn)
 	return FALSE;
 }
 
-static void count_mtg(ChimeConnection *cxn, ChimeMeeting *mtg, gpointer _count)
+static void schedule_joinable(struct purple_chime *pc, PurpleConnection *conn)
 {
-	int *count = _count;
-
-	(*count)++;
+	if (pc->joinable_handle && !pc->joinable_refresh_id)
+		pc->joinable_refresh_id = g_timeout_add(JOINABLE_REFRESH_DELAY, update_joinable, conn);
 }
 
-static void on_meeting_changed(ChimeMeeting *mtg, GParamSpec *ignored, PurpleConnection *conn)
+static void on_meeting_changed(ChimeMeeting *mtg, GParamSpec *ignored, struct joinable_row *row)
 {
-	struct purple_chime *pc = purple_connection_get_protocol_data(conn);
+	struct purple_chime *pc = purple_connection_get_protocol_data(row->conn);
 
-	if (pc && pc->joinable_handle && !pc->joinable_refresh_id)
-		pc->joinable_refresh_id = g_idle_add(update_joinable, conn);
+	g_list_free_full(row->cols, g_free);
+	row->cols = NULL;
+	schedule_joinable(pc, row->conn);
 }
 
-static void on_meeting_ended(ChimeMeeting *mtg, PurpleConnection *conn)
+static void on_meeting_ended(ChimeMeeting *mtg, struct joinable_row *row)
 {
+	PurpleConnection *conn = row->conn;
 	struct purple_chime *pc = purple_connection_get_protocol_data(conn);
 
-	if (pc && pc->joinable_handle) {
-		int count = 0;
+	g_hash_table_remove(pc->joinable_rows, mtg);
 
-		chime_connection_foreach_meeting(PURPLE_CHIME_CXN(conn), count_mtg, &count);
-		if (!count) {
-			if (pc->joinable_refresh_id)
-				g_source_remove(pc->joinable_refresh_id);
-			pc->joinable_refresh_id = 0;
-			purple_notify_close(PURPLE_NOTIFY_SEARCHRESULTS, pc->joinable_handle);
-			pc->joinable_handle = NULL;
-		} else if (!pc->joinable_refresh_id)
-			pc->joinable_refresh_id = g_idle_add(update_joinable, conn);
-	}
-}
-
-static void unsub_mtg(ChimeConnection *cxn, ChimeMeeting *mtg, gpointer _conn)
-{
-	g_signal_handlers_disconnect_matched(mtg, G_SIGNAL_MATCH_FUNC|G_SIGNAL_MATCH_DATA,
-					     0, 0, NULL, on_meeting_changed, _conn);
-	g_signal_handlers_disconnect_matched(mtg, G_SIGNAL_MATCH_FUNC|G_SIGNAL_MATCH_DATA,
-					     0, 0, NULL, on_meeting_ended, _conn);
+	if (!g_hash_table_size(pc->joinable_rows)) {
+		if (pc->joinable_refresh_id)
+			g_source_remove(pc->joinable_refresh_id);
+		pc->joinable_refresh_id = 0;
+		purple_notify_close(PURPLE_NOTIFY_SEARCHRESULTS, pc->joinable_handle);
+		pc->joinable_handle = NULL;
+	} else
+		schedule_joinable(pc, conn);
 }
 
 static void joinable_closed_cb(gpointer _conn)
@@ -443,19 +464,33 @@ static void joinable_closed_cb(gpointer _conn)
 	}
 	pc->joinable_handle = NULL;
 
-	chime_connection_foreach_meeting(PURPLE_CHIME_CXN(conn), unsub_mtg, conn);
+	g_clear_pointer(&pc->joinable_rows, g_hash_table_destroy);
 }
 
-static void sub_mtg(ChimeConnection *cxn, ChimeMeeting *mtg, gpointer _conn)
+static void add_joinable_row(ChimeConnection *cxn, ChimeMeeting *mtg, gpointer _conn)
 {
 	PurpleConnection *conn = _conn;
+	struct purple_chime *pc = purple_connection_get_protocol_data(conn);
+
+	if (!pc->joinable_rows)
+		pc->joinable_rows = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+							  NULL, free_joinable_row);
+	else if (g_hash_table_contains(pc->joinable_rows, mtg))
+		return;
+
+	struct joinable_row *row = g_new0(struct joinable_row, 1);
+	row->conn = conn;
+	row->mtg = mtg;
+	row->link.data = row;
+	g_queue_push_tail_link(&pc->joinable_order, &row->link);
+	g_hash_table_insert(pc->joinable_rows, mtg, row);
 
 	g_signal_connect(mtg, "notify::passcode",
-			 G_CALLBACK(on_meeting_changed), conn);
+			 G_CALLBACK(on_meeting_changed), row);
 	g_signal_connect(mtg, "notify::name",
-			 G_CALLBACK(on_meeting_changed), conn);
+			 G_CALLBACK(on_meeting_changed), row);
 	g_signal_connect(mtg, "ended",
-			 G_CALLBACK(on_meeting_ended), conn);
+			 G_CALLBACK(on_meeting_ended), row);
 }
 
 void on_chime_new_meeting(ChimeConnection *cxn, ChimeMeeting *mtg, PurpleConnection *conn)
@@ -463,10 +498,10 @@ void on_chime_new_meeting(ChimeConnection *cxn, ChimeMeeting *mtg, PurpleConnect
 	struct purple_chime *pc = purple_connection_get_protocol_data(conn);
 
 	if (pc->joinable_handle) {
-		if (mtg)
-			sub_mtg(cxn, mtg, conn);
-
-		if (!pc->joinable_refresh_id)
+		if (mtg) {
+			add_joinable_row(cxn, mtg, conn);
+			schedule_joinable(pc, conn);
+		} else if (!pc->joinable_refresh_id)
 			pc->joinable_refresh_id = g_idle_add(update_joinable, conn);
 		return;
 	}
@@ -481,6 +516,8 @@ void on_chime_new_meeting(ChimeConnection *cxn, ChimeMeeting *mtg, PurpleConnect
 		}
 	}
 
+	chime_connection_foreach_meeting(PURPLE_CHIME_CXN(conn), add_joinable_row, conn);
+
 	PurpleNotifySearchResults *results = generate_joinable_results(conn);
 	pc->joinable_handle = purple_notify_searchresults(conn, _("Joinable Chime Meetings"), _("Joinable Meetings:"),
 							  conn->account->username, results, joinable_closed_cb, conn);
@@ -490,8 +527,6 @@ void on_chime_new_meeting(ChimeConnection *cxn, ChimeMeeting *mtg, PurpleConnect
 				    NULL);
 		joinable_closed_cb(conn);
 	}
-
-	chime_connection_foreach_meeting(PURPLE_CHIME_CXN(conn), sub_mtg, conn);
 }
 
 void chime_purple_show_joinable(PurplePluginAction *action)
@@ -32,94 +32,271 @@
 static void chime_update_last_msg(ChimeConnection *cxn, struct chime_msgs *msgs,
 				  const gchar *msg_time, const gchar *msg_id);
 
-static void mark_msg_seen(GQueue *q, const gchar *id)
+/* Seen message IDs are remembered for as long as a backfill could
+ * return them again, with a hard cap on the number kept. The most
+ * recent few are stored with the last-seen marker for the next login. */
+#define SEEN_WINDOW FETCH_TIME_CHUNK
+#define SEEN_MAX 2048
+#define SEEN_PERSIST 16
+
+/* The marker is written out at most this often (seconds), not per message */
+#define SAVE_LAST_DELAY 10
+
+struct seen_msg {
+	GList link;	/* In msgs->seen_order; data points back to us */
+	time_t tm;
+	gchar id[];
+};
+
+static void init_seen_msgs(struct chime_msgs *msgs)
+{
+	msgs->seen_msgs = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+	g_queue_init(&msgs->seen_order);
+}
+
+static void expire_seen_msgs(struct chime_msgs *msgs, time_t newest)
+{
+	GList *l;
+
+	while ((l = msgs->seen_order.head)) {
+		struct seen_msg *sm = l->data;
+
+		if (msgs->seen_order.length <= SEEN_MAX && sm->tm + SEEN_WINDOW >= newest)
+			break;
+
+		g_queue_unlink(&msgs->seen_order, l);
+		g_hash_table_remove(msgs->seen_msgs, sm->id);
+	}
+}
+
+static void mark_msg_seen(struct chime_msgs *msgs, const gchar *id, time_t tm)
 {
-	if (q->length == 10)
-		g_free(g_queue_pop_tail(q));
-	g_queue_push_head(q, g_strdup(id));
+	size_t len = strlen(id) + 1;
+	struct seen_msg *sm = g_malloc(sizeof(*sm) + len);
+
+	memcpy(sm->id, id, len);
+	sm->tm = tm;
+	sm->link.data = sm;
+	sm->link.prev = sm->link.next = NULL;
+	g_queue_push_tail_link(&msgs->seen_order, &sm->link);
+	g_hash_table_insert(msgs->seen_msgs, sm->id, sm);
+
+	expire_seen_msgs(msgs, tm);
 }
-static gboolean is_msg_unseen(GQueue *q, const gchar *id)
+
+static gboolean is_msg_unseen(struct chime_msgs *msgs, const gchar *id, time_t tm)
 {
-	if (g_queue_find_custom(q, id, (GCompareFunc)strcmp))
+	if (g_hash_table_contains(msgs->seen_msgs, id))
 		return FALSE;
-	mark_msg_seen(q, id);
+	mark_msg_seen(msgs, id, tm);
 	return TRUE;
 }
 
+static gchar *last_msg_key(ChimeObject *obj)
+{
+	return g_strdup_printf("last-%s-%s", CHIME_IS_ROOM(obj) ? "room" : "conversation",
+			       chime_object_get_id(obj));
+}
+
+/*
+ * One setting per room or conversation holds both the last-seen marker
+ * and the newest few seen message IDs: "<seen IDs>|<msg id>|<time>".
+ * Older versions stored just "<msg id>|<time>", or only the time.
+ */
+static void save_last_msg(struct chime_msgs *msgs)
+{
+	GString *str = g_string_new(NULL);
+	GList *l;
+	int i;
+
+	for (l = msgs->seen_order.tail, i = 0; l && i < SEEN_PERSIST; l = l->prev, i++) {
+		struct seen_msg *sm = l->data;
+
+		if (str->len)
+			g_string_append_c(str, ' ');
+		g_string_append(str, sm->id);
+	}
+	g_string_append_printf(str, "|%s|%s", msgs->last_seen_id, msgs->last_seen);
+
+	gchar *key = last_msg_key(msgs->obj);
+	purple_account_set_string(msgs->conn->account, key, str->str);
+	g_free(key);
+	g_string_free(str, TRUE);
+}
+
+static gboolean save_last_msg_timeout(gpointer _msgs)
+{
+	struct chime_msgs *msgs = _msgs;
+
+	msgs->save_id = 0;
+	save_last_msg(msgs);
+	return G_SOURCE_REMOVE;
+}
+
+static void load_seen_msgs(struct chime_msgs *msgs, time_t tm)
+{
+	gchar *key = last_msg_key(msgs->obj);
+	const gchar *val = purple_account_get_string(msgs->conn->account, key, NULL);
+	g_free(key);
+
+	/* Only present if there are two separators */
+	const gchar *end = val ? strchr(val, '|') : NULL;
+	if (!end || end == strrchr(val, '|'))
+		return;
+
+	/* Stored newest first */
+	gchar *list = g_strndup(val, end - val);
+	gchar **ids = g_strsplit(list, " ", SEEN_PERSIST);
+	int i = g_strv_length(ids);
+	while (i--) {
+		if (ids[i][0] && !g_hash_table_contains(msgs->seen_msgs, ids[i]))
+			mark_msg_seen(msgs, ids[i], tm);
+	}
+	g_strfreev(ids);
+	g_free(list);
+}
+
+/* Maximum number of backfilled messages delivered per idle callback */
+#define DELIVER_SLICE 25
+
 struct msg_sort {
 	GTimeVal tm;
 	const gchar *id;
 	JsonNode *node;
+	/* Last of its batch; was msgs->fetch_until clear when it was sorted? */
+	gboolean last, final;
 };
 
 static gint compare_ms(gconstpointer _a, gconstpointer _b)
 {
-	const struct msg_sort *a = _a;
-	const struct msg_sort *b = _b;
-
-	if (a->tm.tv_sec > b->tm.tv_sec)
-		return 1;
-	if (a->tm.tv_sec == b->tm.tv_sec &&
-	    a->tm.tv_usec > b->tm.tv_usec)
-		return 1;
+	const struct msg_sort *a = *(const struct msg_sort **)_a;
+	const struct msg_sort *b = *(const struct msg_sort **)_b;
+
+	if (a->tm.tv_sec != b->tm.tv_sec)
+		return a->tm.tv_sec > b->tm.tv_sec ? 1 : -1;
+	if (a->tm.tv_usec != b->tm.tv_usec)
+		return a->tm.tv_usec > b->tm.tv_usec ? 1 : -1;
 	return 0;
 }
 
-static int insert_queued_msg(gpointer _id, gpointer _node, gpointer _list)
+static int insert_queued_msg(gpointer _id, gpointer _node, gpointer _arr)
 {
-	const gchar *str;
-	GList **l = _list;
+	GPtrArray *arr = _arr;
+	GTimeVal tm;
 
-	if (parse_string(_node, "CreatedOn", &str)) {
+	if (parse_time(_node, "CreatedOn", NULL, &tm)) {
 		struct msg_sort *ms = g_new0(struct msg_sort, 1);
-		if (!g_time_val_from_iso8601(str, &ms->tm)) {
-			g_free(ms);
-			return TRUE;
-		}
+		ms->tm = tm;
 		ms->node = json_node_ref(_node);
 		ms->id = _id;
-		*l = g_list_insert_sorted(*l, ms, compare_ms);
+		g_ptr_array_add(arr, ms);
 	}
 	return TRUE;
 }
 
-void chime_complete_messages(ChimeConnection *cxn, struct chime_msgs *msgs)
+static void free_ms(gpointer _ms)
 {
-	GList *l = NULL;
+	struct msg_sort *ms = _ms;
 
-	/* Sort messages by time */
-	g_hash_table_foreach_remove(msgs->msg_gather, insert_queued_msg, &l);
+	json_node_unref(ms->node);
+	g_free(ms);
+}
 
-	while (l) {
-		struct msg_sort *ms = l->data;
-		const gchar *id = ms->id;
-		JsonNode *node = ms->node;
-		gboolean seen_one = FALSE;
+/* Sort the gathered messages onto the end of the delivery queue. Each
+ * batch is later than anything already queued, since we fetch in order. */
+static void queue_gathered_msgs(struct chime_msgs *msgs)
+{
+	GPtrArray *batch = g_ptr_array_sized_new(g_hash_table_size(msgs->msg_gather));
 
-		l = g_list_remove(l, ms);
+	g_hash_table_foreach_remove(msgs->msg_gather, insert_queued_msg, batch);
+	if (!batch->len) {
+		g_ptr_array_free(batch, TRUE);
+		return;
+	}
 
-		if (is_msg_unseen(msgs->seen_msgs, id)) {
-			gboolean new_msg = FALSE;
-			/* Only treat it as a new message if it is the last one,
-			 * and it was sent within the last day */
-			if (!l && !msgs->fetch_until && ms->tm.tv_sec + 86400 < time(NULL))
-				new_msg = TRUE;
+	g_ptr_array_sort(batch, compare_ms);
 
-			seen_one = TRUE;
-			msgs->cb(cxn, msgs, node, ms->tm.tv_sec, new_msg);
-		}
-		g_free(ms);
+	struct msg_sort *last = batch->pdata[batch->len - 1];
+	last->last = TRUE;
+	last->final = !msgs->fetch_until;
 
-		/* Last message, note down the received time */
-		if (!l && !msgs->msgs_failed && seen_one) {
-			const gchar *tm;
-			if (parse_string(node, "CreatedOn", &tm))
-				chime_update_last_msg(cxn, msgs, tm, id);
-		}
-		json_node_unref(node);
+	/* The last-seen marker moves on to the end of the batch as soon as
+	 * it's sorted, if any of it is new, rather than when it's finally
+	 * delivered. Anything comparing LastSent with it, or fetching from
+	 * it, mustn't go back over what's already queued. */
+	guint i;
+	for (i = 0; i < batch->len; i++) {
+		struct msg_sort *ms = batch->pdata[i];
+
+		if (!g_hash_table_contains(msgs->seen_msgs, ms->id))
+			break;
+	}
+	const gchar *tm;
+	if (i < batch->len && !msgs->msgs_failed &&
+	    parse_string(last->node, "CreatedOn", &tm))
+		chime_update_last_msg(PURPLE_CHIME_CXN(msgs->conn), msgs, tm, last->id);
+
+	if (!msgs->deliver_queue)
+		msgs->deliver_queue = g_ptr_array_new_with_free_func(free_ms);
+
+	for (i = 0; i < batch->len; i++)
+		g_ptr_array_add(msgs->deliver_queue, batch->pdata[i]);
+	g_ptr_array_free(batch, TRUE);
+}
+
+static void deliver_one(ChimeConnection *cxn, struct chime_msgs *msgs,
+			struct msg_sort *ms)
+{
+	if (is_msg_unseen(msgs, ms->id, ms->tm.tv_sec)) {
+		gboolean new_msg = FALSE;
+		/* Only treat it as a new message if it is the last one,
+		 * and it was sent within the last day */
+		if (ms->last && ms->final && ms->tm.tv_sec + 86400 < time(NULL))
+			new_msg = TRUE;
+
+		msgs->cb(cxn, msgs, ms->node, ms->tm.tv_sec, new_msg);
 	}
+}
+
+static gboolean deliver_msgs_idle(gpointer _msgs)
+{
+	struct chime_msgs *msgs = _msgs;
+	ChimeConnection *cxn = PURPLE_CHIME_CXN(msgs->conn);
+	guint end = MIN(msgs->deliver_idx + DELIVER_SLICE, msgs->deliver_queue->len);
+
+	while (msgs->deliver_idx < end)
+		deliver_one(cxn, msgs, msgs->deliver_queue->pdata[msgs->deliver_idx++]);
+
+	if (msgs->deliver_idx < msgs->deliver_queue->len)
+		return G_SOURCE_CONTINUE;
 
-	if (!msgs->fetch_until)
+	g_clear_pointer(&msgs->deliver_queue, g_ptr_array_unref);
+	msgs->deliver_idx = 0;
+
+	/* Anything which arrived while we were delivering, and isn't
+	 * waiting for a fetch still in progress, can go out now. */
+	if (!msgs->fetch_until && msgs->msgs_done && msgs->members_done) {
+		queue_gathered_msgs(msgs);
+		if (msgs->deliver_queue)
+			return G_SOURCE_CONTINUE;
+		g_clear_pointer(&msgs->msg_gather, g_hash_table_destroy);
+	}
+
+	msgs->deliver_id = 0;
+	return G_SOURCE_REMOVE;
+}
+
+/* Deliver in slices from an idle callback so that a long backfill
+ * doesn't block the UI. Until it's finished, msg_gather is kept so
+ * that new messages queue up behind the backlog. */
+void chime_complete_messages(ChimeConnection *cxn, struct chime_msgs *msgs)
+{
+	queue_gathered_msgs(msgs);
+
+	if (msgs->deliver_queue) {
+		if (!msgs->deliver_id)
+			msgs->deliver_id = g_idle_add(deliver_msgs_idle, msgs);
+	} else if (!msgs->fetch_until)
 		g_clear_pointer(&msgs->msg_gather, g_hash_table_destroy);
 }
 
@@ -131,16 +308,12 @@ static gboolean msg_newer_than(JsonNode *new, const gchar *old_date)
 	if (!parse_string(new, "UpdatedOn", &new_updated))
 		return FALSE;
 
-	GTimeVal old_tv, new_tv;
-	if (!g_time_val_from_iso8601(new_updated, &new_tv) ||
-	    !g_time_val_from_iso8601(old_date, &old_tv))
+	gint64 old_us, new_us;
+	if (!chime_parse_time_us(new_updated, &new_us) ||
+	    !chime_parse_time_us(old_date, &old_us))
 		return FALSE;
 
-	if (new_tv.tv_sec > old_tv.tv_sec ||
-	    (new_tv.tv_sec == old_tv.tv_sec && new_tv.tv_usec > old_tv.tv_usec))
-		return TRUE;
-
-	return FALSE;
+	return new_us > old_us;
 }
 
 static gboolean msg_newer(JsonNode *new, JsonNode *old)
@@ -185,7 +358,7 @@ static void on_message_received(ChimeObject *obj, JsonNode *node, struct chime_m
 	if (!msgs->msgs_failed)
 		chime_update_last_msg(cxn, msgs, created, id);
 
-	if (is_msg_unseen(msgs->seen_msgs, id))
+	if (is_msg_unseen(msgs, id, tv.tv_sec))
 		msgs->cb(cxn, msgs, node, tv.tv_sec, TRUE);
 }
 
@@ -262,7 +435,8 @@ static void on_last_sent_updated(ChimeObject *obj, GParamSpec *ignored, struct c
 
 		chime_connection_fetch_messages_async(PURPLE_CHIME_CXN(msgs->conn), obj, NULL, msgs->last_seen, NULL, fetch_msgs_cb, msgs);
 		msgs->msgs_done = FALSE;
-		msgs->msg_gather = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)json_node_unref);
+		if (!msgs->msg_gather)
+			msgs->msg_gather = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)json_node_unref);
 	}
 
 	g_free(last_sent);
@@ -273,17 +447,19 @@ void init_msgs(PurpleConnection *conn, struct chime_msgs *msgs, ChimeObject *obj
 	msgs->conn = conn;
 	msgs->obj = g_object_ref(obj);
 	msgs->cb = cb;
-	msgs->seen_msgs = g_queue_new();
+	init_seen_msgs(msgs);
 
 	const gchar *last_seen = NULL;
 	gchar *last_id = NULL;
 	chime_read_last_msg(conn, obj, &last_seen, &last_id);
 	msgs->last_seen = g_strdup(last_seen ? : "1970-01-01T00:00:00.000Z");
 
-	if (last_id) {
-		mark_msg_seen(msgs->seen_msgs, last_id);
-		g_free(last_id);
-	}
+	GTimeVal seen_tv = { 0, 0 };
+	g_time_val_from_iso8601(msgs->last_seen, &seen_tv);
+	load_seen_msgs(msgs, seen_tv.tv_sec);
+	if (last_id && !g_hash_table_contains(msgs->seen_msgs, last_id))
+		mark_msg_seen(msgs, last_id, seen_tv.tv_sec);
+	msgs->last_seen_id = last_id;
 
 	g_signal_connect(obj, "notify::last-sent", G_CALLBACK(on_last_sent_updated), msgs);
 	g_signal_connect(obj, "message", G_CALLBACK(on_message_received), msgs);
@@ -334,7 +510,19 @@ void init_msgs(PurpleConnection *conn, struct chime_msgs *msgs, ChimeObject *obj
 
 void cleanup_msgs(struct chime_msgs *msgs)
 {
-	g_queue_free_full(msgs->seen_msgs, g_free);
+	if (msgs->save_id) {
+		g_source_remove(msgs->save_id);
+		msgs->save_id = 0;
+		save_last_msg(msgs);
+	}
+	if (msgs->deliver_id) {
+		g_source_remove(msgs->deliver_id);
+		msgs->deliver_id = 0;
+	}
+	g_clear_pointer(&msgs->deliver_queue, g_ptr_array_unref);
+	/* The seen_msg structs are freed with the hash table */
+	g_clear_pointer(&msgs->seen_msgs, g_hash_table_destroy);
+	g_queue_init(&msgs->seen_order);
 	if (msgs->msg_gather) {
 		g_hash_table_destroy(msgs->msg_gather);
 		msgs->msg_gather = NULL;
@@ -342,6 +530,7 @@ void cleanup_msgs(struct chime_msgs *msgs)
 
 	/* Caller disconnects all signals with 'msgs' as user_data */
 	g_clear_pointer(&msgs->last_seen, g_free);
+	g_clear_pointer(&msgs->last_seen_id, g_free);
 	g_clear_object(&msgs->obj);
 	g_free(msgs->fetch_until);
 	/* If msgs->msgs_done then we can free immediately. This
@@ -357,17 +546,13 @@ void cleanup_msgs(struct chime_msgs *msgs)
 static void chime_update_last_msg(ChimeConnection *cxn, struct chime_msgs *msgs,
 				  const gchar *msg_time, const gchar *msg_id)
 {
-	gchar *key = g_strdup_printf("last-%s-%s",
-				     CHIME_IS_ROOM(msgs->obj) ? "room" : "conversation",
-				     chime_object_get_id(msgs->obj));
-	gchar *val = g_strdup_printf("%s|%s", msg_id, msg_time);
-
-	purple_account_set_string(msgs->conn->account, key, val);
-	g_free(key);
-	g_free(val);
-
 	g_free(msgs->last_seen);
 	msgs->last_seen = g_strdup(msg_time);
+	g_free(msgs->last_seen_id);
+	msgs->last_seen_id = g_strdup(msg_id);
+
+	if (!msgs->save_id)
+		msgs->save_id = g_timeout_add_seconds(SAVE_LAST_DELAY, save_last_msg_timeout, msgs);
 
 	msgs->unseen = TRUE;
 }
@@ -376,7 +561,7 @@ static void chime_update_last_msg(ChimeConnection *cxn, struct chime_msgs *msgs,
 gboolean chime_read_last_msg(PurpleConnection *conn, ChimeObject *obj,
 			     const gchar **msg_time, gchar **msg_id)
 {
-	gchar *key = g_strdup_printf("last-%s-%s", CHIME_IS_ROOM(obj) ? "room" : "conversation", chime_object_get_id(obj));
+	gchar *key = last_msg_key(obj);
 	const gchar *val = purple_account_get_string(conn->account, key, NULL);
 	g_free(key);
 
@@ -392,8 +577,14 @@ gboolean chime_read_last_msg(PurpleConnection *conn, ChimeObject *obj,
 		return TRUE;
 	}
 
-	if (msg_id)
-		*msg_id = g_strndup(val, *msg_time - val);
+	/* The msgid follows the seen IDs, if they're there */
+	if (msg_id) {
+		const gchar *id = *msg_time;
+
+		while (id > val && id[-1] != '|')
+			id--;
+		*msg_id = g_strndup(id, *msg_time - id);
+	}
 	(*msg_time)++; /* Past the | */
 
 	return TRUE;
@@ -430,7 +621,7 @@ static void chime_conv_updated_cb(PurpleConversation *conv, PurpleConvUpdateType
 	if (unseen_count)
 		return;
 
-	const gchar *msg_id = g_queue_peek_head(msgs->seen_msgs);
+	const gchar *msg_id = msgs->last_seen_id;
 	g_return_if_fail(msg_id);
 
 	chime_connection_update_last_read_async(PURPLE_CHIME_CXN(conn), msgs->obj, msg_id, NULL, NULL, NULL);
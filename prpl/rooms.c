@@ -59,21 +59,39 @@ static void sort_room(ChimeConnection *cxn, ChimeRoom *room, gpointer _rs_list)
 	const char *tm;
 
 	rs->room = room;
-	rs->unread = chime_room_has_unread(room);
-	rs->mention = chime_room_has_mention(room);
+	rs->unread = chime_room_has_unread(room) || chime_room_get_unread_count(room);
+	rs->mention = chime_room_has_mention(room) || chime_room_get_mention_count(room);
 
-	tm = chime_room_get_last_sent(room);
-	if (!tm || !g_time_val_from_iso8601(tm, &rs->when)) {
+	gint64 when = chime_room_get_last_sent_time(room);
+	if (!when) {
 		tm = chime_room_get_created_on(room);
-		if (tm)
-			g_time_val_from_iso8601(tm, &rs->when);
+		if (!chime_parse_time_us(tm, &when))
+			when = 0;
 	}
+	rs->when.tv_sec = when / G_USEC_PER_SEC;
+	rs->when.tv_usec = when % G_USEC_PER_SEC;
 	while (*rs_list && cmp_room(*rs_list, rs))
 		rs_list = &((*rs_list)->next);
 	rs->next = *rs_list;
 	*rs_list = rs;
 }
 
+/* The counts only cover what's arrived since we connected, so fall back
+ * to a plain marker for rooms which were already unread before then. */
+static gchar *room_status(ChimeRoom *room, gboolean unread, gboolean mention)
+{
+	guint n_unread = chime_room_get_unread_count(room);
+	guint n_mentions = chime_room_get_mention_count(room);
+
+	if (n_mentions)
+		return g_strdup_printf("@%u", n_mentions);
+	if (mention)
+		return g_strdup("@");
+	if (n_unread)
+		return g_strdup_printf("%u", n_unread);
+	return g_strdup(unread ? "•" : "");
+}
+
 PurpleRoomlist *chime_purple_roomlist_get_list(PurpleConnection *conn)
 {
 	ChimeConnection *cxn = PURPLE_CHIME_CXN(conn);
@@ -94,7 +112,9 @@ PurpleRoomlist *chime_purple_roomlist_get_list(PurpleConnection *conn)
 		PurpleRoomlistRoom *proom = purple_roomlist_room_new(PURPLE_ROOMLIST_ROOMTYPE_ROOM,
 								     chime_room_get_name(room), NULL);
 		purple_roomlist_room_add_field(roomlist, proom, chime_room_get_id(room));
-		purple_roomlist_room_add_field(roomlist, proom, rooms->mention ? "@" : (rooms->unread ? "•" : ""));
+		gchar *status = room_status(room, rooms->unread, rooms->mention);
+		purple_roomlist_room_add_field(roomlist, proom, status);
+		g_free(status);
 		purple_roomlist_room_add_field(roomlist, proom, chime_room_get_last_sent(room) ? : chime_room_get_created_on(room));
 		purple_roomlist_room_add(roomlist, proom);
 		tmp_rs = rooms;